@@ -3,7 +3,8 @@
 for /R "shaders\glsl\deferred" %%f in (.) do (
 	pushd %%f
 		for %%i in (*) do (
-			if "%%~xi" neq ".spv" (
+			rem .glsl files are only included by the shaders
+			if "%%~xi" neq ".spv" if "%%~xi" neq ".glsl" (
 				echo found shader %%i
 				%VULKAN_SDK%/bin/glslangValidator.exe -V %%i -o "%%i.spv"
 			)
@@ -14,6 +14,7 @@
 
 #include "vulkan/vulkan.h"
 #include "VulkanTools.h"
+#include "VulkanMemoryAllocator.h"
 
 namespace vks
 {	
@@ -26,6 +27,10 @@ namespace vks
 		VkDevice device;
 		VkBuffer buffer = VK_NULL_HANDLE;
 		VkDeviceMemory memory = VK_NULL_HANDLE;
+		/** @brief Range of memory the buffer is bound to if it was suballocated, offsets passed to the functions below are relative to it */
+		vks::Allocation allocation;
+		/** @brief Allocator the buffer's memory is returned to on destruction, null if the buffer owns its memory */
+		vks::MemoryAllocator* allocator = nullptr;
 		VkDescriptorBufferInfo descriptor;
 		VkDeviceSize size = 0;
 		VkDeviceSize alignment = 0;
@@ -0,0 +1,132 @@
+/*
+* Scoped CPU zone profiler
+*
+* Records the begin and end of named code zones into per thread ring buffers and exports them as a Chrome trace_event
+* JSON file, which can be opened in Perfetto or chrome://tracing
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanCpuProfiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace vks
+{
+	namespace
+	{
+		struct Zone
+		{
+			const char* name;
+			uint64_t begin;
+			uint64_t end;
+		};
+
+		// Zones of a single thread, only ever written by that thread
+		struct ThreadBuffer
+		{
+			// 64k zones per thread, enough for several seconds of frames before the oldest are overwritten
+			static constexpr uint32_t capacity = 1 << 16;
+			std::vector<Zone> zones = std::vector<Zone>(capacity);
+			std::atomic<uint64_t> written{ 0 };
+			uint32_t threadId = 0;
+			const char* threadName = nullptr;
+		};
+
+		// The buffers outlive their threads, so the zones of finished worker threads still end up in the trace
+		std::mutex buffersMutex;
+		std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+		thread_local ThreadBuffer* threadBuffer = nullptr;
+
+		const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+		ThreadBuffer& getThreadBuffer()
+		{
+			if (threadBuffer == nullptr) {
+				std::lock_guard<std::mutex> lock(buffersMutex);
+				buffers.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+				threadBuffer = buffers.back().get();
+				threadBuffer->threadId = static_cast<uint32_t>(buffers.size());
+			}
+			return *threadBuffer;
+		}
+
+		void writeEscaped(std::ofstream& file, const char* text)
+		{
+			for (const char* c = text; *c != '\0'; ++c) {
+				if (*c == '"' || *c == '\\') {
+					file << '\\';
+				}
+				file << *c;
+			}
+		}
+	}
+
+	std::atomic<bool> CpuProfiler::enabled{ false };
+
+	void CpuProfiler::setEnabled(bool enable)
+	{
+		enabled.store(enable, std::memory_order_relaxed);
+	}
+
+	uint64_t CpuProfiler::now()
+	{
+		// Offset by one so a valid begin time is never zero, which zones use for "not recording"
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count()) + 1;
+	}
+
+	void CpuProfiler::record(const char* name, uint64_t begin, uint64_t end)
+	{
+		ThreadBuffer& buffer = getThreadBuffer();
+		const uint64_t index = buffer.written.load(std::memory_order_relaxed);
+		buffer.zones[index % ThreadBuffer::capacity] = { name, begin, end };
+		buffer.written.store(index + 1, std::memory_order_release);
+	}
+
+	void CpuProfiler::setThreadName(const char* name)
+	{
+		getThreadBuffer().threadName = name;
+	}
+
+	bool CpuProfiler::writeTrace(const std::string& filename)
+	{
+		std::ofstream file(filename);
+		if (!file.is_open()) {
+			return false;
+		}
+
+		// Complete ("X") events with microsecond timestamps, the viewer nests the zones of a thread by their times
+		file << std::fixed << std::setprecision(3);
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		bool first = true;
+		std::lock_guard<std::mutex> lock(buffersMutex);
+		for (const std::unique_ptr<ThreadBuffer>& buffer : buffers) {
+			if (buffer->threadName != nullptr) {
+				file << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->threadId << ",\"args\":{\"name\":\"";
+				writeEscaped(file, buffer->threadName);
+				file << "\"}}";
+				first = false;
+			}
+
+			const uint64_t written = buffer->written.load(std::memory_order_acquire);
+			const uint64_t count = std::min<uint64_t>(written, ThreadBuffer::capacity);
+			for (uint64_t i = written - count; i < written; ++i) {
+				const Zone& zone = buffer->zones[i % ThreadBuffer::capacity];
+				file << (first ? "" : ",") << "\n{\"name\":\"";
+				writeEscaped(file, zone.name);
+				file << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadId
+					<< ",\"ts\":" << static_cast<double>(zone.begin) / 1000.0
+					<< ",\"dur\":" << static_cast<double>(zone.end - zone.begin) / 1000.0 << "}";
+				first = false;
+			}
+		}
+		file << "\n]}\n";
+		return static_cast<bool>(file);
+	}
+}
@@ -0,0 +1,75 @@
+/*
+* Scoped CPU zone profiler
+*
+* Records the begin and end of named code zones into per thread ring buffers and exports them as a Chrome trace_event
+* JSON file, which can be opened in Perfetto or chrome://tracing
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace vks
+{
+	/**
+	* @brief Collects scoped CPU zones from every thread
+	* @note Zones are only recorded while the profiler is enabled, a zone in a disabled profiler costs a single atomic load.
+	* Each thread writes to its own ring buffer without locking, so the oldest zones are overwritten once it is full.
+	*/
+	class CpuProfiler
+	{
+	public:
+		/** @brief Start or stop recording zones, the zones recorded so far are kept */
+		static void setEnabled(bool enabled);
+		static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+		/** @brief Current time of the profiler's clock in nanoseconds */
+		static uint64_t now();
+
+		/** @brief Add a zone to the calling thread's ring buffer */
+		static void record(const char* name, uint64_t begin, uint64_t end);
+
+		/** @brief Name the calling thread in the exported trace, the name has to outlive the profiler */
+		static void setThreadName(const char* name);
+
+		/**
+		* Write all recorded zones to a Chrome trace_event JSON file
+		*
+		* @note Should only be called while no other thread is recording, e.g. at shutdown
+		*
+		* @return True if the file was written
+		*/
+		static bool writeTrace(const std::string& filename);
+
+	private:
+		static std::atomic<bool> enabled;
+	};
+
+	/** @brief Records the lifetime of the scope it is declared in as a zone */
+	class CpuProfilerZone
+	{
+	public:
+		explicit CpuProfilerZone(const char* name) : name(name), begin(CpuProfiler::isEnabled() ? CpuProfiler::now() : 0) {}
+		~CpuProfilerZone()
+		{
+			if (begin != 0 && CpuProfiler::isEnabled()) {
+				CpuProfiler::record(name, begin, CpuProfiler::now());
+			}
+		}
+		CpuProfilerZone(const CpuProfilerZone&) = delete;
+		CpuProfilerZone& operator=(const CpuProfilerZone&) = delete;
+
+	private:
+		const char* name;
+		uint64_t begin;
+	};
+}
+
+#define VKS_CPU_ZONE_CONCAT_INNER(a, b) a##b
+#define VKS_CPU_ZONE_CONCAT(a, b) VKS_CPU_ZONE_CONCAT_INNER(a, b)
+// Profile the enclosing scope, the name has to be a string literal or otherwise outlive the profiler
+#define VKS_CPU_ZONE(name) vks::CpuProfilerZone VKS_CPU_ZONE_CONCAT(cpuProfilerZone, __LINE__)(name)
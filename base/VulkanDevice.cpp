@@ -64,10 +64,12 @@ namespace vks
 	*/
 	VulkanDevice::~VulkanDevice()
 	{
+		uploader.destroy();
 		if (commandPool)
 		{
 			vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
 		}
+		allocator.destroy();
 		if (logicalDevice)
 		{
 			vkDestroyDevice(logicalDevice, nullptr);
@@ -269,6 +271,56 @@ namespace vks
 			deviceCreateInfo.pNext = &physicalDeviceFeatures2;
 		}
 
+		auto enableExtension = [&deviceExtensions](const char* extension)
+		{
+			if (std::find_if(deviceExtensions.begin(), deviceExtensions.end(), [extension](const char* enabled) { return strcmp(enabled, extension) == 0; }) == deviceExtensions.end())
+			{
+				deviceExtensions.push_back(extension);
+			}
+		};
+
+		// Let the memory allocator ask the driver which resources should get their own memory
+		bool dedicatedAllocation = false;
+		if (extensionSupported(VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME) && extensionSupported(VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME))
+		{
+			enableExtension(VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME);
+			enableExtension(VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME);
+			dedicatedAllocation = true;
+		}
+
+		// Let the upload manager track its batches with a timeline semaphore, otherwise it falls back to a fence per batch
+		// The feature has to be supported by every device supporting the extension, so it doesn't need to be checked
+		// The extension can't be enabled on a Vulkan 1.0 instance without VK_KHR_get_physical_device_properties2
+		VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphoreFeatures{};
+		bool timelineSemaphore = false;
+		if (physicalDeviceProperties2 && extensionSupported(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME))
+		{
+			enableExtension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+			// Structures enabling the feature must not be chained twice, so if the example passed one it's enabled there
+			bool chained = false;
+			for (VkBaseOutStructure* next = static_cast<VkBaseOutStructure*>(pNextChain); next != nullptr; next = next->pNext)
+			{
+				if (next->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR)
+				{
+					reinterpret_cast<VkPhysicalDeviceTimelineSemaphoreFeaturesKHR*>(next)->timelineSemaphore = VK_TRUE;
+					chained = true;
+				}
+				else if (next->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES)
+				{
+					reinterpret_cast<VkPhysicalDeviceVulkan12Features*>(next)->timelineSemaphore = VK_TRUE;
+					chained = true;
+				}
+			}
+			if (!chained)
+			{
+				timelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+				timelineSemaphoreFeatures.timelineSemaphore = VK_TRUE;
+				timelineSemaphoreFeatures.pNext = const_cast<void*>(deviceCreateInfo.pNext);
+				deviceCreateInfo.pNext = &timelineSemaphoreFeatures;
+			}
+			timelineSemaphore = true;
+		}
+
 #if (defined(VK_USE_PLATFORM_IOS_MVK) || defined(VK_USE_PLATFORM_MACOS_MVK)) && defined(VK_KHR_portability_subset)
 		// SRS - When running on iOS/macOS with MoltenVK and VK_KHR_portability_subset is defined and supported by the device, enable the extension
 		if (extensionSupported(VK_KHR_PORTABILITY_SUBSET_EXTENSION_NAME))
@@ -301,6 +353,9 @@ namespace vks
 		// Create a default command pool for graphics command buffers
 		commandPool = createCommandPool(queueFamilyIndices.graphics);
 
+		allocator.create(physicalDevice, logicalDevice, dedicatedAllocation);
+		uploader.create(this, timelineSemaphore);
+
 		return result;
 	}
 
@@ -382,21 +437,14 @@ namespace vks
 		VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo(usageFlags, size);
 		VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &bufferCreateInfo, nullptr, &buffer->buffer));
 
-		// Create the memory backing up the buffer handle
+		// Suballocate the memory backing up the buffer handle and bind it
+		// If the buffer has VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT set we also need to enable the appropriate flag during allocation
+		const VkMemoryAllocateFlags allocateFlags = (usageFlags & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) ? VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR : 0;
 		VkMemoryRequirements memReqs;
-		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
 		vkGetBufferMemoryRequirements(logicalDevice, buffer->buffer, &memReqs);
-		memAlloc.allocationSize = memReqs.size;
-		// Find a memory type index that fits the properties of the buffer
-		memAlloc.memoryTypeIndex = getMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags);
-		// If the buffer has VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT set we also need to enable the appropriate flag during allocation
-		VkMemoryAllocateFlagsInfoKHR allocFlagsInfo{};
-		if (usageFlags & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
-			allocFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO_KHR;
-			allocFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
-			memAlloc.pNext = &allocFlagsInfo;
-		}
-		VK_CHECK_RESULT(vkAllocateMemory(logicalDevice, &memAlloc, nullptr, &buffer->memory));
+		VK_CHECK_RESULT(allocator.allocateBuffer(buffer->buffer, memoryPropertyFlags, &buffer->allocation, allocateFlags));
+		buffer->allocator = &allocator;
+		buffer->memory = buffer->allocation.memory;
 
 		buffer->alignment = memReqs.alignment;
 		buffer->size = size;
@@ -417,8 +465,7 @@ namespace vks
 		// Initialize a default descriptor that covers the whole buffer size
 		buffer->setupDescriptor();
 
-		// Attach the memory to the buffer object
-		return buffer->bind();
+		return VK_SUCCESS;
 	}
 
 	/**
@@ -451,6 +498,58 @@ namespace vks
 		flushCommandBuffer(copyCmd, queue);
 	}
 
+	/**
+	* Copy the first mip level of a color image into host memory using vkCmdCopyImageToBuffer
+	*
+	* @param image Image to read back, must have been created with VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+	* @param imageLayout Current layout of the image, the image is transitioned back to this layout after the copy
+	* @param extent Size of the image in texels
+	* @param texelSize Size of a single texel in bytes
+	* @param queue Queue to submit the copy to
+	* @param data Pointer to host memory receiving the tightly packed texels (extent.width * extent.height * extent.depth * texelSize bytes)
+	*
+	* @note Blocks until the copy has finished, intended for debugging and validation rather than per-frame use
+	*/
+	void VulkanDevice::copyImageToHost(VkImage image, VkImageLayout imageLayout, VkExtent3D extent, VkDeviceSize texelSize, VkQueue queue, void *data)
+	{
+		const VkDeviceSize size = static_cast<VkDeviceSize>(extent.width) * extent.height * extent.depth * texelSize;
+
+		vks::Buffer readback;
+		VK_CHECK_RESULT(createBuffer(VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &readback, size));
+
+		VkImageSubresourceRange subresourceRange = {};
+		subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		subresourceRange.levelCount = 1;
+		subresourceRange.layerCount = 1;
+
+		VkCommandBuffer copyCmd = createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+
+		vks::tools::insertImageMemoryBarrier(copyCmd, image,
+			VK_ACCESS_MEMORY_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+			imageLayout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			subresourceRange);
+
+		VkBufferImageCopy copyRegion = {};
+		copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		copyRegion.imageSubresource.layerCount = 1;
+		copyRegion.imageExtent = extent;
+		vkCmdCopyImageToBuffer(copyCmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback.buffer, 1, &copyRegion);
+
+		vks::tools::insertImageMemoryBarrier(copyCmd, image,
+			VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, imageLayout,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+			subresourceRange);
+
+		flushCommandBuffer(copyCmd, queue);
+
+		VK_CHECK_RESULT(readback.map());
+		memcpy(data, readback.mapped, static_cast<size_t>(size));
+		readback.unmap();
+		readback.destroy();
+	}
+
 	/** 
 	* Create a command pool for allocation command buffers from
 	* 
@@ -510,6 +609,7 @@ namespace vks
 	*
 	* @note The queue that the command buffer is submitted to must be from the same family index as the pool it was allocated from
 	* @note Uses a fence to ensure command buffer has finished executing
+	* @note Pending uploads of the upload manager are submitted before the command buffer
 	*/
 	void VulkanDevice::flushCommandBuffer(VkCommandBuffer commandBuffer, VkQueue queue, VkCommandPool pool, bool free)
 	{
@@ -520,6 +620,9 @@ namespace vks
 
 		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
 
+		// Submit pending uploads first, so the command buffer sees them if it runs on the graphics queue
+		uploader.flush();
+
 		VkSubmitInfo submitInfo = vks::initializers::submitInfo();
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &commandBuffer;
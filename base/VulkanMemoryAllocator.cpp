@@ -0,0 +1,463 @@
+/*
+* Vulkan device memory allocator
+*
+* Suballocates buffers and images from large blocks of device memory per memory type instead of giving every resource
+* its own vkAllocateMemory call, which is slow and limited to maxMemoryAllocationCount allocations
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanMemoryAllocator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <iterator>
+#include <map>
+
+namespace vks
+{
+	struct MemoryBlock
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		void* mapped = nullptr;
+		uint32_t allocationCount = 0;
+		VkDeviceSize usedBytes = 0;
+		// Free ranges by offset for coalescing, and the same ranges by size for best fit searches
+		std::map<VkDeviceSize, VkDeviceSize> freeRanges;
+		std::multimap<VkDeviceSize, VkDeviceSize> freeBySize;
+
+		void addFreeRange(VkDeviceSize offset, VkDeviceSize rangeSize)
+		{
+			freeRanges[offset] = rangeSize;
+			freeBySize.emplace(rangeSize, offset);
+		}
+
+		void removeFreeRange(std::map<VkDeviceSize, VkDeviceSize>::iterator range)
+		{
+			auto sized = freeBySize.equal_range(range->second);
+			for (auto it = sized.first; it != sized.second; ++it) {
+				if (it->second == range->first) {
+					freeBySize.erase(it);
+					break;
+				}
+			}
+			freeRanges.erase(range);
+		}
+	};
+
+	struct MemoryAllocator::Pool
+	{
+		std::vector<std::unique_ptr<MemoryBlock>> blocks;
+	};
+
+	namespace
+	{
+		// Smallest size class, smaller requests would only fragment the blocks
+		constexpr VkDeviceSize minSizeClass = 256;
+
+		VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+		{
+			return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+		}
+
+		// Round a size up to the next of four classes per power of two, which wastes at most a fifth of the request
+		VkDeviceSize sizeClass(VkDeviceSize size)
+		{
+			if (size <= minSizeClass) {
+				return minSizeClass;
+			}
+			VkDeviceSize power = minSizeClass;
+			while (power * 2 <= size) {
+				power *= 2;
+			}
+			return alignUp(size, power / 4);
+		}
+	}
+
+	float MemoryTypeStats::fragmentation() const
+	{
+		const VkDeviceSize freeBytes = blockBytes - usedBytes;
+		return freeBytes > 0 ? 1.0f - static_cast<float>(largestFreeRange) / static_cast<float>(freeBytes) : 0.0f;
+	}
+
+	MemoryAllocator::MemoryAllocator() = default;
+
+	MemoryAllocator::~MemoryAllocator()
+	{
+		destroy();
+	}
+
+	void MemoryAllocator::create(VkPhysicalDevice physicalDevice, VkDevice device, bool dedicatedAllocation)
+	{
+		this->device = device;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		bufferImageGranularity = std::max<VkDeviceSize>(properties.limits.bufferImageGranularity, 1);
+		nonCoherentAtomSize = std::max<VkDeviceSize>(properties.limits.nonCoherentAtomSize, 1);
+
+		if (dedicatedAllocation) {
+			getBufferMemoryRequirements2 = reinterpret_cast<PFN_vkGetBufferMemoryRequirements2KHR>(vkGetDeviceProcAddr(device, "vkGetBufferMemoryRequirements2KHR"));
+			getImageMemoryRequirements2 = reinterpret_cast<PFN_vkGetImageMemoryRequirements2KHR>(vkGetDeviceProcAddr(device, "vkGetImageMemoryRequirements2KHR"));
+		}
+
+		pools.clear();
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount * 2; i++) {
+			pools.push_back(std::unique_ptr<Pool>(new Pool()));
+		}
+		dedicatedCount.assign(memoryProperties.memoryTypeCount, 0);
+		dedicatedBytes.assign(memoryProperties.memoryTypeCount, 0);
+	}
+
+	void MemoryAllocator::destroy()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (device == VK_NULL_HANDLE) {
+			return;
+		}
+		uint32_t liveAllocations = 0;
+		for (const std::unique_ptr<Pool>& pool : pools) {
+			for (const std::unique_ptr<MemoryBlock>& block : pool->blocks) {
+				liveAllocations += block->allocationCount;
+				if (block->mapped) {
+					vkUnmapMemory(device, block->memory);
+				}
+				vkFreeMemory(device, block->memory, nullptr);
+			}
+		}
+		for (uint32_t count : dedicatedCount) {
+			liveAllocations += count;
+		}
+		if (liveAllocations > 0) {
+			std::cerr << "Memory allocator destroyed with " << liveAllocations << " live allocations\n";
+		}
+		pools.clear();
+		device = VK_NULL_HANDLE;
+	}
+
+	bool MemoryAllocator::findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties, uint32_t* memoryType) const
+	{
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+			if ((typeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+				*memoryType = i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	VkDeviceSize MemoryAllocator::blockSize(uint32_t memoryType) const
+	{
+		const VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+		return heapSize <= 1024ull * 1024 * 1024 ? alignUp(heapSize / 8, minSizeClass) : defaultBlockSize;
+	}
+
+	VkResult MemoryAllocator::allocateDedicated(const VkMemoryRequirements& requirements, uint32_t memoryType, const void* pNext, Allocation* allocation)
+	{
+		VkMemoryAllocateInfo memAlloc{};
+		memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		memAlloc.pNext = pNext;
+		memAlloc.allocationSize = requirements.size;
+		memAlloc.memoryTypeIndex = memoryType;
+		VkDeviceMemory memory;
+		VkResult result = vkAllocateMemory(device, &memAlloc, nullptr, &memory);
+		if (result != VK_SUCCESS) {
+			return result;
+		}
+
+		void* mapped = nullptr;
+		if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+			result = vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+			if (result != VK_SUCCESS) {
+				vkFreeMemory(device, memory, nullptr);
+				return result;
+			}
+		}
+
+		*allocation = Allocation();
+		allocation->memory = memory;
+		allocation->size = requirements.size;
+		allocation->mapped = mapped;
+		allocation->memoryType = memoryType;
+		dedicatedCount[memoryType]++;
+		dedicatedBytes[memoryType] += requirements.size;
+		return VK_SUCCESS;
+	}
+
+	VkResult MemoryAllocator::allocateFromPool(const VkMemoryRequirements& requirements, uint32_t memoryType, bool linear, Allocation* allocation)
+	{
+		// Without a granularity requirement linear and optimal resources can share blocks
+		const bool separateKinds = bufferImageGranularity > 1;
+		Pool& pool = *pools[memoryType + ((separateKinds && !linear) ? memoryProperties.memoryTypeCount : 0)];
+
+		// Ranges of non coherent memory are flushed in whole atoms, so they must not share one with a neighbour
+		VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+		VkDeviceSize size = sizeClass(requirements.size);
+		if ((memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0
+			&& (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+			alignment = std::max(alignment, nonCoherentAtomSize);
+			size = alignUp(size, nonCoherentAtomSize);
+		}
+
+		// Best fit over all blocks, the smallest free range the aligned request fits into
+		MemoryBlock* bestBlock = nullptr;
+		VkDeviceSize bestOffset = 0;
+		VkDeviceSize bestRangeSize = 0;
+		for (const std::unique_ptr<MemoryBlock>& block : pool.blocks) {
+			for (auto it = block->freeBySize.lower_bound(size); it != block->freeBySize.end(); ++it) {
+				if (bestBlock && it->first >= bestRangeSize) {
+					break;
+				}
+				const VkDeviceSize alignedOffset = alignUp(it->second, alignment);
+				if (alignedOffset + size <= it->second + it->first) {
+					bestBlock = block.get();
+					bestOffset = it->second;
+					bestRangeSize = it->first;
+					break;
+				}
+			}
+		}
+
+		if (bestBlock == nullptr) {
+			// Grow the pool by a block, halving its size if the heap can't fit a whole one
+			const VkDeviceSize minBlockSize = alignUp(size + alignment, minSizeClass);
+			VkResult result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+			for (VkDeviceSize newBlockSize = blockSize(memoryType); newBlockSize >= minBlockSize && result != VK_SUCCESS; newBlockSize /= 2) {
+				VkMemoryAllocateInfo memAlloc{};
+				memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+				memAlloc.allocationSize = newBlockSize;
+				memAlloc.memoryTypeIndex = memoryType;
+				VkDeviceMemory memory;
+				result = vkAllocateMemory(device, &memAlloc, nullptr, &memory);
+				if (result == VK_SUCCESS) {
+					std::unique_ptr<MemoryBlock> block(new MemoryBlock());
+					block->memory = memory;
+					block->size = newBlockSize;
+					if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+						result = vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &block->mapped);
+						if (result != VK_SUCCESS) {
+							vkFreeMemory(device, memory, nullptr);
+							return result;
+						}
+					}
+					block->addFreeRange(0, newBlockSize);
+					bestBlock = block.get();
+					bestOffset = 0;
+					bestRangeSize = newBlockSize;
+					pool.blocks.push_back(std::move(block));
+				}
+			}
+			if (result != VK_SUCCESS) {
+				return result;
+			}
+		}
+
+		// Split the free range, the padding in front for the alignment and the tail stay free
+		auto range = bestBlock->freeRanges.find(bestOffset);
+		assert(range != bestBlock->freeRanges.end());
+		const VkDeviceSize alignedOffset = alignUp(bestOffset, alignment);
+		const VkDeviceSize rangeEnd = bestOffset + bestRangeSize;
+		bestBlock->removeFreeRange(range);
+		if (alignedOffset > bestOffset) {
+			bestBlock->addFreeRange(bestOffset, alignedOffset - bestOffset);
+		}
+		if (alignedOffset + size < rangeEnd) {
+			bestBlock->addFreeRange(alignedOffset + size, rangeEnd - alignedOffset - size);
+		}
+		bestBlock->allocationCount++;
+		bestBlock->usedBytes += size;
+
+		*allocation = Allocation();
+		allocation->memory = bestBlock->memory;
+		allocation->offset = alignedOffset;
+		allocation->size = size;
+		allocation->mapped = bestBlock->mapped ? static_cast<char*>(bestBlock->mapped) + alignedOffset : nullptr;
+		allocation->memoryType = memoryType;
+		allocation->block = bestBlock;
+		return VK_SUCCESS;
+	}
+
+	VkResult MemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear, Allocation* allocation)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		uint32_t memoryType;
+		if (!findMemoryType(requirements.memoryTypeBits, properties, &memoryType)) {
+			return VK_ERROR_FEATURE_NOT_PRESENT;
+		}
+		if (requirements.size > blockSize(memoryType) / 2) {
+			return allocateDedicated(requirements, memoryType, nullptr, allocation);
+		}
+		return allocateFromPool(requirements, memoryType, linear, allocation);
+	}
+
+	VkResult MemoryAllocator::allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties, Allocation* allocation, VkMemoryAllocateFlags allocateFlags)
+	{
+		VkMemoryRequirements requirements;
+		bool dedicated = false;
+		if (getBufferMemoryRequirements2) {
+			VkMemoryDedicatedRequirementsKHR dedicatedRequirements{};
+			dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS_KHR;
+			VkMemoryRequirements2KHR requirements2{};
+			requirements2.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2_KHR;
+			requirements2.pNext = &dedicatedRequirements;
+			VkBufferMemoryRequirementsInfo2KHR info{};
+			info.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2_KHR;
+			info.buffer = buffer;
+			getBufferMemoryRequirements2(device, &info, &requirements2);
+			requirements = requirements2.memoryRequirements;
+			dedicated = dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation;
+		}
+		else {
+			vkGetBufferMemoryRequirements(device, buffer, &requirements);
+		}
+
+		VkResult result;
+		if (dedicated || allocateFlags != 0) {
+			std::lock_guard<std::mutex> lock(mutex);
+			uint32_t memoryType;
+			if (!findMemoryType(requirements.memoryTypeBits, properties, &memoryType)) {
+				return VK_ERROR_FEATURE_NOT_PRESENT;
+			}
+			VkMemoryDedicatedAllocateInfoKHR dedicatedInfo{};
+			dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO_KHR;
+			dedicatedInfo.buffer = buffer;
+			VkMemoryAllocateFlagsInfoKHR flagsInfo{};
+			flagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO_KHR;
+			flagsInfo.flags = allocateFlags;
+			flagsInfo.pNext = dedicated ? &dedicatedInfo : nullptr;
+			result = allocateDedicated(requirements, memoryType, allocateFlags != 0 ? static_cast<const void*>(&flagsInfo) : &dedicatedInfo, allocation);
+		}
+		else {
+			result = allocate(requirements, properties, true, allocation);
+		}
+		if (result != VK_SUCCESS) {
+			return result;
+		}
+		return vkBindBufferMemory(device, buffer, allocation->memory, allocation->offset);
+	}
+
+	VkResult MemoryAllocator::allocateImage(VkImage image, VkMemoryPropertyFlags properties, Allocation* allocation, VkImageTiling tiling)
+	{
+		VkMemoryRequirements requirements;
+		bool dedicated = false;
+		if (getImageMemoryRequirements2) {
+			VkMemoryDedicatedRequirementsKHR dedicatedRequirements{};
+			dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS_KHR;
+			VkMemoryRequirements2KHR requirements2{};
+			requirements2.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2_KHR;
+			requirements2.pNext = &dedicatedRequirements;
+			VkImageMemoryRequirementsInfo2KHR info{};
+			info.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2_KHR;
+			info.image = image;
+			getImageMemoryRequirements2(device, &info, &requirements2);
+			requirements = requirements2.memoryRequirements;
+			dedicated = dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation;
+		}
+		else {
+			vkGetImageMemoryRequirements(device, image, &requirements);
+		}
+
+		VkResult result;
+		if (dedicated) {
+			std::lock_guard<std::mutex> lock(mutex);
+			uint32_t memoryType;
+			if (!findMemoryType(requirements.memoryTypeBits, properties, &memoryType)) {
+				return VK_ERROR_FEATURE_NOT_PRESENT;
+			}
+			VkMemoryDedicatedAllocateInfoKHR dedicatedInfo{};
+			dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO_KHR;
+			dedicatedInfo.image = image;
+			result = allocateDedicated(requirements, memoryType, &dedicatedInfo, allocation);
+		}
+		else {
+			result = allocate(requirements, properties, tiling == VK_IMAGE_TILING_LINEAR, allocation);
+		}
+		if (result != VK_SUCCESS) {
+			return result;
+		}
+		return vkBindImageMemory(device, image, allocation->memory, allocation->offset);
+	}
+
+	void MemoryAllocator::free(Allocation& allocation)
+	{
+		if (allocation.memory == VK_NULL_HANDLE) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		MemoryBlock* block = allocation.block;
+		if (block == nullptr) {
+			if (allocation.mapped) {
+				vkUnmapMemory(device, allocation.memory);
+			}
+			vkFreeMemory(device, allocation.memory, nullptr);
+			dedicatedCount[allocation.memoryType]--;
+			dedicatedBytes[allocation.memoryType] -= allocation.size;
+			allocation = Allocation();
+			return;
+		}
+
+		// Coalesce with the free ranges directly before and after
+		VkDeviceSize offset = allocation.offset;
+		VkDeviceSize size = allocation.size;
+		auto next = block->freeRanges.lower_bound(offset);
+		if (next != block->freeRanges.begin()) {
+			auto previous = std::prev(next);
+			if (previous->first + previous->second == offset) {
+				offset = previous->first;
+				size += previous->second;
+				block->removeFreeRange(previous);
+			}
+		}
+		next = block->freeRanges.lower_bound(offset + size);
+		if (next != block->freeRanges.end() && next->first == offset + size) {
+			size += next->second;
+			block->removeFreeRange(next);
+		}
+		block->addFreeRange(offset, size);
+		block->allocationCount--;
+		block->usedBytes -= allocation.size;
+
+		// Empty blocks are returned to the driver, except for the last one of a pool so it doesn't thrash
+		if (block->allocationCount == 0) {
+			for (const std::unique_ptr<Pool>& pool : pools) {
+				auto it = std::find_if(pool->blocks.begin(), pool->blocks.end(), [block](const std::unique_ptr<MemoryBlock>& b) { return b.get() == block; });
+				if (it != pool->blocks.end()) {
+					if (pool->blocks.size() > 1) {
+						if (block->mapped) {
+							vkUnmapMemory(device, block->memory);
+						}
+						vkFreeMemory(device, block->memory, nullptr);
+						pool->blocks.erase(it);
+					}
+					break;
+				}
+			}
+		}
+		allocation = Allocation();
+	}
+
+	std::vector<MemoryTypeStats> MemoryAllocator::getStats() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<MemoryTypeStats> stats(memoryProperties.memoryTypeCount);
+		for (size_t i = 0; i < pools.size(); i++) {
+			MemoryTypeStats& typeStats = stats[i % memoryProperties.memoryTypeCount];
+			for (const std::unique_ptr<MemoryBlock>& block : pools[i]->blocks) {
+				typeStats.blockCount++;
+				typeStats.allocationCount += block->allocationCount;
+				typeStats.blockBytes += block->size;
+				typeStats.usedBytes += block->usedBytes;
+				if (!block->freeBySize.empty()) {
+					typeStats.largestFreeRange = std::max(typeStats.largestFreeRange, block->freeBySize.rbegin()->first);
+				}
+			}
+		}
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount && i < dedicatedCount.size(); i++) {
+			stats[i].dedicatedCount = dedicatedCount[i];
+			stats[i].dedicatedBytes = dedicatedBytes[i];
+		}
+		return stats;
+	}
+}
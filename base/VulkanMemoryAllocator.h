@@ -0,0 +1,138 @@
+/*
+* Vulkan device memory allocator
+*
+* Suballocates buffers and images from large blocks of device memory per memory type instead of giving every resource
+* its own vkAllocateMemory call, which is slow and limited to maxMemoryAllocationCount allocations
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+
+namespace vks
+{
+	struct MemoryBlock;
+
+	/** @brief Range of device memory handed out by the MemoryAllocator */
+	struct Allocation
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		/** @brief Offset of the range in memory, resources have to be bound at this offset */
+		VkDeviceSize offset = 0;
+		/** @brief Size of the range, can be larger than requested */
+		VkDeviceSize size = 0;
+		/** @brief Host pointer to the start of the range if the memory is host visible, blocks stay mapped for their lifetime */
+		void* mapped = nullptr;
+		uint32_t memoryType = 0;
+		/** @brief Block the range was suballocated from, null for dedicated allocations */
+		MemoryBlock* block = nullptr;
+	};
+
+	/** @brief Memory usage of a single memory type */
+	struct MemoryTypeStats
+	{
+		/** @brief Live blocks suballocations are made from */
+		uint32_t blockCount = 0;
+		/** @brief Live allocations with their own device memory */
+		uint32_t dedicatedCount = 0;
+		/** @brief Live suballocations */
+		uint32_t allocationCount = 0;
+		/** @brief Bytes of device memory held by the blocks */
+		VkDeviceSize blockBytes = 0;
+		/** @brief Bytes of the blocks handed out, including alignment and size class rounding */
+		VkDeviceSize usedBytes = 0;
+		/** @brief Bytes of device memory held by dedicated allocations */
+		VkDeviceSize dedicatedBytes = 0;
+		/** @brief Largest contiguous free range over all blocks */
+		VkDeviceSize largestFreeRange = 0;
+
+		/** @brief Share of the free block memory outside the largest free range, 0 if all free memory is contiguous */
+		float fragmentation() const;
+	};
+
+	/**
+	* @brief Suballocates device memory from large blocks per memory type
+	* @note Requests are rounded up to size classes, four per power of two, so ranges freed by one resource fit the next one
+	* of a similar size instead of splintering into unusable gaps. Free ranges are found best fit and coalesced with their
+	* neighbours when freed. Buffers and linear images are kept in other blocks than optimal images if the device's
+	* bufferImageGranularity would otherwise require padding between them. Resources the driver prefers to have their own
+	* memory, and requests larger than half a block, get a dedicated allocation. All functions are thread safe.
+	*/
+	class MemoryAllocator
+	{
+	public:
+		/** @brief Size of the blocks allocated from heaps larger than 1 GB, smaller heaps use an eighth of their size */
+		static constexpr VkDeviceSize defaultBlockSize = 64ull * 1024 * 1024;
+
+		MemoryAllocator();
+		~MemoryAllocator();
+		MemoryAllocator(const MemoryAllocator&) = delete;
+		MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+
+		/**
+		* Prepare the allocator for a logical device
+		*
+		* @param dedicatedAllocation True if VK_KHR_get_memory_requirements2 and VK_KHR_dedicated_allocation are enabled on the
+		* device, the driver is then asked which resources should get their own memory
+		*/
+		void create(VkPhysicalDevice physicalDevice, VkDevice device, bool dedicatedAllocation);
+
+		/** @brief Free all blocks, allocations that are still live are reported */
+		void destroy();
+
+		/**
+		* Allocate memory for a resource with the given requirements
+		*
+		* @param requirements Memory requirements of the resource
+		* @param properties Property flags the memory type needs to have
+		* @param linear True for buffers and linear images, false for optimal images
+		* @param allocation Receives the allocated range
+		*
+		* @return VK_SUCCESS, or the error of the failed vkAllocateMemory call
+		*/
+		VkResult allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear, Allocation* allocation);
+
+		/**
+		* Allocate memory for a buffer and bind it
+		*
+		* @param allocateFlags Flags for the device memory, e.g. VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, these always get a dedicated allocation
+		*/
+		VkResult allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties, Allocation* allocation, VkMemoryAllocateFlags allocateFlags = 0);
+
+		/** @brief Allocate memory for an image and bind it */
+		VkResult allocateImage(VkImage image, VkMemoryPropertyFlags properties, Allocation* allocation, VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL);
+
+		/** @brief Return an allocation to its block, or free its memory if it is dedicated, and reset it */
+		void free(Allocation& allocation);
+
+		/** @brief Current memory usage of every memory type of the device */
+		std::vector<MemoryTypeStats> getStats() const;
+
+	private:
+		struct Pool;
+
+		VkDevice device = VK_NULL_HANDLE;
+		VkPhysicalDeviceMemoryProperties memoryProperties{};
+		VkDeviceSize bufferImageGranularity = 1;
+		VkDeviceSize nonCoherentAtomSize = 1;
+		PFN_vkGetBufferMemoryRequirements2KHR getBufferMemoryRequirements2 = nullptr;
+		PFN_vkGetImageMemoryRequirements2KHR getImageMemoryRequirements2 = nullptr;
+		// One pool per memory type for linear resources, followed by one per memory type for optimal images
+		std::vector<std::unique_ptr<Pool>> pools;
+		std::vector<uint32_t> dedicatedCount;
+		std::vector<VkDeviceSize> dedicatedBytes;
+		mutable std::mutex mutex;
+
+		bool findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties, uint32_t* memoryType) const;
+		VkDeviceSize blockSize(uint32_t memoryType) const;
+		VkResult allocateDedicated(const VkMemoryRequirements& requirements, uint32_t memoryType, const void* pNext, Allocation* allocation);
+		VkResult allocateFromPool(const VkMemoryRequirements& requirements, uint32_t memoryType, bool linear, Allocation* allocation);
+	};
+}
@@ -396,6 +396,75 @@ void VulkanSwapChain::create(uint32_t *width, uint32_t *height, bool vsync, bool
 	}
 }
 
+/**
+* Create offscreen images standing in for the swap chain, for rendering without a window or surface
+*
+* @param queue Queue the images are "presented" on, which signals the acquire semaphores and writes the dumped images
+* @param queueFamilyIndex Family of the queue
+* @param width Width of the images
+* @param height Height of the images
+*
+* @note The images are left in VK_IMAGE_LAYOUT_PRESENT_SRC_KHR like swap chain images, so render passes written for the
+* swap chain work unchanged. This still needs the VK_KHR_swapchain device extension, but no surface.
+*/
+void VulkanSwapChain::createOffscreen(VkQueue queue, uint32_t queueFamilyIndex, uint32_t width, uint32_t height)
+{
+	offscreen = true;
+	offscreenQueue = queue;
+	offscreenWidth = width;
+	offscreenHeight = height;
+	queueNodeIndex = queueFamilyIndex;
+
+	// Prefer the format most swap chains use
+	colorFormat = VK_FORMAT_B8G8R8A8_UNORM;
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, colorFormat, &formatProperties);
+	if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT)) {
+		colorFormat = VK_FORMAT_R8G8B8A8_UNORM;
+	}
+	colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+
+	// Three images, so the CPU can record a frame while two are in flight as with a triple buffered swap chain
+	imageCount = 3;
+	images.resize(imageCount);
+	buffers.resize(imageCount);
+	offscreenMemory.resize(imageCount);
+	for (uint32_t i = 0; i < imageCount; i++) {
+		VkImageCreateInfo imageCI = vks::initializers::imageCreateInfo();
+		imageCI.imageType = VK_IMAGE_TYPE_2D;
+		imageCI.format = colorFormat;
+		imageCI.extent = { width, height, 1 };
+		imageCI.mipLevels = 1;
+		imageCI.arrayLayers = 1;
+		imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageCI.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		imageCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VK_CHECK_RESULT(vkCreateImage(device, &imageCI, nullptr, &images[i]));
+
+		VkMemoryRequirements memReqs;
+		vkGetImageMemoryRequirements(device, images[i], &memReqs);
+		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+		memAlloc.allocationSize = memReqs.size;
+		memAlloc.memoryTypeIndex = getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &offscreenMemory[i]));
+		VK_CHECK_RESULT(vkBindImageMemory(device, images[i], offscreenMemory[i], 0));
+
+		VkImageViewCreateInfo viewCI = vks::initializers::imageViewCreateInfo();
+		viewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewCI.format = colorFormat;
+		viewCI.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+		viewCI.image = images[i];
+		buffers[i].image = images[i];
+		VK_CHECK_RESULT(vkCreateImageView(device, &viewCI, nullptr, &buffers[i].view));
+	}
+
+	VkCommandPoolCreateInfo cmdPoolInfo = vks::initializers::commandPoolCreateInfo();
+	cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
+	cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &offscreenCommandPool));
+}
+
 /** 
 * Acquires the next image in the swap chain
 *
@@ -408,6 +477,20 @@ void VulkanSwapChain::create(uint32_t *width, uint32_t *height, bool vsync, bool
 */
 VkResult VulkanSwapChain::acquireNextImage(VkSemaphore presentCompleteSemaphore, uint32_t *imageIndex)
 {
+	if (offscreen) {
+		// The images are used in turn, each one's last frame has been submitted before it, so signalling the semaphore
+		// from the queue right away keeps the same ordering as the presentation engine
+		*imageIndex = nextOffscreenImage;
+		nextOffscreenImage = (nextOffscreenImage + 1) % imageCount;
+		if (presentCompleteSemaphore == VK_NULL_HANDLE) {
+			return VK_SUCCESS;
+		}
+		VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &presentCompleteSemaphore;
+		return vkQueueSubmit(offscreenQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	}
+
 	// By setting timeout to UINT64_MAX we will always wait until the next image has been acquired or an actual error is thrown
 	// With that we don't have to handle VK_NOT_READY
 	return vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, presentCompleteSemaphore, (VkFence)nullptr, imageIndex);
@@ -424,6 +507,23 @@ VkResult VulkanSwapChain::acquireNextImage(VkSemaphore presentCompleteSemaphore,
 */
 VkResult VulkanSwapChain::queuePresent(VkQueue queue, uint32_t imageIndex, VkSemaphore waitSemaphore)
 {
+	if (offscreen) {
+		presentedImages++;
+		if (offscreenDumpInterval > 0 && (presentedImages - 1) % offscreenDumpInterval == 0) {
+			return saveOffscreenImage(imageIndex, waitSemaphore);
+		}
+		if (waitSemaphore == VK_NULL_HANDLE) {
+			return VK_SUCCESS;
+		}
+		// Wait on the semaphore like the presentation engine would, so it can be signalled again
+		const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = &waitSemaphore;
+		submitInfo.pWaitDstStageMask = &waitStage;
+		return vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+	}
+
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 	presentInfo.pNext = NULL;
@@ -445,6 +545,21 @@ VkResult VulkanSwapChain::queuePresent(VkQueue queue, uint32_t imageIndex, VkSem
 */
 void VulkanSwapChain::cleanup()
 {
+	if (offscreen)
+	{
+		for (uint32_t i = 0; i < imageCount; i++)
+		{
+			vkDestroyImageView(device, buffers[i].view, nullptr);
+			vkDestroyImage(device, images[i], nullptr);
+			vkFreeMemory(device, offscreenMemory[i], nullptr);
+		}
+		vkDestroyCommandPool(device, offscreenCommandPool, nullptr);
+		offscreenMemory.clear();
+		images.clear();
+		buffers.clear();
+		offscreen = false;
+		return;
+	}
 	if (swapChain != VK_NULL_HANDLE)
 	{
 		for (uint32_t i = 0; i < imageCount; i++)
@@ -461,6 +576,97 @@ void VulkanSwapChain::cleanup()
 	swapChain = VK_NULL_HANDLE;
 }
 
+uint32_t VulkanSwapChain::getMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties) const
+{
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+		if ((typeBits & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+			return i;
+		}
+	}
+	throw std::runtime_error("Could not find a matching memory type");
+}
+
+/**
+* Copy a rendered offscreen image back and write it to frame_<n>.ppm
+*
+* @note Waits for the copy, so dumping frames stalls the renderer
+*/
+VkResult VulkanSwapChain::saveOffscreenImage(uint32_t imageIndex, VkSemaphore waitSemaphore)
+{
+	const VkDeviceSize size = static_cast<VkDeviceSize>(offscreenWidth) * offscreenHeight * 4;
+	VkBufferCreateInfo bufferCI = vks::initializers::bufferCreateInfo(VK_BUFFER_USAGE_TRANSFER_DST_BIT, size);
+	VkBuffer buffer;
+	VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCI, nullptr, &buffer));
+	VkMemoryRequirements memReqs;
+	vkGetBufferMemoryRequirements(device, buffer, &memReqs);
+	VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+	memAlloc.allocationSize = memReqs.size;
+	memAlloc.memoryTypeIndex = getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	VkDeviceMemory memory;
+	VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &memory));
+	VK_CHECK_RESULT(vkBindBufferMemory(device, buffer, memory, 0));
+
+	VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(offscreenCommandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+	VkCommandBuffer cmdBuffer;
+	VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &cmdBuffer));
+	VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+	cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	VK_CHECK_RESULT(vkBeginCommandBuffer(cmdBuffer, &cmdBufInfo));
+	const VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+	vks::tools::setImageLayout(cmdBuffer, images[imageIndex], VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, subresourceRange,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+	VkBufferImageCopy copyRegion{};
+	copyRegion.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+	copyRegion.imageExtent = { offscreenWidth, offscreenHeight, 1 };
+	vkCmdCopyImageToBuffer(cmdBuffer, images[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1, &copyRegion);
+	vks::tools::setImageLayout(cmdBuffer, images[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, subresourceRange,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+	VK_CHECK_RESULT(vkEndCommandBuffer(cmdBuffer));
+
+	const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &cmdBuffer;
+	if (waitSemaphore != VK_NULL_HANDLE) {
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = &waitSemaphore;
+		submitInfo.pWaitDstStageMask = &waitStage;
+	}
+	VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo();
+	VkFence fence;
+	VK_CHECK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &fence));
+	VkResult result = vkQueueSubmit(offscreenQueue, 1, &submitInfo, fence);
+	if (result == VK_SUCCESS) {
+		result = vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+	}
+
+	if (result == VK_SUCCESS) {
+		const uint8_t* data;
+		VK_CHECK_RESULT(vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, (void**)&data));
+		char filename[32];
+		snprintf(filename, sizeof(filename), "frame_%05u.ppm", presentedImages - 1);
+		std::ofstream file(filename, std::ios::out | std::ios::binary);
+		file << "P6\n" << offscreenWidth << "\n" << offscreenHeight << "\n" << 255 << "\n";
+		// PPM is RGB, swizzle the BGR formats
+		const bool bgr = colorFormat == VK_FORMAT_B8G8R8A8_UNORM;
+		for (uint32_t i = 0; i < offscreenWidth * offscreenHeight; i++) {
+			const uint8_t* pixel = data + i * 4;
+			file.put(pixel[bgr ? 2 : 0]);
+			file.put(pixel[1]);
+			file.put(pixel[bgr ? 0 : 2]);
+		}
+		vkUnmapMemory(device, memory);
+	}
+
+	vkDestroyFence(device, fence, nullptr);
+	vkFreeCommandBuffers(device, offscreenCommandPool, 1, &cmdBuffer);
+	vkDestroyBuffer(device, buffer, nullptr);
+	vkFreeMemory(device, memory, nullptr);
+	return result;
+}
+
 #if defined(_DIRECT2DISPLAY)
 /**
 * Create direct to display surface
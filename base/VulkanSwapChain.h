@@ -38,7 +38,19 @@ private:
 	VkInstance instance;
 	VkDevice device;
 	VkPhysicalDevice physicalDevice;
-	VkSurfaceKHR surface;
+	VkSurfaceKHR surface = VK_NULL_HANDLE;
+
+	// Offscreen images standing in for the swap chain when there is no window
+	bool offscreen = false;
+	VkQueue offscreenQueue = VK_NULL_HANDLE;
+	uint32_t offscreenWidth = 0;
+	uint32_t offscreenHeight = 0;
+	uint32_t nextOffscreenImage = 0;
+	uint32_t presentedImages = 0;
+	std::vector<VkDeviceMemory> offscreenMemory;
+	VkCommandPool offscreenCommandPool = VK_NULL_HANDLE;
+	uint32_t getMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties) const;
+	VkResult saveOffscreenImage(uint32_t imageIndex, VkSemaphore waitSemaphore);
 public:
 	VkFormat colorFormat;
 	VkColorSpaceKHR colorSpace;
@@ -47,6 +59,8 @@ public:
 	std::vector<VkImage> images;
 	std::vector<SwapChainBuffer> buffers;
 	uint32_t queueNodeIndex = UINT32_MAX;
+	/** @brief Write every n-th presented offscreen image to frame_<n>.ppm, zero to not write any */
+	uint32_t offscreenDumpInterval = 0;
 
 #if defined(VK_USE_PLATFORM_WIN32_KHR)
 	void initSurface(void* platformHandle, void* platformWindow);
@@ -70,6 +84,7 @@ public:
 #endif
 	void connect(VkInstance instance, VkPhysicalDevice physicalDevice, VkDevice device);
 	void create(uint32_t* width, uint32_t* height, bool vsync = false, bool fullscreen = false);
+	void createOffscreen(VkQueue queue, uint32_t queueFamilyIndex, uint32_t width, uint32_t height);
 	VkResult acquireNextImage(VkSemaphore presentCompleteSemaphore, uint32_t* imageIndex);
 	VkResult queuePresent(VkQueue queue, uint32_t imageIndex, VkSemaphore waitSemaphore = VK_NULL_HANDLE);
 	void cleanup();
@@ -0,0 +1,297 @@
+/*
+* Work stealing task scheduler
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanTaskScheduler.h"
+#include "VulkanCpuProfiler.h"
+
+#include <cassert>
+#include <thread>
+
+namespace vks
+{
+	struct TaskGroup::Task
+	{
+		TaskScheduler::Function function;
+		TaskGroup* group;
+	};
+
+	namespace
+	{
+		// Failed attempts to find a task before a thread goes to sleep, tasks are often queued again shortly after
+		const uint32_t spinCount = 32;
+
+		uint32_t randomIndex(uint32_t count)
+		{
+			// Xorshift, only used to spread the thieves over their victims
+			thread_local uint32_t state = static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1u;
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			return state % count;
+		}
+
+		/**
+		* @brief Chase-Lev work stealing deque
+		* @note Only the owning worker pushes and pops at the bottom, any thread steals from the top. Follows "Correct and Efficient
+		* Work-Stealing for Weak Memory Models" (Le et al. 2013), with sequentially consistent operations in place of its
+		* fences. The capacity is fixed, a push to a full deque fails.
+		*/
+		template<typename T>
+		class WorkStealingDeque
+		{
+		public:
+			static constexpr int64_t capacity = 4096;
+
+			bool push(T* task)
+			{
+				const int64_t b = bottom.load(std::memory_order_relaxed);
+				const int64_t t = top.load(std::memory_order_acquire);
+				if (b - t >= capacity) {
+					return false;
+				}
+				buffer[b & (capacity - 1)].store(task, std::memory_order_relaxed);
+				bottom.store(b + 1, std::memory_order_release);
+				return true;
+			}
+
+			T* pop()
+			{
+				// Taking the bottom slot has to be visible to thieves before top is read
+				const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+				bottom.exchange(b, std::memory_order_seq_cst);
+				int64_t t = top.load(std::memory_order_seq_cst);
+				if (t > b) {
+					// Empty
+					bottom.store(b + 1, std::memory_order_relaxed);
+					return nullptr;
+				}
+				T* task = buffer[b & (capacity - 1)].load(std::memory_order_relaxed);
+				if (t == b) {
+					// Last task, a thief may be taking it at the same time
+					if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+						task = nullptr;
+					}
+					bottom.store(b + 1, std::memory_order_relaxed);
+				}
+				return task;
+			}
+
+			T* steal()
+			{
+				int64_t t = top.load(std::memory_order_seq_cst);
+				const int64_t b = bottom.load(std::memory_order_seq_cst);
+				if (t >= b) {
+					return nullptr;
+				}
+				T* task = buffer[t & (capacity - 1)].load(std::memory_order_relaxed);
+				// Lost the race against the owner or another thief, the caller moves on to the next victim
+				if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+					return nullptr;
+				}
+				return task;
+			}
+
+		private:
+			// Kept on separate cache lines, as the owner writes bottom and thieves write top
+			std::atomic<int64_t> top{ 0 };
+			char topPadding[64 - sizeof(std::atomic<int64_t>)];
+			std::atomic<int64_t> bottom{ 0 };
+			char bottomPadding[64 - sizeof(std::atomic<int64_t>)];
+			std::atomic<T*> buffer[capacity];
+		};
+	}
+
+	struct TaskScheduler::Worker
+	{
+		explicit Worker(TaskScheduler* scheduler) : scheduler(scheduler) {}
+
+		TaskScheduler* scheduler;
+		WorkStealingDeque<TaskGroup::Task> deque;
+		std::thread thread;
+	};
+
+	thread_local TaskScheduler::Worker* TaskScheduler::currentWorker = nullptr;
+
+	TaskGroup::~TaskGroup()
+	{
+		assert(done());
+	}
+
+	TaskScheduler::TaskScheduler(uint32_t workerCount)
+	{
+		if (workerCount == 0) {
+			workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+		}
+		for (uint32_t i = 0; i < workerCount; i++) {
+			workers.push_back(std::unique_ptr<Worker>(new Worker(this)));
+		}
+		// Started once all workers exist, as they steal from each other right away
+		for (auto& worker : workers) {
+			worker->thread = std::thread(&TaskScheduler::workerLoop, this, std::ref(*worker));
+		}
+	}
+
+	TaskScheduler::~TaskScheduler()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			stopping = true;
+		}
+		wakeup.notify_all();
+		for (auto& worker : workers) {
+			worker->thread.join();
+		}
+	}
+
+	TaskScheduler& TaskScheduler::shared()
+	{
+		static TaskScheduler scheduler;
+		return scheduler;
+	}
+
+	void TaskScheduler::run(TaskGroup& group, Function function)
+	{
+		group.pending++;
+		push(new TaskGroup::Task{ std::move(function), &group });
+	}
+
+	void TaskScheduler::continueWith(TaskGroup& group, TaskGroup& next, Function function)
+	{
+		next.pending++;
+		TaskGroup::Task* task = new TaskGroup::Task{ std::move(function), &next };
+		{
+			// The thread finishing the group's last task takes the continuations after it counted the task as done, so a
+			// continuation is either queued here or taken by that thread
+			std::lock_guard<std::mutex> lock(group.continuationMutex);
+			if (group.pending.load() != 0) {
+				group.continuations.push_back(task);
+				return;
+			}
+		}
+		push(task);
+	}
+
+	void TaskScheduler::wait(TaskGroup& group)
+	{
+		while (!group.done()) {
+			TaskGroup::Task* task = take();
+			for (uint32_t spin = 0; task == nullptr && spin < spinCount && !group.done(); spin++) {
+				std::this_thread::yield();
+				task = take();
+			}
+			if (task != nullptr) {
+				execute(task);
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			sleepers++;
+			wakeup.wait(lock, [this, &group] { return queued.load() > 0 || group.done(); });
+			sleepers--;
+		}
+	}
+
+	void TaskScheduler::push(TaskGroup::Task* task)
+	{
+		Worker* worker = currentWorker;
+		if (worker == nullptr || worker->scheduler != this || !worker->deque.push(task)) {
+			std::lock_guard<std::mutex> lock(injectionMutex);
+			injected.push_back(task);
+			injectedCount++;
+		}
+		// Sleeping threads count themselves before checking for tasks, so either they see this task or they are woken up
+		queued++;
+		if (sleepers.load() > 0) {
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			wakeup.notify_one();
+		}
+	}
+
+	TaskGroup::Task* TaskScheduler::take()
+	{
+		Worker* self = (currentWorker != nullptr && currentWorker->scheduler == this) ? currentWorker : nullptr;
+		TaskGroup::Task* task = (self != nullptr) ? self->deque.pop() : nullptr;
+		if (task == nullptr && queued.load() > 0) {
+			// Starting at a random worker spreads the thieves over the victims
+			const uint32_t count = workerCount();
+			const uint32_t start = randomIndex(count);
+			for (uint32_t i = 0; i < count && task == nullptr; i++) {
+				Worker* victim = workers[(start + i) % count].get();
+				if (victim != self) {
+					task = victim->deque.steal();
+				}
+			}
+		}
+		if (task == nullptr && injectedCount.load() > 0) {
+			std::lock_guard<std::mutex> lock(injectionMutex);
+			if (!injected.empty()) {
+				task = injected.front();
+				injected.pop_front();
+				injectedCount--;
+			}
+		}
+		if (task != nullptr) {
+			queued--;
+		}
+		return task;
+	}
+
+	void TaskScheduler::execute(TaskGroup::Task* task)
+	{
+		task->function();
+		TaskGroup& group = *task->group;
+		delete task;
+		finish(group);
+	}
+
+	void TaskScheduler::finish(TaskGroup& group)
+	{
+		// Keeps the group alive for waiting threads until this thread is done with it
+		group.finishing++;
+		const bool last = --group.pending == 0;
+		if (last) {
+			std::vector<TaskGroup::Task*> continuations;
+			{
+				std::lock_guard<std::mutex> lock(group.continuationMutex);
+				continuations.swap(group.continuations);
+			}
+			for (TaskGroup::Task* continuation : continuations) {
+				push(continuation);
+			}
+		}
+		group.finishing--;
+		// Threads waiting for the group count themselves before checking it, like for queued tasks
+		if (last && sleepers.load() > 0) {
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			wakeup.notify_all();
+		}
+	}
+
+	void TaskScheduler::workerLoop(Worker& worker)
+	{
+		currentWorker = &worker;
+		CpuProfiler::setThreadName("Task worker");
+		while (true) {
+			TaskGroup::Task* task = take();
+			for (uint32_t spin = 0; task == nullptr && spin < spinCount; spin++) {
+				std::this_thread::yield();
+				task = take();
+			}
+			if (task != nullptr) {
+				execute(task);
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			// Queued tasks are still run when stopping, as they may belong to groups other threads wait for
+			if (stopping && queued.load() <= 0) {
+				break;
+			}
+			sleepers++;
+			wakeup.wait(lock, [this] { return queued.load() > 0 || stopping; });
+			sleepers--;
+		}
+		currentWorker = nullptr;
+	}
+}
@@ -0,0 +1,171 @@
+/*
+* Work stealing task scheduler
+*
+* Runs tasks on a fixed set of worker threads. Each worker pushes the tasks it spawns to its own lock free Chase-Lev
+* deque and runs them last in, first out, idle workers steal the oldest tasks of a random other worker. Tasks are
+* tracked in task groups, threads waiting for a group run queued tasks in the meantime.
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace vks
+{
+	class TaskScheduler;
+
+	/**
+	* @brief Set of tasks that are waited for together
+	* @note A group has to be done before it's destroyed. Continuations run once all of the group's tasks have finished, so
+	* they should be added after the tasks they depend on have been started.
+	*/
+	class TaskGroup
+	{
+	public:
+		TaskGroup() = default;
+		~TaskGroup();
+		TaskGroup(const TaskGroup&) = delete;
+		TaskGroup& operator=(const TaskGroup&) = delete;
+
+		/** @brief True if none of the group's tasks or continuations are queued or running */
+		bool done() const { return pending.load() == 0 && finishing.load() == 0; }
+
+	private:
+		friend class TaskScheduler;
+		struct Task;
+
+		std::atomic<uint32_t> pending{ 0 };
+		// Threads still finishing a task of the group, which have to be done with it before the group may be destroyed
+		std::atomic<uint32_t> finishing{ 0 };
+		std::mutex continuationMutex;
+		std::vector<Task*> continuations;
+	};
+
+	/**
+	* @brief Schedules tasks across worker threads by work stealing
+	* @note Tasks spawned on a worker go to its own deque, tasks from other threads to a shared queue. Workers sleep while
+	* there's nothing to run. Tasks must not throw.
+	*/
+	class TaskScheduler
+	{
+	public:
+		using Function = std::function<void()>;
+
+		/**
+		* Start the worker threads
+		*
+		* @param workerCount Number of worker threads, zero starts one less than there are hardware threads, as the thread
+		* waiting for a group helps running its tasks. At least one worker is started.
+		*/
+		explicit TaskScheduler(uint32_t workerCount = 0);
+		/** @brief Runs all queued tasks, then joins the workers */
+		~TaskScheduler();
+		TaskScheduler(const TaskScheduler&) = delete;
+		TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+		/** @brief Scheduler shared by everything that doesn't need one of its own, created on first use */
+		static TaskScheduler& shared();
+
+		uint32_t workerCount() const { return static_cast<uint32_t>(workers.size()); }
+		/** @brief Threads running tasks while a group is waited for, the workers and the waiting thread */
+		uint32_t concurrency() const { return workerCount() + 1; }
+
+		/** @brief Queue a task in a group */
+		void run(TaskGroup& group, Function function);
+
+		/**
+		* Queue a task in a group once all tasks of another group have finished
+		*
+		* @param group Group the continuation waits for, it runs right away if that group is done
+		* @param next Group the continuation is part of, waiting for it includes waiting for the continuation
+		*/
+		void continueWith(TaskGroup& group, TaskGroup& next, Function function);
+
+		/** @brief Run queued tasks on the calling thread until the group is done */
+		void wait(TaskGroup& group);
+
+		/**
+		* Call a function for ranges of indices in parallel and wait for all of them
+		*
+		* @param grainSize Largest range a single call gets, the range is halved until it fits, and the halves can be stolen by
+		* other threads. Zero picks a grain size giving every thread several ranges.
+		* @param function Called as function(rangeBegin, rangeEnd) for disjoint ranges covering [begin, end)
+		*/
+		template<typename Func>
+		void parallelForRanges(uint32_t begin, uint32_t end, uint32_t grainSize, const Func& function)
+		{
+			if (begin >= end) {
+				return;
+			}
+			if (grainSize == 0) {
+				grainSize = std::max((end - begin) / (concurrency() * 8), 1u);
+			}
+			TaskGroup group;
+			splitRange(group, begin, end, grainSize, function);
+			wait(group);
+		}
+
+		/**
+		* Call a function for every index in [begin, end) in parallel and wait for all of them
+		*
+		* @param function Called as function(index)
+		*/
+		template<typename Func>
+		void parallelFor(uint32_t begin, uint32_t end, uint32_t grainSize, const Func& function)
+		{
+			parallelForRanges(begin, end, grainSize, [&function](uint32_t rangeBegin, uint32_t rangeEnd) {
+				for (uint32_t i = rangeBegin; i < rangeEnd; ++i) {
+					function(i);
+				}
+			});
+		}
+
+	private:
+		struct Worker;
+
+		std::vector<std::unique_ptr<Worker>> workers;
+
+		// Tasks queued by threads that aren't workers of this scheduler, or that didn't fit into a worker's deque
+		std::mutex injectionMutex;
+		std::deque<TaskGroup::Task*> injected;
+		std::atomic<uint32_t> injectedCount{ 0 };
+
+		// Tasks in all deques and the shared queue, signed as a task can be taken before its push has been counted
+		std::atomic<int32_t> queued{ 0 };
+		// Workers and waiting threads sleep until a task is queued or a group is done
+		std::mutex sleepMutex;
+		std::condition_variable wakeup;
+		std::atomic<uint32_t> sleepers{ 0 };
+		bool stopping = false;
+
+		static thread_local Worker* currentWorker;
+
+		void push(TaskGroup::Task* task);
+		TaskGroup::Task* take();
+		void execute(TaskGroup::Task* task);
+		void finish(TaskGroup& group);
+		void workerLoop(Worker& worker);
+
+		template<typename Func>
+		void splitRange(TaskGroup& group, uint32_t begin, uint32_t end, uint32_t grainSize, const Func& function)
+		{
+			// The upper halves are queued, so the largest ones are the first to be stolen, the lowest range runs right here
+			while (end - begin > grainSize) {
+				const uint32_t middle = begin + (end - begin) / 2;
+				run(group, [this, &group, middle, end, grainSize, &function] { splitRange(group, middle, end, grainSize, function); });
+				end = middle;
+			}
+			function(begin, end);
+		}
+	};
+}
@@ -35,6 +35,8 @@ class Texture
 	VkImage               image;
 	VkImageLayout         imageLayout;
 	VkDeviceMemory        deviceMemory;
+	/** @brief Range of deviceMemory the image is bound to if it was suballocated from the device's allocator */
+	vks::Allocation       allocation;
 	VkImageView           view;
 	uint32_t              width, height;
 	uint32_t              mipLevels;
@@ -45,6 +47,8 @@ class Texture
 	void      updateDescriptor();
 	void      destroy();
 	ktxResult loadKTXFile(std::string filename, ktxTexture **target);
+
+	static std::string loadKTXFileError(std::string filename, ktxResult result);
 };
 
 class Texture2D : public Texture
@@ -58,6 +62,14 @@ class Texture2D : public Texture
 	    VkImageUsageFlags  imageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT,
 	    VkImageLayout      imageLayout     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
 	    bool               forceLinear     = false);
+	void fromKtxTexture(
+	    ktxTexture *       ktxTexture,
+	    VkFormat           format,
+	    vks::VulkanDevice *device,
+	    VkQueue            copyQueue,
+	    VkImageUsageFlags  imageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT,
+	    VkImageLayout      imageLayout     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	    bool               forceLinear     = false);
 	void loadFromFileCustomAddressMode(
 		std::string        filename,
 		VkFormat           format,
@@ -80,6 +92,27 @@ class Texture2D : public Texture
 	    VkImageLayout      imageLayout     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 };
 
+class Texture3D : public Texture
+{
+  public:
+	uint32_t depth;
+
+	void fromBuffer(
+	    void *               buffer,
+	    VkDeviceSize         bufferSize,
+	    VkFormat             format,
+	    uint32_t             texWidth,
+	    uint32_t             texHeight,
+	    uint32_t             texDepth,
+	    vks::VulkanDevice *  device,
+	    VkQueue              copyQueue,
+	    VkFilter             filter          = VK_FILTER_LINEAR,
+	    VkSamplerAddressMode addressMode     = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+	    VkImageUsageFlags    imageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT,
+	    VkImageLayout        imageLayout     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	    uint32_t             queueFamily     = VK_QUEUE_FAMILY_IGNORED);
+};
+
 class Texture2DArray : public Texture
 {
   public:
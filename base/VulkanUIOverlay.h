@@ -39,10 +39,17 @@ namespace vks
 		VkSampleCountFlagBits rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
 		uint32_t subpass = 0;
 
-		vks::Buffer vertexBuffer;
-		vks::Buffer indexBuffer;
-		int32_t vertexCount = 0;
-		int32_t indexCount = 0;
+		/** @brief Geometry of the overlay for one frame in flight */
+		struct FrameBuffers {
+			vks::Buffer vertexBuffer;
+			vks::Buffer indexBuffer;
+			int32_t vertexCount = 0;
+			int32_t indexCount = 0;
+		};
+		/** @brief One set of buffers per frame in flight, so the next frame's overlay can be written while the GPU still draws the previous one */
+		std::vector<FrameBuffers> frames = std::vector<FrameBuffers>(1);
+		/** @brief Frame whose buffers are written by update() and drawn by draw() */
+		uint32_t frameIndex = 0;
 
 		std::vector<VkPipelineShaderStageCreateInfo> shaders;
 
@@ -75,6 +82,8 @@ namespace vks
 		bool update();
 		void draw(const VkCommandBuffer commandBuffer);
 		void resize(uint32_t width, uint32_t height);
+		/** @brief Keep a separate set of buffers for each of frameCount frames in flight */
+		void setFrameCount(uint32_t frameCount);
 
 		void freeResources();
 
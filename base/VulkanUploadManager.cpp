@@ -0,0 +1,514 @@
+/*
+* Vulkan upload manager
+*
+* Stages host data for buffers and images in a persistently mapped ring buffer and records the copies of many uploads
+* into a single submission on the transfer queue, instead of a staging allocation, command buffer and fence wait per upload
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanUploadManager.h"
+#include "VulkanDevice.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace vks
+{
+	namespace
+	{
+		uint64_t alignUp(uint64_t value, uint64_t alignment)
+		{
+			return (value + alignment - 1) / alignment * alignment;
+		}
+
+		// Blit the levels of a range after the first from their predecessor, all levels are in the transfer destination
+		// layout with the first one written, and end up in the final layout
+		void recordMipmaps(VkCommandBuffer commandBuffer, VkImage image, VkExtent3D extent, const VkImageSubresourceRange& subresourceRange, VkImageLayout layout)
+		{
+			VkImageMemoryBarrier barrier = vks::initializers::imageMemoryBarrier();
+			barrier.image = image;
+			barrier.subresourceRange = subresourceRange;
+			barrier.subresourceRange.levelCount = 1;
+
+			for (uint32_t i = 1; i < subresourceRange.levelCount; i++) {
+				// The previous level has been written by the copy or the last blit
+				barrier.subresourceRange.baseMipLevel = subresourceRange.baseMipLevel + i - 1;
+				barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+				vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+				VkImageBlit blit{};
+				blit.srcSubresource = { subresourceRange.aspectMask, subresourceRange.baseMipLevel + i - 1, subresourceRange.baseArrayLayer, subresourceRange.layerCount };
+				blit.srcOffsets[1] = { static_cast<int32_t>(std::max(1u, extent.width >> (i - 1))), static_cast<int32_t>(std::max(1u, extent.height >> (i - 1))), static_cast<int32_t>(std::max(1u, extent.depth >> (i - 1))) };
+				blit.dstSubresource = { subresourceRange.aspectMask, subresourceRange.baseMipLevel + i, subresourceRange.baseArrayLayer, subresourceRange.layerCount };
+				blit.dstOffsets[1] = { static_cast<int32_t>(std::max(1u, extent.width >> i)), static_cast<int32_t>(std::max(1u, extent.height >> i)), static_cast<int32_t>(std::max(1u, extent.depth >> i)) };
+				vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+			}
+
+			// All but the last level have been read as blit sources, the last one has only been written
+			VkImageMemoryBarrier barriers[2] = { barrier, barrier };
+			uint32_t barrierCount = 0;
+			if (subresourceRange.levelCount > 1) {
+				barriers[barrierCount].subresourceRange.baseMipLevel = subresourceRange.baseMipLevel;
+				barriers[barrierCount].subresourceRange.levelCount = subresourceRange.levelCount - 1;
+				barriers[barrierCount].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+				barriers[barrierCount].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+				barrierCount++;
+			}
+			barriers[barrierCount].subresourceRange.baseMipLevel = subresourceRange.baseMipLevel + subresourceRange.levelCount - 1;
+			barriers[barrierCount].subresourceRange.levelCount = 1;
+			barriers[barrierCount].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barriers[barrierCount].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrierCount++;
+			for (uint32_t i = 0; i < barrierCount; i++) {
+				barriers[i].newLayout = layout;
+				barriers[i].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+			}
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, barrierCount, barriers);
+		}
+	}
+
+	UploadManager::UploadManager() = default;
+
+	UploadManager::~UploadManager()
+	{
+		destroy();
+	}
+
+	void UploadManager::create(VulkanDevice* device, bool timelineSemaphore, VkDeviceSize ringSize)
+	{
+		this->device = device;
+		this->ringSize = ringSize;
+		VkDevice logicalDevice = device->logicalDevice;
+
+		vkGetDeviceQueue(logicalDevice, device->queueFamilyIndices.transfer, 0, &transferQueue);
+		vkGetDeviceQueue(logicalDevice, device->queueFamilyIndices.graphics, 0, &graphicsQueue);
+		vkGetDeviceQueue(logicalDevice, device->queueFamilyIndices.compute, 0, &computeQueue);
+		ownershipTransfer = device->queueFamilyIndices.transfer != device->queueFamilyIndices.graphics;
+		transferPool = device->createCommandPool(device->queueFamilyIndices.transfer, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+		graphicsPool = ownershipTransfer ? device->createCommandPool(device->queueFamilyIndices.graphics, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT) : transferPool;
+		if ((device->queueFamilyIndices.compute != device->queueFamilyIndices.transfer) && (device->queueFamilyIndices.compute != device->queueFamilyIndices.graphics)) {
+			computePool = device->createCommandPool(device->queueFamilyIndices.compute, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+		}
+
+		if (timelineSemaphore) {
+			getSemaphoreCounterValue = reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>(vkGetDeviceProcAddr(logicalDevice, "vkGetSemaphoreCounterValueKHR"));
+			waitSemaphores = reinterpret_cast<PFN_vkWaitSemaphoresKHR>(vkGetDeviceProcAddr(logicalDevice, "vkWaitSemaphoresKHR"));
+			VkSemaphoreTypeCreateInfoKHR semaphoreTypeInfo{};
+			semaphoreTypeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+			semaphoreTypeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+			semaphoreTypeInfo.initialValue = 0;
+			VkSemaphoreCreateInfo semaphoreInfo = vks::initializers::semaphoreCreateInfo();
+			semaphoreInfo.pNext = &semaphoreTypeInfo;
+			VK_CHECK_RESULT(vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &timeline));
+		}
+
+		// The ring is a single persistently mapped buffer, copies are aligned to what the device prefers and at least to
+		// 16 bytes, which covers the offset requirements of image copies for texel blocks up to that size
+		VkBufferCreateInfo bufferInfo = vks::initializers::bufferCreateInfo(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, ringSize);
+		VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &ringBuffer));
+		VK_CHECK_RESULT(device->allocator.allocateBuffer(ringBuffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &ringMemory));
+		copyOffsetAlignment = std::max<VkDeviceSize>(device->properties.limits.optimalBufferCopyOffsetAlignment, 16);
+		ringHead = 0;
+		ringTail = 0;
+		nextValue = 1;
+		completedValue = 0;
+	}
+
+	void UploadManager::destroy()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (device == nullptr) {
+			return;
+		}
+		if (!submitted.empty()) {
+			waitForValue(submitted.back().value);
+		}
+		if (pending.transferCommandBuffer != VK_NULL_HANDLE) {
+			releaseBatch(pending);
+			pending = Batch();
+		}
+
+		VkDevice logicalDevice = device->logicalDevice;
+		if (timeline != VK_NULL_HANDLE) {
+			vkDestroySemaphore(logicalDevice, timeline, nullptr);
+			timeline = VK_NULL_HANDLE;
+		}
+		vkDestroyBuffer(logicalDevice, ringBuffer, nullptr);
+		device->allocator.free(ringMemory);
+		ringBuffer = VK_NULL_HANDLE;
+		if (graphicsPool != transferPool) {
+			vkDestroyCommandPool(logicalDevice, graphicsPool, nullptr);
+		}
+		if (computePool != VK_NULL_HANDLE) {
+			vkDestroyCommandPool(logicalDevice, computePool, nullptr);
+		}
+		vkDestroyCommandPool(logicalDevice, transferPool, nullptr);
+		transferPool = VK_NULL_HANDLE;
+		graphicsPool = VK_NULL_HANDLE;
+		computePool = VK_NULL_HANDLE;
+		device = nullptr;
+	}
+
+	uint64_t UploadManager::uploadBuffer(VkBuffer buffer, const void* data, VkDeviceSize size, VkDeviceSize offset, uint32_t queueFamily)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		assert(device != nullptr && size > 0);
+
+		VkBuffer stagingBuffer;
+		const VkDeviceSize stagingOffset = stage(data, size, &stagingBuffer);
+		beginBatch();
+
+		VkBufferCopy copyRegion{};
+		copyRegion.srcOffset = stagingOffset;
+		copyRegion.dstOffset = offset;
+		copyRegion.size = size;
+		vkCmdCopyBuffer(pending.transferCommandBuffer, stagingBuffer, buffer, 1, &copyRegion);
+
+		if (queueFamily == VK_QUEUE_FAMILY_IGNORED) {
+			queueFamily = device->queueFamilyIndices.graphics;
+		}
+		VkCommandBuffer acquireBuffer = acquireCommandBuffer(queueFamily);
+		if (acquireBuffer != VK_NULL_HANDLE) {
+			// Release the copied range on the transfer queue and acquire it on the queue it's used on
+			VkBufferMemoryBarrier barrier = vks::initializers::bufferMemoryBarrier();
+			barrier.buffer = buffer;
+			barrier.offset = offset;
+			barrier.size = size;
+			barrier.srcQueueFamilyIndex = device->queueFamilyIndices.transfer;
+			barrier.dstQueueFamilyIndex = queueFamily;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = 0;
+			vkCmdPipelineBarrier(pending.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+			vkCmdPipelineBarrier(acquireBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+		}
+		else {
+			// A single memory barrier at the end of the batch covers all buffer copies
+			pending.hasBufferCopies = true;
+		}
+		return pending.value;
+	}
+
+	uint64_t UploadManager::uploadImage(VkImage image, const void* data, VkDeviceSize size, const std::vector<VkBufferImageCopy>& regions, const VkImageSubresourceRange& subresourceRange, VkImageLayout layout, bool generateMipmaps, uint32_t queueFamily)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		assert(device != nullptr && size > 0 && !regions.empty());
+		if (queueFamily == VK_QUEUE_FAMILY_IGNORED) {
+			queueFamily = device->queueFamilyIndices.graphics;
+		}
+		assert(!generateMipmaps || queueFamily == device->queueFamilyIndices.graphics);
+
+		VkBuffer stagingBuffer;
+		const VkDeviceSize stagingOffset = stage(data, size, &stagingBuffer);
+		beginBatch();
+
+		std::vector<VkBufferImageCopy> stagedRegions(regions);
+		for (VkBufferImageCopy& region : stagedRegions) {
+			region.bufferOffset += stagingOffset;
+		}
+
+		VkImageMemoryBarrier barrier = vks::initializers::imageMemoryBarrier();
+		barrier.image = image;
+		barrier.subresourceRange = subresourceRange;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(pending.transferCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		vkCmdCopyBufferToImage(pending.transferCommandBuffer, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(stagedRegions.size()), stagedRegions.data());
+
+		// Mip maps are generated from the transfer destination layout, so the transition to the final layout comes after them
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = generateMipmaps ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : layout;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		VkCommandBuffer acquireBuffer = acquireCommandBuffer(queueFamily);
+		if (acquireBuffer != VK_NULL_HANDLE) {
+			// Release and acquire with the same layout transition, it's executed once
+			barrier.srcQueueFamilyIndex = device->queueFamilyIndices.transfer;
+			barrier.dstQueueFamilyIndex = queueFamily;
+			barrier.dstAccessMask = 0;
+			vkCmdPipelineBarrier(pending.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = generateMipmaps ? VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_MEMORY_READ_BIT;
+			vkCmdPipelineBarrier(acquireBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, generateMipmaps ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		}
+		else if (!generateMipmaps) {
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+			vkCmdPipelineBarrier(pending.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		}
+
+		if (generateMipmaps) {
+			recordMipmaps(pending.graphicsCommandBuffer, image, regions[0].imageExtent, subresourceRange, layout);
+		}
+		return pending.value;
+	}
+
+	uint64_t UploadManager::flush()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (device == nullptr) {
+			return 0;
+		}
+		return submitPending();
+	}
+
+	bool UploadManager::isComplete(uint64_t value)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (device == nullptr) {
+			return true;
+		}
+		retireCompleted();
+		return value <= completedValue;
+	}
+
+	void UploadManager::wait(uint64_t value)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (device == nullptr) {
+			return;
+		}
+		if (value == pending.value && pending.transferCommandBuffer != VK_NULL_HANDLE) {
+			submitPending();
+		}
+		// Values of batches that never got an upload are complete already
+		waitForValue(std::min(value, nextValue - 1));
+	}
+
+	void UploadManager::beginBatch()
+	{
+		if (pending.transferCommandBuffer != VK_NULL_HANDLE) {
+			return;
+		}
+		pending.value = nextValue;
+		pending.transferCommandBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, transferPool, true);
+		pending.graphicsCommandBuffer = ownershipTransfer ? device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, graphicsPool, true) : pending.transferCommandBuffer;
+	}
+
+	VkCommandBuffer UploadManager::acquireCommandBuffer(uint32_t queueFamily)
+	{
+		// Uploads used on the transfer queue's own family need no ownership transfer
+		if (queueFamily == device->queueFamilyIndices.transfer) {
+			return VK_NULL_HANDLE;
+		}
+		if (queueFamily == device->queueFamilyIndices.graphics) {
+			return pending.graphicsCommandBuffer;
+		}
+		assert(queueFamily == device->queueFamilyIndices.compute && computePool != VK_NULL_HANDLE);
+		if (pending.computeCommandBuffer == VK_NULL_HANDLE) {
+			pending.computeCommandBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, computePool, true);
+		}
+		return pending.computeCommandBuffer;
+	}
+
+	VkDeviceSize UploadManager::stage(const void* data, VkDeviceSize size, VkBuffer* stagingBuffer)
+	{
+		if (size > ringSize) {
+			// Too large for the ring, gets a staging buffer that's freed along with the batch
+			std::pair<VkBuffer, Allocation> staging;
+			VkBufferCreateInfo bufferInfo = vks::initializers::bufferCreateInfo(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, size);
+			VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferInfo, nullptr, &staging.first));
+			VK_CHECK_RESULT(device->allocator.allocateBuffer(staging.first, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &staging.second));
+			memcpy(staging.second.mapped, data, static_cast<size_t>(size));
+			pending.stagingBuffers.push_back(staging);
+			*stagingBuffer = staging.first;
+			return 0;
+		}
+
+		for (;;) {
+			// Start over at the beginning of the ring once nothing is in flight, so every upload that fits the ring finds room
+			if (ringTail == ringHead) {
+				ringHead = ringTail = alignUp(ringHead, ringSize);
+			}
+			uint64_t offset = alignUp(ringHead, copyOffsetAlignment);
+			// Staged data doesn't wrap around the end of the ring
+			if (offset % ringSize + size > ringSize) {
+				offset = alignUp(offset, ringSize);
+			}
+			if (offset + size - ringTail <= ringSize) {
+				ringHead = offset + size;
+				memcpy(static_cast<uint8_t*>(ringMemory.mapped) + offset % ringSize, data, static_cast<size_t>(size));
+				*stagingBuffer = ringBuffer;
+				return offset % ringSize;
+			}
+			// The ring is full, submit the pending batch if it's holding all of it and wait for the oldest batch in flight
+			if (submitted.empty()) {
+				submitPending();
+			}
+			waitForValue(submitted.front().value);
+		}
+	}
+
+	uint64_t UploadManager::submitPending()
+	{
+		if (pending.transferCommandBuffer == VK_NULL_HANDLE) {
+			return nextValue - 1;
+		}
+		if (pending.hasBufferCopies) {
+			VkMemoryBarrier barrier = vks::initializers::memoryBarrier();
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+			vkCmdPipelineBarrier(pending.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+		}
+		VK_CHECK_RESULT(vkEndCommandBuffer(pending.transferCommandBuffer));
+		if (ownershipTransfer) {
+			VK_CHECK_RESULT(vkEndCommandBuffer(pending.graphicsCommandBuffer));
+		}
+		const bool computeAcquire = pending.computeCommandBuffer != VK_NULL_HANDLE;
+		if (computeAcquire) {
+			VK_CHECK_RESULT(vkEndCommandBuffer(pending.computeCommandBuffer));
+		}
+		pending.ringEnd = ringHead;
+
+		VkDevice logicalDevice = device->logicalDevice;
+		VkTimelineSemaphoreSubmitInfoKHR timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+		timelineInfo.signalSemaphoreValueCount = 1;
+		timelineInfo.pSignalSemaphoreValues = &pending.value;
+		if (timeline == VK_NULL_HANDLE) {
+			VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo();
+			VK_CHECK_RESULT(vkCreateFence(logicalDevice, &fenceInfo, nullptr, &pending.fence));
+		}
+
+		// The last submission signals the batch's value, it's on the graphics queue in all cases
+		VkSubmitInfo completionSubmit = vks::initializers::submitInfo();
+		completionSubmit.commandBufferCount = 1;
+		completionSubmit.pCommandBuffers = &pending.graphicsCommandBuffer;
+		if (timeline != VK_NULL_HANDLE) {
+			completionSubmit.pNext = &timelineInfo;
+			completionSubmit.signalSemaphoreCount = 1;
+			completionSubmit.pSignalSemaphores = &timeline;
+		}
+
+		if (ownershipTransfer || computeAcquire) {
+			VkSemaphoreCreateInfo semaphoreInfo = vks::initializers::semaphoreCreateInfo();
+			std::vector<VkSemaphore> transferSignals;
+			std::vector<VkSemaphore> completionWaits;
+			if (ownershipTransfer) {
+				VK_CHECK_RESULT(vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &pending.ownershipSemaphore));
+				transferSignals.push_back(pending.ownershipSemaphore);
+				completionWaits.push_back(pending.ownershipSemaphore);
+			}
+			if (computeAcquire) {
+				VK_CHECK_RESULT(vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &pending.computeOwnershipSemaphore));
+				VK_CHECK_RESULT(vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &pending.computeCompleteSemaphore));
+				transferSignals.push_back(pending.computeOwnershipSemaphore);
+				// The batch is only complete once the compute queue has acquired its uploads
+				completionWaits.push_back(pending.computeCompleteSemaphore);
+			}
+
+			VkSubmitInfo transferSubmit = vks::initializers::submitInfo();
+			transferSubmit.commandBufferCount = 1;
+			transferSubmit.pCommandBuffers = &pending.transferCommandBuffer;
+			transferSubmit.signalSemaphoreCount = static_cast<uint32_t>(transferSignals.size());
+			transferSubmit.pSignalSemaphores = transferSignals.data();
+			VK_CHECK_RESULT(vkQueueSubmit(transferQueue, 1, &transferSubmit, VK_NULL_HANDLE));
+
+			const std::vector<VkPipelineStageFlags> ownershipWaitStages(completionWaits.size(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+			if (computeAcquire) {
+				VkSubmitInfo computeSubmit = vks::initializers::submitInfo();
+				computeSubmit.waitSemaphoreCount = 1;
+				computeSubmit.pWaitSemaphores = &pending.computeOwnershipSemaphore;
+				computeSubmit.pWaitDstStageMask = ownershipWaitStages.data();
+				computeSubmit.commandBufferCount = 1;
+				computeSubmit.pCommandBuffers = &pending.computeCommandBuffer;
+				computeSubmit.signalSemaphoreCount = 1;
+				computeSubmit.pSignalSemaphores = &pending.computeCompleteSemaphore;
+				VK_CHECK_RESULT(vkQueueSubmit(computeQueue, 1, &computeSubmit, VK_NULL_HANDLE));
+			}
+
+			// Without an ownership transfer to the graphics queue the transfer command buffer has been submitted already, the
+			// completion then only waits for the compute queue
+			completionSubmit.commandBufferCount = ownershipTransfer ? 1 : 0;
+			completionSubmit.waitSemaphoreCount = static_cast<uint32_t>(completionWaits.size());
+			completionSubmit.pWaitSemaphores = completionWaits.data();
+			completionSubmit.pWaitDstStageMask = ownershipWaitStages.data();
+			VK_CHECK_RESULT(vkQueueSubmit(graphicsQueue, 1, &completionSubmit, pending.fence));
+		}
+		else {
+			VK_CHECK_RESULT(vkQueueSubmit(transferQueue, 1, &completionSubmit, pending.fence));
+		}
+
+		const uint64_t value = pending.value;
+		submitted.push_back(std::move(pending));
+		pending = Batch();
+		nextValue++;
+		return value;
+	}
+
+	void UploadManager::retireCompleted()
+	{
+		if (timeline != VK_NULL_HANDLE) {
+			uint64_t value = 0;
+			VK_CHECK_RESULT(getSemaphoreCounterValue(device->logicalDevice, timeline, &value));
+			completedValue = std::max(completedValue, value);
+		}
+		else {
+			for (const Batch& batch : submitted) {
+				if (vkGetFenceStatus(device->logicalDevice, batch.fence) != VK_SUCCESS) {
+					break;
+				}
+				completedValue = batch.value;
+			}
+		}
+		while (!submitted.empty() && submitted.front().value <= completedValue) {
+			ringTail = std::max(ringTail, submitted.front().ringEnd);
+			releaseBatch(submitted.front());
+			submitted.pop_front();
+		}
+	}
+
+	void UploadManager::waitForValue(uint64_t value)
+	{
+		if (value > completedValue) {
+			if (timeline != VK_NULL_HANDLE) {
+				VkSemaphoreWaitInfoKHR waitInfo{};
+				waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+				waitInfo.semaphoreCount = 1;
+				waitInfo.pSemaphores = &timeline;
+				waitInfo.pValues = &value;
+				VK_CHECK_RESULT(waitSemaphores(device->logicalDevice, &waitInfo, UINT64_MAX));
+			}
+			else {
+				for (const Batch& batch : submitted) {
+					if (batch.value > value) {
+						break;
+					}
+					VK_CHECK_RESULT(vkWaitForFences(device->logicalDevice, 1, &batch.fence, VK_TRUE, UINT64_MAX));
+				}
+			}
+		}
+		retireCompleted();
+	}
+
+	void UploadManager::releaseBatch(Batch& batch)
+	{
+		VkDevice logicalDevice = device->logicalDevice;
+		vkFreeCommandBuffers(logicalDevice, transferPool, 1, &batch.transferCommandBuffer);
+		if (ownershipTransfer) {
+			vkFreeCommandBuffers(logicalDevice, graphicsPool, 1, &batch.graphicsCommandBuffer);
+		}
+		if (batch.computeCommandBuffer != VK_NULL_HANDLE) {
+			vkFreeCommandBuffers(logicalDevice, computePool, 1, &batch.computeCommandBuffer);
+		}
+		for (VkSemaphore semaphore : { batch.ownershipSemaphore, batch.computeOwnershipSemaphore, batch.computeCompleteSemaphore }) {
+			if (semaphore != VK_NULL_HANDLE) {
+				vkDestroySemaphore(logicalDevice, semaphore, nullptr);
+			}
+		}
+		if (batch.fence != VK_NULL_HANDLE) {
+			vkDestroyFence(logicalDevice, batch.fence, nullptr);
+		}
+		for (std::pair<VkBuffer, Allocation>& staging : batch.stagingBuffers) {
+			vkDestroyBuffer(logicalDevice, staging.first, nullptr);
+			device->allocator.free(staging.second);
+		}
+	}
+}
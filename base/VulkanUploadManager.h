@@ -0,0 +1,158 @@
+/*
+* Vulkan upload manager
+*
+* Stages host data for buffers and images in a persistently mapped ring buffer and records the copies of many uploads
+* into a single submission on the transfer queue, instead of a staging allocation, command buffer and fence wait per upload
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+#include "VulkanMemoryAllocator.h"
+
+namespace vks
+{
+	struct VulkanDevice;
+
+	/**
+	* @brief Batches copies of host data into buffers and images on the transfer queue
+	* @note Every upload returns the timeline value of the batch it was recorded into. Batches are submitted by flush(), or
+	* when the staging ring runs full, and complete in order, so a value is complete once the semaphore reaches it. If the
+	* transfer queue is of another family than the queue an upload is used on, the ownership of the uploaded resource is
+	* transferred to that queue's family, the graphics one unless another is passed. Only the graphics and compute queue
+	* families are supported, and mip maps are always generated on the graphics queue as transfer queues can't blit.
+	* Resources uploaded to have to be unused so far in that case, as their previous content isn't preserved.
+	* The batch is submitted to the compute and graphics queues last, so later work on either sees the uploads without
+	* waiting. All functions are thread safe, but flushing submits to the transfer, compute and graphics queues, which must
+	* not be used by other threads at the same time.
+	*/
+	class UploadManager
+	{
+	public:
+		/** @brief Size of the staging ring, uploads larger than the ring get a staging buffer of their own */
+		static constexpr VkDeviceSize defaultRingSize = 32ull * 1024 * 1024;
+
+		UploadManager();
+		~UploadManager();
+		UploadManager(const UploadManager&) = delete;
+		UploadManager& operator=(const UploadManager&) = delete;
+
+		/**
+		* Prepare the upload manager for a logical device
+		*
+		* @param timelineSemaphore True if VK_KHR_timeline_semaphore is enabled on the device, batches are tracked with a fence each otherwise
+		*/
+		void create(VulkanDevice* device, bool timelineSemaphore, VkDeviceSize ringSize = defaultRingSize);
+
+		/** @brief Wait for all submitted batches and free the staging ring, pending uploads are discarded */
+		void destroy();
+
+		/**
+		* Copy host data into a buffer
+		*
+		* @param buffer Buffer to copy to, needs VK_BUFFER_USAGE_TRANSFER_DST_BIT
+		* @param data Data to copy, it's staged before the function returns
+		* @param size Size of the data in bytes
+		* @param offset Offset in the buffer to copy to
+		* @param queueFamily Queue family the buffer is used on, the graphics queue family if VK_QUEUE_FAMILY_IGNORED
+		*
+		* @return Timeline value the copy is complete at
+		*/
+		uint64_t uploadBuffer(VkBuffer buffer, const void* data, VkDeviceSize size, VkDeviceSize offset = 0, uint32_t queueFamily = VK_QUEUE_FAMILY_IGNORED);
+
+		/**
+		* Copy host data into an image and transition it to its final layout
+		*
+		* @param image Image to copy to, needs VK_IMAGE_USAGE_TRANSFER_DST_BIT and its content is discarded
+		* @param data Data to copy, it's staged before the function returns
+		* @param size Size of the data in bytes
+		* @param regions Copy regions, their bufferOffset is relative to data and has to be a multiple of the texel block size and 4
+		* @param subresourceRange Subresources of the image the copy and the layout transition cover
+		* @param layout Layout the image is in once the upload is complete
+		* @param generateMipmaps Blit the levels of subresourceRange after the first from the first one on the graphics queue,
+		* the image then needs VK_IMAGE_USAGE_TRANSFER_SRC_BIT and the first region has to cover the whole first level
+		* @param queueFamily Queue family the image is used on, the graphics queue family if VK_QUEUE_FAMILY_IGNORED, has to be
+		* the graphics one to generate mip maps
+		*
+		* @return Timeline value the copy is complete at
+		*/
+		uint64_t uploadImage(VkImage image, const void* data, VkDeviceSize size, const std::vector<VkBufferImageCopy>& regions, const VkImageSubresourceRange& subresourceRange, VkImageLayout layout, bool generateMipmaps = false, uint32_t queueFamily = VK_QUEUE_FAMILY_IGNORED);
+
+		/** @brief Submit the pending uploads, returns the timeline value they complete at */
+		uint64_t flush();
+
+		/** @brief True if the batch of a timeline value has completed, doesn't submit pending uploads */
+		bool isComplete(uint64_t value);
+
+		/** @brief Wait until the batch of a timeline value has completed, submits it first if it's still pending */
+		void wait(uint64_t value);
+
+	private:
+		struct Batch
+		{
+			uint64_t value = 0;
+			VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+			// Same as the transfer command buffer if both queues are of the same family
+			VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE;
+			// Signalled by the transfer submission and waited on by the graphics one if the families differ
+			VkSemaphore ownershipSemaphore = VK_NULL_HANDLE;
+			// Acquires the uploads used on the compute queue, only created by the first of them if the compute queue is of a
+			// family of its own
+			VkCommandBuffer computeCommandBuffer = VK_NULL_HANDLE;
+			// Signalled by the transfer submission for the compute one, which signals the second for the graphics one
+			VkSemaphore computeOwnershipSemaphore = VK_NULL_HANDLE;
+			VkSemaphore computeCompleteSemaphore = VK_NULL_HANDLE;
+			// Only used without timeline semaphores
+			VkFence fence = VK_NULL_HANDLE;
+			// End of the batch's staging data in the ring, counted from the creation of the ring
+			uint64_t ringEnd = 0;
+			// Uploads too large for the ring
+			std::vector<std::pair<VkBuffer, Allocation>> stagingBuffers;
+			bool hasBufferCopies = false;
+		};
+
+		VulkanDevice* device = nullptr;
+		VkQueue transferQueue = VK_NULL_HANDLE;
+		VkQueue graphicsQueue = VK_NULL_HANDLE;
+		VkQueue computeQueue = VK_NULL_HANDLE;
+		VkCommandPool transferPool = VK_NULL_HANDLE;
+		VkCommandPool graphicsPool = VK_NULL_HANDLE;
+		// Only created if the compute queue family differs from both others
+		VkCommandPool computePool = VK_NULL_HANDLE;
+		bool ownershipTransfer = false;
+
+		VkSemaphore timeline = VK_NULL_HANDLE;
+		PFN_vkGetSemaphoreCounterValueKHR getSemaphoreCounterValue = nullptr;
+		PFN_vkWaitSemaphoresKHR waitSemaphores = nullptr;
+
+		VkBuffer ringBuffer = VK_NULL_HANDLE;
+		Allocation ringMemory;
+		VkDeviceSize ringSize = 0;
+		VkDeviceSize copyOffsetAlignment = 16;
+		// Positions in the ring counted from its creation, so wrapping around doesn't need special cases
+		uint64_t ringHead = 0;
+		uint64_t ringTail = 0;
+
+		// Batch uploads are recorded into, created by the first upload after a flush
+		Batch pending;
+		std::deque<Batch> submitted;
+		uint64_t nextValue = 1;
+		uint64_t completedValue = 0;
+		std::mutex mutex;
+
+		void beginBatch();
+		VkCommandBuffer acquireCommandBuffer(uint32_t queueFamily);
+		VkDeviceSize stage(const void* data, VkDeviceSize size, VkBuffer* stagingBuffer);
+		uint64_t submitPending();
+		void retireCompleted();
+		void waitForValue(uint64_t value);
+		void releaseBatch(Batch& batch);
+	};
+}
@@ -128,14 +128,14 @@ namespace vkglTF
 		glTF mesh
 	*/
 	struct Mesh {
-		vks::VulkanDevice* device;
+		vks::VulkanDevice* device = nullptr;
 
 		std::vector<Primitive*> primitives;
 		std::string name;
 
 		struct UniformBuffer {
 			VkBuffer buffer;
-			VkDeviceMemory memory;
+			vks::Allocation memory;
 			VkDescriptorBufferInfo descriptor;
 			VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
 			void* mapped;
@@ -147,8 +147,10 @@ namespace vkglTF
 			float jointcount{ 0 };
 		} uniformBlock;
 
-		Mesh(vks::VulkanDevice* device, glm::mat4 matrix);
+		Mesh(glm::mat4 matrix);
 		~Mesh();
+		// Meshes are created while the file is parsed, their uniform buffers once the model's resources are created
+		void createUniformBuffer(vks::VulkanDevice* device);
 	};
 
 	/*
@@ -259,8 +261,13 @@ namespace vkglTF
 		vkglTF::Texture* getTexture(uint32_t index);
 		vkglTF::Texture emptyTexture;
 		void createEmptyTexture(VkQueue transferQueue);
+		// Kept from parseFile until createResources has uploaded them
+		tinygltf::Model gltfModel;
+		std::vector<uint32_t> indexData;
+		std::vector<Vertex> vertexData;
+		uint32_t fileLoadingFlags = 0;
 	public:
-		vks::VulkanDevice* device;
+		vks::VulkanDevice* device = nullptr;
 		VkDescriptorPool descriptorPool;
 
 		struct Vertices {
@@ -303,6 +310,12 @@ namespace vkglTF
 		void loadMaterials(tinygltf::Model& gltfModel);
 		void loadAnimations(tinygltf::Model& gltfModel);
 		void loadFromFile(std::string filename, vks::VulkanDevice* device, VkQueue transferQueue, uint32_t fileLoadingFlags = vkglTF::FileLoadingFlags::None, float scale = 1.0f);
+		// First half of loadFromFile: reads the file, decodes its images and prepares the vertex data
+		// Doesn't touch Vulkan, so it can run on another thread before the device has been created
+		// Returns false if the file can't be loaded, with the reason in errorMessage if given and exiting otherwise
+		bool parseFile(std::string filename, uint32_t fileLoadingFlags = vkglTF::FileLoadingFlags::None, float scale = 1.0f, std::string* errorMessage = nullptr);
+		// Second half of loadFromFile: creates the Vulkan resources of the parsed file and queues their uploads
+		void createResources(vks::VulkanDevice* device, VkQueue transferQueue);
 		void bindBuffers(VkCommandBuffer commandBuffer);
 		void drawNode(Node* node, VkCommandBuffer commandBuffer, uint32_t renderFlags = 0, VkPipelineLayout pipelineLayout = VK_NULL_HANDLE, uint32_t bindImageSet = 1);
 		void draw(VkCommandBuffer commandBuffer, uint32_t renderFlags = 0, VkPipelineLayout pipelineLayout = VK_NULL_HANDLE, uint32_t bindImageSet = 1);
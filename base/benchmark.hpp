@@ -12,7 +12,9 @@
 #include <limits>
 #include <functional>
 #include <chrono>
+#include <cmath>
 #include <iomanip>
+#include <numeric>
 
 namespace vks
 {
@@ -31,6 +33,55 @@ namespace vks
 
 		double runtime = 0.0;
 		uint32_t frameCount = 0;
+		/** @brief Set once the warm up has finished and the frames are being measured */
+		bool measuring = false;
+
+		/** @brief Distribution of the measured frame times in milliseconds */
+		struct FrameTimeStatistics {
+			double mean = 0.0;
+			double stddev = 0.0;
+			double min = 0.0;
+			double max = 0.0;
+			double p50 = 0.0;
+			double p90 = 0.0;
+			double p99 = 0.0;
+			double p999 = 0.0;
+		};
+
+		/** @brief Percentiles use the nearest rank of the sorted frame times */
+		FrameTimeStatistics statistics() const {
+			FrameTimeStatistics stats;
+			if (frameTimes.empty()) {
+				return stats;
+			}
+			std::vector<double> sorted = frameTimes;
+			std::sort(sorted.begin(), sorted.end());
+			auto percentile = [&sorted](double p) {
+				const size_t rank = static_cast<size_t>(std::ceil(p * static_cast<double>(sorted.size())));
+				return sorted[std::min(std::max(rank, static_cast<size_t>(1)), sorted.size()) - 1];
+			};
+			stats.mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / static_cast<double>(sorted.size());
+			double variance = 0.0;
+			for (double t : sorted) {
+				variance += (t - stats.mean) * (t - stats.mean);
+			}
+			stats.stddev = std::sqrt(variance / static_cast<double>(sorted.size()));
+			stats.min = sorted.front();
+			stats.max = sorted.back();
+			stats.p50 = percentile(0.5);
+			stats.p90 = percentile(0.9);
+			stats.p99 = percentile(0.99);
+			stats.p999 = percentile(0.999);
+			return stats;
+		}
+
+		/** @brief Clear the measurements of the last run, e.g. before running the next scenario */
+		void reset() {
+			frameTimes.clear();
+			runtime = 0.0;
+			frameCount = 0;
+			measuring = false;
+		}
 
 		void run(std::function<void()> renderFunc, VkPhysicalDeviceProperties deviceProps) {
 			active = true;
@@ -55,6 +106,7 @@ namespace vks
 
 			// Benchmark phase
 			{
+				measuring = true;
 				while (runtime < (duration * 1000.0)) {
 					auto tStart = std::chrono::high_resolution_clock::now();
 					renderFunc();
@@ -69,6 +121,10 @@ namespace vks
 				std::cout << "runtime: " << (runtime / 1000.0) << "\n";
 				std::cout << "frames : " << frameCount << "\n";
 				std::cout << "fps    : " << frameCount / (runtime / 1000.0) << "\n";
+				const FrameTimeStatistics stats = statistics();
+				std::cout << "p50    : " << stats.p50 << " ms, p90: " << stats.p90 << " ms, p99: " << stats.p99 << " ms, p99.9: " << stats.p999 << " ms" << "\n";
+				std::cout << "stddev : " << stats.stddev << " ms" << "\n";
+				measuring = false;
 			}
 		}
 
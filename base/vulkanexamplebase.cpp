@@ -31,30 +31,33 @@ VkResult VulkanExampleBase::createInstance(bool enableValidation)
 	appInfo.pEngineName = name.c_str();
 	appInfo.apiVersion = apiVersion;
 
-	std::vector<const char*> instanceExtensions = { VK_KHR_SURFACE_EXTENSION_NAME };
+	std::vector<const char*> instanceExtensions;
 
-	// Enable surface extensions depending on os
+	// Enable surface extensions depending on os, rendering headless doesn't need any
+	if (!settings.headless) {
+		instanceExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
 #if defined(_WIN32)
-	instanceExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_ANDROID_KHR)
-	instanceExtensions.push_back(VK_KHR_ANDROID_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_ANDROID_SURFACE_EXTENSION_NAME);
 #elif defined(_DIRECT2DISPLAY)
-	instanceExtensions.push_back(VK_KHR_DISPLAY_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_DISPLAY_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_DIRECTFB_EXT)
-	instanceExtensions.push_back(VK_EXT_DIRECTFB_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_EXT_DIRECTFB_SURFACE_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
-	instanceExtensions.push_back(VK_KHR_WAYLAND_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_WAYLAND_SURFACE_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_XCB_KHR)
-	instanceExtensions.push_back(VK_KHR_XCB_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_XCB_SURFACE_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_IOS_MVK)
-	instanceExtensions.push_back(VK_MVK_IOS_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_MVK_IOS_SURFACE_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_MACOS_MVK)
-	instanceExtensions.push_back(VK_MVK_MACOS_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_MVK_MACOS_SURFACE_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_HEADLESS_EXT)
-	instanceExtensions.push_back(VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_SCREEN_QNX)
-	instanceExtensions.push_back(VK_QNX_SCREEN_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_QNX_SCREEN_SURFACE_EXTENSION_NAME);
 #endif
+	}
 
 	// Get extensions supported by the instance and store for later use
 	uint32_t extCount = 0;
@@ -79,6 +82,14 @@ VkResult VulkanExampleBase::createInstance(bool enableValidation)
 	}
 #endif
 
+	// Device extensions such as VK_KHR_timeline_semaphore depend on VK_KHR_get_physical_device_properties2 on a Vulkan 1.0 instance, enable it if available
+	if (apiVersion < VK_API_VERSION_1_1 &&
+		std::find(supportedInstanceExtensions.begin(), supportedInstanceExtensions.end(), VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) != supportedInstanceExtensions.end() &&
+		!instanceExtensionEnabled(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME))
+	{
+		enabledInstanceExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+	}
+
 	// Enabled requested instance extensions
 	if (enabledInstanceExtensions.size() > 0)
 	{
@@ -160,8 +171,18 @@ VkResult VulkanExampleBase::createInstance(bool enableValidation)
 	return result;
 }
 
+void VulkanExampleBase::runBenchmark()
+{
+	benchmark.run([=] { render(); }, vulkanDevice->properties);
+	vkDeviceWaitIdle(device);
+	if (benchmark.filename != "") {
+		benchmark.saveResults();
+	}
+}
+
 void VulkanExampleBase::renderFrame()
 {
+	VKS_CPU_ZONE("VulkanExampleBase::renderFrame");
 	VulkanExampleBase::prepareFrame();
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
@@ -206,13 +227,81 @@ std::string VulkanExampleBase::getShadersPath() const
 
 void VulkanExampleBase::createPipelineCache()
 {
+	// Start from the data saved by the last run, unless it was written by another device or driver version
+	std::vector<char> cacheData;
+	if (!commandLineParser.isSet("nopipelinecache")) {
+		std::ifstream file(pipelineCacheFile, std::ios::binary | std::ios::ate);
+		if (file.is_open()) {
+			cacheData.resize(static_cast<size_t>(file.tellg()));
+			file.seekg(0, std::ios::beg);
+			if (!file.read(cacheData.data(), cacheData.size())) {
+				cacheData.clear();
+			}
+		}
+		if (!cacheData.empty() && !isPipelineCacheCompatible(cacheData)) {
+			std::cout << "Pipeline cache " << pipelineCacheFile << " was written by another device or driver, starting with an empty cache\n";
+			cacheData.clear();
+		}
+	}
+
 	VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
 	pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	pipelineCacheCreateInfo.initialDataSize = cacheData.size();
+	pipelineCacheCreateInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
 	VK_CHECK_RESULT(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache));
+
+	pipelineCacheWarm = !cacheData.empty();
+	pipelineCacheLoadedSize = cacheData.size();
+}
+
+bool VulkanExampleBase::instanceExtensionEnabled(const char* extension) const
+{
+	return std::find_if(enabledInstanceExtensions.begin(), enabledInstanceExtensions.end(), [extension](const char* enabled) { return strcmp(enabled, extension) == 0; }) != enabledInstanceExtensions.end();
+}
+
+bool VulkanExampleBase::isPipelineCacheCompatible(const std::vector<char>& data) const
+{
+	VkPipelineCacheHeaderVersionOne header{};
+	if (data.size() < sizeof(header)) {
+		return false;
+	}
+	memcpy(&header, data.data(), sizeof(header));
+	return header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+		header.headerSize >= sizeof(header) && header.headerSize <= data.size() &&
+		header.vendorID == deviceProperties.vendorID &&
+		header.deviceID == deviceProperties.deviceID &&
+		memcmp(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void VulkanExampleBase::savePipelineCache()
+{
+	if (pipelineCache == VK_NULL_HANDLE || commandLineParser.isSet("nopipelinecache")) {
+		return;
+	}
+	size_t size = 0;
+	VK_CHECK_RESULT(vkGetPipelineCacheData(device, pipelineCache, &size, nullptr));
+	std::vector<char> cacheData(size);
+	VK_CHECK_RESULT(vkGetPipelineCacheData(device, pipelineCache, &size, cacheData.data()));
+
+	// Write to a temporary file first so an interrupted write never leaves a truncated cache behind
+	const std::string tempFile = pipelineCacheFile + ".tmp";
+	{
+		std::ofstream file(tempFile, std::ios::binary);
+		file.write(cacheData.data(), size);
+		if (!file) {
+			file.close();
+			std::remove(tempFile.c_str());
+			std::cerr << "Could not write the pipeline cache " << pipelineCacheFile << "\n";
+			return;
+		}
+	}
+	std::remove(pipelineCacheFile.c_str());
+	std::rename(tempFile.c_str(), pipelineCacheFile.c_str());
 }
 
 void VulkanExampleBase::prepare()
 {
+	VKS_CPU_ZONE("VulkanExampleBase::prepare");
 	initSwapchain();
 	createCommandPool();
 	setupSwapChain();
@@ -222,7 +311,7 @@ void VulkanExampleBase::prepare()
 	setupRenderPass();
 	createPipelineCache();
 	setupFrameBuffer();
-	settings.overlay = settings.overlay && (!benchmark.active);
+	settings.overlay = settings.overlay && (!benchmark.active) && (!settings.headless);
 	if (settings.overlay) {
 		UIOverlay.device = vulkanDevice;
 		UIOverlay.queue = queue;
@@ -253,6 +342,7 @@ VkPipelineShaderStageCreateInfo VulkanExampleBase::loadShader(std::string fileNa
 
 void VulkanExampleBase::nextFrame()
 {
+	VKS_CPU_ZONE("VulkanExampleBase::nextFrame");
 	auto tStart = std::chrono::high_resolution_clock::now();
 	if (viewUpdated)
 	{
@@ -304,25 +394,30 @@ void VulkanExampleBase::nextFrame()
 
 void VulkanExampleBase::renderLoop()
 {
+	// Assets loaded by prepare() may still have their uploads pending
+	vulkanDevice->uploader.flush();
+
 // SRS - for non-apple plaforms, handle benchmarking here within VulkanExampleBase::renderLoop()
 //     - for macOS, handle benchmarking within NSApp rendering loop via displayLinkOutputCb()
 #if !(defined(VK_USE_PLATFORM_IOS_MVK) || defined(VK_USE_PLATFORM_MACOS_MVK))
 	if (benchmark.active) {
 #if defined(VK_USE_PLATFORM_WAYLAND_KHR)
-		while (!configured)
-			wl_display_dispatch(display);
-		while (wl_display_prepare_read(display) != 0)
+		if (!settings.headless) {
+			while (!configured)
+				wl_display_dispatch(display);
+			while (wl_display_prepare_read(display) != 0)
+				wl_display_dispatch_pending(display);
+			wl_display_flush(display);
+			wl_display_read_events(display);
 			wl_display_dispatch_pending(display);
-		wl_display_flush(display);
-		wl_display_read_events(display);
-		wl_display_dispatch_pending(display);
+		}
 #endif
 
-		benchmark.run([=] { render(); }, vulkanDevice->properties);
-		vkDeviceWaitIdle(device);
-		if (benchmark.filename != "") {
-			benchmark.saveResults();
-		}
+		runBenchmark();
+		return;
+	}
+	if (settings.headless) {
+		renderHeadless();
 		return;
 	}
 #endif
@@ -676,11 +771,26 @@ void VulkanExampleBase::renderLoop()
 	}
 }
 
+void VulkanExampleBase::renderHeadless()
+{
+	lastTimestamp = std::chrono::high_resolution_clock::now();
+	tPrevEnd = lastTimestamp;
+	const auto tStart = lastTimestamp;
+	for (uint32_t i = 0; i < headlessFrames; i++) {
+		nextFrame();
+	}
+	vkDeviceWaitIdle(device);
+	const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+	std::cout << "Rendered " << headlessFrames << " headless frames in " << seconds << " s (" << headlessFrames / seconds << " fps)\n";
+}
+
 void VulkanExampleBase::updateOverlay()
 {
 	if (!settings.overlay)
 		return;
 
+	VKS_CPU_ZONE("VulkanExampleBase::updateOverlay");
+
 	ImGuiIO& io = ImGui::GetIO();
 
 	io.DisplaySize = ImVec2((float)width, (float)height);
@@ -810,6 +920,17 @@ VulkanExampleBase::VulkanExampleBase()
 	commandLineParser.add("benchmarkresultfile", { "-bf", "--benchfilename" }, 1, "Set file name for benchmark results");
 	commandLineParser.add("benchmarkresultframes", { "-bt", "--benchframetimes" }, 0, "Save frame times to benchmark results file");
 	commandLineParser.add("benchmarkframes", { "-bfs", "--benchmarkframes" }, 1, "Only render the given number of frames");
+	commandLineParser.add("benchmarkscenarios", { "-bsc", "--benchscenarios" }, 1, "Run the benchmark scenarios from the given file, results are written to the benchmark result file as JSON");
+	commandLineParser.add("cpureference", { "-cpu", "--cpureference" }, 0, "Compare the volumetrics against the CPU reference after the first frame");
+	commandLineParser.add("gpuprofile", { "-gp", "--gpuprofile" }, 0, "Write the GPU time of every pass to gpu_profile.csv");
+	commandLineParser.add("cputrace", { "-ct", "--cputrace" }, 0, "Record CPU zones and write them to cpu_trace.json at exit");
+	commandLineParser.add("nopipelinecache", { "-npc", "--nopipelinecache" }, 0, "Start with an empty pipeline cache and don't save it at exit");
+	commandLineParser.add("fogscaling", { "-fs", "--fogscaling" }, 0, "Time the volumetrics over a range of fog primitive counts after the first frame");
+	commandLineParser.add("headless", { "-hl", "--headless" }, 0, "Render to offscreen images without a window or surface, e.g. on servers without a display");
+	commandLineParser.add("headlessframes", { "-hf", "--headlessframes" }, 1, "Number of frames to render in headless mode, combine with --benchmark to run a benchmark instead");
+	commandLineParser.add("dumpframes", { "-df", "--dumpframes" }, 1, "Write every n-th frame rendered in headless mode to frame_<n>.ppm");
+	commandLineParser.add("golden", { "-gi", "--golden" }, 1, "Render the scenarios from the given file headless and compare them against their golden images, requires --headless");
+	commandLineParser.add("goldenupdate", { "-gu", "--goldenupdate" }, 0, "Write the images rendered with --golden as the new golden images instead of comparing them");
 
 	commandLineParser.parse(args);
 	if (commandLineParser.isSet("help")) {
@@ -863,6 +984,19 @@ VulkanExampleBase::VulkanExampleBase()
 	if (commandLineParser.isSet("benchmarkframes")) {
 		benchmark.outputFrames = commandLineParser.getValueAsInt("benchmarkframes", benchmark.outputFrames);
 	}
+	if (commandLineParser.isSet("cputrace")) {
+		vks::CpuProfiler::setThreadName("Main thread");
+		vks::CpuProfiler::setEnabled(true);
+	}
+	if (commandLineParser.isSet("headless")) {
+#if (defined(VK_USE_PLATFORM_ANDROID_KHR) || defined(VK_USE_PLATFORM_IOS_MVK) || defined(VK_USE_PLATFORM_MACOS_MVK))
+		std::cerr << "Headless mode is not supported on this platform\n";
+#else
+		settings.headless = true;
+		headlessFrames = commandLineParser.getValueAsInt("headlessframes", headlessFrames);
+		swapChain.offscreenDumpInterval = commandLineParser.getValueAsInt("dumpframes", 0);
+#endif
+	}
 
 #if defined(VK_USE_PLATFORM_ANDROID_KHR)
 	// Vulkan library is loaded dynamically on Android
@@ -871,14 +1005,18 @@ VulkanExampleBase::VulkanExampleBase()
 #elif defined(_DIRECT2DISPLAY)
 
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
-	initWaylandConnection();
+	if (!settings.headless) {
+		initWaylandConnection();
+	}
 #elif defined(VK_USE_PLATFORM_XCB_KHR)
-	initxcbConnection();
+	if (!settings.headless) {
+		initxcbConnection();
+	}
 #endif
 
 #if defined(_WIN32)
-	// Enable console if validation is active, debug message callback will output to it
-	if (this->settings.validation)
+	// Enable console if validation is active, debug message callback will output to it, or when rendering headless
+	if (this->settings.validation || this->settings.headless)
 	{
 		setupConsole("Vulkan example");
 	}
@@ -888,6 +1026,16 @@ VulkanExampleBase::VulkanExampleBase()
 
 VulkanExampleBase::~VulkanExampleBase()
 {
+	if (vks::CpuProfiler::isEnabled()) {
+		vks::CpuProfiler::setEnabled(false);
+		if (vks::CpuProfiler::writeTrace("cpu_trace.json")) {
+			std::cout << "CPU trace written to cpu_trace.json\n";
+		}
+		else {
+			std::cerr << "Could not write the CPU trace cpu_trace.json\n";
+		}
+	}
+
 	// Clean up Vulkan resources
 	swapChain.cleanup();
 	if (descriptorPool != VK_NULL_HANDLE)
@@ -912,6 +1060,7 @@ VulkanExampleBase::~VulkanExampleBase()
 	vkDestroyImage(device, depthStencil.image, nullptr);
 	vkFreeMemory(device, depthStencil.mem, nullptr);
 
+	savePipelineCache();
 	vkDestroyPipelineCache(device, pipelineCache, nullptr);
 
 	vkDestroyCommandPool(device, cmdPool, nullptr);
@@ -949,6 +1098,9 @@ VulkanExampleBase::~VulkanExampleBase()
 	if (dfb)
 		dfb->Release(dfb);
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
+	if (settings.headless) {
+		return;
+	}
 	xdg_toplevel_destroy(xdg_toplevel);
 	xdg_surface_destroy(xdg_surface);
 	wl_surface_destroy(surface);
@@ -965,9 +1117,14 @@ VulkanExampleBase::~VulkanExampleBase()
 #elif defined(VK_USE_PLATFORM_ANDROID_KHR)
 	// todo : android cleanup (if required)
 #elif defined(VK_USE_PLATFORM_XCB_KHR)
-	xcb_destroy_window(connection, window);
-	xcb_disconnect(connection);
+	if (!settings.headless) {
+		xcb_destroy_window(connection, window);
+		xcb_disconnect(connection);
+	}
 #elif defined(VK_USE_PLATFORM_SCREEN_QNX)
+	if (settings.headless) {
+		return;
+	}
 	screen_destroy_event(screen_event);
 	screen_destroy_window(screen_window);
 	screen_destroy_context(screen_context);
@@ -1053,6 +1210,7 @@ bool VulkanExampleBase::initVulkan()
 	// This is handled by a separate class that gets a logical device representation
 	// and encapsulates functions related to a device
 	vulkanDevice = new vks::VulkanDevice(physicalDevice);
+	vulkanDevice->physicalDeviceProperties2 = (apiVersion >= VK_API_VERSION_1_1) || instanceExtensionEnabled(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
 
 	// Derived examples can enable extensions based on the list of supported extensions read from the physical device
 	getEnabledExtensions();
@@ -1142,6 +1300,9 @@ void VulkanExampleBase::setupDPIAwareness()
 HWND VulkanExampleBase::setupWindow(HINSTANCE hinstance, WNDPROC wndproc)
 {
 	this->windowInstance = hinstance;
+	if (settings.headless) {
+		return nullptr;
+	}
 
 	WNDCLASSEX wndClass;
 
@@ -1902,10 +2063,7 @@ void VulkanExampleBase::displayLinkOutputCb()
 {
 #if defined(VK_EXAMPLE_XCODE_GENERATED)
 	if (benchmark.active) {
-		benchmark.run([=] { render(); }, vulkanDevice->properties);
-		if (benchmark.filename != "") {
-			benchmark.saveResults();
-		}
+		runBenchmark();
 		quit = true;	// SRS - quit NSApp rendering loop when benchmarking complete
 		return;
 	}
@@ -1939,6 +2097,10 @@ void VulkanExampleBase::windowDidResize()
 #elif defined(VK_USE_PLATFORM_DIRECTFB_EXT)
 IDirectFBSurface *VulkanExampleBase::setupWindow()
 {
+	if (settings.headless) {
+		return nullptr;
+	}
+
 	DFBResult ret;
 	int posx = 0, posy = 0;
 
@@ -2443,6 +2605,9 @@ static const struct xdg_toplevel_listener xdg_toplevel_listener = {
 
 struct xdg_surface *VulkanExampleBase::setupWindow()
 {
+	if (settings.headless) {
+		return nullptr;
+	}
 	surface = wl_compositor_create_surface(compositor);
 	xdg_surface = xdg_wm_base_get_xdg_surface(shell, surface);
 
@@ -2467,6 +2632,10 @@ static inline xcb_intern_atom_reply_t* intern_atom_helper(xcb_connection_t *conn
 // Set up a window using XCB and request event types
 xcb_window_t VulkanExampleBase::setupWindow()
 {
+	if (settings.headless) {
+		return 0;
+	}
+
 	uint32_t value_mask, value_list[32];
 
 	window = xcb_generate_id(connection);
@@ -2869,6 +3038,10 @@ void VulkanExampleBase::handleEvent()
 
 void VulkanExampleBase::setupWindow()
 {
+	if (settings.headless) {
+		return;
+	}
+
 	const char *idstr = name.c_str();
 	int size[2];
 	int usage = SCREEN_USAGE_VULKAN;
@@ -3223,6 +3396,10 @@ void VulkanExampleBase::windowResized() {}
 
 void VulkanExampleBase::initSwapchain()
 {
+	// The offscreen images don't need a surface
+	if (settings.headless) {
+		return;
+	}
 #if defined(_WIN32)
 	swapChain.initSurface(windowInstance, window);
 #elif defined(VK_USE_PLATFORM_ANDROID_KHR)
@@ -3244,6 +3421,10 @@ void VulkanExampleBase::initSwapchain()
 
 void VulkanExampleBase::setupSwapChain()
 {
+	if (settings.headless) {
+		swapChain.createOffscreen(queue, vulkanDevice->queueFamilyIndices.graphics, width, height);
+		return;
+	}
 	swapChain.create(&width, &height, settings.vsync, settings.fullscreen);
 }
 
@@ -68,6 +68,7 @@
 #include "VulkanBuffer.h"
 #include "VulkanDevice.h"
 #include "VulkanTexture.h"
+#include "VulkanCpuProfiler.h"
 
 #include "VulkanInitializers.hpp"
 #include "camera.hpp"
@@ -84,6 +85,9 @@ private:
 	void nextFrame();
 	void updateOverlay();
 	void createPipelineCache();
+	bool isPipelineCacheCompatible(const std::vector<char>& data) const;
+	void savePipelineCache();
+	bool instanceExtensionEnabled(const char* extension) const;
 	void createCommandPool();
 	void createSynchronizationPrimitives();
 	void initSwapchain();
@@ -143,6 +147,12 @@ protected:
 	std::vector<VkShaderModule> shaderModules;
 	// Pipeline cache object
 	VkPipelineCache pipelineCache{ VK_NULL_HANDLE };
+	/** @brief File the pipeline cache is loaded from at startup and saved to at shutdown */
+	std::string pipelineCacheFile = "pipeline_cache.bin";
+	/** @brief Set if the pipeline cache was created from data saved by an earlier run on the same device and driver */
+	bool pipelineCacheWarm = false;
+	/** @brief Size in bytes of the pipeline cache data loaded at startup */
+	size_t pipelineCacheLoadedSize = 0;
 	// Wraps the swap chain to present images (framebuffers) to the windowing system
 	VulkanSwapChain swapChain;
 	// Synchronization semaphores
@@ -182,6 +192,8 @@ public:
 		bool vsync = false;
 		/** @brief Enable UI overlay */
 		bool overlay = true;
+		/** @brief Render to offscreen images instead of a window, set via command line */
+		bool headless = false;
 	} settings;
 
 	VkClearColorValue defaultClearColor = { { 0.025f, 0.025f, 0.025f, 1.0f } };
@@ -397,6 +409,14 @@ public:
 	void submitFrame();
 	/** @brief (Virtual) Default image acquire + submission and command buffer submission function */
 	virtual void renderFrame();
+	/** @brief Runs the benchmark requested with --benchmark, can be overridden to e.g. measure several scenarios */
+	virtual void runBenchmark();
+	/** @brief Renders the frames requested with --headless, can be overridden to e.g. render test images */
+	virtual void renderHeadless();
+	/** @brief Frames rendered by the default headless mode before the example exits */
+	uint32_t headlessFrames = 100;
+	/** @brief Returned by the example's main function, e.g. to report failed tests to scripts */
+	int exitCode = 0;
 
 	/** @brief (Virtual) Called when the UI overlay is updating, can be used to add custom elements to the overlay */
 	virtual void OnUpdateUIOverlay(vks::UIOverlay *overlay);
@@ -427,8 +447,9 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int)									\
 	vulkanExample->setupWindow(hInstance, WndProc);													\
 	vulkanExample->prepare();																		\
 	vulkanExample->renderLoop();																	\
+	int exitCode = vulkanExample->exitCode;															\
 	delete(vulkanExample);																			\
-	return 0;																						\
+	return exitCode;																						\
 }
 #elif defined(VK_USE_PLATFORM_ANDROID_KHR)
 // Android entry point
@@ -459,8 +480,9 @@ int main(const int argc, const char *argv[])													    \
 	vulkanExample->initVulkan();																	\
 	vulkanExample->prepare();																		\
 	vulkanExample->renderLoop();																	\
+	int exitCode = vulkanExample->exitCode;															\
 	delete(vulkanExample);																			\
-	return 0;																						\
+	return exitCode;																						\
 }
 #elif defined(VK_USE_PLATFORM_DIRECTFB_EXT)
 #define VULKAN_EXAMPLE_MAIN()																		\
@@ -480,8 +502,9 @@ int main(const int argc, const char *argv[])													    \
 	vulkanExample->setupWindow();					 												\
 	vulkanExample->prepare();																		\
 	vulkanExample->renderLoop();																	\
+	int exitCode = vulkanExample->exitCode;															\
 	delete(vulkanExample);																			\
-	return 0;																						\
+	return exitCode;																						\
 }
 #elif (defined(VK_USE_PLATFORM_WAYLAND_KHR) || defined(VK_USE_PLATFORM_HEADLESS_EXT))
 #define VULKAN_EXAMPLE_MAIN()																		\
@@ -494,8 +517,9 @@ int main(const int argc, const char *argv[])													    \
 	vulkanExample->setupWindow();					 												\
 	vulkanExample->prepare();																		\
 	vulkanExample->renderLoop();																	\
+	int exitCode = vulkanExample->exitCode;															\
 	delete(vulkanExample);																			\
-	return 0;																						\
+	return exitCode;																						\
 }
 #elif defined(VK_USE_PLATFORM_XCB_KHR)
 #define VULKAN_EXAMPLE_MAIN()																		\
@@ -515,8 +539,9 @@ int main(const int argc, const char *argv[])													    \
 	vulkanExample->setupWindow();					 												\
 	vulkanExample->prepare();																		\
 	vulkanExample->renderLoop();																	\
+	int exitCode = vulkanExample->exitCode;															\
 	delete(vulkanExample);																			\
-	return 0;																						\
+	return exitCode;																						\
 }
 #elif (defined(VK_USE_PLATFORM_IOS_MVK) || defined(VK_USE_PLATFORM_MACOS_MVK))
 #if defined(VK_EXAMPLE_XCODE_GENERATED)
@@ -524,6 +549,7 @@ int main(const int argc, const char *argv[])													    \
 VulkanExample *vulkanExample;																		\
 int main(const int argc, const char *argv[])														\
 {																									\
+	int exitCode = 0;																						\
 	@autoreleasepool																				\
 	{																								\
 		for (size_t i = 0; i < argc; i++) { VulkanExample::args.push_back(argv[i]); };				\
@@ -532,9 +558,10 @@ int main(const int argc, const char *argv[])														\
 		vulkanExample->setupWindow(nullptr);														\
 		vulkanExample->prepare();																	\
 		vulkanExample->renderLoop();																\
+		exitCode = vulkanExample->exitCode;														\
 		delete(vulkanExample);																		\
 	}																								\
-	return 0;																						\
+	return exitCode;																						\
 }
 #else
 #define VULKAN_EXAMPLE_MAIN()
@@ -551,7 +578,8 @@ int main(const int argc, const char *argv[])										\
 	vulkanExample->setupWindow();											\
 	vulkanExample->prepare();											\
 	vulkanExample->renderLoop();											\
+	int exitCode = vulkanExample->exitCode;								\
 	delete(vulkanExample);												\
-	return 0;													\
+	return exitCode;													\
 }
 #endif
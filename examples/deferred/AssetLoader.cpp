@@ -0,0 +1,32 @@
+#include "AssetLoader.h"
+
+AssetLoader::AssetLoader(vks::TaskScheduler* scheduler)
+	: Scheduler((scheduler != nullptr) ? scheduler : &vks::TaskScheduler::shared())
+{
+}
+
+AssetLoader::~AssetLoader()
+{
+	// Jobs still running write the counters, so they have to finish before the loader is destroyed
+	Scheduler->wait(Jobs);
+}
+
+uint32_t AssetLoader::ThreadCount() const
+{
+	return Scheduler->workerCount();
+}
+
+void AssetLoader::Enqueue(std::function<void()> job)
+{
+	Scheduler->run(Jobs, std::move(job));
+}
+
+void AssetLoader::JobFinished(long long microseconds)
+{
+	JobMicroseconds += microseconds;
+	const long long end = StartTimer.total_elapsed();
+	long long last = LastJobEnd.load();
+	while (end > last && !LastJobEnd.compare_exchange_weak(last, end))
+	{
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "Timer.h"
+#include "VulkanCpuProfiler.h"
+#include "VulkanTaskScheduler.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+
+// Runs the CPU side of asset loading, reading, parsing and decoding files, on worker threads, so it overlaps with the
+// Vulkan initialization on the main thread. Jobs must not use Vulkan, the main thread creates the resources from their
+// results once it has a device, and only has to wait for the jobs that haven't finished by then.
+class AssetLoader
+{
+public:
+	// Runs the jobs on the shared task scheduler if no other one is given
+	explicit AssetLoader(vks::TaskScheduler* scheduler = nullptr);
+	~AssetLoader();
+
+	// Queues a job on the scheduler, returns the future of its result
+	template<typename Func>
+	auto Submit(Func func) -> std::future<decltype(func())>
+	{
+		using Result = decltype(func());
+		// std::function needs a copyable job, so the task is shared
+		auto task = std::make_shared<std::packaged_task<Result()>>([this, func]() mutable
+		{
+			// Counted before the result is made available, so the statistics cover every job that has been waited for
+			JobScope scope(*this);
+			return func();
+		});
+		std::future<Result> future = task->get_future();
+		Enqueue([task] { (*task)(); });
+		return future;
+	}
+
+	// Waits for a job's result on the main thread, the time spent blocked is counted as stall time
+	template<typename T>
+	T Get(std::future<T>& future)
+	{
+		Timer<resolutions::microseconds> timer;
+		future.wait();
+		StallMicroseconds += timer.total_elapsed();
+		return future.get();
+	}
+
+	uint32_t ThreadCount() const;
+	// Summed duration of all jobs in milliseconds
+	double JobTime() const { return JobMicroseconds.load() / 1000.0; }
+	// Time from the loader's creation until its last job finished in milliseconds
+	double CompletionTime() const { return LastJobEnd.load() / 1000.0; }
+	// Time the main thread has spent waiting for results in milliseconds
+	double StallTime() const { return StallMicroseconds / 1000.0; }
+
+private:
+	struct JobScope
+	{
+		AssetLoader& Loader;
+		vks::CpuProfilerZone Zone{ "AssetLoader job" };
+		Timer<resolutions::microseconds> Duration;
+		explicit JobScope(AssetLoader& loader) : Loader(loader) {}
+		~JobScope() { Loader.JobFinished(Duration.total_elapsed()); }
+	};
+
+	void Enqueue(std::function<void()> job);
+	void JobFinished(long long microseconds);
+
+	vks::TaskScheduler* Scheduler;
+	vks::TaskGroup Jobs;
+	Timer<resolutions::microseconds> StartTimer;
+	std::atomic<long long> JobMicroseconds{ 0 };
+	std::atomic<long long> LastJobEnd{ 0 };
+	long long StallMicroseconds = 0;
+};
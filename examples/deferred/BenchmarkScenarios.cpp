@@ -0,0 +1,228 @@
+#include "BenchmarkScenarios.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+	template <typename T>
+	T CatmullRom(const T& p0, const T& p1, const T& p2, const T& p3, float t)
+	{
+		const float t2 = t * t;
+		const float t3 = t2 * t;
+		return 0.5f * ((2.f * p1) + (p2 - p0) * t + (2.f * p0 - 5.f * p1 + 4.f * p2 - p3) * t2 + (3.f * p1 - p0 - 3.f * p2 + p3) * t3);
+	}
+
+	void WriteEscaped(std::ofstream& file, const std::string& text)
+	{
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\')
+			{
+				file << '\\';
+			}
+			file << c;
+		}
+	}
+
+	// The driver version is packed differently by some vendors
+	std::string DriverVersionString(const VkPhysicalDeviceProperties& properties)
+	{
+		const uint32_t Version = properties.driverVersion;
+		std::stringstream Stream;
+		if (properties.vendorID == 0x10DE)
+		{
+			// NVIDIA
+			Stream << ((Version >> 22) & 0x3ff) << "." << ((Version >> 14) & 0x0ff) << "." << ((Version >> 6) & 0x0ff) << "." << (Version & 0x003f);
+		}
+#if defined(_WIN32)
+		else if (properties.vendorID == 0x8086)
+		{
+			// Intel on Windows
+			Stream << (Version >> 14) << "." << (Version & 0x3fff);
+		}
+#endif
+		else
+		{
+			Stream << VK_VERSION_MAJOR(Version) << "." << VK_VERSION_MINOR(Version) << "." << VK_VERSION_PATCH(Version);
+		}
+		return Stream.str();
+	}
+}
+
+BenchmarkScenario::CameraKey BenchmarkScenario::Evaluate(float time) const
+{
+	if (CameraPath.empty())
+	{
+		return {};
+	}
+	const size_t KeyCount = CameraPath.size();
+	if (KeyCount == 1)
+	{
+		return CameraPath[0];
+	}
+
+	// The path loops, so there are as many segments as keys
+	const float PathTime = std::min(std::max(time, 0.f), 1.f) * static_cast<float>(KeyCount);
+	const size_t Segment = std::min(static_cast<size_t>(PathTime), KeyCount - 1);
+	const float t = PathTime - static_cast<float>(Segment);
+	const CameraKey& Key0 = CameraPath[(Segment + KeyCount - 1) % KeyCount];
+	const CameraKey& Key1 = CameraPath[Segment];
+	const CameraKey& Key2 = CameraPath[(Segment + 1) % KeyCount];
+	const CameraKey& Key3 = CameraPath[(Segment + 2) % KeyCount];
+	return { CatmullRom(Key0.Position, Key1.Position, Key2.Position, Key3.Position, t), CatmullRom(Key0.Rotation, Key1.Rotation, Key2.Rotation, Key3.Rotation, t) };
+}
+
+std::vector<BenchmarkScenario> LoadBenchmarkScenarios(const std::string& filename)
+{
+	std::vector<BenchmarkScenario> Scenarios;
+	std::ifstream File(filename);
+	if (!File.is_open())
+	{
+		std::cerr << "Could not open benchmark scenarios " << filename << "\n";
+		return Scenarios;
+	}
+
+	std::string Line;
+	uint32_t LineNumber = 0;
+	while (std::getline(File, Line))
+	{
+		++LineNumber;
+		Line = Line.substr(0, Line.find('#'));
+		std::istringstream Stream(Line);
+		std::string Command;
+		if (!(Stream >> Command))
+		{
+			continue;
+		}
+
+		bool Valid = false;
+		if (Command == "scenario")
+		{
+			BenchmarkScenario Scenario;
+			Valid = static_cast<bool>(Stream >> Scenario.Name);
+			if (Valid)
+			{
+				Scenarios.push_back(Scenario);
+			}
+		}
+		else if (Scenarios.empty())
+		{
+			std::cerr << filename << ":" << LineNumber << ": " << Command << " before the first scenario\n";
+			continue;
+		}
+		else if (Command == "camera")
+		{
+			BenchmarkScenario::CameraKey Key{};
+			Valid = static_cast<bool>(Stream >> Key.Position.x >> Key.Position.y >> Key.Position.z >> Key.Rotation.x >> Key.Rotation.y);
+			if (Valid)
+			{
+				Scenarios.back().CameraPath.push_back(Key);
+			}
+		}
+		else if (Command == "duration")
+		{
+			Valid = static_cast<bool>(Stream >> Scenarios.back().Duration) && Scenarios.back().Duration > 0.f;
+		}
+		else if (Command == "lights")
+		{
+			Valid = static_cast<bool>(Stream >> Scenarios.back().LightCount);
+		}
+		else if (Command == "frames")
+		{
+			Valid = static_cast<bool>(Stream >> Scenarios.back().CaptureFrames) && Scenarios.back().CaptureFrames > 0;
+		}
+		else if (Command == "tolerance")
+		{
+			std::string Metric;
+			BenchmarkScenario::ToleranceLimits& Tolerance = Scenarios.back().Tolerance;
+			Valid = static_cast<bool>(Stream >> Metric);
+			if (Valid && Metric == "rmse")
+			{
+				Valid = static_cast<bool>(Stream >> Tolerance.RMSE);
+			}
+			else if (Valid && Metric == "maxerror")
+			{
+				Valid = static_cast<bool>(Stream >> Tolerance.MaxError);
+			}
+			else if (Valid && Metric == "perceptual")
+			{
+				Valid = static_cast<bool>(Stream >> Tolerance.Perceptual);
+			}
+			else
+			{
+				Valid = false;
+			}
+		}
+		else if (Command == "fog")
+		{
+			std::pair<std::string, float> Setting;
+			Valid = static_cast<bool>(Stream >> Setting.first >> Setting.second);
+			if (Valid)
+			{
+				Scenarios.back().FogSettings.push_back(Setting);
+			}
+		}
+
+		if (!Valid)
+		{
+			std::cerr << filename << ":" << LineNumber << ": could not parse \"" << Line << "\"\n";
+		}
+	}
+	return Scenarios;
+}
+
+bool WriteBenchmarkResults(const std::string& filename, const VkPhysicalDeviceProperties& properties, const std::vector<BenchmarkScenarioResult>& results)
+{
+	std::ofstream File(filename);
+	if (!File.is_open())
+	{
+		return false;
+	}
+
+	File << std::fixed << std::setprecision(4);
+	File << "{\n\t\"device\": {\n";
+	File << "\t\t\"name\": \"";
+	WriteEscaped(File, properties.deviceName);
+	File << "\",\n";
+	File << "\t\t\"vendorID\": " << properties.vendorID << ",\n";
+	File << "\t\t\"deviceID\": " << properties.deviceID << ",\n";
+	File << "\t\t\"deviceType\": " << properties.deviceType << ",\n";
+	File << "\t\t\"apiVersion\": \"" << VK_VERSION_MAJOR(properties.apiVersion) << "." << VK_VERSION_MINOR(properties.apiVersion) << "." << VK_VERSION_PATCH(properties.apiVersion) << "\",\n";
+	File << "\t\t\"driverVersion\": " << properties.driverVersion << ",\n";
+	File << "\t\t\"driverVersionString\": \"" << DriverVersionString(properties) << "\"\n";
+	File << "\t},\n\t\"scenarios\": [";
+
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const BenchmarkScenarioResult& Result = results[i];
+		const vks::Benchmark::FrameTimeStatistics& Stats = Result.FrameTimes;
+		File << (i == 0 ? "\n" : ",\n") << "\t\t{\n";
+		File << "\t\t\t\"name\": \"";
+		WriteEscaped(File, Result.Name);
+		File << "\",\n";
+		File << "\t\t\t\"frames\": " << Result.FrameCount << ",\n";
+		File << "\t\t\t\"runtimeMs\": " << Result.Runtime << ",\n";
+		File << "\t\t\t\"fps\": " << (Result.Runtime > 0.0 ? Result.FrameCount / (Result.Runtime / 1000.0) : 0.0) << ",\n";
+		File << "\t\t\t\"frameTimeMs\": { \"mean\": " << Stats.mean << ", \"stddev\": " << Stats.stddev << ", \"min\": " << Stats.min << ", \"max\": " << Stats.max
+			<< ", \"p50\": " << Stats.p50 << ", \"p90\": " << Stats.p90 << ", \"p99\": " << Stats.p99 << ", \"p99.9\": " << Stats.p999 << " },\n";
+		File << "\t\t\t\"gpuPassMs\": {";
+		for (uint32_t Pass = 0; Pass < GpuProfiler::s_PassCount; ++Pass)
+		{
+			File << (Pass == 0 ? " \"" : ", \"") << GpuProfiler::PassName(static_cast<GpuPass>(Pass)) << "\": " << Result.PassTimes[Pass];
+		}
+		File << " },\n";
+		File << "\t\t\t\"frameTimesMs\": [";
+		for (size_t Frame = 0; Frame < Result.FrameTimeSamples.size(); ++Frame)
+		{
+			File << (Frame == 0 ? "" : ", ") << Result.FrameTimeSamples[Frame];
+		}
+		File << "]\n\t\t}";
+	}
+	File << "\n\t]\n}\n";
+	return static_cast<bool>(File);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "vulkanexamplebase.h"
+#include "GpuProfiler.h"
+#include <array>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A scripted benchmark run: a looping camera path, the number of scene lights and fog settings applied before it starts.
+// Settings are applied on top of the previous scenario's, so later scenarios only have to list what they change.
+// Golden image runs use the same scenarios, rendered from the first camera key.
+struct BenchmarkScenario
+{
+	struct CameraKey
+	{
+		glm::vec3 Position;
+		// Pitch, yaw and roll in degrees, as used by the camera
+		glm::vec3 Rotation;
+	};
+
+	std::string Name;
+	// Keys the camera passes through at an even pace, looping back to the first one, a single key is a static camera
+	std::vector<CameraKey> CameraPath;
+	// Measured seconds after the warm up, the camera path takes the whole duration
+	float Duration = 10.f;
+	// Lights of the composition, left unchanged when negative
+	int32_t LightCount = -1;
+	// Volumetrics settings by the names VulkanVolumetrics::ApplySetting takes
+	std::vector<std::pair<std::string, float>> FogSettings;
+
+	// Golden image runs only: frames rendered before the capture, so the temporal accumulation has settled
+	uint32_t CaptureFrames = 32;
+	// Golden image runs only: largest differences from the reference images that still pass
+	struct ToleranceLimits
+	{
+		// Root mean square error in 8 bit units
+		double RMSE = 2.0;
+		// Largest per channel error in 8 bit units
+		uint32_t MaxError = 64;
+		// Mean perceptual error in [0, 1]
+		double Perceptual = 0.05;
+	} Tolerance;
+
+	// Catmull-Rom interpolation of the camera path, time is in [0, 1]
+	CameraKey Evaluate(float time) const;
+};
+
+struct BenchmarkScenarioResult
+{
+	std::string Name;
+	uint32_t FrameCount = 0;
+	// Measured milliseconds
+	double Runtime = 0.0;
+	vks::Benchmark::FrameTimeStatistics FrameTimes;
+	// Every measured frame time in milliseconds, so runs can be compared with tools/benchcompare
+	std::vector<double> FrameTimeSamples;
+	// Mean GPU time of each pass over the measured frames in milliseconds
+	std::array<double, GpuProfiler::s_PassCount> PassTimes{};
+};
+
+// Reads scenarios from a text file with one command per line, '#' starts a comment:
+//   scenario <name>                 starts a new scenario
+//   camera <x> <y> <z> <pitch> <yaw> adds a key to the camera path
+//   duration <seconds>
+//   lights <count>
+//   fog <setting> <value>
+//   frames <count>                  frames rendered before a golden image capture
+//   tolerance <rmse|maxerror|perceptual> <value>
+// Returns no scenarios if the file can't be read, malformed lines are reported and skipped.
+std::vector<BenchmarkScenario> LoadBenchmarkScenarios(const std::string& filename);
+
+// Writes the results of all scenarios with the device and driver they were measured on as JSON, so runs on different
+// machines and driver versions can be compared. Returns false if the file couldn't be written.
+bool WriteBenchmarkResults(const std::string& filename, const VkPhysicalDeviceProperties& properties, const std::vector<BenchmarkScenarioResult>& results);
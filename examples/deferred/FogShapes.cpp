@@ -0,0 +1,154 @@
+#include "FogShapes.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#include "glm/geometric.hpp"
+
+void FogGrid::PrimitiveBounds(const FogPrimitive& primitive, glm::vec3& boundsMin, glm::vec3& boundsMax)
+{
+	switch (primitive.Type)
+	{
+	case FogPrimitiveBox:
+		boundsMin = primitive.Pos - glm::abs(primitive.Extent);
+		boundsMax = primitive.Pos + glm::abs(primitive.Extent);
+		break;
+	case FogPrimitiveCapsule:
+		boundsMin = primitive.Pos - glm::abs(primitive.Extent) - glm::vec3(primitive.Radius);
+		boundsMax = primitive.Pos + glm::abs(primitive.Extent) + glm::vec3(primitive.Radius);
+		break;
+	default:
+		boundsMin = primitive.Pos - glm::vec3(primitive.Radius);
+		boundsMax = primitive.Pos + glm::vec3(primitive.Radius);
+		break;
+	}
+}
+
+// Modified From https://iquilezles.org/articles/distfunctions, must match PrimitiveDistance in the shaders
+float FogGrid::PrimitiveDistance(const FogPrimitive& primitive, const glm::vec3& pos)
+{
+	const glm::vec3 p = pos - primitive.Pos;
+	switch (primitive.Type)
+	{
+	case FogPrimitiveBox:
+	{
+		const glm::vec3 q = glm::abs(p) - primitive.Extent;
+		return glm::length(glm::max(q, glm::vec3(0.f))) + std::min(std::max(q.x, std::max(q.y, q.z)), 0.f);
+	}
+	case FogPrimitiveCapsule:
+	{
+		const glm::vec3 pa = p + primitive.Extent;
+		const glm::vec3 ba = 2.f * primitive.Extent;
+		const float h = glm::clamp(glm::dot(pa, ba) / std::max(glm::dot(ba, ba), 1e-6f), 0.f, 1.f);
+		return glm::length(pa - ba * h) - primitive.Radius;
+	}
+	default:
+		return glm::length(p) - primitive.Radius;
+	}
+}
+
+void FogGrid::Build(const FogShapes& shapes, float smoothFactor, float cellsPerPrimitive)
+{
+	const std::vector<FogPrimitive>& primitives = shapes.Primitives;
+
+	// Bounds of each primitive grown by the smooth union factor
+	std::vector<glm::vec3> primitiveMin(primitives.size());
+	std::vector<glm::vec3> primitiveMax(primitives.size());
+	glm::vec3 boundsMin(FLT_MAX);
+	glm::vec3 boundsMax(-FLT_MAX);
+	for (size_t i = 0; i < primitives.size(); ++i)
+	{
+		PrimitiveBounds(primitives[i], primitiveMin[i], primitiveMax[i]);
+		primitiveMin[i] -= glm::vec3(smoothFactor);
+		primitiveMax[i] += glm::vec3(smoothFactor);
+		boundsMin = glm::min(boundsMin, primitiveMin[i]);
+		boundsMax = glm::max(boundsMax, primitiveMax[i]);
+	}
+	if (primitives.empty())
+	{
+		boundsMin = glm::vec3(0.f);
+		boundsMax = glm::vec3(0.f);
+	}
+
+	// Keep the cells roughly cubic, sized so there are about cellsPerPrimitive of them for each primitive
+	const glm::vec3 size = glm::max(boundsMax - boundsMin, glm::vec3(1e-3f));
+	glm::uvec3 dims(1);
+	if (cellsPerPrimitive > 0.f && !primitives.empty())
+	{
+		const float targetCells = cellsPerPrimitive * static_cast<float>(primitives.size());
+		const float cellSize = std::cbrt((size.x * size.y * size.z) / targetCells);
+		dims = glm::clamp(glm::uvec3(glm::ceil(size / cellSize)), glm::uvec3(1), glm::uvec3(s_MaxDim));
+	}
+
+	Info.BoundsMin = glm::vec4(boundsMin, 0.f);
+	Info.BoundsMax = glm::vec4(boundsMax, 0.f);
+	Info.CellSize = glm::vec4(size / glm::vec3(dims), 0.f);
+	Info.Dims = glm::uvec4(dims, dims.x * dims.y * dims.z);
+
+	// Count the primitives in each cell, then fill the indices in a second pass once the offsets are known.
+	// Primitives are added in order so every cell blends them in the same order as a loop over all of them.
+	const uint32_t cellCount = Info.Dims.w;
+	std::vector<uint32_t> counts(cellCount, 0);
+	auto forEachCell = [&](size_t primitive, auto&& func)
+	{
+		const glm::uvec3 first = glm::uvec3(glm::clamp((primitiveMin[primitive] - boundsMin) / glm::vec3(Info.CellSize), glm::vec3(0.f), glm::vec3(dims - 1u)));
+		const glm::uvec3 last = glm::uvec3(glm::clamp((primitiveMax[primitive] - boundsMin) / glm::vec3(Info.CellSize), glm::vec3(0.f), glm::vec3(dims - 1u)));
+		for (uint32_t z = first.z; z <= last.z; ++z)
+		{
+			for (uint32_t y = first.y; y <= last.y; ++y)
+			{
+				for (uint32_t x = first.x; x <= last.x; ++x)
+				{
+					func((z * dims.y + y) * dims.x + x);
+				}
+			}
+		}
+	};
+
+	for (size_t i = 0; i < primitives.size(); ++i)
+	{
+		forEachCell(i, [&](uint32_t cell) { ++counts[cell]; });
+	}
+
+	Data.assign(cellCount * 2, 0);
+	uint32_t offset = cellCount * 2;
+	MaxCellCount = 0;
+	for (uint32_t cell = 0; cell < cellCount; ++cell)
+	{
+		Data[cell * 2 + 0] = offset;
+		Data[cell * 2 + 1] = 0;
+		offset += counts[cell];
+		MaxCellCount = std::max(MaxCellCount, counts[cell]);
+	}
+	Data.resize(offset);
+
+	for (size_t i = 0; i < primitives.size(); ++i)
+	{
+		forEachCell(i, [&](uint32_t cell)
+		{
+			Data[Data[cell * 2] + Data[cell * 2 + 1]++] = static_cast<uint32_t>(i);
+		});
+	}
+}
+
+void FogGrid::Write(void* dst) const
+{
+	memcpy(dst, &Info, sizeof(FogGridInfo));
+	if (!Data.empty())
+	{
+		memcpy(static_cast<uint8_t*>(dst) + sizeof(FogGridInfo), Data.data(), Data.size() * sizeof(uint32_t));
+	}
+}
+
+int64_t FogGrid::CellIndex(const glm::vec3& pos) const
+{
+	const glm::vec3 cell = glm::floor((pos - glm::vec3(Info.BoundsMin)) / glm::vec3(Info.CellSize));
+	if (cell.x < 0.f || cell.y < 0.f || cell.z < 0.f ||
+		cell.x >= static_cast<float>(Info.Dims.x) || cell.y >= static_cast<float>(Info.Dims.y) || cell.z >= static_cast<float>(Info.Dims.z))
+	{
+		return -1;
+	}
+	return (static_cast<int64_t>(cell.z) * Info.Dims.y + static_cast<int64_t>(cell.y)) * Info.Dims.x + static_cast<int64_t>(cell.x);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "glm/common.hpp"
+#include "glm/vec3.hpp"
+#include "glm/vec4.hpp"
+
+// Shapes the fog can be built from, matches the FOG_PRIMITIVE_* defines in the volumetrics shaders
+enum FogPrimitiveType : glm::u32
+{
+	FogPrimitiveSphere = 0,
+	FogPrimitiveBox = 1,
+	FogPrimitiveCapsule = 2,
+	FogPrimitiveTypeCount
+};
+
+// A single fog shape, laid out for a std430 storage buffer.
+// Positions use the same negated space as the density query in the shaders.
+struct FogPrimitive
+{
+	// Centre of the shape
+	glm::vec3 Pos;
+	// Radius of a sphere or capsule, unused by boxes
+	glm::f32 Radius;
+	// Half extents of a box, or the offset from the centre to either end of a capsule's segment
+	glm::vec3 Extent;
+	// One of FogPrimitiveType
+	glm::u32 Type;
+};
+
+// Header of the uniform grid buffer, followed by an offset and count into the primitive indices for each cell and then the
+// indices themselves
+struct FogGridInfo
+{
+	// Bounds of all primitives grown by the smooth union factor, nothing outside of them is within the fog
+	glm::vec4 BoundsMin;
+	glm::vec4 BoundsMax;
+	// Size of a single cell
+	glm::vec4 CellSize;
+	// Number of cells along each axis, w is the total number of cells
+	glm::uvec4 Dims;
+};
+
+struct FogShapes
+{
+	std::vector<FogPrimitive> Primitives;
+
+	// Incremented whenever a primitive changes so dependent data can tell it's out of date
+	uint32_t Version = 0;
+};
+
+// Uniform grid over the fog primitives so each density query only evaluates the shapes that can affect it.
+// Each primitive is added to every cell overlapping its bounds grown by the smooth union factor, further away the
+// smooth union can't pull the distance field below zero.
+struct FogGrid
+{
+	// Rebuild the grid, CellsPerPrimitive sets roughly how many cells there are for each primitive.
+	// A value of zero puts everything in a single cell, which evaluates every primitive like the original fixed loop.
+	void Build(const FogShapes& shapes, float smoothFactor, float cellsPerPrimitive = 4.f);
+
+	// Bounds of a single primitive, not including the smooth union factor
+	static void PrimitiveBounds(const FogPrimitive& primitive, glm::vec3& boundsMin, glm::vec3& boundsMax);
+
+	// Signed distance to a single primitive, negative within it
+	static float PrimitiveDistance(const FogPrimitive& primitive, const glm::vec3& pos);
+
+	// Size in bytes of the grid buffer, header included
+	size_t BufferSize() const { return sizeof(FogGridInfo) + Data.size() * sizeof(uint32_t); }
+
+	// Write the header and cell data to mapped memory of at least BufferSize() bytes
+	void Write(void* dst) const;
+
+	// Index of the cell containing pos, or -1 when it's outside the grid
+	int64_t CellIndex(const glm::vec3& pos) const;
+
+	FogGridInfo Info{};
+
+	// Offset and count pairs for every cell, followed by the primitive indices they point at
+	std::vector<uint32_t> Data;
+
+	// Largest number of primitives in a single cell
+	uint32_t MaxCellCount = 0;
+
+	static constexpr uint32_t s_MaxDim = 64;
+};
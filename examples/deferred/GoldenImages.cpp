@@ -0,0 +1,278 @@
+#include "GoldenImages.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+	struct Colour
+	{
+		float X, Y, Z;
+	};
+
+	// D65 white point
+	constexpr Colour s_White = { 0.950428545f, 1.0f, 1.088900371f };
+
+	float SRGBToLinear(uint32_t value)
+	{
+		const float c = static_cast<float>(value) / 255.f;
+		return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+	}
+
+	Colour LinearRGBToXYZ(const Colour& rgb)
+	{
+		return {
+			0.4124564f * rgb.X + 0.3575761f * rgb.Y + 0.1804375f * rgb.Z,
+			0.2126729f * rgb.X + 0.7151522f * rgb.Y + 0.0721750f * rgb.Z,
+			0.0193339f * rgb.X + 0.1191920f * rgb.Y + 0.9503041f * rgb.Z };
+	}
+
+	Colour XYZToLinearRGB(const Colour& xyz)
+	{
+		return {
+			3.2404542f * xyz.X - 1.5371385f * xyz.Y - 0.4985314f * xyz.Z,
+			-0.9692660f * xyz.X + 1.8760108f * xyz.Y + 0.0415560f * xyz.Z,
+			0.0556434f * xyz.X - 0.2040259f * xyz.Y + 1.0572252f * xyz.Z };
+	}
+
+	// Opponent space the spatial filtering is done in
+	Colour XYZToYCxCz(const Colour& xyz)
+	{
+		const float Y = xyz.Y / s_White.Y;
+		return { 116.f * Y - 16.f, 500.f * (xyz.X / s_White.X - Y), 200.f * (Y - xyz.Z / s_White.Z) };
+	}
+
+	Colour YCxCzToXYZ(const Colour& ycxcz)
+	{
+		const float Y = (ycxcz.X + 16.f) / 116.f;
+		return { s_White.X * (ycxcz.Y / 500.f + Y), s_White.Y * Y, s_White.Z * (Y - ycxcz.Z / 200.f) };
+	}
+
+	Colour XYZToLab(const Colour& xyz)
+	{
+		auto f = [](float t) {
+			constexpr float Delta = 6.f / 29.f;
+			return t > Delta * Delta * Delta ? std::cbrt(t) : t / (3.f * Delta * Delta) + 4.f / 29.f;
+		};
+		const float fx = f(xyz.X / s_White.X);
+		const float fy = f(xyz.Y / s_White.Y);
+		const float fz = f(xyz.Z / s_White.Z);
+		return { 116.f * fy - 16.f, 500.f * (fx - fy), 200.f * (fy - fz) };
+	}
+
+	float HyAB(const Colour& a, const Colour& b)
+	{
+		const float da = a.Y - b.Y;
+		const float db = a.Z - b.Z;
+		return std::abs(a.X - b.X) + std::sqrt(da * da + db * db);
+	}
+
+	Colour LinearRGBToLab(const Colour& rgb)
+	{
+		return XYZToLab(LinearRGBToXYZ(rgb));
+	}
+
+	// Converts an RGBA8 image to YCxCz and blurs it with a Gaussian standing in for the contrast sensitivity function, at
+	// roughly the pixel density of a desktop monitor viewed from arm's length
+	std::vector<Colour> FilteredImage(const std::vector<uint32_t>& texels, uint32_t width, uint32_t height)
+	{
+		constexpr int32_t s_Radius = 3;
+		constexpr float s_Sigma = 1.f;
+		std::array<float, s_Radius * 2 + 1> Weights{};
+		float WeightSum = 0.f;
+		for (int32_t i = -s_Radius; i <= s_Radius; ++i)
+		{
+			Weights[i + s_Radius] = std::exp(-static_cast<float>(i * i) / (2.f * s_Sigma * s_Sigma));
+			WeightSum += Weights[i + s_Radius];
+		}
+		for (float& Weight : Weights)
+		{
+			Weight /= WeightSum;
+		}
+
+		std::vector<Colour> Image(texels.size());
+		for (size_t i = 0; i < texels.size(); ++i)
+		{
+			const Colour Linear = { SRGBToLinear(texels[i] & 0xFF), SRGBToLinear((texels[i] >> 8) & 0xFF), SRGBToLinear((texels[i] >> 16) & 0xFF) };
+			Image[i] = XYZToYCxCz(LinearRGBToXYZ(Linear));
+		}
+
+		// Separable filter, clamped at the edges
+		std::vector<Colour> Temp(Image.size());
+		const int32_t Width = static_cast<int32_t>(width);
+		const int32_t Height = static_cast<int32_t>(height);
+		for (int32_t y = 0; y < Height; ++y)
+		{
+			for (int32_t x = 0; x < Width; ++x)
+			{
+				Colour Sum = { 0.f, 0.f, 0.f };
+				for (int32_t i = -s_Radius; i <= s_Radius; ++i)
+				{
+					const Colour& Sample = Image[y * Width + std::min(std::max(x + i, 0), Width - 1)];
+					const float Weight = Weights[i + s_Radius];
+					Sum = { Sum.X + Sample.X * Weight, Sum.Y + Sample.Y * Weight, Sum.Z + Sample.Z * Weight };
+				}
+				Temp[y * Width + x] = Sum;
+			}
+		}
+		for (int32_t y = 0; y < Height; ++y)
+		{
+			for (int32_t x = 0; x < Width; ++x)
+			{
+				Colour Sum = { 0.f, 0.f, 0.f };
+				for (int32_t i = -s_Radius; i <= s_Radius; ++i)
+				{
+					const Colour& Sample = Temp[std::min(std::max(y + i, 0), Height - 1) * Width + x];
+					const float Weight = Weights[i + s_Radius];
+					Sum = { Sum.X + Sample.X * Weight, Sum.Y + Sample.Y * Weight, Sum.Z + Sample.Z * Weight };
+				}
+				Image[y * Width + x] = Sum;
+			}
+		}
+
+		// Back to L*a*b* through linear RGB, clamped like the display would
+		for (Colour& Pixel : Image)
+		{
+			const Colour Linear = XYZToLinearRGB(YCxCzToXYZ(Pixel));
+			Pixel = LinearRGBToLab({ std::min(std::max(Linear.X, 0.f), 1.f), std::min(std::max(Linear.Y, 0.f), 1.f), std::min(std::max(Linear.Z, 0.f), 1.f) });
+		}
+		return Image;
+	}
+
+	void WriteDifference(std::ofstream& file, const char* name, const GoldenImageDifference& difference)
+	{
+		file << "\t\t\t\"" << name << "\": { \"compared\": " << (difference.Compared ? "true" : "false") << ", \"rmse\": " << difference.RMSE
+			<< ", \"maxError\": " << difference.MaxError << ", \"perceptual\": " << difference.Perceptual << ", \"noticeablePixels\": " << difference.NoticeablePixels << " },\n";
+	}
+}
+
+GoldenImageDifference CompareGoldenImages(const std::vector<uint32_t>& reference, const std::vector<uint32_t>& test, uint32_t width, uint32_t height)
+{
+	GoldenImageDifference Result;
+	const size_t PixelCount = static_cast<size_t>(width) * height;
+	if (PixelCount == 0 || reference.size() != PixelCount || test.size() != PixelCount)
+	{
+		return Result;
+	}
+	Result.Compared = true;
+
+	double SquaredError = 0.0;
+	for (size_t i = 0; i < PixelCount; ++i)
+	{
+		for (uint32_t Channel = 0; Channel < 3; ++Channel)
+		{
+			const int32_t a = static_cast<int32_t>((reference[i] >> (Channel * 8)) & 0xFF);
+			const int32_t b = static_cast<int32_t>((test[i] >> (Channel * 8)) & 0xFF);
+			const uint32_t Error = static_cast<uint32_t>(std::abs(a - b));
+			Result.MaxError = std::max(Result.MaxError, Error);
+			SquaredError += static_cast<double>(Error) * Error;
+		}
+	}
+	Result.RMSE = std::sqrt(SquaredError / (static_cast<double>(PixelCount) * 3.0));
+
+	// FLIP compresses the colour difference with an exponent and maps it to [0, 1] relative to the largest difference
+	// between two colours, the one between pure green and pure blue
+	constexpr float s_Exponent = 0.7f;
+	constexpr float s_Pc = 0.4f;
+	constexpr float s_Pt = 0.95f;
+	const float MaxDifference = std::pow(HyAB(LinearRGBToLab({ 0.f, 1.f, 0.f }), LinearRGBToLab({ 0.f, 0.f, 1.f })), s_Exponent);
+
+	const std::vector<Colour> Reference = FilteredImage(reference, width, height);
+	const std::vector<Colour> Test = FilteredImage(test, width, height);
+	double PerceptualSum = 0.0;
+	for (size_t i = 0; i < PixelCount; ++i)
+	{
+		const float Difference = std::pow(HyAB(Reference[i], Test[i]), s_Exponent);
+		const float Error = Difference < s_Pc * MaxDifference
+			? s_Pt / (s_Pc * MaxDifference) * Difference
+			: s_Pt + (Difference - s_Pc * MaxDifference) / (MaxDifference - s_Pc * MaxDifference) * (1.f - s_Pt);
+		PerceptualSum += std::min(Error, 1.f);
+		Result.NoticeablePixels += Error > 0.1f ? 1 : 0;
+	}
+	Result.Perceptual = PerceptualSum / static_cast<double>(PixelCount);
+	return Result;
+}
+
+bool LoadPAM(const std::string& filename, std::vector<uint32_t>& texels, uint32_t& width, uint32_t& height)
+{
+	std::ifstream File(filename, std::ios::in | std::ios::binary);
+	if (!File.is_open())
+	{
+		return false;
+	}
+
+	std::string Line;
+	uint32_t Depth = 0;
+	uint32_t MaxValue = 0;
+	width = 0;
+	height = 0;
+	if (!std::getline(File, Line) || Line != "P7")
+	{
+		return false;
+	}
+	while (std::getline(File, Line) && Line != "ENDHDR")
+	{
+		std::istringstream Stream(Line);
+		std::string Key;
+		Stream >> Key;
+		if (Key == "WIDTH")
+		{
+			Stream >> width;
+		}
+		else if (Key == "HEIGHT")
+		{
+			Stream >> height;
+		}
+		else if (Key == "DEPTH")
+		{
+			Stream >> Depth;
+		}
+		else if (Key == "MAXVAL")
+		{
+			Stream >> MaxValue;
+		}
+	}
+	if (Depth != 4 || MaxValue != 255 || width == 0 || height == 0)
+	{
+		return false;
+	}
+
+	texels.resize(static_cast<size_t>(width) * height);
+	File.read(reinterpret_cast<char*>(texels.data()), static_cast<std::streamsize>(texels.size() * sizeof(uint32_t)));
+	return static_cast<bool>(File);
+}
+
+bool WriteGoldenImageResults(const std::string& filename, const std::vector<GoldenImageResult>& results)
+{
+	std::ofstream File(filename);
+	if (!File.is_open())
+	{
+		return false;
+	}
+
+	File << std::fixed << std::setprecision(4);
+	File << "{\n\t\"cases\": [";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const GoldenImageResult& Result = results[i];
+		File << (i == 0 ? "\n" : ",\n") << "\t\t{\n";
+		File << "\t\t\t\"name\": \"" << Result.Name << "\",\n";
+		File << "\t\t\t\"passed\": " << (Result.Passed ? "true" : "false") << ",\n";
+		File << "\t\t\t\"updated\": " << (Result.Updated ? "true" : "false") << ",\n";
+		WriteDifference(File, "composition", Result.Composition);
+		WriteDifference(File, "secondStage", Result.SecondStage);
+		File << "\t\t\t\"frameTimeMs\": " << Result.FrameTime << ",\n";
+		File << "\t\t\t\"gpuPassMs\": {";
+		for (uint32_t Pass = 0; Pass < GpuProfiler::s_PassCount; ++Pass)
+		{
+			File << (Pass == 0 ? " \"" : ", \"") << GpuProfiler::PassName(static_cast<GpuPass>(Pass)) << "\": " << Result.PassTimes[Pass];
+		}
+		File << " }\n\t\t}";
+	}
+	File << "\n\t]\n}\n";
+	return static_cast<bool>(File);
+}
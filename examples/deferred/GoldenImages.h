@@ -0,0 +1,55 @@
+#pragma once
+
+#include "BenchmarkScenarios.h"
+#include "GpuProfiler.h"
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Difference between a rendered image and its reference
+struct GoldenImageDifference
+{
+	// Root mean square error over the colour channels in 8 bit units
+	double RMSE = 0.0;
+	// Largest per channel error in 8 bit units
+	uint32_t MaxError = 0;
+	// Mean perceptual error in [0, 1], see CompareGoldenImages
+	double Perceptual = 0.0;
+	// Pixels with a perceptual error above 0.1, which is about where differences become noticeable side by side
+	size_t NoticeablePixels = 0;
+	// False if the images couldn't be compared, e.g. the reference is missing or has a different size
+	bool Compared = false;
+
+	bool Within(const BenchmarkScenario::ToleranceLimits& tolerance) const
+	{
+		return Compared && RMSE <= tolerance.RMSE && MaxError <= tolerance.MaxError && Perceptual <= tolerance.Perceptual;
+	}
+};
+
+struct GoldenImageResult
+{
+	std::string Name;
+	bool Passed = false;
+	// The images were written as the new references instead of being compared
+	bool Updated = false;
+	GoldenImageDifference Composition;
+	GoldenImageDifference SecondStage;
+	// Mean CPU frame time over the rendered frames in milliseconds
+	double FrameTime = 0.0;
+	// Mean GPU time of each pass over the rendered frames in milliseconds
+	std::array<double, GpuProfiler::s_PassCount> PassTimes{};
+};
+
+// Compare two packed RGBA8 images of the same size, alpha is ignored.
+// The perceptual error follows the colour pipeline of NVIDIA's FLIP: both images are filtered by an approximation of the
+// contrast sensitivity of the eye in an opponent colour space, then compared by their HyAB distance in L*a*b*, which is
+// compressed to [0, 1] the same way. FLIP's edge and point feature detection is left out, so sharp detail is weighted less
+// than by the full metric.
+GoldenImageDifference CompareGoldenImages(const std::vector<uint32_t>& reference, const std::vector<uint32_t>& test, uint32_t width, uint32_t height);
+
+// Read a packed RGBA8 image written by VolumetricsCPU::SavePAM, returns false if it couldn't be read
+bool LoadPAM(const std::string& filename, std::vector<uint32_t>& texels, uint32_t& width, uint32_t& height);
+
+// Write the results of all golden image comparisons as JSON, returns false if the file couldn't be written
+bool WriteGoldenImageResults(const std::string& filename, const std::vector<GoldenImageResult>& results);
@@ -0,0 +1,218 @@
+#include "GpuProfiler.h"
+#include "VulkanTools.h"
+
+const std::array<GpuProfiler::PassInfo, GpuProfiler::s_PassCount> GpuProfiler::s_Passes =
+{{
+	{ "G-Buffer", false },
+	{ "Volumetrics first stage", true },
+	{ "Volumetrics second stage", true },
+	{ "Composition", false },
+	{ "UI", false },
+}};
+
+void GpuProfiler::Init(vks::VulkanDevice* device, uint32_t frameSlots)
+{
+	pDevice = device;
+
+	// Timestamps are only written on queues which support them
+	const bool GraphicsTimestamps = pDevice->queueFamilyProperties[pDevice->queueFamilyIndices.graphics].timestampValidBits != 0;
+	const bool ComputeTimestamps = pDevice->queueFamilyProperties[pDevice->queueFamilyIndices.compute].timestampValidBits != 0;
+	for (uint32_t i = 0; i < s_PassCount; ++i)
+	{
+		TimestampsSupported[i] = s_Passes[i].Compute ? ComputeTimestamps : GraphicsTimestamps;
+	}
+
+	TimestampPools.resize(frameSlots, VK_NULL_HANDLE);
+	StatisticsPools.resize(frameSlots, VK_NULL_HANDLE);
+	SlotsWritten.resize(frameSlots, false);
+
+	for (uint32_t Slot = 0; Slot < frameSlots; ++Slot)
+	{
+		VkQueryPoolCreateInfo QueryPoolInfo{};
+		QueryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		QueryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		QueryPoolInfo.queryCount = s_PassCount * 2;
+		VK_CHECK_RESULT(vkCreateQueryPool(*pDevice, &QueryPoolInfo, nullptr, &TimestampPools[Slot]));
+
+		// Only the compute invocations are counted, a pool with graphics statistics couldn't be used on a compute only queue
+		if (pDevice->enabledFeatures.pipelineStatisticsQuery)
+		{
+			QueryPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+			QueryPoolInfo.queryCount = s_PassCount;
+			QueryPoolInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+			VK_CHECK_RESULT(vkCreateQueryPool(*pDevice, &QueryPoolInfo, nullptr, &StatisticsPools[Slot]));
+		}
+	}
+}
+
+void GpuProfiler::Release()
+{
+	for (VkQueryPool Pool : TimestampPools)
+	{
+		vkDestroyQueryPool(*pDevice, Pool, nullptr);
+	}
+	for (VkQueryPool Pool : StatisticsPools)
+	{
+		if (Pool != VK_NULL_HANDLE)
+		{
+			vkDestroyQueryPool(*pDevice, Pool, nullptr);
+		}
+	}
+	TimestampPools.clear();
+	StatisticsPools.clear();
+}
+
+void GpuProfiler::ResetPass(VkCommandBuffer cmdBuff, uint32_t frameSlot, GpuPass pass) const
+{
+	const uint32_t Pass = static_cast<uint32_t>(pass);
+	if (!TimestampsSupported[Pass])
+	{
+		return;
+	}
+	vkCmdResetQueryPool(cmdBuff, TimestampPools[frameSlot], Pass * 2, 2);
+	if (s_Passes[Pass].Compute && StatisticsPools[frameSlot] != VK_NULL_HANDLE)
+	{
+		vkCmdResetQueryPool(cmdBuff, StatisticsPools[frameSlot], Pass, 1);
+	}
+}
+
+void GpuProfiler::BeginPass(VkCommandBuffer cmdBuff, uint32_t frameSlot, GpuPass pass) const
+{
+	const uint32_t Pass = static_cast<uint32_t>(pass);
+	if (!TimestampsSupported[Pass])
+	{
+		return;
+	}
+	vkCmdWriteTimestamp(cmdBuff, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, TimestampPools[frameSlot], Pass * 2);
+	if (s_Passes[Pass].Compute && StatisticsPools[frameSlot] != VK_NULL_HANDLE)
+	{
+		vkCmdBeginQuery(cmdBuff, StatisticsPools[frameSlot], Pass, 0);
+	}
+}
+
+void GpuProfiler::EndPass(VkCommandBuffer cmdBuff, uint32_t frameSlot, GpuPass pass) const
+{
+	const uint32_t Pass = static_cast<uint32_t>(pass);
+	if (!TimestampsSupported[Pass])
+	{
+		return;
+	}
+	if (s_Passes[Pass].Compute && StatisticsPools[frameSlot] != VK_NULL_HANDLE)
+	{
+		vkCmdEndQuery(cmdBuff, StatisticsPools[frameSlot], Pass);
+	}
+	vkCmdWriteTimestamp(cmdBuff, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, TimestampPools[frameSlot], Pass * 2 + 1);
+}
+
+void GpuProfiler::FrameSubmitted(uint32_t frameSlot)
+{
+	SlotsWritten[frameSlot] = true;
+}
+
+void GpuProfiler::ReadResults(uint32_t frameSlot)
+{
+	// Nothing has been written until the slot's first frame was submitted
+	if (!SlotsWritten[frameSlot])
+	{
+		return;
+	}
+
+	// The frame which last used this slot has finished by now, but don't stall if it somehow hasn't
+	std::array<float, s_PassCount> Times{};
+	std::array<uint64_t, s_PassCount> Counts{};
+	const double Period = static_cast<double>(pDevice->properties.limits.timestampPeriod) / 1000000.0;
+	for (uint32_t Pass = 0; Pass < s_PassCount; ++Pass)
+	{
+		if (!TimestampsSupported[Pass])
+		{
+			continue;
+		}
+
+		std::array<uint64_t, 2> Timestamps{};
+		if (vkGetQueryPoolResults(*pDevice, TimestampPools[frameSlot], Pass * 2, 2, sizeof(Timestamps), Timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+		{
+			++SkippedFrames;
+			return;
+		}
+		Times[Pass] = static_cast<float>(static_cast<double>(Timestamps[1] - Timestamps[0]) * Period);
+
+		if (s_Passes[Pass].Compute && StatisticsPools[frameSlot] != VK_NULL_HANDLE &&
+			vkGetQueryPoolResults(*pDevice, StatisticsPools[frameSlot], Pass, 1, sizeof(uint64_t), &Counts[Pass], sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+		{
+			++SkippedFrames;
+			return;
+		}
+	}
+
+	PassTimes = Times;
+	Invocations = Counts;
+	++FrameIndex;
+
+	if (CsvEnabled)
+	{
+		WriteCsv();
+	}
+}
+
+void GpuProfiler::WriteCsv()
+{
+	if (!Csv.is_open())
+	{
+		Csv.open("gpu_profile.csv");
+		Csv << "frame";
+		for (const PassInfo& Pass : s_Passes)
+		{
+			Csv << "," << Pass.Name << " ms";
+			if (Pass.Compute)
+			{
+				Csv << "," << Pass.Name << " invocations";
+			}
+		}
+		Csv << ",total ms\n";
+	}
+
+	float Total = 0.0f;
+	Csv << FrameIndex;
+	for (uint32_t Pass = 0; Pass < s_PassCount; ++Pass)
+	{
+		Csv << "," << PassTimes[Pass];
+		if (s_Passes[Pass].Compute)
+		{
+			Csv << "," << Invocations[Pass];
+		}
+		Total += PassTimes[Pass];
+	}
+	Csv << "," << Total << "\n";
+}
+
+void GpuProfiler::UpdateOverlay(vks::UIOverlay* overlay)
+{
+	if (overlay->header("GPU Profiler"))
+	{
+		float Total = 0.0f;
+		for (uint32_t Pass = 0; Pass < s_PassCount; ++Pass)
+		{
+			if (!TimestampsSupported[Pass])
+			{
+				overlay->text("%s: no timestamps on this queue", s_Passes[Pass].Name);
+				continue;
+			}
+			if (s_Passes[Pass].Compute && StatisticsPools[0] != VK_NULL_HANDLE)
+			{
+				overlay->text("%s: %.2f ms, %.2fM invocations", s_Passes[Pass].Name, PassTimes[Pass], static_cast<double>(Invocations[Pass]) / 1000000.0);
+			}
+			else
+			{
+				overlay->text("%s: %.2f ms", s_Passes[Pass].Name, PassTimes[Pass]);
+			}
+			Total += PassTimes[Pass];
+		}
+		// The volumetrics first stage overlaps the G-Buffer on the compute queue, so this can be more than the frame time
+		overlay->text("Sum of passes: %.2f ms", Total);
+		if (SkippedFrames > 0)
+		{
+			overlay->text("Frames not ready when read: %llu", static_cast<unsigned long long>(SkippedFrames));
+		}
+		overlay->checkBox("Write gpu_profile.csv", &CsvEnabled);
+	}
+}
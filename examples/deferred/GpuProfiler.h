@@ -0,0 +1,93 @@
+#pragma once
+
+#include "VulkanDevice.h"
+#include "VulkanUIOverlay.h"
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+// Passes of a frame, in submission order
+enum class GpuPass : uint32_t
+{
+	Offscreen,
+	VolumetricsFirstStage,
+	VolumetricsSecondStage,
+	Composition,
+	UI,
+	Count
+};
+
+// Measures the GPU time of every pass of a frame with timestamps, and the compute shader invocations of the compute passes
+// with pipeline statistics.
+// Each frame slot writes its own query pools, which are read once the slot's fence has been waited on. The results are
+// fetched without waiting, a frame whose queries aren't all available yet is skipped rather than stalling the CPU.
+// Each pass resets its own queries in its command buffer, so pre-recorded command buffers keep working.
+class GpuProfiler
+{
+public:
+	// The compute invocations are only counted if the pipelineStatisticsQuery feature was enabled
+	void Init(vks::VulkanDevice* device, uint32_t frameSlots);
+	void Release();
+
+	// Reset the pass' queries, has to be recorded outside of a render pass before BeginPass
+	void ResetPass(VkCommandBuffer cmdBuff, uint32_t frameSlot, GpuPass pass) const;
+	void BeginPass(VkCommandBuffer cmdBuff, uint32_t frameSlot, GpuPass pass) const;
+	void EndPass(VkCommandBuffer cmdBuff, uint32_t frameSlot, GpuPass pass) const;
+
+	// Marks the slot's queries as written once its frame has been submitted
+	void FrameSubmitted(uint32_t frameSlot);
+
+	// Reads back the slot's queries from the frame which last used it, that frame has to have completed
+	void ReadResults(uint32_t frameSlot);
+
+	// True if the queue the pass runs on supports timestamps
+	bool Supported(GpuPass pass) const { return TimestampsSupported[static_cast<uint32_t>(pass)]; }
+
+	// GPU time of the pass in the last frame read back in milliseconds, zero if it isn't supported
+	float PassTime(GpuPass pass) const { return PassTimes[static_cast<uint32_t>(pass)]; }
+
+	// Compute shader invocations of the pass in the last frame read back, zero without pipeline statistics
+	uint64_t ComputeInvocations(GpuPass pass) const { return Invocations[static_cast<uint32_t>(pass)]; }
+
+	// Number of frames whose results have been read back, changes whenever new results are available
+	uint64_t FramesRead() const { return FrameIndex; }
+
+	void UpdateOverlay(vks::UIOverlay* overlay);
+
+	static const char* PassName(GpuPass pass) { return s_Passes[static_cast<uint32_t>(pass)].Name; }
+
+	// Append every frame read back to gpu_profile.csv
+	bool CsvEnabled = false;
+
+	static constexpr uint32_t s_PassCount = static_cast<uint32_t>(GpuPass::Count);
+
+private:
+	struct PassInfo
+	{
+		const char* Name;
+		// Runs on the compute queue and counts its compute shader invocations
+		bool Compute;
+	};
+	static const std::array<PassInfo, s_PassCount> s_Passes;
+
+	void WriteCsv();
+
+	vks::VulkanDevice* pDevice = nullptr;
+
+	// Two timestamps for each pass in every frame slot
+	std::vector<VkQueryPool> TimestampPools;
+	// One compute shader invocation count for each pass in every frame slot, only used by the compute passes
+	std::vector<VkQueryPool> StatisticsPools;
+	std::vector<bool> SlotsWritten;
+
+	std::array<bool, s_PassCount> TimestampsSupported{};
+	std::array<float, s_PassCount> PassTimes{};
+	std::array<uint64_t, s_PassCount> Invocations{};
+
+	uint64_t FrameIndex = 0;
+	// Frames read back without all of their queries available
+	uint64_t SkippedFrames = 0;
+
+	std::ofstream Csv;
+};
@@ -0,0 +1,454 @@
+#include "NoiseVolume.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+#include <ktx.h>
+
+#include "VulkanCpuProfiler.h"
+#include "VulkanTaskScheduler.h"
+#include "VolumetricsSIMD.h"
+
+using namespace simd;
+
+namespace
+{
+	// Metadata key holding NoiseVolumeParams::Key() in the cache file
+	const char* s_KeyName = "VolumetricsNoiseKey";
+
+	inline uint32_t Hash(uint32_t x, uint32_t y, uint32_t z, uint32_t seed)
+	{
+		uint32_t h = seed * 0x9E3779B9u;
+		h ^= x * 0x85EBCA6Bu;
+		h = (h << 13) | (h >> 19);
+		h ^= y * 0xC2B2AE35u;
+		h = (h << 13) | (h >> 19);
+		h ^= z * 0x27D4EB2Fu;
+		h ^= h >> 16;
+		h *= 0x7FEB352Du;
+		h ^= h >> 15;
+		h *= 0x846CA68Bu;
+		h ^= h >> 16;
+		return h;
+	}
+
+	inline float HashToUnit(uint32_t h)
+	{
+		return static_cast<float>(h >> 8) / 16777216.f;
+	}
+
+	// Values stored per lattice point, split into one array per component so the lanes can gather them
+	struct Lattice
+	{
+		uint32_t Period = 0;
+		std::vector<float> X, Y, Z;
+
+		size_t Index(uint32_t x, uint32_t y, uint32_t z) const { return (static_cast<size_t>(z) * Period + y) * Period + x; }
+	};
+
+	// Random edge gradients for a Perlin octave, the lattice wraps around at the period so the noise tiles
+	Lattice BuildGradients(uint32_t period, uint32_t seed)
+	{
+		static const float s_Gradients[12][3] =
+		{
+			{ 1, 1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { -1, -1, 0 },
+			{ 1, 0, 1 }, { -1, 0, 1 }, { 1, 0, -1 }, { -1, 0, -1 },
+			{ 0, 1, 1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, -1, -1 },
+		};
+
+		Lattice lattice;
+		lattice.Period = period;
+		const size_t count = static_cast<size_t>(period) * period * period;
+		lattice.X.resize(count);
+		lattice.Y.resize(count);
+		lattice.Z.resize(count);
+		for (uint32_t z = 0; z < period; ++z)
+		{
+			for (uint32_t y = 0; y < period; ++y)
+			{
+				for (uint32_t x = 0; x < period; ++x)
+				{
+					const float* gradient = s_Gradients[Hash(x, y, z, seed) % 12];
+					const size_t i = lattice.Index(x, y, z);
+					lattice.X[i] = gradient[0];
+					lattice.Y[i] = gradient[1];
+					lattice.Z[i] = gradient[2];
+				}
+			}
+		}
+		return lattice;
+	}
+
+	// A random feature point within every Worley cell
+	Lattice BuildFeaturePoints(uint32_t cells, uint32_t seed)
+	{
+		Lattice lattice;
+		lattice.Period = cells;
+		const size_t count = static_cast<size_t>(cells) * cells * cells;
+		lattice.X.resize(count);
+		lattice.Y.resize(count);
+		lattice.Z.resize(count);
+		for (uint32_t z = 0; z < cells; ++z)
+		{
+			for (uint32_t y = 0; y < cells; ++y)
+			{
+				for (uint32_t x = 0; x < cells; ++x)
+				{
+					const size_t i = lattice.Index(x, y, z);
+					lattice.X[i] = HashToUnit(Hash(x, y, z, seed));
+					lattice.Y[i] = HashToUnit(Hash(x, y, z, seed + 1));
+					lattice.Z[i] = HashToUnit(Hash(x, y, z, seed + 2));
+				}
+			}
+		}
+		return lattice;
+	}
+
+	inline uint32_t Wrap(int64_t index, uint32_t period)
+	{
+		const int64_t wrapped = index % static_cast<int64_t>(period);
+		return static_cast<uint32_t>(wrapped < 0 ? wrapped + period : wrapped);
+	}
+
+	// Load one lattice value per lane, x differs per lane while y and z are shared by the whole row
+	inline VVec3 Gather(const Lattice& lattice, const uint32_t* x, uint32_t y, uint32_t z)
+	{
+		alignas(32) float gx[Width], gy[Width], gz[Width];
+		for (int i = 0; i < Width; ++i)
+		{
+			const size_t index = lattice.Index(x[i], y, z);
+			gx[i] = lattice.X[index];
+			gy[i] = lattice.Y[index];
+			gz[i] = lattice.Z[index];
+		}
+		return VVec3(VFloat::Load(gx), VFloat::Load(gy), VFloat::Load(gz));
+	}
+
+	// Lattice cell of every lane, wrapped around the period
+	inline void LatticeCells(VFloat cell, uint32_t period, int64_t offset, uint32_t* out)
+	{
+		alignas(32) float cells[Width];
+		cell.Store(cells);
+		for (int i = 0; i < Width; ++i)
+		{
+			out[i] = Wrap(static_cast<int64_t>(cells[i]) + offset, period);
+		}
+	}
+
+	inline VFloat Fade(VFloat t)
+	{
+		return t * t * t * (t * (t * VFloat(6.f) - VFloat(15.f)) + VFloat(10.f));
+	}
+
+	inline float Fade(float t)
+	{
+		return t * t * t * (t * (t * 6.f - 15.f) + 10.f);
+	}
+
+	// Periodic gradient noise in roughly [-1, 1] for a row of texels
+	VFloat Perlin(const Lattice& lattice, VFloat u, float v, float w)
+	{
+		const float period = static_cast<float>(lattice.Period);
+
+		const VFloat px = u * VFloat(period);
+		const VFloat cellX = Floor(px);
+		const VFloat fx = px - cellX;
+
+		const float py = v * period;
+		const float pz = w * period;
+		const float cellY = std::floor(py);
+		const float cellZ = std::floor(pz);
+		const float fy = py - cellY;
+		const float fz = pz - cellZ;
+
+		alignas(32) uint32_t x0[Width], x1[Width];
+		LatticeCells(cellX, lattice.Period, 0, x0);
+		LatticeCells(cellX, lattice.Period, 1, x1);
+		const uint32_t y0 = Wrap(static_cast<int64_t>(cellY), lattice.Period);
+		const uint32_t y1 = Wrap(static_cast<int64_t>(cellY) + 1, lattice.Period);
+		const uint32_t z0 = Wrap(static_cast<int64_t>(cellZ), lattice.Period);
+		const uint32_t z1 = Wrap(static_cast<int64_t>(cellZ) + 1, lattice.Period);
+
+		auto corner = [&](const uint32_t* x, uint32_t y, uint32_t z, VFloat dx, float dy, float dz)
+		{
+			return Dot(Gather(lattice, x, y, z), VVec3(dx, VFloat(dy), VFloat(dz)));
+		};
+
+		const VFloat fx1 = fx - VFloat(1.f);
+		const VFloat n000 = corner(x0, y0, z0, fx, fy, fz);
+		const VFloat n100 = corner(x1, y0, z0, fx1, fy, fz);
+		const VFloat n010 = corner(x0, y1, z0, fx, fy - 1.f, fz);
+		const VFloat n110 = corner(x1, y1, z0, fx1, fy - 1.f, fz);
+		const VFloat n001 = corner(x0, y0, z1, fx, fy, fz - 1.f);
+		const VFloat n101 = corner(x1, y0, z1, fx1, fy, fz - 1.f);
+		const VFloat n011 = corner(x0, y1, z1, fx, fy - 1.f, fz - 1.f);
+		const VFloat n111 = corner(x1, y1, z1, fx1, fy - 1.f, fz - 1.f);
+
+		const VFloat tx = Fade(fx);
+		const VFloat ty(Fade(fy));
+		const VFloat tz(Fade(fz));
+		return Mix(Mix(Mix(n000, n100, tx), Mix(n010, n110, tx), ty), Mix(Mix(n001, n101, tx), Mix(n011, n111, tx), ty), tz);
+	}
+
+	// Inverted distance to the closest feature point in [0, 1], 1 at the feature points
+	VFloat Worley(const Lattice& points, VFloat u, float v, float w)
+	{
+		const float cells = static_cast<float>(points.Period);
+
+		const VFloat px = u * VFloat(cells);
+		const VFloat cellX = Floor(px);
+		const VFloat fx = px - cellX;
+
+		const float py = v * cells;
+		const float pz = w * cells;
+		const float cellY = std::floor(py);
+		const float cellZ = std::floor(pz);
+		const float fy = py - cellY;
+		const float fz = pz - cellZ;
+
+		VFloat closest(FLT_MAX);
+		for (int64_t dz = -1; dz <= 1; ++dz)
+		{
+			const uint32_t z = Wrap(static_cast<int64_t>(cellZ) + dz, points.Period);
+			for (int64_t dy = -1; dy <= 1; ++dy)
+			{
+				const uint32_t y = Wrap(static_cast<int64_t>(cellY) + dy, points.Period);
+				for (int64_t dx = -1; dx <= 1; ++dx)
+				{
+					alignas(32) uint32_t x[Width];
+					LatticeCells(cellX, points.Period, dx, x);
+					const VVec3 point = Gather(points, x, y, z);
+					const VVec3 offset(point.x + VFloat(static_cast<float>(dx)) - fx, point.y + VFloat(static_cast<float>(dy) - fy), point.z + VFloat(static_cast<float>(dz) - fz));
+					closest = Min(closest, Dot(offset, offset));
+				}
+			}
+		}
+		return VFloat(1.f) - Clamp(Sqrt(closest), VFloat(0.f), VFloat(1.f));
+	}
+}
+
+std::string NoiseVolumeParams::Key() const
+{
+	std::stringstream key;
+	key << "r" << Resolution << "_p" << PerlinPeriod << "x" << PerlinOctaves << "_w" << WorleyCells << "_"
+		<< std::fixed << std::setprecision(3) << WorleyWeight << "_s" << Seed << "_v" << s_GeneratorVersion;
+	return key.str();
+}
+
+void NoiseVolume::LoadOrGenerate(const NoiseVolumeParams& params, const std::string& cacheDirectory)
+{
+	VKS_CPU_ZONE("NoiseVolume::LoadOrGenerate");
+	CacheFile = cacheDirectory + "volumetrics_noise_" + params.Key() + ".ktx";
+
+	const auto start = std::chrono::high_resolution_clock::now();
+	CacheHit = Load(CacheFile, params);
+	if (!CacheHit)
+	{
+		Generate(params);
+		if (!Save(CacheFile))
+		{
+			std::cerr << "Could not write the noise volume cache " << CacheFile << "\n";
+		}
+	}
+	LoadTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	std::cout << "Volumetrics noise volume " << params.Resolution << "^3: " << (CacheHit ? "cache hit, loaded" : "cache miss, generated")
+		<< " in " << std::fixed << std::setprecision(1) << LoadTime << " ms (" << CacheFile << ")\n";
+}
+
+void NoiseVolume::Generate(const NoiseVolumeParams& params, uint32_t threadCount)
+{
+	assert(params.Resolution > 0 && params.PerlinPeriod > 0 && params.WorleyCells > 0);
+
+	Params = params;
+	const uint32_t resolution = params.Resolution;
+	Texels.assign(static_cast<size_t>(resolution) * resolution * resolution, 0);
+
+	std::vector<Lattice> octaves;
+	for (uint32_t o = 0; o < std::max(params.PerlinOctaves, 1u); ++o)
+	{
+		octaves.push_back(BuildGradients(params.PerlinPeriod << o, params.Seed + o * 7919u));
+	}
+	const Lattice featurePoints = BuildFeaturePoints(params.WorleyCells, params.Seed ^ 0x5F3759DFu);
+
+	float amplitudeSum = 0.f;
+	for (uint32_t o = 0; o < octaves.size(); ++o)
+	{
+		amplitudeSum += std::pow(0.5f, static_cast<float>(o));
+	}
+
+	const float invResolution = 1.f / static_cast<float>(resolution);
+	auto generateRow = [&](uint32_t row)
+	{
+		const uint32_t y = row % resolution;
+		const uint32_t z = row / resolution;
+		const float v = (static_cast<float>(y) + 0.5f) * invResolution;
+		const float w = (static_cast<float>(z) + 0.5f) * invResolution;
+		uint8_t* out = Texels.data() + static_cast<size_t>(row) * resolution;
+
+		for (uint32_t x = 0; x < resolution; x += Width)
+		{
+			const VFloat u = (VFloat::Iota() + VFloat(static_cast<float>(x) + 0.5f)) * VFloat(invResolution);
+
+			VFloat fbm(0.f);
+			float amplitude = 1.f;
+			for (const Lattice& octave : octaves)
+			{
+				fbm = fbm + Perlin(octave, u, v, w) * VFloat(amplitude);
+				amplitude *= 0.5f;
+			}
+			const VFloat perlin01 = Clamp(fbm * VFloat(0.5f / amplitudeSum) + VFloat(0.5f), VFloat(0.f), VFloat(1.f));
+
+			// The Worley cells only ever thin out the Perlin noise, giving it billowy edges
+			const VFloat cells = Worley(featurePoints, u, v, w);
+			const VFloat value = perlin01 * (VFloat(1.f - params.WorleyWeight) + cells * VFloat(params.WorleyWeight));
+
+			alignas(32) float quantized[Width];
+			(Clamp(value, VFloat(0.f), VFloat(1.f)) * VFloat(255.f) + VFloat(0.5f)).Store(quantized);
+			for (uint32_t i = 0; i < static_cast<uint32_t>(Width) && x + i < resolution; ++i)
+			{
+				out[x + i] = static_cast<uint8_t>(quantized[i]);
+			}
+		}
+	};
+
+	// Rows are split into ranges that idle threads steal from each other
+	std::unique_ptr<vks::TaskScheduler> ownScheduler;
+	if (threadCount > 0)
+	{
+		ownScheduler.reset(new vks::TaskScheduler(std::max(threadCount, 2u) - 1));
+	}
+	vks::TaskScheduler& scheduler = ownScheduler ? *ownScheduler : vks::TaskScheduler::shared();
+	scheduler.parallelForRanges(0, resolution * resolution, 0, [&](uint32_t begin, uint32_t end)
+	{
+		VKS_CPU_ZONE("NoiseVolume::Generate rows");
+		for (uint32_t row = begin; row < end; ++row)
+		{
+			generateRow(row);
+		}
+	});
+}
+
+bool NoiseVolume::Load(const std::string& filename, const NoiseVolumeParams& params)
+{
+	ktxTexture* texture = nullptr;
+	if (ktxTexture_CreateFromNamedFile(filename.c_str(), KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT, &texture) != KTX_SUCCESS)
+	{
+		return false;
+	}
+
+	// Only accept files written with exactly the same parameters
+	const std::string key = params.Key();
+	unsigned int valueLength = 0;
+	void* value = nullptr;
+	bool matches = ktxHashList_FindValue(&texture->kvDataHead, s_KeyName, &valueLength, &value) == KTX_SUCCESS &&
+		valueLength == key.size() + 1 && memcmp(value, key.c_str(), valueLength) == 0;
+
+	const size_t texelCount = static_cast<size_t>(params.Resolution) * params.Resolution * params.Resolution;
+	matches = matches && texture->baseWidth == params.Resolution && texture->baseHeight == params.Resolution &&
+		texture->baseDepth == params.Resolution;
+
+	ktx_size_t offset = 0;
+	matches = matches && ktxTexture_GetImageOffset(texture, 0, 0, 0, &offset) == KTX_SUCCESS && ktxTexture_GetDataSize(texture) >= offset + texelCount;
+
+	if (matches)
+	{
+		const ktx_uint8_t* data = ktxTexture_GetData(texture) + offset;
+		Texels.assign(data, data + texelCount);
+		Params = params;
+	}
+
+	ktxTexture_Destroy(texture);
+	return matches;
+}
+
+bool NoiseVolume::Save(const std::string& filename) const
+{
+	// KTX 1.1 with a single R8 3D image, the rows are already 4 byte aligned as the resolution is a multiple of 4
+	assert(Params.Resolution % 4 == 0);
+
+	const std::string key = Params.Key();
+	const uint32_t keyValueSize = static_cast<uint32_t>(strlen(s_KeyName) + 1 + key.size() + 1);
+	const uint32_t keyValuePadding = (4 - keyValueSize % 4) % 4;
+
+	const uint8_t identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+	const uint32_t header[13] =
+	{
+		0x04030201,				// endianness
+		0x1401,					// glType GL_UNSIGNED_BYTE
+		1,						// glTypeSize
+		0x1903,					// glFormat GL_RED
+		0x8229,					// glInternalFormat GL_R8
+		0x1903,					// glBaseInternalFormat GL_RED
+		Params.Resolution,		// pixelWidth
+		Params.Resolution,		// pixelHeight
+		Params.Resolution,		// pixelDepth
+		0,						// numberOfArrayElements
+		1,						// numberOfFaces
+		1,						// numberOfMipmapLevels
+		4 + keyValueSize + keyValuePadding,	// bytesOfKeyValueData
+	};
+	const uint32_t imageSize = static_cast<uint32_t>(Texels.size());
+	const uint8_t padding[4] = {};
+
+	// Write to a temporary file first so an interrupted write never leaves a truncated cache behind
+	const std::string tempFilename = filename + ".tmp";
+	{
+		std::ofstream file(tempFilename, std::ios::binary);
+		file.write(reinterpret_cast<const char*>(identifier), sizeof(identifier));
+		file.write(reinterpret_cast<const char*>(header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(&keyValueSize), sizeof(keyValueSize));
+		file.write(s_KeyName, strlen(s_KeyName) + 1);
+		file.write(key.c_str(), key.size() + 1);
+		file.write(reinterpret_cast<const char*>(padding), keyValuePadding);
+		file.write(reinterpret_cast<const char*>(&imageSize), sizeof(imageSize));
+		file.write(reinterpret_cast<const char*>(Texels.data()), Texels.size());
+		if (!file)
+		{
+			file.close();
+			std::remove(tempFilename.c_str());
+			return false;
+		}
+	}
+
+	std::remove(filename.c_str());
+	return std::rename(tempFilename.c_str(), filename.c_str()) == 0;
+}
+
+float NoiseVolume::Sample(const glm::vec3& uvw) const
+{
+	const uint32_t resolution = Params.Resolution;
+	const float size = static_cast<float>(resolution);
+
+	float coord[3] = { uvw.x * size - 0.5f, uvw.y * size - 0.5f, uvw.z * size - 0.5f };
+	uint32_t texel0[3], texel1[3];
+	float weight[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const float base = std::floor(coord[axis]);
+		weight[axis] = coord[axis] - base;
+		texel0[axis] = Wrap(static_cast<int64_t>(base), resolution);
+		texel1[axis] = Wrap(static_cast<int64_t>(base) + 1, resolution);
+	}
+
+	float result = 0.f;
+	for (uint32_t corner = 0; corner < 8; ++corner)
+	{
+		const uint32_t x = (corner & 1) ? texel1[0] : texel0[0];
+		const uint32_t y = (corner & 2) ? texel1[1] : texel0[1];
+		const uint32_t z = (corner & 4) ? texel1[2] : texel0[2];
+		const float w = ((corner & 1) ? weight[0] : 1.f - weight[0]) * ((corner & 2) ? weight[1] : 1.f - weight[1]) * ((corner & 4) ? weight[2] : 1.f - weight[2]);
+		result += w * static_cast<float>(Texels[(static_cast<size_t>(z) * resolution + y) * resolution + x]);
+	}
+	return result / 255.f;
+}
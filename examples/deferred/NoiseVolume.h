@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "glm/vec3.hpp"
+
+// Settings of the noise generator, every field is part of the cache key
+struct NoiseVolumeParams
+{
+	// Texels along each axis, a multiple of 4 so the rows of the KTX file need no padding
+	uint32_t Resolution = 128;
+	// Perlin lattice cells across the volume in the first octave, doubled with every further octave
+	uint32_t PerlinPeriod = 4;
+	uint32_t PerlinOctaves = 4;
+	// Worley feature point cells across the volume
+	uint32_t WorleyCells = 6;
+	// How strongly the Worley cells carve into the Perlin noise, 0 leaves plain Perlin noise
+	float WorleyWeight = 0.6f;
+	uint32_t Seed = 1;
+
+	// Bump whenever the generator output changes so old cache files are ignored
+	static constexpr uint32_t s_GeneratorVersion = 1;
+
+	// Readable key identifying the generated volume, used in the cache file name and stored in its metadata
+	std::string Key() const;
+};
+
+// Tileable Perlin-Worley noise volume sampled by the density query with a single 3D fetch.
+// Generated on the CPU across worker threads, vectorised along x with the volumetrics SIMD wrapper, and cached on disk as
+// a single channel KTX file so later runs only have to load it.
+class NoiseVolume
+{
+public:
+	// Load the volume from the cache directory, or generate it and write it there when there's no matching file
+	void LoadOrGenerate(const NoiseVolumeParams& params, const std::string& cacheDirectory);
+
+	// A thread count of 0 runs on the shared task scheduler, which uses all hardware threads
+	void Generate(const NoiseVolumeParams& params, uint32_t threadCount = 0);
+
+	// Returns false when the file is missing or was written with other parameters
+	bool Load(const std::string& filename, const NoiseVolumeParams& params);
+
+	bool Save(const std::string& filename) const;
+
+	// Trilinear sample with repeat addressing, matches a linear VK_SAMPLER_ADDRESS_MODE_REPEAT sampler on the R8 texture
+	float Sample(const glm::vec3& uvw) const;
+
+	NoiseVolumeParams Params;
+
+	// Resolution^3 UNORM texels, x varies fastest
+	std::vector<uint8_t> Texels;
+
+	// Time spent loading or generating the volume in milliseconds
+	double LoadTime = 0.0;
+	bool CacheHit = false;
+	std::string CacheFile;
+};
@@ -1,11 +1,39 @@
 #include "Volumetrics.h"
 #include "deferred.h"
+#include "VolumetricsCPU.h"
 #include "VulkanTools.h"
 #include "VulkanInitializers.hpp"
 
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <glm/gtc/packing.hpp>
+
+// Froxel grid sizes selectable in the overlay, the last one matches the original fixed size map
+static const std::array<FroxelGridPreset, 4> s_FroxelGridPresets =
+{{
+	{ "160 x 90 x 64", 160, 90, 64 },
+	{ "320 x 180 x 128", 320, 180, 128 },
+	{ "640 x 360 x 256", 640, 360, 256 },
+	{ "640 x 360 x 512", 640, 360, 512 },
+}};
+
+// Names of the froxel storage formats, in FroxelStorageFormat order
+static const std::array<const char*, FroxelStorageCount> s_FroxelStorageNames =
+{{
+	"RGBA8",
+	"RGBA16F",
+	"B10G11R11 + density",
+	"RGB9E5 + density",
+}};
 
 void VulkanVolumetrics::Init(VulkanExample* example, vks::VulkanDevice* device, Camera* camera, VkQueue* pQueue)
 {
+	VKS_CPU_ZONE("VulkanVolumetrics::Init");
+
 	// Store a member pointer to the device
 	pDevice = device;
 	pExampleBase = example;
@@ -15,24 +43,24 @@ void VulkanVolumetrics::Init(VulkanExample* example, vks::VulkanDevice* device,
 	YWindSpeed = 0.7f;
 	ZWindSpeed = -0.1f;
 
-	FogShapesData.Spheres[0].Pos = glm::vec3(1.25f, 5.4f, -2.01f);
-	FogShapesData.Spheres[0].Radius = 2.9f;
-	FogShapesData.Spheres[1].Pos = glm::vec3(-0.8f, 2.5f, -1.25f);
-	FogShapesData.Spheres[1].Radius = 3.5f;
-	FogShapesData.Spheres[2].Pos = glm::vec3(0.f, -2.5f, -2.f);
-	FogShapesData.Spheres[2].Radius = 4.f;
-
-	// Create the memory buffer for the sphere volume
+	FogShapesData.Primitives =
 	{
-		device->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &FogShapesBuff, sizeof(FogShapes), (void*)&FogShapesData);
-	}
+		{ glm::vec3(1.25f, 5.4f, -2.01f), 2.9f, glm::vec3(0.f), FogPrimitiveSphere },
+		{ glm::vec3(-0.8f, 2.5f, -1.25f), 3.5f, glm::vec3(0.f), FogPrimitiveSphere },
+		{ glm::vec3(0.f, -2.5f, -2.f), 4.f, glm::vec3(0.f), FogPrimitiveSphere },
+	};
 
 	VolumetricsData.Near = pCamera->getNearClip();
 	VolumetricsData.Far = pCamera->getFarClip();
 	VolumetricsData.Albedo = glm::vec3(0.8f, 0.8f, 0.8f);
-	VolumetricsData.InitialStepSize = 0.025f;
+	// Slices cover 12.8 units of depth at the default 128 slice grid
+	VolumetricsData.InitialStepSize = 0.1f;
 	VolumetricsData.StepFallOff = 0.00f;
+	// The exponential slices cover the same depth as the quadratic ones at the default grid, putting more of them close
+	// to the camera so fewer are needed
+	VolumetricsData.SliceDistribution = SliceDistributionExponential;
+	VolumetricsData.SliceFar = 16.f;
+	VolumetricsData.SliceCurvature = 3.f;
 	VolumetricsData.LightMarchSize = 0.2f;
 	VolumetricsData.Absorption = 0.5f;
 	VolumetricsData.Density = 0.8f;
@@ -46,19 +74,105 @@ void VulkanVolumetrics::Init(VulkanExample* example, vks::VulkanDevice* device,
 	VolumetricsData.NoiseZOffset = 0.0f;
 	VolumetricsData.NoiseFactor = 1.5f;
 	VolumetricsData.SmoothFactor = 0.9f;
-	VolumetricsData.MapHeight = 360;
-	VolumetricsData.MapWidth = 640;
-	VolumetricsData.MapDepth = 16 * 16 * 2;
+	VolumetricsData.MapHeight = s_FroxelGridPresets[FroxelPresetIndex].Height;
+	VolumetricsData.MapWidth = s_FroxelGridPresets[FroxelPresetIndex].Width;
+	VolumetricsData.MapDepth = s_FroxelGridPresets[FroxelPresetIndex].Depth;
+	VolumetricsData.StorageFormat = FroxelStorageRGBA8;
+
+	// Find the storage formats the device can write from the first stage and filter in the second
+	{
+		auto Supports = [&](VkFormat Format, VkFormatFeatureFlags Features)
+		{
+			VkFormatProperties Properties;
+			vkGetPhysicalDeviceFormatProperties(pDevice->physicalDevice, Format, &Properties);
+			return (Properties.optimalTilingFeatures & Features) == Features;
+		};
+		const VkFormatFeatureFlags FilteredStorage = VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+		FroxelDensityFormat = Supports(VK_FORMAT_R16_UNORM, FilteredStorage) ? VK_FORMAT_R16_UNORM : VK_FORMAT_R8_UNORM;
+		const bool DensitySupported = Supports(FroxelDensityFormat, FilteredStorage);
+		// RGBA8 has a first stage with format qualified images, the other formats are written through format-less ones
+		const bool FormatlessWrites = pDevice->enabledFeatures.shaderStorageImageWriteWithoutFormat == VK_TRUE;
+
+		FroxelStorageSupported[FroxelStorageRGBA8] = true;
+		FroxelStorageSupported[FroxelStorageRGBA16F] = FormatlessWrites && Supports(VK_FORMAT_R16G16B16A16_SFLOAT, FilteredStorage);
+		FroxelStorageSupported[FroxelStorageB10G11R11] = FormatlessWrites && Supports(VK_FORMAT_B10G11R11_UFLOAT_PACK32, FilteredStorage) && DensitySupported;
+		FroxelStorageSupported[FroxelStorageRGB9E5] = FormatlessWrites && DensitySupported;
+	}
+
+	// Create the memory buffers for the fog primitives and the grid over them, sized by the grid's smooth factor
+	UploadFogShapes();
 
 	// Create memory buffer for the volumetrics info
 	{
-		device->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &VolumetricsBuff, sizeof(VolumetricsInfo), (void*)&VolumetricsData);
+		for (vks::Buffer& Buffer : VolumetricsBuffs)
+		{
+			device->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &Buffer, sizeof(VolumetricsInfo), (void*)&VolumetricsData);
+		}
+	}
+
+	// Create memory buffer for the per frame camera info
+	{
+		FrameData.InvViewProj = glm::inverse(pCamera->matrices.perspective * pCamera->matrices.view);
+		FrameData.PrevViewProj = glm::mat4(1.0f);
+		FrameData.PrevViewPos = glm::vec4(0.0f);
+		FrameData.DepthJitter = 0.0f;
+		FrameData.HistoryBlend = 0.1f;
+		FrameData.HistoryValid = 0;
+		FrameData.LightLimit = VolumetricsQualityLevel::s_AllLights;
+		for (vks::Buffer& Buffer : FrameBuffs)
+		{
+			device->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &Buffer, sizeof(VolumetricsFrameInfo), (void*)&FrameData);
+		}
+	}
+
+	// Create memory buffer for the transmittance volume info
+	{
+		TransmittanceData.Resolution = s_TransmittanceResolution;
+		TransmittanceData.Enabled = 1;
+		TransmittanceData.LightCount = 0;
+		UpdateTransmittanceInfo();
+		for (vks::Buffer& Buffer : TransmittanceBuffs)
+		{
+			device->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &Buffer, sizeof(TransmittanceInfo), (void*)&TransmittanceData);
+		}
+	}
+
+	// Create the memory buffers for the fog lights and the per cluster light lists written by the culling pass
+	{
+		UpdateFogLights();
+		for (vks::Buffer& Buffer : FogLightsBuffs)
+		{
+			device->createBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &Buffer, sizeof(FogLightsInfo) + s_MaxFogLights * sizeof(FogLight));
+		}
+
+		// Sized for the largest grid, smaller grids get more room per cluster
+		VkDeviceSize MaxClusterCount = 0;
+		for (const FroxelGridPreset& Preset : s_FroxelGridPresets)
+		{
+			const VkDeviceSize ClusterCount = static_cast<VkDeviceSize>((Preset.Width + s_ClusterSize - 1) / s_ClusterSize) *
+				((Preset.Height + s_ClusterSize - 1) / s_ClusterSize) * ((Preset.Depth + s_ClusterSize - 1) / s_ClusterSize);
+			MaxClusterCount = std::max(MaxClusterCount, ClusterCount);
+		}
+		const VkDeviceSize ClusterLightsSize = sizeof(ClusterLightsInfo) + MaxClusterCount * (2 + s_ClusterLightBudget) * sizeof(uint32_t);
+		VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &ClusterLightsBuff, ClusterLightsSize));
+		ClusterLightsInfo NoCounters{};
+		VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &ClusterCountersBuff, sizeof(ClusterLightsInfo), &NoCounters));
 	}
 
-	// Create memory buffer for the perlin noise, Setting the Sampler Address mode to mirrored repeat
+	// Load the noise volume from the cache in the working directory or generate it, it tiles so it's sampled with repeat.
+	// Only the compute passes sample it, so the upload hands it over to the compute queue family
 	{
-		PerlinNoise.loadFromFileCustomAddressMode(getAssetPath() + "Volumetrics/PerlinNoise512.ktx", VK_FORMAT_R8G8B8A8_UNORM, pDevice, *pQueue, VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT);
+		NoiseData.LoadOrGenerate(NoiseVolumeParams(), "");
+		const uint32_t Resolution = NoiseData.Params.Resolution;
+		NoiseTexture.fromBuffer(NoiseData.Texels.data(), NoiseData.Texels.size(), VK_FORMAT_R8_UNORM, Resolution, Resolution, Resolution, pDevice, *pQueue,
+			VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_REPEAT, VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, pDevice->queueFamilyIndices.compute);
 	}
 
 	PrepareTextures();
@@ -67,8 +181,20 @@ void VulkanVolumetrics::Init(VulkanExample* example, vks::VulkanDevice* device,
 
 	PreparePipelines();
 
+	// Timestamps for the scaling benchmark, only available if the compute queue supports them
+	if (pDevice->queueFamilyProperties[pDevice->queueFamilyIndices.compute].timestampValidBits != 0)
+	{
+		VkQueryPoolCreateInfo QueryPoolInfo{};
+		QueryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		QueryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		QueryPoolInfo.queryCount = s_BenchmarkQueryCount;
+		VK_CHECK_RESULT(vkCreateQueryPool(*pDevice, &QueryPoolInfo, nullptr, &TimestampQueryPool));
+	}
+
 	BuildCommandBuffers();
 
+	Governor.Reset(GovernorLevelForPreset(FroxelPresetIndex));
+
 	// Prepare common submit info parameters for later
 	SubmitInfo = vks::initializers::submitInfo();
 	SubmitInfo.pWaitDstStageMask = &SubmitStageFlag;
@@ -81,59 +207,62 @@ void VulkanVolumetrics::PrepareTextures()
 	// Get the compute queue for the device
 	vkGetDeviceQueue(*pDevice, pDevice->queueFamilyIndices.compute, 0, &ComputeQueue);
 
-	// Create 3D Texture Buffer for the first stage compute output
+	for (FroxelVolume& Volume : FirstStageTextures)
+	{
+		PrepareFroxelVolume(Volume);
+	}
+	PrepareFroxelTexture(DummyPackedTexture, VK_FORMAT_R32_UINT, { 1, 1, 1 });
+
+	// Create 3D Texture Buffer for the per light transmittance volumes, stacked along z
 	{
-		FirstStageTexture.device = pDevice;
+		TransmittanceTexture.device = pDevice;
 
 		VkImageCreateInfo ImageCreateInfo = vks::initializers::imageCreateInfo();
 		ImageCreateInfo.imageType = VK_IMAGE_TYPE_3D;
-		ImageCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
-		// Set width and height to match screen size for now
-		FirstStageTexture.width = VolumetricsData.MapWidth;
-		ImageCreateInfo.extent.width = FirstStageTexture.width;
-		FirstStageTexture.height = VolumetricsData.MapHeight;
-		ImageCreateInfo.extent.height = FirstStageTexture.height;
-		// Set depth to be equal to the number of max steps
-		ImageCreateInfo.extent.depth = VolumetricsData.MapDepth;
+		ImageCreateInfo.format = VK_FORMAT_R32_SFLOAT;
+		TransmittanceTexture.width = s_TransmittanceResolution;
+		ImageCreateInfo.extent.width = TransmittanceTexture.width;
+		TransmittanceTexture.height = s_TransmittanceResolution;
+		ImageCreateInfo.extent.height = TransmittanceTexture.height;
+		ImageCreateInfo.extent.depth = s_TransmittanceResolution * s_MaxTransmittanceLights;
 		ImageCreateInfo.mipLevels = 1;
 		ImageCreateInfo.arrayLayers = 1;
 		ImageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 		ImageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-		ImageCreateInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+		ImageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
 
-		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
-		VkMemoryRequirements memReqs;
-
-		VK_CHECK_RESULT(vkCreateImage(*pDevice, &ImageCreateInfo, nullptr, &FirstStageTexture.image));
-		vkGetImageMemoryRequirements(*pDevice, FirstStageTexture.image, &memReqs);
-		memAlloc.allocationSize = memReqs.size;
-		memAlloc.memoryTypeIndex = pDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(*pDevice, &memAlloc, nullptr, &FirstStageTexture.deviceMemory));
-		VK_CHECK_RESULT(vkBindImageMemory(*pDevice, FirstStageTexture.image, FirstStageTexture.deviceMemory, 0));
+		VK_CHECK_RESULT(vkCreateImage(*pDevice, &ImageCreateInfo, nullptr, &TransmittanceTexture.image));
+		VK_CHECK_RESULT(pDevice->allocator.allocateImage(TransmittanceTexture.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &TransmittanceTexture.allocation));
+		TransmittanceTexture.deviceMemory = TransmittanceTexture.allocation.memory;
 
 		VkCommandBuffer layoutCmd = pDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-		FirstStageTexture.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-		vks::tools::setImageLayout(layoutCmd, FirstStageTexture.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, FirstStageTexture.imageLayout);
+		TransmittanceTexture.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+		vks::tools::setImageLayout(layoutCmd, TransmittanceTexture.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, TransmittanceTexture.imageLayout);
 		pDevice->flushCommandBuffer(layoutCmd, pExampleBase->queue, true);
 
 		VkImageViewCreateInfo imageView = vks::initializers::imageViewCreateInfo();
 		imageView.viewType = VK_IMAGE_VIEW_TYPE_3D;
-		imageView.format = VK_FORMAT_R8G8B8A8_UNORM;
+		imageView.format = VK_FORMAT_R32_SFLOAT;
 		imageView.subresourceRange = {};
 		imageView.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 		imageView.subresourceRange.baseMipLevel = 0;
 		imageView.subresourceRange.levelCount = 1;
 		imageView.subresourceRange.baseArrayLayer = 0;
 		imageView.subresourceRange.layerCount = 1;
-		imageView.image = FirstStageTexture.image;
-		VK_CHECK_RESULT(vkCreateImageView(*pDevice, &imageView, nullptr, &FirstStageTexture.view));
+		imageView.image = TransmittanceTexture.image;
+		VK_CHECK_RESULT(vkCreateImageView(*pDevice, &imageView, nullptr, &TransmittanceTexture.view));
 
-		// Create a sampler for second stage to use
+		// Linear filtering of 32 bit float formats is optional, fall back to nearest where it isn't supported
+		VkFormatProperties FormatProperties;
+		vkGetPhysicalDeviceFormatProperties(pDevice->physicalDevice, VK_FORMAT_R32_SFLOAT, &FormatProperties);
+		const VkFilter Filter = (FormatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+
+		// Create a sampler for the first stage to use
 		VkSamplerCreateInfo samplerci = vks::initializers::samplerCreateInfo();
-		samplerci.magFilter = VK_FILTER_NEAREST;
-		samplerci.minFilter = VK_FILTER_NEAREST;
-		samplerci.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-		samplerci.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+		samplerci.magFilter = Filter;
+		samplerci.minFilter = Filter;
+		samplerci.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		samplerci.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
 		samplerci.addressModeV = samplerci.addressModeU;
 		samplerci.addressModeW = samplerci.addressModeU;
 		samplerci.mipLodBias = 0.0f;
@@ -141,42 +270,38 @@ void VulkanVolumetrics::PrepareTextures()
 		samplerci.minLod = 0.0f;
 		samplerci.maxLod = 1.0f;
 		samplerci.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
-		VK_CHECK_RESULT(vkCreateSampler(*pDevice, &samplerci, nullptr, &FirstStageTexture.sampler));
+		VK_CHECK_RESULT(vkCreateSampler(*pDevice, &samplerci, nullptr, &TransmittanceTexture.sampler));
 
-		FirstStageTexture.descriptor = vks::initializers::descriptorImageInfo(
-			FirstStageTexture.sampler,
-			FirstStageTexture.view,
-			VK_IMAGE_LAYOUT_GENERAL); // TODO: Check if this is optimal
+		TransmittanceTexture.descriptor = vks::initializers::descriptorImageInfo(
+			TransmittanceTexture.sampler,
+			TransmittanceTexture.view,
+			VK_IMAGE_LAYOUT_GENERAL);
 	}
 
-	// Create 2D Texture Buffer for second stage compute output
+	// Create 2D Texture Buffers for second stage compute output, one per frame slot
+	for (vks::Texture& SecondStageTexture : SecondStageTextures)
 	{
 		SecondStageTexture.device = pDevice;
 
 		VkImageCreateInfo ImageCreateInfo = vks::initializers::imageCreateInfo();
 		ImageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
 		ImageCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
-		// Set width and height to match screen size for now
-		SecondStageTexture.width = VolumetricsData.MapWidth;
+		// Set width and height to match screen size so the froxel grid is resolved per output pixel
+		SecondStageTexture.width = pExampleBase->width;
 		ImageCreateInfo.extent.width = SecondStageTexture.width;
-		SecondStageTexture.height = VolumetricsData.MapHeight;
+		SecondStageTexture.height = pExampleBase->height;
 		ImageCreateInfo.extent.height = SecondStageTexture.height;
 		ImageCreateInfo.extent.depth = 1;
 		ImageCreateInfo.mipLevels = 1;
 		ImageCreateInfo.arrayLayers = 1;
 		ImageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 		ImageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-		ImageCreateInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
-
-		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
-		VkMemoryRequirements memReqs;
+		ImageCreateInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		// Written on the compute queue and read by the lighting pass on the graphics queue, which it's handed over to every frame
 
 		VK_CHECK_RESULT(vkCreateImage(*pDevice, &ImageCreateInfo, nullptr, &SecondStageTexture.image));
-		vkGetImageMemoryRequirements(*pDevice, SecondStageTexture.image, &memReqs);
-		memAlloc.allocationSize = memReqs.size;
-		memAlloc.memoryTypeIndex = pDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(*pDevice, &memAlloc, nullptr, &SecondStageTexture.deviceMemory));
-		VK_CHECK_RESULT(vkBindImageMemory(*pDevice, SecondStageTexture.image, SecondStageTexture.deviceMemory, 0));
+		VK_CHECK_RESULT(pDevice->allocator.allocateImage(SecondStageTexture.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &SecondStageTexture.allocation));
+		SecondStageTexture.deviceMemory = SecondStageTexture.allocation.memory;
 
 		VkCommandBuffer layoutCmd = pDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
 		SecondStageTexture.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
@@ -197,10 +322,10 @@ void VulkanVolumetrics::PrepareTextures()
 
 		// Create a sampler for the lighting pass fragment shader to use
 		VkSamplerCreateInfo samplerci = vks::initializers::samplerCreateInfo();
-		samplerci.magFilter = VK_FILTER_NEAREST;
-		samplerci.minFilter = VK_FILTER_NEAREST;
+		samplerci.magFilter = VK_FILTER_LINEAR;
+		samplerci.minFilter = VK_FILTER_LINEAR;
 		samplerci.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-		samplerci.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+		samplerci.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
 		samplerci.addressModeV = samplerci.addressModeU;
 		samplerci.addressModeW = samplerci.addressModeU;
 		samplerci.mipLodBias = 0.0f;
@@ -218,46 +343,225 @@ void VulkanVolumetrics::PrepareTextures()
 
 }
 
+VkDeviceSize VulkanVolumetrics::PrepareFroxelTexture(vks::Texture& Texture, VkFormat Format, VkExtent3D Extent)
+{
+	Texture.device = pDevice;
+
+	VkImageCreateInfo ImageCreateInfo = vks::initializers::imageCreateInfo();
+	ImageCreateInfo.imageType = VK_IMAGE_TYPE_3D;
+	ImageCreateInfo.format = Format;
+	// x and y of the froxel grid map to screen space, independent of the output resolution
+	Texture.width = Extent.width;
+	ImageCreateInfo.extent.width = Texture.width;
+	Texture.height = Extent.height;
+	ImageCreateInfo.extent.height = Texture.height;
+	// Each depth slice is one step along the view ray
+	ImageCreateInfo.extent.depth = Extent.depth;
+	ImageCreateInfo.mipLevels = 1;
+	ImageCreateInfo.arrayLayers = 1;
+	ImageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	ImageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	ImageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+	VK_CHECK_RESULT(vkCreateImage(*pDevice, &ImageCreateInfo, nullptr, &Texture.image));
+	VK_CHECK_RESULT(pDevice->allocator.allocateImage(Texture.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &Texture.allocation));
+	Texture.deviceMemory = Texture.allocation.memory;
+
+	VkCommandBuffer layoutCmd = pDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	Texture.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	vks::tools::setImageLayout(layoutCmd, Texture.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, Texture.imageLayout);
+	pDevice->flushCommandBuffer(layoutCmd, pExampleBase->queue, true);
+
+	VkImageViewCreateInfo imageView = vks::initializers::imageViewCreateInfo();
+	imageView.viewType = VK_IMAGE_VIEW_TYPE_3D;
+	imageView.format = Format;
+	imageView.subresourceRange = {};
+	imageView.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	imageView.subresourceRange.baseMipLevel = 0;
+	imageView.subresourceRange.levelCount = 1;
+	imageView.subresourceRange.baseArrayLayer = 0;
+	imageView.subresourceRange.layerCount = 1;
+	imageView.image = Texture.image;
+	VK_CHECK_RESULT(vkCreateImageView(*pDevice, &imageView, nullptr, &Texture.view));
+
+	// Create a sampler for second stage to use, filtering linearly between froxels so the grid can be coarser than the output.
+	// Integer formats can't be filtered, the shaders filter the packed grid themselves.
+	const VkFilter Filter = (Format == VK_FORMAT_R32_UINT) ? VK_FILTER_NEAREST : VK_FILTER_LINEAR;
+	VkSamplerCreateInfo samplerci = vks::initializers::samplerCreateInfo();
+	samplerci.magFilter = Filter;
+	samplerci.minFilter = Filter;
+	samplerci.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerci.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerci.addressModeV = samplerci.addressModeU;
+	samplerci.addressModeW = samplerci.addressModeU;
+	samplerci.mipLodBias = 0.0f;
+	samplerci.maxAnisotropy = 1.0f;
+	samplerci.minLod = 0.0f;
+	samplerci.maxLod = 1.0f;
+	samplerci.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+	VK_CHECK_RESULT(vkCreateSampler(*pDevice, &samplerci, nullptr, &Texture.sampler));
+
+	Texture.descriptor = vks::initializers::descriptorImageInfo(
+		Texture.sampler,
+		Texture.view,
+		VK_IMAGE_LAYOUT_GENERAL); // TODO: Check if this is optimal
+
+	return Texture.allocation.size;
+}
+
+void VulkanVolumetrics::PrepareFroxelVolume(FroxelVolume& Volume)
+{
+	const VkExtent3D Extent = { VolumetricsData.MapWidth, VolumetricsData.MapHeight, VolumetricsData.MapDepth };
+
+	VkFormat ColourFormat = VK_FORMAT_R8G8B8A8_UNORM;
+	switch (VolumetricsData.StorageFormat)
+	{
+	case FroxelStorageRGBA16F:
+		ColourFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+		break;
+	case FroxelStorageB10G11R11:
+		ColourFormat = VK_FORMAT_B10G11R11_UFLOAT_PACK32;
+		break;
+	case FroxelStorageRGB9E5:
+		ColourFormat = VK_FORMAT_R32_UINT;
+		break;
+	default:
+		break;
+	}
+
+	FroxelMemorySize += PrepareFroxelTexture(Volume.Colour, ColourFormat, Extent);
+	if (VolumetricsData.StorageFormat == FroxelStorageB10G11R11 || VolumetricsData.StorageFormat == FroxelStorageRGB9E5)
+	{
+		FroxelMemorySize += PrepareFroxelTexture(Volume.Density, FroxelDensityFormat, Extent);
+	}
+}
+
+void VulkanVolumetrics::DestroyFroxelVolume(FroxelVolume& Volume)
+{
+	Volume.Colour.destroy();
+	if (Volume.Density.image != VK_NULL_HANDLE)
+	{
+		Volume.Density.destroy();
+	}
+	Volume = FroxelVolume();
+}
+
+std::vector<uint32_t> VulkanVolumetrics::ReadbackFroxels(const FroxelVolume& Volume)
+{
+	const VkExtent3D Extent = { VolumetricsData.MapWidth, VolumetricsData.MapHeight, VolumetricsData.MapDepth };
+	const size_t TexelCount = static_cast<size_t>(Extent.width) * Extent.height * Extent.depth;
+
+	std::vector<uint32_t> Froxels(TexelCount);
+	if (VolumetricsData.StorageFormat == FroxelStorageRGBA8)
+	{
+		pDevice->copyImageToHost(Volume.Colour.image, Volume.Colour.imageLayout, Extent, sizeof(uint32_t), pExampleBase->queue, Froxels.data());
+		return Froxels;
+	}
+
+	if (VolumetricsData.StorageFormat == FroxelStorageRGBA16F)
+	{
+		std::vector<glm::uint64> Halves(TexelCount);
+		pDevice->copyImageToHost(Volume.Colour.image, Volume.Colour.imageLayout, Extent, sizeof(glm::uint64), pExampleBase->queue, Halves.data());
+		for (size_t i = 0; i < TexelCount; ++i)
+		{
+			Froxels[i] = glm::packUnorm4x8(glm::unpackHalf4x16(Halves[i]));
+		}
+		return Froxels;
+	}
+
+	// The split formats keep the density in its own texture
+	std::vector<uint32_t> Colours(TexelCount);
+	pDevice->copyImageToHost(Volume.Colour.image, Volume.Colour.imageLayout, Extent, sizeof(uint32_t), pExampleBase->queue, Colours.data());
+
+	std::vector<float> Densities(TexelCount);
+	if (FroxelDensityFormat == VK_FORMAT_R16_UNORM)
+	{
+		std::vector<uint16_t> Texels(TexelCount);
+		pDevice->copyImageToHost(Volume.Density.image, Volume.Density.imageLayout, Extent, sizeof(uint16_t), pExampleBase->queue, Texels.data());
+		std::transform(Texels.begin(), Texels.end(), Densities.begin(), [](uint16_t Texel) { return Texel / 65535.0f; });
+	}
+	else
+	{
+		std::vector<uint8_t> Texels(TexelCount);
+		pDevice->copyImageToHost(Volume.Density.image, Volume.Density.imageLayout, Extent, sizeof(uint8_t), pExampleBase->queue, Texels.data());
+		std::transform(Texels.begin(), Texels.end(), Densities.begin(), [](uint8_t Texel) { return Texel / 255.0f; });
+	}
+
+	for (size_t i = 0; i < TexelCount; ++i)
+	{
+		// B10G11R11 has red in the low bits, the same order glm unpacks it in. The shaders pack RGB9E5 in the same layout
+		// as E5B9G9R9.
+		const glm::vec3 Colour = (VolumetricsData.StorageFormat == FroxelStorageB10G11R11) ? glm::unpackF2x11_1x10(Colours[i]) : glm::unpackF3x9_E1x5(Colours[i]);
+		Froxels[i] = glm::packUnorm4x8(glm::vec4(Colour, Densities[i]));
+	}
+	return Froxels;
+}
+
 void VulkanVolumetrics::PrepareDescriptors()
 {
 	// Create a descriptor pool for the compute stages
 	{
 		std::vector<VkDescriptorPoolSize> poolSizes = {
-			//Scene info, Scene Fog & Volumetrics info
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4),
-			// Noise texture sampler for the first stage, and 3D frustrum texture sampler for the second stage
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2),
-			// Output 3D texture from the first compute stage, and the 2d texture output for the second
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 4)
+			// Scene info, Volumetrics info, Frame info & Transmittance info for the first stage and the fused kernel, Volumetrics
+			// & Scene info for the second, Scene info, Volumetrics info & Transmittance info for the transmittance pass and
+			// Volumetrics info, Frame info & Scene info for the light culling pass, for both frame slots
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 32),
+			// Fog primitives, grid, lights and cluster light lists for the first stage and the fused kernel, the primitives and
+			// grid for the transmittance pass and the lights and cluster light lists for the light culling pass, for both frame
+			// slots
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 24),
+			// Noise texture, history and transmittance samplers for the first stage, froxel grid and position samplers for the
+			// second stage, the fog texture sampler for the lighting pass and the noise texture for the transmittance pass. The
+			// history density and packed samplers of the first stage and the density and packed samplers of the second stage.
+			// The noise, position and transmittance samplers of the fused kernel. All for both frame slots.
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 28),
+			// Output 3D colour, density and packed textures from the first compute stage, the 2d texture output for the second
+			// and the fused kernel and the transmittance volume, for both frame slots
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 12)
 		};
 
-		VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, static_cast<uint32_t>(poolSizes.size())); // MAX SETS MAY NEED CHANGING
+		// One set per frame slot for each compute stage, the fused kernel, the lighting pass, the transmittance pass and light
+		// culling
+		VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, 6 * s_FrameSlots);
 		VK_CHECK_RESULT(vkCreateDescriptorPool(pDevice->logicalDevice, &descriptorPoolInfo, nullptr, &DescPool));
 	}
 
 	//-------------------------------------------------------------------------------------------------------------------------------------------------------------
 	// Descriptor Set layouts and Descriptor sets for the first compute stage
 	{
-		// Image descriptors for the offscreen color attachments
-		VkDescriptorImageInfo PositionDesciptor =
-			vks::initializers::descriptorImageInfo(
-				pExampleBase->colorSampler,
-				pExampleBase->offScreenFrameBuf.position.view,
-				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
 		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
 			// Scene Info
 			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0, 1),
-			// Fog Shape
-			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 1),
+			// Fog Primitives
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 1),
 			// Volumetrics Info
 			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2, 1),
-			// Perlin Noise sampler
+			// Noise volume sampler
 			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 3, 1),
-			// Position sampler
-			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 4, 1),
+			// Frame info
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 4, 1),
 			// 3D Output texture
-			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 5, 1)
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 5, 1),
+			// History sampler, the output of the previous frame
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 6, 1),
+			// Transmittance Info
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 7, 1),
+			// Transmittance sampler
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 8, 1),
+			// Fog Grid
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 9, 1),
+			// 3D density output texture of the split storage formats
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 10, 1),
+			// 3D packed output texture of the shared exponent storage format
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 11, 1),
+			// History density sampler
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 12, 1),
+			// History packed sampler
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 13, 1),
+			// Fog lights
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 14, 1),
+			// Cluster light lists
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 15, 1)
 		};
 
 		VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(), static_cast<uint32_t>(setLayoutBindings.size()));
@@ -267,22 +571,27 @@ void VulkanVolumetrics::PrepareDescriptors()
 		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo(&ComputePipelines[0].DescSetLayout, 1);
 		VK_CHECK_RESULT(vkCreatePipelineLayout(pDevice->logicalDevice, &pipelineLayoutCreateInfo, nullptr, &ComputePipelines[0].PipelineLayout));
 
-		VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(DescPool, &ComputePipelines[0].DescSetLayout, 1);
-		VK_CHECK_RESULT(vkAllocateDescriptorSets(pDevice->logicalDevice, &allocInfo, &ComputePipelines[0].DescSet));
-
-
-		std::vector<VkWriteDescriptorSet> writeDescriptorSets =
+		for (uint32_t i = 0; i < s_FrameSlots; ++i)
 		{
-			vks::initializers::writeDescriptorSet(ComputePipelines[0].DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &pExampleBase->uniformBuffers.composition.descriptor),
-			vks::initializers::writeDescriptorSet(ComputePipelines[0].DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, &FogShapesBuff.descriptor),
-			vks::initializers::writeDescriptorSet(ComputePipelines[0].DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2, &VolumetricsBuff.descriptor),
-			vks::initializers::writeDescriptorSet(ComputePipelines[0].DescSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3, &PerlinNoise.descriptor),
-			vks::initializers::writeDescriptorSet(ComputePipelines[0].DescSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4, &PositionDesciptor),
-			vks::initializers::writeDescriptorSet(ComputePipelines[0].DescSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 5, &FirstStageTexture.descriptor)
-		};
-
-		vkUpdateDescriptorSets(pDevice->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()),
-			writeDescriptorSets.data(), 0, nullptr);
+			VkDescriptorSet& DescSet = ComputePipelines[0].DescSets[i];
+			VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(DescPool, &ComputePipelines[0].DescSetLayout, 1);
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(pDevice->logicalDevice, &allocInfo, &DescSet));
+
+			std::vector<VkWriteDescriptorSet> writeDescriptorSets =
+			{
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &pExampleBase->uniformBuffers[i].composition.descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2, &VolumetricsBuffs[i].descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3, &NoiseTexture.descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &FrameBuffs[i].descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 7, &TransmittanceBuffs[i].descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 8, &TransmittanceTexture.descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 14, &FogLightsBuffs[i].descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 15, &ClusterLightsBuff.descriptor)
+			};
+
+			vkUpdateDescriptorSets(pDevice->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()),
+				writeDescriptorSets.data(), 0, nullptr);
+		}
 	}
 
 	//-------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -291,9 +600,17 @@ void VulkanVolumetrics::PrepareDescriptors()
 		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
 			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0, 1),
 			// 3D texture from previous compute stage
-			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 1, 1),
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 1),
 			// 2D Texture output
 			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 2, 1),
+			// Position sampler
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 3, 1),
+			// Scene Info
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 4, 1),
+			// Density from the previous compute stage for the split storage formats
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 5, 1),
+			// Packed texture from the previous compute stage for the shared exponent storage format
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 6, 1),
 		};
 
 		VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(), static_cast<uint32_t>(setLayoutBindings.size()));
@@ -303,19 +620,193 @@ void VulkanVolumetrics::PrepareDescriptors()
 		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo(&ComputePipelines[1].DescSetLayout, 1);
 		VK_CHECK_RESULT(vkCreatePipelineLayout(pDevice->logicalDevice, &pipelineLayoutCreateInfo, nullptr, &ComputePipelines[1].PipelineLayout));
 
-		VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(DescPool, &ComputePipelines[1].DescSetLayout, 1);
-		VK_CHECK_RESULT(vkAllocateDescriptorSets(pDevice->logicalDevice, &allocInfo, &ComputePipelines[1].DescSet));
+		for (uint32_t i = 0; i < s_FrameSlots; ++i)
+		{
+			VkDescriptorSet& DescSet = ComputePipelines[1].DescSets[i];
+			VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(DescPool, &ComputePipelines[1].DescSetLayout, 1);
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(pDevice->logicalDevice, &allocInfo, &DescSet));
+
+			// Image descriptor for the frame slot's offscreen position attachment
+			VkDescriptorImageInfo PositionDesciptor =
+				vks::initializers::descriptorImageInfo(
+					pExampleBase->colorSampler,
+					pExampleBase->offScreenFrameBuf.slots[i].position.view,
+					VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+			std::vector<VkWriteDescriptorSet> writeDescriptorSets =
+			{
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &VolumetricsBuffs[i].descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2 ,&SecondStageTextures[i].descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3, &PositionDesciptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &pExampleBase->uniformBuffers[i].composition.descriptor)
+			};
+
+			vkUpdateDescriptorSets(pDevice->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()),
+				writeDescriptorSets.data(), 0, nullptr);
+		}
+	}
+
+	//-------------------------------------------------------------------------------------------------------------------------------------------------------------
+	// Descriptor Set layouts and Descriptor sets for the fused kernel
+	{
+		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+			// Scene Info
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0, 1),
+			// Fog Primitives
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 1),
+			// Volumetrics Info
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2, 1),
+			// Noise volume sampler
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 3, 1),
+			// Frame info
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 4, 1),
+			// 2D Texture output
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 5, 1),
+			// Position sampler
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 6, 1),
+			// Transmittance Info
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 7, 1),
+			// Transmittance sampler
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 8, 1),
+			// Fog Grid
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 9, 1),
+			// Fog lights
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 10, 1),
+			// Cluster light lists
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 11, 1)
+		};
+
+		VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(), static_cast<uint32_t>(setLayoutBindings.size()));
+
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(pDevice->logicalDevice, &descriptorSetLayoutCI, nullptr, &FusedPipeline.DescSetLayout));
 
+		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo(&FusedPipeline.DescSetLayout, 1);
+		VK_CHECK_RESULT(vkCreatePipelineLayout(pDevice->logicalDevice, &pipelineLayoutCreateInfo, nullptr, &FusedPipeline.PipelineLayout));
 
-		std::vector<VkWriteDescriptorSet> writeDescriptorSets =
+		for (uint32_t i = 0; i < s_FrameSlots; ++i)
 		{
-			vks::initializers::writeDescriptorSet(ComputePipelines[1].DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &VolumetricsBuff.descriptor),
-			vks::initializers::writeDescriptorSet(ComputePipelines[1].DescSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, &FirstStageTexture.descriptor),
-			vks::initializers::writeDescriptorSet(ComputePipelines[1].DescSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2 ,&SecondStageTexture.descriptor)
+			VkDescriptorSet& DescSet = FusedPipeline.DescSets[i];
+			VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(DescPool, &FusedPipeline.DescSetLayout, 1);
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(pDevice->logicalDevice, &allocInfo, &DescSet));
+
+			// Image descriptor for the frame slot's offscreen position attachment
+			VkDescriptorImageInfo PositionDesciptor =
+				vks::initializers::descriptorImageInfo(
+					pExampleBase->colorSampler,
+					pExampleBase->offScreenFrameBuf.slots[i].position.view,
+					VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+			std::vector<VkWriteDescriptorSet> writeDescriptorSets =
+			{
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &pExampleBase->uniformBuffers[i].composition.descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2, &VolumetricsBuffs[i].descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3, &NoiseTexture.descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &FrameBuffs[i].descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 5, &SecondStageTextures[i].descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 6, &PositionDesciptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 7, &TransmittanceBuffs[i].descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 8, &TransmittanceTexture.descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10, &FogLightsBuffs[i].descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 11, &ClusterLightsBuff.descriptor)
+			};
+
+			vkUpdateDescriptorSets(pDevice->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()),
+				writeDescriptorSets.data(), 0, nullptr);
+		}
+	}
+
+	//-------------------------------------------------------------------------------------------------------------------------------------------------------------
+	// Descriptor Set layouts and Descriptor sets for the transmittance pass
+	{
+		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+			// Scene Info
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0, 1),
+			// Fog Primitives
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 1),
+			// Volumetrics Info
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2, 1),
+			// Noise volume sampler
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 3, 1),
+			// Transmittance Info
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 4, 1),
+			// 3D Output texture
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 5, 1),
+			// Fog Grid
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 6, 1)
 		};
 
-		vkUpdateDescriptorSets(pDevice->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()),
-			writeDescriptorSets.data(), 0, nullptr);
+		VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(), static_cast<uint32_t>(setLayoutBindings.size()));
+
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(pDevice->logicalDevice, &descriptorSetLayoutCI, nullptr, &TransmittancePipeline.DescSetLayout));
+
+		// The light to build is passed as a push constant so one set covers all lights
+		VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, sizeof(int32_t), 0);
+		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo(&TransmittancePipeline.DescSetLayout, 1);
+		pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+		pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+		VK_CHECK_RESULT(vkCreatePipelineLayout(pDevice->logicalDevice, &pipelineLayoutCreateInfo, nullptr, &TransmittancePipeline.PipelineLayout));
+
+		for (uint32_t i = 0; i < s_FrameSlots; ++i)
+		{
+			VkDescriptorSet& DescSet = TransmittancePipeline.DescSets[i];
+			VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(DescPool, &TransmittancePipeline.DescSetLayout, 1);
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(pDevice->logicalDevice, &allocInfo, &DescSet));
+
+			std::vector<VkWriteDescriptorSet> writeDescriptorSets =
+			{
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &pExampleBase->uniformBuffers[i].composition.descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2, &VolumetricsBuffs[i].descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3, &NoiseTexture.descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &TransmittanceBuffs[i].descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 5, &TransmittanceTexture.descriptor)
+			};
+
+			vkUpdateDescriptorSets(pDevice->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()),
+				writeDescriptorSets.data(), 0, nullptr);
+		}
+	}
+
+	//-------------------------------------------------------------------------------------------------------------------------------------------------------------
+	// Descriptor Set layouts and Descriptor sets for the light culling pass
+	{
+		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+			// Volumetrics Info
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0, 1),
+			// Frame info
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1, 1),
+			// Scene Info
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2, 1),
+			// Fog lights
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3, 1),
+			// Cluster light lists output
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 4, 1)
+		};
+
+		VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(), static_cast<uint32_t>(setLayoutBindings.size()));
+
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(pDevice->logicalDevice, &descriptorSetLayoutCI, nullptr, &LightCullPipeline.DescSetLayout));
+
+		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo(&LightCullPipeline.DescSetLayout, 1);
+		VK_CHECK_RESULT(vkCreatePipelineLayout(pDevice->logicalDevice, &pipelineLayoutCreateInfo, nullptr, &LightCullPipeline.PipelineLayout));
+
+		for (uint32_t i = 0; i < s_FrameSlots; ++i)
+		{
+			VkDescriptorSet& DescSet = LightCullPipeline.DescSets[i];
+			VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(DescPool, &LightCullPipeline.DescSetLayout, 1);
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(pDevice->logicalDevice, &allocInfo, &DescSet));
+
+			std::vector<VkWriteDescriptorSet> writeDescriptorSets =
+			{
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &VolumetricsBuffs[i].descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, &FrameBuffs[i].descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2, &pExampleBase->uniformBuffers[i].composition.descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &FogLightsBuffs[i].descriptor),
+				vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4, &ClusterLightsBuff.descriptor)
+			};
+
+			vkUpdateDescriptorSets(pDevice->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()),
+				writeDescriptorSets.data(), 0, nullptr);
+		}
 	}
 
 	//-------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -323,7 +814,7 @@ void VulkanVolumetrics::PrepareDescriptors()
 	{
 		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
 			// 2D texture produced from the 2nd compute stage
-			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 1)
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 1)
 		};
 
 		VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(), static_cast<uint32_t>(setLayoutBindings.size()));
@@ -331,13 +822,55 @@ void VulkanVolumetrics::PrepareDescriptors()
 		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(pDevice->logicalDevice, &descriptorSetLayoutCI, nullptr, &LightingPassDescSetLayout));
 
 
-		VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(DescPool, &LightingPassDescSetLayout, 1);
-		VK_CHECK_RESULT(vkAllocateDescriptorSets(pDevice->logicalDevice, &allocInfo, &LightingPassDescSet));
+		for (uint32_t i = 0; i < s_FrameSlots; ++i)
+		{
+			VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(DescPool, &LightingPassDescSetLayout, 1);
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(pDevice->logicalDevice, &allocInfo, &LightingPassDescSets[i]));
+
+			std::vector<VkWriteDescriptorSet> writeDescriptorSets =
+			{
+				vks::initializers::writeDescriptorSet(LightingPassDescSets[i], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &SecondStageTextures[i].descriptor)
+			};
+
+			vkUpdateDescriptorSets(pDevice->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()),
+				writeDescriptorSets.data(), 0, nullptr);
+		}
+	}
+
+	UpdateFroxelDescriptors();
 
+	UpdateFogShapeDescriptors();
+}
+
+void VulkanVolumetrics::UpdateFroxelDescriptors()
+{
+	// Bindings the current storage format doesn't use still need a valid texture of the right kind. The float ones point at
+	// a texture of the grid, the packed ones at a single texel dummy.
+	const bool Packed = VolumetricsData.StorageFormat == FroxelStorageRGB9E5;
+	const bool Split = Packed || VolumetricsData.StorageFormat == FroxelStorageB10G11R11;
+	auto FloatColour = [&](const FroxelVolume& Volume) { return Packed ? &Volume.Density.descriptor : &Volume.Colour.descriptor; };
+	auto FloatDensity = [&](const FroxelVolume& Volume) { return Split ? &Volume.Density.descriptor : &Volume.Colour.descriptor; };
+	auto PackedColour = [&](const FroxelVolume& Volume) { return Packed ? &Volume.Colour.descriptor : &DummyPackedTexture.descriptor; };
+
+	// Each frame slot writes one grid and reads the other one as its history
+	for (uint32_t i = 0; i < FirstStageTextures.size(); ++i)
+	{
+		const FroxelVolume& Current = FirstStageTextures[i];
+		const FroxelVolume& History = FirstStageTextures[(i + 1) % FirstStageTextures.size()];
 
 		std::vector<VkWriteDescriptorSet> writeDescriptorSets =
 		{
-			vks::initializers::writeDescriptorSet(LightingPassDescSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &SecondStageTexture.descriptor)
+			// Written by the first stage
+			vks::initializers::writeDescriptorSet(ComputePipelines[0].DescSets[i], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 5, FloatColour(Current)),
+			vks::initializers::writeDescriptorSet(ComputePipelines[0].DescSets[i], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 10, FloatDensity(Current)),
+			vks::initializers::writeDescriptorSet(ComputePipelines[0].DescSets[i], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 11, PackedColour(Current)),
+			vks::initializers::writeDescriptorSet(ComputePipelines[0].DescSets[i], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 6, FloatColour(History)),
+			vks::initializers::writeDescriptorSet(ComputePipelines[0].DescSets[i], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 12, FloatDensity(History)),
+			vks::initializers::writeDescriptorSet(ComputePipelines[0].DescSets[i], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 13, PackedColour(History)),
+			// Sampled by the second stage
+			vks::initializers::writeDescriptorSet(ComputePipelines[1].DescSets[i], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, FloatColour(Current)),
+			vks::initializers::writeDescriptorSet(ComputePipelines[1].DescSets[i], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 5, FloatDensity(Current)),
+			vks::initializers::writeDescriptorSet(ComputePipelines[1].DescSets[i], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 6, PackedColour(Current))
 		};
 
 		vkUpdateDescriptorSets(pDevice->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()),
@@ -345,224 +878,1563 @@ void VulkanVolumetrics::PrepareDescriptors()
 	}
 }
 
-void VulkanVolumetrics::PreparePipelines()
+void VulkanVolumetrics::UpdateFogShapeDescriptors()
 {
-	// Shared Command Pool for both compute pipelines
-
-	VkCommandPoolCreateInfo cmdPoolInfo = {};
-	cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-	cmdPoolInfo.queueFamilyIndex = pDevice->queueFamilyIndices.compute;
-	cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-	VK_CHECK_RESULT(vkCreateCommandPool(*pDevice, &cmdPoolInfo, nullptr, &ComputeCmdPool));
-
-	// Create First Compute Stage Pipeline
+	std::vector<VkWriteDescriptorSet> writeDescriptorSets;
+	for (VkDescriptorSet DescSet : TransmittancePipeline.DescSets)
+	{
+		writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &FogShapesBuff.descriptor));
+		writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 6, &FogGridBuff.descriptor));
+	}
+	for (VkDescriptorSet DescSet : ComputePipelines[0].DescSets)
+	{
+		writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &FogShapesBuff.descriptor));
+		writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 9, &FogGridBuff.descriptor));
+	}
+	for (VkDescriptorSet DescSet : FusedPipeline.DescSets)
 	{
-		VkComputePipelineCreateInfo computePipelineCreateInfo = vks::initializers::computePipelineCreateInfo(ComputePipelines[0].PipelineLayout, 0);
+		writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &FogShapesBuff.descriptor));
+		writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(DescSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 9, &FogGridBuff.descriptor));
+	}
 
-		// One pipeline for each available image filter
-		computePipelineCreateInfo.stage = pExampleBase->loadShader(pExampleBase->getShadersPath() + "deferred/volumetrics_firststage.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+	vkUpdateDescriptorSets(pDevice->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()),
+		writeDescriptorSets.data(), 0, nullptr);
+}
 
-		VK_CHECK_RESULT(vkCreateComputePipelines(*pDevice, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &ComputePipelines[0].Pipeline));
+void VulkanVolumetrics::UploadFogShapes()
+{
+	FogGridData.Build(FogShapesData, VolumetricsData.SmoothFactor, FogGridEnabled ? FogGridCellsPerPrimitive : 0.f);
 
-		// Create a command buffer for compute operations
-		VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(ComputeCmdPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-		VK_CHECK_RESULT(vkAllocateCommandBuffers(*pDevice, &cmdBufAllocateInfo, &ComputePipelines[0].CmdBuff));
+	const VkDeviceSize ShapesSize = std::max<VkDeviceSize>(FogShapesData.Primitives.size(), 1) * sizeof(FogPrimitive);
+	const VkDeviceSize GridSize = FogGridData.BufferSize();
 
-		// Semaphore for compute & graphics sync
-		VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
-		VK_CHECK_RESULT(vkCreateSemaphore(*pDevice, &semaphoreCreateInfo, nullptr, &ComputePipelines[0].Semaphore));
+	// The buffers are shared by both frame slots, so the other slot's frame may still be reading them
+	if (ComputeQueue != VK_NULL_HANDLE)
+	{
+		vkQueueWaitIdle(ComputeQueue);
 	}
 
-	// Create First Compute Stage Pipeline
+	// Grow the buffers with some headroom so adding primitives one at a time doesn't reallocate every time.
+	// The descriptors and command buffers referencing the old buffers have to be updated too.
+	if (ShapesSize > FogShapesBuff.size || GridSize > FogGridBuff.size)
 	{
-		VkComputePipelineCreateInfo computePipelineCreateInfo = vks::initializers::computePipelineCreateInfo(ComputePipelines[1].PipelineLayout, 0);
-
-		// One pipeline for each available image filter
-		computePipelineCreateInfo.stage = pExampleBase->loadShader(pExampleBase->getShadersPath() + "deferred/volumetrics_secondstage.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
-
-		VK_CHECK_RESULT(vkCreateComputePipelines(*pDevice, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &ComputePipelines[1].Pipeline));
+		if (ShapesSize > FogShapesBuff.size)
+		{
+			FogShapesBuff.destroy();
+			VK_CHECK_RESULT(pDevice->createBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &FogShapesBuff, ShapesSize * 2));
+		}
+		if (GridSize > FogGridBuff.size)
+		{
+			FogGridBuff.destroy();
+			VK_CHECK_RESULT(pDevice->createBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &FogGridBuff, GridSize * 2));
+		}
 
-		// Create a command buffer for compute operations
-		VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(ComputeCmdPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-		VK_CHECK_RESULT(vkAllocateCommandBuffers(*pDevice, &cmdBufAllocateInfo, &ComputePipelines[1].CmdBuff));
+		// Skipped during Init, the descriptors are written once they've been created
+		if (DescPool != VK_NULL_HANDLE)
+		{
+			UpdateFogShapeDescriptors();
+			BuildCommandBuffers();
+		}
+	}
 
-		// Semaphore for compute & graphics sync
-		VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
-		VK_CHECK_RESULT(vkCreateSemaphore(*pDevice, &semaphoreCreateInfo, nullptr, &ComputePipelines[1].Semaphore));
+	FogShapesBuff.map();
+	if (!FogShapesData.Primitives.empty())
+	{
+		memcpy(FogShapesBuff.mapped, FogShapesData.Primitives.data(), FogShapesData.Primitives.size() * sizeof(FogPrimitive));
 	}
-	
+	FogShapesBuff.unmap();
+	FogGridBuff.map();
+	FogGridData.Write(FogGridBuff.mapped);
+	FogGridBuff.unmap();
+
+	FogShapesDirty = false;
+	++FogShapesVersion;
 }
 
-void VulkanVolumetrics::BuildCommandBuffers()
+void VulkanVolumetrics::PreparePipelines()
 {
-	//Build the command buffer for the first stage compute pipeline
-	{
-		// Flush the queue if we're rebuilding the command buffer after a pipeline change to ensure it's not currently in use
-		vkQueueWaitIdle(ComputeQueue);
-
-		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+	// Shared Command Pool for both compute pipelines
 
-		VK_CHECK_RESULT(vkBeginCommandBuffer(ComputePipelines[0].CmdBuff, &cmdBufInfo));
+	VkCommandPoolCreateInfo cmdPoolInfo = {};
+	cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	cmdPoolInfo.queueFamilyIndex = pDevice->queueFamilyIndices.compute;
+	cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	VK_CHECK_RESULT(vkCreateCommandPool(*pDevice, &cmdPoolInfo, nullptr, &ComputeCmdPool));
 
-		vkCmdBindPipeline(ComputePipelines[0].CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, ComputePipelines[0].Pipeline);
-		vkCmdBindDescriptorSets(ComputePipelines[0].CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, ComputePipelines[0].PipelineLayout, 0, 1, &ComputePipelines[0].DescSet, 0, 0);
+	// The froxel passes are created as variants specialised for the current settings on first use, only load their shaders
+	ComputePipelines[0].ShaderStage = pExampleBase->loadShader(pExampleBase->getShadersPath() + "deferred/volumetrics_firststage.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+	ComputePipelines[1].ShaderStage = pExampleBase->loadShader(pExampleBase->getShadersPath() + "deferred/volumetrics_secondstage.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+	// The fused kernel and light culling are recorded into the stages' command buffers, so they need no command buffers or
+	// semaphores of their own. The fused kernel's shader is loaded the first time it's selected.
+	LightCullPipeline.ShaderStage = LoadComputeShader("volumetrics_lightcull.comp");
 
-		// Thread group sizes set to 8 x 8 x 8 in the compute shader, so we dispatch enough groups to cover the 3d map
-		vkCmdDispatch(ComputePipelines[0].CmdBuff, FirstStageTexture.width / 8, FirstStageTexture.height / 8, VolumetricsData.MapDepth / 8);
+	// Command buffers and semaphores for both compute stages
+	for (ComputePipelineResources& Stage : ComputePipelines)
+	{
+		// Create a command buffer for compute operations for each frame slot
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(ComputeCmdPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, static_cast<uint32_t>(Stage.CmdBuffs.size()));
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(*pDevice, &cmdBufAllocateInfo, Stage.CmdBuffs.data()));
 
-		vkEndCommandBuffer(ComputePipelines[0].CmdBuff);
+		// Semaphores for compute & graphics sync
+		VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
+		for (VkSemaphore& Semaphore : Stage.Semaphores)
+		{
+			VK_CHECK_RESULT(vkCreateSemaphore(*pDevice, &semaphoreCreateInfo, nullptr, &Semaphore));
+		}
 	}
-	
-	//Build the command buffer for the second stage compute pipeline
-	{
-		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
 
-		VK_CHECK_RESULT(vkBeginCommandBuffer(ComputePipelines[1].CmdBuff, &cmdBufInfo));
+	// Create Transmittance Pipeline
+	{
+		VkComputePipelineCreateInfo computePipelineCreateInfo = vks::initializers::computePipelineCreateInfo(TransmittancePipeline.PipelineLayout, 0);
 
-		vkCmdBindPipeline(ComputePipelines[1].CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, ComputePipelines[1].Pipeline);
-		vkCmdBindDescriptorSets(ComputePipelines[1].CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, ComputePipelines[1].PipelineLayout, 0, 1, &ComputePipelines[1].DescSet, 0, 0);
+		computePipelineCreateInfo.stage = LoadComputeShader("volumetrics_transmittance.comp");
 
-		// Thread group sizes set to 8 x 8 in the compute shader, so we dispatch enough groups to cover the 2D output texture
-		vkCmdDispatch(ComputePipelines[1].CmdBuff, SecondStageTexture.width / 8, SecondStageTexture.height / 8, 1);
+		Timer<resolutions::microseconds> CreationTimer;
+		VK_CHECK_RESULT(vkCreateComputePipelines(*pDevice, pExampleBase->pipelineCache, 1, &computePipelineCreateInfo, nullptr, &TransmittancePipeline.Pipeline));
+		PipelineCreationTime += static_cast<double>(CreationTimer.total_elapsed()) / 1000.0;
 
-		vkEndCommandBuffer(ComputePipelines[1].CmdBuff);
+		// Only submitted when the volume is out of date, without semaphores as the first stage waits on it with a barrier.
+		// One per frame slot as the other slot's may still be pending when it's recorded again.
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(ComputeCmdPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, static_cast<uint32_t>(TransmittancePipeline.CmdBuffs.size()));
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(*pDevice, &cmdBufAllocateInfo, TransmittancePipeline.CmdBuffs.data()));
 	}
+}
 
+VkPipelineShaderStageCreateInfo VulkanVolumetrics::LoadComputeShader(const std::string& Name)
+{
+	const std::string FileName = pExampleBase->getShadersPath() + "deferred/" + Name + ".spv";
+#if !defined(VK_USE_PLATFORM_ANDROID_KHR)
+	// loadShader only asserts, so a release build would go on with a null module
+	if (!vks::tools::fileExists(FileName))
+	{
+		vks::tools::exitFatal("Could not load shader \"" + FileName + "\", the SPIR-V is compiled from the GLSL source by Compile_deferred_GLSL.bat or shaders/glsl/compileshaders.py", -1);
+	}
+#endif
+	return pExampleBase->loadShader(FileName, VK_SHADER_STAGE_COMPUTE_BIT);
+}
 
+VolumetricsPipelineKey VulkanVolumetrics::CurrentPipelineKey() const
+{
+	VolumetricsPipelineKey Key{};
+	Key.SliceDistribution = VolumetricsData.SliceDistribution;
+	// StepFallOff is derived from the multiplier every frame, so check that to match the next frame
+	Key.UniformSlices = (StepFallOffMult == 0.f) ? VK_TRUE : VK_FALSE;
+	Key.StorageFormat = VolumetricsData.StorageFormat;
+	Key.TransmittanceEnabled = (TransmittanceData.Enabled != 0) ? VK_TRUE : VK_FALSE;
+	return Key;
 }
 
-void VulkanVolumetrics::UpdateBuffers()
+const VolumetricsPipelineVariant& VulkanVolumetrics::GetPipelineVariant()
 {
-	float DTime = static_cast<float>(FrameTimer.total_elapsed()) / 1000.f;
-	FrameTimer.restart();
+	const VolumetricsPipelineKey Key = CurrentPipelineKey();
+	VolumetricsPipelineVariant& Variant = PipelineVariants[Key.Hash()];
+	const bool NeedsScan = SecondStageScanEnabled && Variant.SecondStageScan == VK_NULL_HANDLE;
+	const bool NeedsFused = FusedKernelActive() && Variant.Fused == VK_NULL_HANDLE;
+	if (Variant.FirstStage != VK_NULL_HANDLE && !NeedsScan && !NeedsFused)
+	{
+		return Variant;
+	}
 
-	VolumetricsData.NoiseXOffset += DTime * XWindSpeed;
-	VolumetricsData.NoiseXOffset = fmodf(VolumetricsData.NoiseXOffset, FLT_MAX - 10.f);
-	VolumetricsData.NoiseYOffset += DTime * YWindSpeed;
-	VolumetricsData.NoiseYOffset = fmodf(VolumetricsData.NoiseYOffset, FLT_MAX - 10.f);
-	VolumetricsData.NoiseZOffset += DTime * ZWindSpeed;
-	VolumetricsData.NoiseZOffset = fmodf(VolumetricsData.NoiseZOffset, FLT_MAX - 10.f);
-	if (StepFallOffMult == 0.f)
+	// The same constants are passed to every pass, the ones a shader doesn't declare are ignored
+	const std::array<VkSpecializationMapEntry, 4> SpecializationMapEntries =
 	{
-		VolumetricsData.StepFallOff = 0.f;
+		vks::initializers::specializationMapEntry(0, offsetof(VolumetricsPipelineKey, SliceDistribution), sizeof(glm::u32)),
+		vks::initializers::specializationMapEntry(1, offsetof(VolumetricsPipelineKey, UniformSlices), sizeof(VkBool32)),
+		vks::initializers::specializationMapEntry(2, offsetof(VolumetricsPipelineKey, StorageFormat), sizeof(glm::u32)),
+		vks::initializers::specializationMapEntry(3, offsetof(VolumetricsPipelineKey, TransmittanceEnabled), sizeof(VkBool32))
+	};
+	const VkSpecializationInfo SpecializationInfo = vks::initializers::specializationInfo(static_cast<uint32_t>(SpecializationMapEntries.size()), SpecializationMapEntries.data(), sizeof(Key), &Key);
+
+	auto CreatePipeline = [&](VkPipelineLayout layout, VkPipelineShaderStageCreateInfo stage)
+	{
+		stage.pSpecializationInfo = &SpecializationInfo;
+		VkComputePipelineCreateInfo computePipelineCreateInfo = vks::initializers::computePipelineCreateInfo(layout, 0);
+		computePipelineCreateInfo.stage = stage;
+
+		VkPipeline Pipeline = VK_NULL_HANDLE;
+		Timer<resolutions::microseconds> CreationTimer;
+		VK_CHECK_RESULT(vkCreateComputePipelines(*pDevice, pExampleBase->pipelineCache, 1, &computePipelineCreateInfo, nullptr, &Pipeline));
+		PipelineCreationTime += static_cast<double>(CreationTimer.total_elapsed()) / 1000.0;
+		return Pipeline;
+	};
+
+	if (Variant.FirstStage == VK_NULL_HANDLE)
+	{
+		// Only RGBA8 is written through format qualified images
+		VkPipelineShaderStageCreateInfo FirstStage = ComputePipelines[0].ShaderStage;
+		if (Key.StorageFormat != FroxelStorageRGBA8)
+		{
+			if (FirstStageFormatlessShaderStage.module == VK_NULL_HANDLE)
+			{
+				FirstStageFormatlessShaderStage = LoadComputeShader("volumetrics_firststage_formatless.comp");
+			}
+			FirstStage = FirstStageFormatlessShaderStage;
+		}
+		Variant.FirstStage = CreatePipeline(ComputePipelines[0].PipelineLayout, FirstStage);
+		Variant.SecondStage = CreatePipeline(ComputePipelines[1].PipelineLayout, ComputePipelines[1].ShaderStage);
+		Variant.LightCull = CreatePipeline(LightCullPipeline.PipelineLayout, LightCullPipeline.ShaderStage);
 	}
-	else
+
+	// The scan variant of the second stage is only loaded and created once it's selected
+	if (NeedsScan)
 	{
-		VolumetricsData.StepFallOff = StepFallOffMult / 100.f;
+		if (SecondStageScanShaderStage.module == VK_NULL_HANDLE)
+		{
+			SecondStageScanShaderStage = LoadComputeShader("volumetrics_secondstage_scan.comp");
+		}
+		Variant.SecondStageScan = CreatePipeline(ComputePipelines[1].PipelineLayout, SecondStageScanShaderStage);
 	}
 
-	VolumetricsBuff.map();
-	memcpy(VolumetricsBuff.mapped, &VolumetricsData, sizeof(VolumetricsData));
-	VolumetricsBuff.unmap();
-	FogShapesBuff.map();
-	memcpy(FogShapesBuff.mapped, &FogShapesData, sizeof(FogShapes));
-	FogShapesBuff.unmap();
-	SettingsOOD = false;
+	// Likewise the fused kernel, once it's selected and fits the grid
+	if (NeedsFused)
+	{
+		if (FusedPipeline.ShaderStage.module == VK_NULL_HANDLE)
+		{
+			FusedPipeline.ShaderStage = LoadComputeShader("volumetrics_fused.comp");
+		}
+		Variant.Fused = CreatePipeline(FusedPipeline.PipelineLayout, FusedPipeline.ShaderStage);
+	}
+
+	return Variant;
 }
 
-VkSemaphore* VulkanVolumetrics::SubmitCommands(VkSemaphore* pWaitSemaphore)
+bool VulkanVolumetrics::FusedKernelActive() const
 {
-	// Submit First Stage
-	// If a semaphore was passed in wait on that
-	SubmitInfo.pWaitSemaphores = pWaitSemaphore;
-	SubmitInfo.waitSemaphoreCount = (pWaitSemaphore != VK_NULL_HANDLE)? 1 : 0;
+	// Each workgroup keeps the froxels under its tile in shared memory, which only has room for them when there are no more
+	// froxels than pixels
+	return FusedEnabled && VolumetricsData.MapWidth <= SecondStageTextures[0].width && VolumetricsData.MapHeight <= SecondStageTextures[0].height;
+}
 
-	SubmitInfo.pSignalSemaphores = &ComputePipelines[0].Semaphore;
+void VulkanVolumetrics::BuildCommandBuffers()
+{
+	// Flush the queue if we're rebuilding the command buffer after a pipeline change to ensure it's not currently in use
+	vkQueueWaitIdle(ComputeQueue);
 
-	SubmitInfo.pCommandBuffers = &ComputePipelines[0].CmdBuff;
-	VK_CHECK_RESULT(vkQueueSubmit(ComputeQueue, 1, &SubmitInfo, VK_NULL_HANDLE));
+	const bool Fused = FusedKernelActive();
 
+	const VolumetricsPipelineVariant& Variant = GetPipelineVariant();
+	RecordedPipelineKey = CurrentPipelineKey().Hash();
 
-	// Submit Second Stage
+	// Each frame slot writes its own queries so the other slot's can be read while it's in flight
+	const GpuProfiler& Profiler = pExampleBase->profiler;
 
-	// Wait on the previous stage to complete
-	SubmitInfo.pWaitSemaphores = &ComputePipelines[0].Semaphore;
-	SubmitInfo.waitSemaphoreCount = 1;
+	for (uint32_t i = 0; i < s_FrameSlots; ++i)
+	{
+		//Build the command buffer for the first stage compute pipeline
+		{
+			VkCommandBuffer CmdBuff = ComputePipelines[0].CmdBuffs[i];
 
-	SubmitInfo.pSignalSemaphores = &ComputePipelines[1].Semaphore;
+			VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
 
-	SubmitInfo.pCommandBuffers = &ComputePipelines[1].CmdBuff;
-	VK_CHECK_RESULT(vkQueueSubmit(ComputeQueue, 1, &SubmitInfo, VK_NULL_HANDLE));
+			VK_CHECK_RESULT(vkBeginCommandBuffer(CmdBuff, &cmdBufInfo));
 
-	return &ComputePipelines[1].Semaphore;
-}
+			Profiler.ResetPass(CmdBuff, i, GpuPass::VolumetricsFirstStage);
+			Profiler.BeginPass(CmdBuff, i, GpuPass::VolumetricsFirstStage);
 
-void VulkanVolumetrics::Release(VkDevice& device)
-{
-	// Release Second Stage Compute Pipeline resources
-	vkDestroySemaphore(device, ComputePipelines[1].Semaphore, nullptr);
-	
-	vkDestroyPipeline(device, ComputePipelines[1].Pipeline, nullptr);
-	vkDestroyPipelineLayout(device, ComputePipelines[1].PipelineLayout, nullptr);
-	vkDestroyDescriptorSetLayout(device, ComputePipelines[1].DescSetLayout, nullptr);
+			// Restart the cluster light list once the previous first stage has finished reading it. The previous frame's stages
+			// may still be running as this no longer waits for the G-Buffer, so this also keeps them from overlapping.
+			vkCmdPipelineBarrier(CmdBuff, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+			vkCmdFillBuffer(CmdBuff, ClusterLightsBuff.buffer, 0, sizeof(ClusterLightsInfo), 0);
 
-	// Release First Stage Compute Pipeline resources
-	vkDestroySemaphore(device, ComputePipelines[0].Semaphore, nullptr);
-	vkDestroyPipeline(device, ComputePipelines[0].Pipeline, nullptr);
-	vkDestroyPipelineLayout(device, ComputePipelines[0].PipelineLayout, nullptr);
-	vkDestroyDescriptorSetLayout(device, ComputePipelines[0].DescSetLayout, nullptr);
+			// The transmittance volume may have been rebuilt by the previous submission on this queue
+			VkMemoryBarrier TransmittanceBarrier = vks::initializers::memoryBarrier();
+			TransmittanceBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+			TransmittanceBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+			vkCmdPipelineBarrier(CmdBuff, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &TransmittanceBarrier, 0, nullptr, 0, nullptr);
 
-	// Release Additional Descriptor set layout
-	vkDestroyDescriptorSetLayout(device, LightingPassDescSetLayout, nullptr);
+			// Bin the lights into clusters of froxels, one for every first stage workgroup
+			vkCmdBindPipeline(CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, Variant.LightCull);
+			vkCmdBindDescriptorSets(CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, LightCullPipeline.PipelineLayout, 0, 1, &LightCullPipeline.DescSets[i], 0, 0);
+			vkCmdDispatch(CmdBuff, (VolumetricsData.MapWidth + s_ClusterSize - 1) / s_ClusterSize, (VolumetricsData.MapHeight + s_ClusterSize - 1) / s_ClusterSize,
+				(VolumetricsData.MapDepth + s_ClusterSize - 1) / s_ClusterSize);
+
+			VkMemoryBarrier ClusterBarrier = vks::initializers::memoryBarrier();
+			ClusterBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			ClusterBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+			vkCmdPipelineBarrier(CmdBuff, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &ClusterBarrier, 0, nullptr, 0, nullptr);
+
+			// Keep the counters for the overlay
+			VkBufferCopy CountersCopy = { 0, 0, sizeof(ClusterLightsInfo) };
+			vkCmdCopyBuffer(CmdBuff, ClusterLightsBuff.buffer, ClusterCountersBuff.buffer, 1, &CountersCopy);
+
+			// The fused kernel evaluates the froxels itself once the G-Buffer is ready, only the light culling runs ahead of it
+			if (!Fused)
+			{
+				vkCmdBindPipeline(CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, Variant.FirstStage);
+				vkCmdBindDescriptorSets(CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, ComputePipelines[0].PipelineLayout, 0, 1, &ComputePipelines[0].DescSets[i], 0, 0);
+
+				// Thread group sizes set to 8 x 8 x 8 in the compute shader, so we dispatch enough groups to cover the 3d map.
+				// Rounded up as the grid sizes don't have to be multiples of 8, the shader skips the excess invocations
+				vkCmdDispatch(CmdBuff, (VolumetricsData.MapWidth + 7) / 8, (VolumetricsData.MapHeight + 7) / 8, (VolumetricsData.MapDepth + 7) / 8);
+			}
+
+			Profiler.EndPass(CmdBuff, i, GpuPass::VolumetricsFirstStage);
+
+			vkEndCommandBuffer(CmdBuff);
+		}
+
+		//Build the command buffer for the second stage compute pipeline
+		{
+			VkCommandBuffer CmdBuff = ComputePipelines[1].CmdBuffs[i];
+
+			VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+
+			VK_CHECK_RESULT(vkBeginCommandBuffer(CmdBuff, &cmdBufInfo));
+
+			Profiler.ResetPass(CmdBuff, i, GpuPass::VolumetricsSecondStage);
+			Profiler.BeginPass(CmdBuff, i, GpuPass::VolumetricsSecondStage);
+
+			const vks::Texture& SecondStageTexture = SecondStageTextures[i];
+			const VkImage PositionImage = pExampleBase->offScreenFrameBuf.slots[i].position.image;
+			const bool TransferOwnership = pDevice->queueFamilyIndices.graphics != pDevice->queueFamilyIndices.compute;
+
+			if (TransferOwnership)
+			{
+				// Take the positions from the graphics queue, which released them after rendering the G-Buffer. The fog output
+				// is overwritten, so it's taken without a transfer and its contents from the last frame are dropped.
+				std::array<VkImageMemoryBarrier, 2> Barriers =
+				{
+					OwnershipTransfer(PositionImage, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, true),
+					vks::initializers::imageMemoryBarrier()
+				};
+				Barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+				Barriers[1].image = SecondStageTexture.image;
+				Barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				Barriers[1].newLayout = SecondStageTexture.imageLayout;
+				Barriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+				Barriers[1].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+				// From the stage the G-Buffer semaphore is waited on, so the acquire is ordered after the release
+				vkCmdPipelineBarrier(CmdBuff, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr,
+					static_cast<uint32_t>(Barriers.size()), Barriers.data());
+			}
+
+			if (Fused)
+			{
+				// Each workgroup evaluates and composites the froxels under a tile of s_FusedTileSize x s_FusedTileSize pixels
+				vkCmdBindPipeline(CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, Variant.Fused);
+				vkCmdBindDescriptorSets(CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, FusedPipeline.PipelineLayout, 0, 1, &FusedPipeline.DescSets[i], 0, 0);
+				vkCmdDispatch(CmdBuff, (SecondStageTexture.width + s_FusedTileSize - 1) / s_FusedTileSize, (SecondStageTexture.height + s_FusedTileSize - 1) / s_FusedTileSize, 1);
+			}
+			else if (SecondStageScanEnabled)
+			{
+				vkCmdBindPipeline(CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, Variant.SecondStageScan);
+				vkCmdBindDescriptorSets(CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, ComputePipelines[1].PipelineLayout, 0, 1, &ComputePipelines[1].DescSets[i], 0, 0);
+
+				// Each workgroup covers a row of s_ScanPixelsPerGroup pixels, with a row of threads splitting the depth of each one
+				vkCmdDispatch(CmdBuff, (SecondStageTexture.width + s_ScanPixelsPerGroup - 1) / s_ScanPixelsPerGroup, SecondStageTexture.height, 1);
+			}
+			else
+			{
+				vkCmdBindPipeline(CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, Variant.SecondStage);
+				vkCmdBindDescriptorSets(CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, ComputePipelines[1].PipelineLayout, 0, 1, &ComputePipelines[1].DescSets[i], 0, 0);
+
+				// Thread group sizes set to 8 x 8 in the compute shader, so we dispatch enough groups to cover the 2D output texture
+				vkCmdDispatch(CmdBuff, (SecondStageTexture.width + 7) / 8, (SecondStageTexture.height + 7) / 8, 1);
+			}
+
+			if (TransferOwnership)
+			{
+				// Hand the positions and the fog back to the lighting pass, which acquires them in AcquireOutputs
+				std::array<VkImageMemoryBarrier, 2> Barriers =
+				{
+					OwnershipTransfer(PositionImage, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false),
+					OwnershipTransfer(SecondStageTexture.image, SecondStageTexture.imageLayout, false)
+				};
+				Barriers[1].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+				vkCmdPipelineBarrier(CmdBuff, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr,
+					static_cast<uint32_t>(Barriers.size()), Barriers.data());
+			}
+
+			Profiler.EndPass(CmdBuff, i, GpuPass::VolumetricsSecondStage);
+
+			vkEndCommandBuffer(CmdBuff);
+		}
+	}
+}
+
+VkImageMemoryBarrier VulkanVolumetrics::OwnershipTransfer(VkImage Image, VkImageLayout Layout, bool ToCompute) const
+{
+	VkImageMemoryBarrier Barrier = vks::initializers::imageMemoryBarrier();
+	Barrier.srcQueueFamilyIndex = ToCompute ? pDevice->queueFamilyIndices.graphics : pDevice->queueFamilyIndices.compute;
+	Barrier.dstQueueFamilyIndex = ToCompute ? pDevice->queueFamilyIndices.compute : pDevice->queueFamilyIndices.graphics;
+	Barrier.image = Image;
+	Barrier.oldLayout = Layout;
+	Barrier.newLayout = Layout;
+	Barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+	return Barrier;
+}
+
+void VulkanVolumetrics::ReleaseGBuffer(VkCommandBuffer CmdBuff, uint32_t frameSlot) const
+{
+	// A single queue family needs no transfers, the semaphores between the submissions order everything
+	if (pDevice->queueFamilyIndices.graphics == pDevice->queueFamilyIndices.compute)
+	{
+		return;
+	}
+
+	VkImageMemoryBarrier Barrier = OwnershipTransfer(pExampleBase->offScreenFrameBuf.slots[frameSlot].position.image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, true);
+	Barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	vkCmdPipelineBarrier(CmdBuff, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &Barrier);
+}
+
+void VulkanVolumetrics::AcquireOutputs(VkCommandBuffer CmdBuff, uint32_t frameSlot) const
+{
+	if (pDevice->queueFamilyIndices.graphics == pDevice->queueFamilyIndices.compute)
+	{
+		return;
+	}
+
+	// Matches the release at the end of the second stage. The fog output isn't transferred back, the next second stage of the
+	// slot overwrites it.
+	std::array<VkImageMemoryBarrier, 2> Barriers =
+	{
+		OwnershipTransfer(pExampleBase->offScreenFrameBuf.slots[frameSlot].position.image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false),
+		OwnershipTransfer(SecondStageTextures[frameSlot].image, SecondStageTextures[frameSlot].imageLayout, false)
+	};
+	for (VkImageMemoryBarrier& Barrier : Barriers)
+	{
+		Barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	}
+	// From the stage the composition waits for the volumetrics semaphore at
+	vkCmdPipelineBarrier(CmdBuff, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr,
+		static_cast<uint32_t>(Barriers.size()), Barriers.data());
+}
+
+void VulkanVolumetrics::BuildTransmittanceCommandBuffer()
+{
+	VkCommandBuffer CmdBuff = TransmittancePipeline.CmdBuffs[CurrentFroxelIndex];
+
+	VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+	cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	VK_CHECK_RESULT(vkBeginCommandBuffer(CmdBuff, &cmdBufInfo));
+
+	// The previous frame's first stage may still be reading the volume
+	vkCmdPipelineBarrier(CmdBuff, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+	vkCmdBindPipeline(CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, TransmittancePipeline.Pipeline);
+	vkCmdBindDescriptorSets(CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, TransmittancePipeline.PipelineLayout, 0, 1, &TransmittancePipeline.DescSets[CurrentFroxelIndex], 0, 0);
+
+	// Thread group sizes set to 4 x 4 x 4 in the compute shader, one dispatch per light writing its own slices
+	const int32_t LightCount = std::min(TransmittanceBuiltLightCount, static_cast<int32_t>(s_MaxTransmittanceLights));
+	for (int32_t LightIndex = 0; LightIndex < LightCount; ++LightIndex)
+	{
+		vkCmdPushConstants(CmdBuff, TransmittancePipeline.PipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(int32_t), &LightIndex);
+		vkCmdDispatch(CmdBuff, (s_TransmittanceResolution + 3) / 4, (s_TransmittanceResolution + 3) / 4, (s_TransmittanceResolution + 3) / 4);
+	}
+
+	vkEndCommandBuffer(CmdBuff);
+}
+
+bool VulkanVolumetrics::TransmittanceOutOfDate() const
+{
+	const VulkanExample::UniformDataComposition& Scene = pExampleBase->uniformDataComposition;
+	if (Scene.lightCount != TransmittanceBuiltLightCount)
+	{
+		return true;
+	}
+	for (int32_t i = 0; i < Scene.lightCount && i < static_cast<int32_t>(s_MaxTransmittanceLights); ++i)
+	{
+		if (Scene.lights[i].position != TransmittanceBuiltLights[i])
+		{
+			return true;
+		}
+	}
+
+	if (FogShapesVersion != TransmittanceBuiltShapesVersion)
+	{
+		return true;
+	}
+
+	const VolumetricsInfo& Built = TransmittanceBuiltInfo;
+	if (VolumetricsData.Density != Built.Density || VolumetricsData.Absorption != Built.Absorption ||
+		VolumetricsData.LightMarchSize != Built.LightMarchSize || VolumetricsData.LightAbsorptionCutoff != Built.LightAbsorptionCutoff ||
+		VolumetricsData.NoiseXTile != Built.NoiseXTile || VolumetricsData.NoiseYTile != Built.NoiseYTile ||
+		VolumetricsData.NoiseZTile != Built.NoiseZTile || VolumetricsData.NoiseFactor != Built.NoiseFactor ||
+		VolumetricsData.SmoothFactor != Built.SmoothFactor)
+	{
+		return true;
+	}
+
+	// The wind scrolls the noise every frame, only rebuild once it has moved far enough to be noticeable
+	return fabsf(VolumetricsData.NoiseXOffset - Built.NoiseXOffset) > TransmittanceNoiseTolerance ||
+		fabsf(VolumetricsData.NoiseYOffset - Built.NoiseYOffset) > TransmittanceNoiseTolerance ||
+		fabsf(VolumetricsData.NoiseZOffset - Built.NoiseZOffset) > TransmittanceNoiseTolerance;
+}
+
+void VulkanVolumetrics::UpdateTransmittanceInfo()
+{
+	const VulkanExample::UniformDataComposition& Scene = pExampleBase->uniformDataComposition;
+	TransmittanceBuiltInfo = VolumetricsData;
+	TransmittanceBuiltShapesVersion = FogShapesVersion;
+	TransmittanceBuiltLightCount = Scene.lightCount;
+	TransmittanceData.LightCount = static_cast<glm::u32>(std::min(std::max(Scene.lightCount, 0), static_cast<int32_t>(s_MaxTransmittanceLights)));
+	for (uint32_t i = 0; i < s_MaxTransmittanceLights; ++i)
+	{
+		TransmittanceBuiltLights[i] = Scene.lights[i].position;
+	}
+
+	// There is no fog outside of the grid, which already covers the smooth union growing the fog past the primitives.
+	// The shapes are defined with the shaders' negated positions, so flip them into world space.
+	TransmittanceData.BoundsMin = -FogGridData.Info.BoundsMax;
+	TransmittanceData.BoundsMax = -FogGridData.Info.BoundsMin;
+
+	TransmittanceDirty = true;
+}
+
+void VulkanVolumetrics::UpdateFogLights()
+{
+	// The scene lights come first so their indices match the transmittance volumes
+	const VulkanExample::UniformDataComposition& Scene = pExampleBase->uniformDataComposition;
+	const int32_t SceneLightCount = std::min(std::max(Scene.lightCount, 0), static_cast<int32_t>(s_MaxTransmittanceLights));
+	FogLightsData.resize(SceneLightCount);
+	for (int32_t i = 0; i < SceneLightCount; ++i)
+	{
+		FogLightsData[i] = { Scene.lights[i].position, Scene.lights[i].color, Scene.lights[i].radius };
+	}
+
+	// Scatter the extra lights through the fog with a fixed seed, so the same count always gives the same lights.
+	// The fog bounds use the shaders' negated positions, so flip them into world space.
+	std::mt19937 Generator(7);
+	std::uniform_real_distribution<float> Unit(0.f, 1.f);
+	const glm::vec3 BoundsMin = -glm::vec3(FogGridData.Info.BoundsMax);
+	const glm::vec3 BoundsMax = -glm::vec3(FogGridData.Info.BoundsMin);
+	const int32_t ExtraCount = std::min(ExtraFogLightCount, static_cast<int32_t>(s_MaxFogLights) - SceneLightCount);
+	for (int32_t i = 0; i < ExtraCount; ++i)
+	{
+		FogLight Light;
+		const glm::vec3 T(Unit(Generator), Unit(Generator), Unit(Generator));
+		Light.Position = glm::vec4(glm::mix(BoundsMin, BoundsMax, T), 0.f);
+		Light.Colour = glm::vec3(0.2f) + glm::vec3(Unit(Generator), Unit(Generator), Unit(Generator)) * 0.8f;
+		Light.Radius = 0.5f + Unit(Generator) * 1.5f;
+		FogLightsData.push_back(Light);
+	}
+}
+
+void VulkanVolumetrics::UpdateFrameInfo()
+{
+	FrameData.PrevViewProj = ViewProj;
+	FrameData.PrevViewPos = ViewPos;
+
+	ViewProj = pCamera->matrices.perspective * pCamera->matrices.view;
+	ViewPos = pExampleBase->uniformDataComposition.viewPos;
+	FrameData.InvViewProj = glm::inverse(ViewProj);
+
+	// The fused kernel has no froxel grid to keep as the history
+	if (!TemporalEnabled || FusedKernelActive())
+	{
+		FrameData.DepthJitter = 0.0f;
+		FrameData.HistoryValid = 0;
+		return;
+	}
+
+	if (HistoryInvalid)
+	{
+		TemporalFrameIndex = 0;
+	}
+
+	// Base 2 Halton sequence, spreads the samples evenly through each slice over consecutive frames
+	float Jitter = 0.0f;
+	float Fraction = 0.5f;
+	for (uint32_t Index = (TemporalFrameIndex % 16) + 1; Index > 0; Index /= 2)
+	{
+		Jitter += Fraction * static_cast<float>(Index % 2);
+		Fraction *= 0.5f;
+	}
+	FrameData.DepthJitter = Jitter;
+	FrameData.HistoryValid = HistoryInvalid ? 0 : 1;
+
+	HistoryInvalid = false;
+	++TemporalFrameIndex;
+}
+
+void VulkanVolumetrics::ReadStageTimes()
+{
+	// Only use frames the profiler has read back since the last call, it skips the ones which weren't ready
+	const GpuProfiler& Profiler = pExampleBase->profiler;
+	if (!Profiler.Supported(GpuPass::VolumetricsFirstStage) || Profiler.FramesRead() == ProfilerFrameRead)
+	{
+		return;
+	}
+	ProfilerFrameRead = Profiler.FramesRead();
+
+	FirstStageGPUTime = Profiler.PassTime(GpuPass::VolumetricsFirstStage);
+	SecondStageGPUTime = Profiler.PassTime(GpuPass::VolumetricsSecondStage);
+
+	// The fused kernel doesn't store the froxels, so it says nothing about the storage formats
+	if (!FusedKernelActive())
+	{
+		FroxelStorageStats& Stats = FroxelStorageResults[VolumetricsData.StorageFormat];
+		Stats.MemorySize = FroxelMemorySize;
+		Stats.FirstStageMs = Stats.Measured ? Stats.FirstStageMs + (FirstStageGPUTime - Stats.FirstStageMs) * 0.05f : FirstStageGPUTime;
+		Stats.SecondStageMs = Stats.Measured ? Stats.SecondStageMs + (SecondStageGPUTime - Stats.SecondStageMs) * 0.05f : SecondStageGPUTime;
+		Stats.Measured = true;
+	}
+
+	if (Governor.Enabled && Governor.Update(FirstStageGPUTime + SecondStageGPUTime))
+	{
+		ApplyQualityLevel(Governor.CurrentLevel());
+	}
+}
+
+int32_t VulkanVolumetrics::GovernorLevelForPreset(int32_t presetIndex) const
+{
+	// The first level using the preset at full light quality
+	for (int32_t i = 0; i < static_cast<int32_t>(VolumetricsGovernor::s_Levels.size()); ++i)
+	{
+		if (static_cast<int32_t>(VolumetricsGovernor::s_Levels[i].PresetIndex) == presetIndex)
+		{
+			return i;
+		}
+	}
+	return 0;
+}
+
+void VulkanVolumetrics::ApplyQualityLevel(const VolumetricsQualityLevel& level)
+{
+	FroxelPresetIndex = static_cast<int32_t>(level.PresetIndex);
+	const FroxelGridPreset& Preset = s_FroxelGridPresets[FroxelPresetIndex];
+	ResizeFroxelGrid(Preset.Width, Preset.Height, Preset.Depth);
+
+	VolumetricsData.LightMarchSize = GovernorBaseLightMarchSize * level.LightMarchScale;
+	FrameData.LightLimit = level.LightLimit;
+	HistoryInvalid = true;
+}
+
+void VulkanVolumetrics::SetGovernorEnabled(bool enabled)
+{
+	Governor.Enabled = enabled;
+	if (enabled)
+	{
+		// The governor scales the light march from the user's setting
+		GovernorBaseLightMarchSize = VolumetricsData.LightMarchSize;
+		Governor.Reset(GovernorLevelForPreset(FroxelPresetIndex));
+		ApplyQualityLevel(Governor.CurrentLevel());
+	}
+	else
+	{
+		VolumetricsData.LightMarchSize = GovernorBaseLightMarchSize;
+		FrameData.LightLimit = VolumetricsQualityLevel::s_AllLights;
+		HistoryInvalid = true;
+	}
+}
+
+void VulkanVolumetrics::UpdateBuffers(uint32_t frameSlot)
+{
+	VKS_CPU_ZONE("VulkanVolumetrics::UpdateBuffers");
+
+	float DTime = FixedFrameTime >= 0.f ? FixedFrameTime : static_cast<float>(FrameTimer.total_elapsed()) / 1000.f;
+	FrameTimer.restart();
+
+	// The grid written by the other slot last frame becomes the history
+	CurrentFroxelIndex = frameSlot;
+
+	ReadStageTimes();
+
+	VolumetricsData.NoiseXOffset += DTime * XWindSpeed;
+	VolumetricsData.NoiseXOffset = fmodf(VolumetricsData.NoiseXOffset, FLT_MAX - 10.f);
+	VolumetricsData.NoiseYOffset += DTime * YWindSpeed;
+	VolumetricsData.NoiseYOffset = fmodf(VolumetricsData.NoiseYOffset, FLT_MAX - 10.f);
+	VolumetricsData.NoiseZOffset += DTime * ZWindSpeed;
+	VolumetricsData.NoiseZOffset = fmodf(VolumetricsData.NoiseZOffset, FLT_MAX - 10.f);
+	if (StepFallOffMult == 0.f)
+	{
+		VolumetricsData.StepFallOff = 0.f;
+	}
+	else
+	{
+		VolumetricsData.StepFallOff = StepFallOffMult / 100.f;
+	}
+
+	UpdateFrameInfo();
+
+	if (FogShapesDirty)
+	{
+		UploadFogShapes();
+	}
+
+	if (TransmittanceData.Enabled != 0 && (TransmittanceDirty || TransmittanceOutOfDate()))
+	{
+		UpdateTransmittanceInfo();
+	}
+
+	// The settings were changed to ones the recorded pipelines weren't specialised for
+	if (CurrentPipelineKey().Hash() != RecordedPipelineKey)
+	{
+		BuildCommandBuffers();
+	}
+
+	vks::Buffer& VolumetricsBuff = VolumetricsBuffs[CurrentFroxelIndex];
+	VolumetricsBuff.map();
+	memcpy(VolumetricsBuff.mapped, &VolumetricsData, sizeof(VolumetricsData));
+	VolumetricsBuff.unmap();
+	vks::Buffer& FrameBuff = FrameBuffs[CurrentFroxelIndex];
+	FrameBuff.map();
+	memcpy(FrameBuff.mapped, &FrameData, sizeof(VolumetricsFrameInfo));
+	FrameBuff.unmap();
+	vks::Buffer& TransmittanceBuff = TransmittanceBuffs[CurrentFroxelIndex];
+	TransmittanceBuff.map();
+	memcpy(TransmittanceBuff.mapped, &TransmittanceData, sizeof(TransmittanceInfo));
+	TransmittanceBuff.unmap();
+
+	UpdateFogLights();
+	vks::Buffer& FogLightsBuff = FogLightsBuffs[CurrentFroxelIndex];
+	FogLightsBuff.map();
+	FogLightsInfo LightsHeader{ glm::uvec4(static_cast<glm::u32>(FogLightsData.size()), 0, 0, 0) };
+	memcpy(FogLightsBuff.mapped, &LightsHeader, sizeof(FogLightsInfo));
+	memcpy(static_cast<uint8_t*>(FogLightsBuff.mapped) + sizeof(FogLightsInfo), FogLightsData.data(), FogLightsData.size() * sizeof(FogLight));
+	FogLightsBuff.unmap();
+	SettingsOOD = false;
+}
+
+VkSemaphore* VulkanVolumetrics::SubmitCommands(VkSemaphore* pWaitSemaphore)
+{
+	VKS_CPU_ZONE("VulkanVolumetrics::SubmitCommands");
+
+	// Rebuild the transmittance volume ahead of the first stage, it only depends on the volumetrics buffers
+	// so doesn't need to wait on the G-Buffer. The first stage's barrier orders it against the writes.
+	if (TransmittanceData.Enabled != 0 && TransmittanceDirty)
+	{
+		BuildTransmittanceCommandBuffer();
+
+		VkSubmitInfo TransmittanceSubmitInfo = vks::initializers::submitInfo();
+		TransmittanceSubmitInfo.commandBufferCount = 1;
+		TransmittanceSubmitInfo.pCommandBuffers = &TransmittancePipeline.CmdBuffs[CurrentFroxelIndex];
+		VK_CHECK_RESULT(vkQueueSubmit(ComputeQueue, 1, &TransmittanceSubmitInfo, VK_NULL_HANDLE));
+
+		TransmittanceDirty = false;
+		++TransmittanceBuildCount;
+	}
+
+	// Submit First Stage
+	// It only reads the froxel history and the per frame buffers, so it starts straight away and runs alongside the G-Buffer
+	SubmitInfo.pWaitSemaphores = nullptr;
+	SubmitInfo.waitSemaphoreCount = 0;
+
+	SubmitInfo.pSignalSemaphores = &ComputePipelines[0].Semaphores[CurrentFroxelIndex];
+
+	SubmitInfo.pCommandBuffers = &ComputePipelines[0].CmdBuffs[CurrentFroxelIndex];
+	VK_CHECK_RESULT(vkQueueSubmit(ComputeQueue, 1, &SubmitInfo, VK_NULL_HANDLE));
+
+
+	// Submit Second Stage
+
+	// Wait on the previous stage to complete, and on the G-Buffer positions if a semaphore was passed in
+	const std::array<VkSemaphore, 2> WaitSemaphores = { ComputePipelines[0].Semaphores[CurrentFroxelIndex], (pWaitSemaphore != VK_NULL_HANDLE) ? *pWaitSemaphore : VK_NULL_HANDLE };
+	const std::array<VkPipelineStageFlags, 2> WaitStageFlags = { SubmitStageFlag, SubmitStageFlag };
+	SubmitInfo.pWaitSemaphores = WaitSemaphores.data();
+	SubmitInfo.pWaitDstStageMask = WaitStageFlags.data();
+	SubmitInfo.waitSemaphoreCount = (pWaitSemaphore != VK_NULL_HANDLE) ? 2 : 1;
+
+	SubmitInfo.pSignalSemaphores = &ComputePipelines[1].Semaphores[CurrentFroxelIndex];
+
+	SubmitInfo.pCommandBuffers = &ComputePipelines[1].CmdBuffs[CurrentFroxelIndex];
+	VK_CHECK_RESULT(vkQueueSubmit(ComputeQueue, 1, &SubmitInfo, VK_NULL_HANDLE));
+	SubmitInfo.pWaitDstStageMask = &SubmitStageFlag;
+
+	return &ComputePipelines[1].Semaphores[CurrentFroxelIndex];
+}
+
+void VulkanVolumetrics::ResizeFroxelGrid(uint32_t width, uint32_t height, uint32_t depth)
+{
+	if (width == VolumetricsData.MapWidth && height == VolumetricsData.MapHeight && depth == VolumetricsData.MapDepth)
+	{
+		return;
+	}
+
+	// The old grid may still be in use by the last submitted frame
+	vkQueueWaitIdle(ComputeQueue);
+
+	// Scale the slices so the same depth range is covered with the new number of slices, the exponential distribution
+	// always spans Near to SliceFar
+	const float SliceScale = static_cast<float>(VolumetricsData.MapDepth) / static_cast<float>(depth);
+	VolumetricsData.InitialStepSize *= SliceScale;
+	StepFallOffMult *= SliceScale * SliceScale;
+
+	const uint32_t OldWidth = VolumetricsData.MapWidth;
+	const uint32_t OldHeight = VolumetricsData.MapHeight;
+	const uint32_t OldDepth = VolumetricsData.MapDepth;
+	VolumetricsData.MapWidth = width;
+	VolumetricsData.MapHeight = height;
+	VolumetricsData.MapDepth = depth;
+
+	// The measurements of the storage formats only compare with each other at the same grid size
+	FroxelStorageResults = {};
+
+	SwapFroxelVolumes(OldWidth, OldHeight, OldDepth, VolumetricsData.StorageFormat);
+}
+
+void VulkanVolumetrics::SetFroxelStorageFormat(FroxelStorageFormat format)
+{
+	if (format == VolumetricsData.StorageFormat || !FroxelStorageSupported[format])
+	{
+		return;
+	}
+
+	// The old grid may still be in use by the last submitted frame
+	vkQueueWaitIdle(ComputeQueue);
+
+	const uint32_t OldFormat = VolumetricsData.StorageFormat;
+	VolumetricsData.StorageFormat = format;
+
+	SwapFroxelVolumes(VolumetricsData.MapWidth, VolumetricsData.MapHeight, VolumetricsData.MapDepth, OldFormat);
+}
+
+void VulkanVolumetrics::SwapFroxelVolumes(uint32_t oldWidth, uint32_t oldHeight, uint32_t oldDepth, uint32_t oldFormat)
+{
+	// Keep the old grid around in case it's needed again, e.g. by the governor stepping back up, and reuse a pooled grid
+	// of the new size and format rather than creating it
+	FroxelTexturePool.push_back({ oldWidth, oldHeight, oldDepth, oldFormat, FirstStageTextures, FroxelMemorySize });
+	auto Pooled = std::find_if(FroxelTexturePool.begin(), FroxelTexturePool.end(), [&](const FroxelGridTextures& Entry)
+	{
+		return Entry.Width == VolumetricsData.MapWidth && Entry.Height == VolumetricsData.MapHeight && Entry.Depth == VolumetricsData.MapDepth &&
+			Entry.StorageFormat == VolumetricsData.StorageFormat;
+	});
+	if (Pooled != FroxelTexturePool.end())
+	{
+		FirstStageTextures = Pooled->Volumes;
+		FroxelMemorySize = Pooled->MemorySize;
+		FroxelTexturePool.erase(Pooled);
+	}
+	else
+	{
+		FroxelMemorySize = 0;
+		for (FroxelVolume& Volume : FirstStageTextures)
+		{
+			PrepareFroxelVolume(Volume);
+		}
+	}
+
+	// Release the least recently used grids once the pool is over budget
+	VkDeviceSize PoolMemorySize = 0;
+	for (const FroxelGridTextures& Entry : FroxelTexturePool)
+	{
+		PoolMemorySize += Entry.MemorySize;
+	}
+	while (!FroxelTexturePool.empty() && PoolMemorySize > s_FroxelPoolBudget)
+	{
+		PoolMemorySize -= FroxelTexturePool.front().MemorySize;
+		for (FroxelVolume& Volume : FroxelTexturePool.front().Volumes)
+		{
+			DestroyFroxelVolume(Volume);
+		}
+		FroxelTexturePool.erase(FroxelTexturePool.begin());
+	}
+	FroxelPoolMemorySize = PoolMemorySize;
+
+	UpdateFroxelDescriptors();
+
+	BuildCommandBuffers();
+
+	// The history was built with the old grid
+	HistoryInvalid = true;
+	SettingsOOD = true;
+}
+
+void VulkanVolumetrics::Release(VkDevice& device)
+{
+	// Release the specialised pipelines of every pass
+	for (auto& Entry : PipelineVariants)
+	{
+		const VolumetricsPipelineVariant& Variant = Entry.second;
+		vkDestroyPipeline(device, Variant.FirstStage, nullptr);
+		vkDestroyPipeline(device, Variant.SecondStage, nullptr);
+		vkDestroyPipeline(device, Variant.SecondStageScan, nullptr);
+		vkDestroyPipeline(device, Variant.Fused, nullptr);
+		vkDestroyPipeline(device, Variant.LightCull, nullptr);
+	}
+
+	// Release Second Stage Compute Pipeline resources
+	for (VkSemaphore Semaphore : ComputePipelines[1].Semaphores)
+	{
+		vkDestroySemaphore(device, Semaphore, nullptr);
+	}
+	
+	vkDestroyPipelineLayout(device, ComputePipelines[1].PipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, ComputePipelines[1].DescSetLayout, nullptr);
+
+	// Release Fused Pipeline resources
+	vkDestroyPipelineLayout(device, FusedPipeline.PipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, FusedPipeline.DescSetLayout, nullptr);
+
+	// Release Light Culling Pipeline resources
+	vkDestroyPipelineLayout(device, LightCullPipeline.PipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, LightCullPipeline.DescSetLayout, nullptr);
+
+	// Release Transmittance Pipeline resources
+	vkDestroyPipeline(device, TransmittancePipeline.Pipeline, nullptr);
+	vkDestroyPipelineLayout(device, TransmittancePipeline.PipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, TransmittancePipeline.DescSetLayout, nullptr);
+
+	// Release First Stage Compute Pipeline resources
+	for (VkSemaphore Semaphore : ComputePipelines[0].Semaphores)
+	{
+		vkDestroySemaphore(device, Semaphore, nullptr);
+	}
+	vkDestroyPipelineLayout(device, ComputePipelines[0].PipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, ComputePipelines[0].DescSetLayout, nullptr);
+
+	// Release Additional Descriptor set layout
+	vkDestroyDescriptorSetLayout(device, LightingPassDescSetLayout, nullptr);
+
+	if (TimestampQueryPool != VK_NULL_HANDLE)
+	{
+		vkDestroyQueryPool(device, TimestampQueryPool, nullptr);
+	}
 
 	// Release shared pools
 	vkDestroyCommandPool(device, ComputeCmdPool, nullptr);
 	vkDestroyDescriptorPool(device, DescPool, nullptr);
 
 	// Release Textures and buffers
-	SecondStageTexture.destroy();
-	FirstStageTexture.destroy();
+	for (vks::Texture& SecondStageTexture : SecondStageTextures)
+	{
+		SecondStageTexture.destroy();
+	}
+	for (FroxelVolume& Volume : FirstStageTextures)
+	{
+		DestroyFroxelVolume(Volume);
+	}
+	for (FroxelGridTextures& Entry : FroxelTexturePool)
+	{
+		for (FroxelVolume& Volume : Entry.Volumes)
+		{
+			DestroyFroxelVolume(Volume);
+		}
+	}
+	DummyPackedTexture.destroy();
 
-	PerlinNoise.destroy();
+	TransmittanceTexture.destroy();
+
+	NoiseTexture.destroy();
+
+	for (uint32_t i = 0; i < s_FrameSlots; ++i)
+	{
+		VolumetricsBuffs[i].destroy();
 
-	VolumetricsBuff.destroy();
+		TransmittanceBuffs[i].destroy();
+
+		FrameBuffs[i].destroy();
+
+		FogLightsBuffs[i].destroy();
+	}
 
 	FogShapesBuff.destroy();
+
+	FogGridBuff.destroy();
+
+	ClusterLightsBuff.destroy();
+
+	ClusterCountersBuff.destroy();
+}
+
+void VulkanVolumetrics::RunCPUReference()
+{
+	CPUReferenceRequested = false;
+
+	// Make sure the last frame's volumetrics have finished before reading anything back
+	vkDeviceWaitIdle(*pDevice);
+
+	// Read back the G-Buffer positions the second stage ends its rays at, from the frame slot it last ran in
+	const uint32_t PositionWidth = static_cast<uint32_t>(pExampleBase->offScreenFrameBuf.width);
+	const uint32_t PositionHeight = static_cast<uint32_t>(pExampleBase->offScreenFrameBuf.height);
+	std::vector<uint64_t> PackedPositions(static_cast<size_t>(PositionWidth) * PositionHeight);
+	pDevice->copyImageToHost(pExampleBase->offScreenFrameBuf.slots[CurrentFroxelIndex].position.image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		{ PositionWidth, PositionHeight, 1 }, sizeof(uint64_t), pExampleBase->queue, PackedPositions.data());
+
+	// Position target is R16G16B16A16_SFLOAT
+	std::vector<glm::vec4> Positions(PackedPositions.size());
+	for (size_t i = 0; i < PackedPositions.size(); ++i)
+	{
+		Positions[i] = glm::unpackHalf4x16(PackedPositions[i]);
+	}
+	PackedPositions.clear();
+
+	const vks::Texture& SecondStageTexture = SecondStageTextures[CurrentFroxelIndex];
+
+	VolumetricsCPU Reference;
+	Reference.SetNoise(NoiseData);
+	Reference.SetLights(FogLightsData);
+	Reference.SetPositions(std::move(Positions), PositionWidth, PositionHeight);
+
+	const FroxelVolume& CurrentFroxels = FirstStageTextures[CurrentFroxelIndex];
+	const FroxelVolume& HistoryFroxels = FirstStageTextures[(CurrentFroxelIndex + 1) % FirstStageTextures.size()];
+
+	// The first stage blended its result with the grid written the frame before, which hasn't been touched since
+	if (FrameData.HistoryValid != 0)
+	{
+		Reference.SetHistory(ReadbackFroxels(HistoryFroxels));
+	}
+
+	// The transmittance volume is only rebuilt once its inputs drift, so use the ones it was last built with
+	if (TransmittanceData.Enabled != 0)
+	{
+		VulkanExample::UniformDataComposition BuiltScene = pExampleBase->uniformDataComposition;
+		BuiltScene.lightCount = TransmittanceBuiltLightCount;
+		Reference.RunTransmittance(TransmittanceBuiltInfo, TransmittanceData, FogShapesData, FogGridData, BuiltScene);
+	}
+
+	// All UBOs were uploaded from these in the last UpdateBuffers call
+	Reference.Run(VolumetricsData, FrameData, TransmittanceData, FogShapesData, FogGridData, pExampleBase->uniformDataComposition, SecondStageTexture.width, SecondStageTexture.height);
+
+	// Read back the GPU output of both stages, the fused kernel never writes the froxel grid
+	const bool Fused = FusedKernelActive();
+	const std::vector<uint32_t> GPUFirstStage = Fused ? std::vector<uint32_t>() : ReadbackFroxels(CurrentFroxels);
+	std::vector<uint32_t> GPUSecondStage(Reference.SecondStageMap.size());
+	pDevice->copyImageToHost(SecondStageTexture.image, SecondStageTexture.imageLayout,
+		{ SecondStageTexture.width, SecondStageTexture.height, 1 }, sizeof(uint32_t), pExampleBase->queue, GPUSecondStage.data());
+
+	const VolumetricsCPU::Difference FirstStageDiff = Fused ? VolumetricsCPU::Difference{} : VolumetricsCPU::Compare(Reference.FirstStageMap, GPUFirstStage);
+	const VolumetricsCPU::Difference SecondStageDiff = VolumetricsCPU::Compare(Reference.SecondStageMap, GPUSecondStage);
+
+	// Keep both sets of results on disk so they can be inspected and diffed with external tools
+	VolumetricsCPU::SaveRaw("volumetrics_cpu_firststage.rgba", Reference.FirstStageMap);
+	if (!Fused)
+	{
+		VolumetricsCPU::SaveRaw("volumetrics_gpu_firststage.rgba", GPUFirstStage);
+	}
+	VolumetricsCPU::SavePAM("volumetrics_cpu_secondstage.pam", Reference.SecondStageMap, SecondStageTexture.width, SecondStageTexture.height);
+	VolumetricsCPU::SavePAM("volumetrics_gpu_secondstage.pam", GPUSecondStage, SecondStageTexture.width, SecondStageTexture.height);
+
+	std::stringstream Report;
+	Report << std::fixed << std::setprecision(2);
+	Report << "CPU reference (" << simd::Name << ", " << Reference.ThreadCount << " threads, " << s_FroxelStorageNames[VolumetricsData.StorageFormat] << " froxels)\n";
+	if (TransmittanceData.Enabled != 0)
+	{
+		Report << "Transmittance: " << Reference.TransmittanceTime << " ms\n";
+	}
+	if (Fused)
+	{
+		Report << "First stage: " << Reference.FirstStageTime << " ms, not compared as the fused kernel keeps the froxels in shared memory\n";
+	}
+	else
+	{
+		Report << "First stage: " << Reference.FirstStageTime << " ms, max error " << FirstStageDiff.MaxError << ", RMSE " << FirstStageDiff.RMSE << ", " << FirstStageDiff.MismatchedTexels << " texels differ\n";
+	}
+	Report << "Second stage (" << (Fused ? "fused" : (SecondStageScanEnabled ? "scan" : "serial")) << " on the GPU): " << Reference.SecondStageTime << " ms, max error " << SecondStageDiff.MaxError << ", RMSE " << SecondStageDiff.RMSE << ", " << SecondStageDiff.MismatchedTexels << " texels differ";
+	CPUReferenceReport = Report.str();
+	std::cout << CPUReferenceReport << "\n";
+}
+
+void VulkanVolumetrics::RunScalingBenchmark()
+{
+	ScalingBenchmarkRequested = false;
+
+	if (TimestampQueryPool == VK_NULL_HANDLE)
+	{
+		ScalingBenchmarkReport = "Timestamps aren't supported on the compute queue";
+		std::cout << ScalingBenchmarkReport << "\n";
+		return;
+	}
+
+	vkDeviceWaitIdle(*pDevice);
+
+	const FogShapes SavedShapes = FogShapesData;
+	const bool SavedGridEnabled = FogGridEnabled;
+
+	static const std::array<uint32_t, 7> s_PrimitiveCounts = { 3, 16, 64, 256, 1024, 2048, 4096 };
+	static constexpr uint32_t s_Iterations = 8;
+
+	// Reuse one of the first stage's descriptor sets, both frame slots do the same amount of work
+	VkCommandBuffer CmdBuff = TransmittancePipeline.CmdBuffs[CurrentFroxelIndex];
+	const VkDescriptorSet FirstStageDescSet = ComputePipelines[0].DescSets[CurrentFroxelIndex];
+	vks::Buffer& TransmittanceBuff = TransmittanceBuffs[CurrentFroxelIndex];
+
+	std::stringstream Report;
+	Report << std::fixed << std::setprecision(3);
+	Report << "Fog scaling (" << VolumetricsData.MapWidth << " x " << VolumetricsData.MapHeight << " x " << VolumetricsData.MapDepth
+		<< ", transmittance " << (TransmittanceData.Enabled != 0 ? "on" : "off") << ")\n";
+	Report << "primitives, grid, transmittance ms, first stage ms, max per cell\n";
+
+	std::ofstream Csv("volumetrics_fogscaling.csv");
+	Csv << "primitives,grid,transmittance_ms,first_stage_ms,max_cell_primitives\n";
+
+	for (uint32_t Count : s_PrimitiveCounts)
+	{
+		// Scatter a mix of shapes through the same region, shrinking them as the count grows so the amount of fog stays similar
+		// and only the cost of evaluating the shapes changes
+		std::mt19937 Random(Count);
+		std::uniform_real_distribution<float> UnitDist(0.f, 1.f);
+		const float Scale = 3.5f * std::cbrt(3.f / static_cast<float>(Count));
+		FogShapesData.Primitives.resize(Count);
+		for (uint32_t i = 0; i < Count; ++i)
+		{
+			FogPrimitive& Primitive = FogShapesData.Primitives[i];
+			Primitive.Pos = glm::vec3(-8.f, -6.f, -6.f) + glm::vec3(UnitDist(Random), UnitDist(Random), UnitDist(Random)) * glm::vec3(16.f, 14.f, 8.f);
+			Primitive.Radius = Scale * (0.5f + UnitDist(Random));
+			Primitive.Extent = Scale * (glm::vec3(0.25f) + glm::vec3(UnitDist(Random), UnitDist(Random), UnitDist(Random)));
+			Primitive.Type = i % FogPrimitiveTypeCount;
+		}
+
+		for (bool GridEnabled : { true, false })
+		{
+			FogGridEnabled = GridEnabled;
+			UploadFogShapes();
+			UpdateTransmittanceInfo();
+			TransmittanceBuff.map();
+			memcpy(TransmittanceBuff.mapped, &TransmittanceData, sizeof(TransmittanceInfo));
+			TransmittanceBuff.unmap();
+
+			VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+			VK_CHECK_RESULT(vkBeginCommandBuffer(CmdBuff, &cmdBufInfo));
+
+			vkCmdResetQueryPool(CmdBuff, TimestampQueryPool, s_BenchmarkFirstQuery, s_BenchmarkQueryCount);
+			vkCmdWriteTimestamp(CmdBuff, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, TimestampQueryPool, s_BenchmarkFirstQuery + 0);
+
+			if (TransmittanceData.Enabled != 0)
+			{
+				vkCmdBindPipeline(CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, TransmittancePipeline.Pipeline);
+				vkCmdBindDescriptorSets(CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, TransmittancePipeline.PipelineLayout, 0, 1, &TransmittancePipeline.DescSets[CurrentFroxelIndex], 0, 0);
+				for (int32_t LightIndex = 0; LightIndex < std::min(TransmittanceBuiltLightCount, static_cast<int32_t>(s_MaxTransmittanceLights)); ++LightIndex)
+				{
+					vkCmdPushConstants(CmdBuff, TransmittancePipeline.PipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(int32_t), &LightIndex);
+					vkCmdDispatch(CmdBuff, (s_TransmittanceResolution + 3) / 4, (s_TransmittanceResolution + 3) / 4, (s_TransmittanceResolution + 3) / 4);
+				}
+			}
+
+			VkMemoryBarrier TransmittanceBarrier = vks::initializers::memoryBarrier();
+			TransmittanceBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			TransmittanceBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			vkCmdPipelineBarrier(CmdBuff, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &TransmittanceBarrier, 0, nullptr, 0, nullptr);
+			vkCmdWriteTimestamp(CmdBuff, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, TimestampQueryPool, s_BenchmarkFirstQuery + 1);
+
+			vkCmdBindPipeline(CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, GetPipelineVariant().FirstStage);
+			vkCmdBindDescriptorSets(CmdBuff, VK_PIPELINE_BIND_POINT_COMPUTE, ComputePipelines[0].PipelineLayout, 0, 1, &FirstStageDescSet, 0, 0);
+			vkCmdDispatch(CmdBuff, (VolumetricsData.MapWidth + 7) / 8, (VolumetricsData.MapHeight + 7) / 8, (VolumetricsData.MapDepth + 7) / 8);
+
+			vkCmdWriteTimestamp(CmdBuff, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, TimestampQueryPool, s_BenchmarkFirstQuery + 2);
+
+			VK_CHECK_RESULT(vkEndCommandBuffer(CmdBuff));
+
+			double TransmittanceTime = 0.0;
+			double FirstStageTime = 0.0;
+			for (uint32_t Iteration = 0; Iteration < s_Iterations; ++Iteration)
+			{
+				VkSubmitInfo BenchmarkSubmitInfo = vks::initializers::submitInfo();
+				BenchmarkSubmitInfo.commandBufferCount = 1;
+				BenchmarkSubmitInfo.pCommandBuffers = &CmdBuff;
+				VK_CHECK_RESULT(vkQueueSubmit(ComputeQueue, 1, &BenchmarkSubmitInfo, VK_NULL_HANDLE));
+				VK_CHECK_RESULT(vkQueueWaitIdle(ComputeQueue));
+
+				std::array<uint64_t, s_BenchmarkQueryCount> Timestamps{};
+				VK_CHECK_RESULT(vkGetQueryPoolResults(*pDevice, TimestampQueryPool, s_BenchmarkFirstQuery, s_BenchmarkQueryCount, sizeof(Timestamps), Timestamps.data(), sizeof(uint64_t),
+					VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+				const double Period = static_cast<double>(pDevice->properties.limits.timestampPeriod) / 1000000.0;
+				TransmittanceTime += static_cast<double>(Timestamps[1] - Timestamps[0]) * Period;
+				FirstStageTime += static_cast<double>(Timestamps[2] - Timestamps[1]) * Period;
+			}
+			TransmittanceTime /= s_Iterations;
+			FirstStageTime /= s_Iterations;
+
+			Report << Count << ", " << (GridEnabled ? "on" : "off") << ", " << TransmittanceTime << ", " << FirstStageTime << ", " << FogGridData.MaxCellCount << "\n";
+			Csv << Count << "," << (GridEnabled ? 1 : 0) << "," << TransmittanceTime << "," << FirstStageTime << "," << FogGridData.MaxCellCount << "\n";
+		}
+	}
+
+	// Put the scene back the way it was
+	FogShapesData = SavedShapes;
+	FogGridEnabled = SavedGridEnabled;
+	UploadFogShapes();
+	UpdateTransmittanceInfo();
+	HistoryInvalid = true;
+
+	ScalingBenchmarkReport = Report.str();
+	std::cout << ScalingBenchmarkReport;
 }
 
-static int s_CurrentIMGUISphere = 0;
+static int s_CurrentIMGUIPrimitive = 0;
 
 void VulkanVolumetrics::UpdateOverlay(vks::UIOverlay* overlay)
 {
 	if (overlay->header("Fog Settings"))
 	{
+		bool SettingsChanged = false;
 
+		std::vector<std::string> PresetNames;
+		for (const FroxelGridPreset& Preset : s_FroxelGridPresets)
+		{
+			PresetNames.push_back(Preset.Name);
+		}
+		if (overlay->comboBox("Froxel Grid", &FroxelPresetIndex, PresetNames))
+		{
+			const FroxelGridPreset& Preset = s_FroxelGridPresets[FroxelPresetIndex];
+			ResizeFroxelGrid(Preset.Width, Preset.Height, Preset.Depth);
+			// Carry on governing from the picked grid
+			if (Governor.Enabled)
+			{
+				Governor.Reset(GovernorLevelForPreset(FroxelPresetIndex));
+				ApplyQualityLevel(Governor.CurrentLevel());
+			}
+		}
+
+		// Only offer the storage formats the device supports
+		std::vector<std::string> StorageNames;
+		std::vector<FroxelStorageFormat> StorageFormats;
+		int32_t StorageIndex = 0;
+		for (uint32_t i = 0; i < FroxelStorageCount; ++i)
+		{
+			if (FroxelStorageSupported[i])
+			{
+				if (i == VolumetricsData.StorageFormat)
+				{
+					StorageIndex = static_cast<int32_t>(StorageFormats.size());
+				}
+				StorageNames.push_back(s_FroxelStorageNames[i]);
+				StorageFormats.push_back(static_cast<FroxelStorageFormat>(i));
+			}
+		}
+		if (overlay->comboBox("Froxel Storage", &StorageIndex, StorageNames))
+		{
+			SetFroxelStorageFormat(StorageFormats[StorageIndex]);
+		}
 		overlay->text("Volumetrics Resolution:\n");
 		overlay->text("Width: %d", VolumetricsData.MapWidth);
 		overlay->text("Height: %d", VolumetricsData.MapHeight);
 		overlay->text("Depth: %d", VolumetricsData.MapDepth);
-		overlay->sliderFloat("Albedo R", &VolumetricsData.Albedo.r, 0.f, 1.f);
-		overlay->sliderFloat("Albedo G", &VolumetricsData.Albedo.g, 0.f, 1.f);
-		overlay->sliderFloat("Albedo B", &VolumetricsData.Albedo.b, 0.f, 1.f);
-
-		overlay->sliderFloat("InitialStepSize", &VolumetricsData.InitialStepSize, 0.01f, 0.1f);
-		overlay->sliderFloat("StepFallOff 10^-2", &StepFallOffMult, 0.0f, 1.0f);
-
-		overlay->sliderFloat("LightStepSize", &VolumetricsData.LightMarchSize, 0.01f, 0.2f);
-		overlay->sliderFloat("AbsorptionCoefficient", &VolumetricsData.Absorption, 0.01f, 1.f);
-		overlay->sliderFloat("Max Density", &VolumetricsData.Density, 0.01f, 1.f);
-		overlay->sliderFloat("AbsorptionCutoff", &VolumetricsData.AbsorptionCutoff, 0.f, 1.f);
-		overlay->sliderFloat("LightAbsorptionCutoff", &VolumetricsData.LightAbsorptionCutoff, 0.f, 1.f);
-
-		overlay->sliderFloat("NoiseXTile", &VolumetricsData.NoiseXTile, 0.05f, 40.f);
-		overlay->sliderFloat("NoiseYTile", &VolumetricsData.NoiseYTile, 0.05f, 40.f);
-		overlay->sliderFloat("NoiseZTile", &VolumetricsData.NoiseZTile, 0.05f, 40.f);
-		overlay->sliderFloat("NoiseFactor", &VolumetricsData.NoiseFactor, 0.1f, 15.f);
+		overlay->text("Froxel memory: %.1f MB, pooled %.1f MB", static_cast<float>(FroxelMemorySize) / (1024.f * 1024.f), static_cast<float>(FroxelPoolMemorySize) / (1024.f * 1024.f));
+		overlay->text("Noise volume: %u^3, %s in %.1f ms", NoiseData.Params.Resolution, NoiseData.CacheHit ? "cached" : "generated", NoiseData.LoadTime);
+		overlay->text("Output: %d x %d", SecondStageTextures[0].width, SecondStageTextures[0].height);
+
+		if (pExampleBase->profiler.Supported(GpuPass::VolumetricsFirstStage))
+		{
+			if (FusedKernelActive())
+			{
+				overlay->text("GPU: light culling %.2f ms, fused %.2f ms", FirstStageGPUTime, SecondStageGPUTime);
+			}
+			else
+			{
+				overlay->text("GPU: first stage %.2f ms, second stage %.2f ms", FirstStageGPUTime, SecondStageGPUTime);
+			}
+
+			// Compare the storage formats measured so far at this grid size
+			for (uint32_t i = 0; i < FroxelStorageCount; ++i)
+			{
+				const FroxelStorageStats& Stats = FroxelStorageResults[i];
+				if (Stats.Measured)
+				{
+					overlay->text("%s: %.1f MB, %.2f / %.2f ms", s_FroxelStorageNames[i], static_cast<float>(Stats.MemorySize) / (1024.f * 1024.f), Stats.FirstStageMs, Stats.SecondStageMs);
+				}
+			}
+
+			bool GovernorEnabled = Governor.Enabled;
+			if (overlay->checkBox("Quality Governor", &GovernorEnabled))
+			{
+				SetGovernorEnabled(GovernorEnabled);
+			}
+			if (Governor.Enabled)
+			{
+				overlay->sliderFloat("Budget (ms)", &Governor.BudgetMs, 0.25f, 16.f);
+				overlay->text("Level %d: %s, smoothed %.2f ms", Governor.Level, Governor.CurrentLevel().Name, Governor.SmoothedMs);
+				for (const std::string& Decision : Governor.RecentDecisions)
+				{
+					overlay->text("%s", Decision.c_str());
+				}
+			}
+		}
+
+		if (overlay->checkBox("Temporal Accumulation", &TemporalEnabled))
+		{
+			HistoryInvalid = true;
+		}
+		overlay->sliderFloat("History Blend", &FrameData.HistoryBlend, 0.02f, 1.f);
+
+		if (overlay->checkBox("Second Stage Depth Scan", &SecondStageScanEnabled))
+		{
+			BuildCommandBuffers();
+		}
+
+		// The grids written while fused are stale by the time the two stages take over again
+		if (overlay->checkBox("Fused Kernel", &FusedEnabled))
+		{
+			BuildCommandBuffers();
+			HistoryInvalid = true;
+		}
+		if (FusedEnabled && !FusedKernelActive())
+		{
+			overlay->text("Froxel grid larger than the output, using both stages");
+		}
+
+		bool TransmittanceEnabled = TransmittanceData.Enabled != 0;
+		if (overlay->checkBox("Light Transmittance Volume", &TransmittanceEnabled))
+		{
+			TransmittanceData.Enabled = TransmittanceEnabled ? 1 : 0;
+			TransmittanceDirty = true;
+			HistoryInvalid = true;
+		}
+		if (TransmittanceEnabled)
+		{
+			overlay->sliderFloat("Transmittance Noise Tolerance", &TransmittanceNoiseTolerance, 0.f, 1.f);
+			const float TransmittanceMemory = static_cast<float>(s_TransmittanceResolution * s_TransmittanceResolution * s_TransmittanceResolution * s_MaxTransmittanceLights * sizeof(float));
+			overlay->text("Transmittance rebuilds: %u (%.1f MB)", TransmittanceBuildCount, TransmittanceMemory / (1024.f * 1024.f));
+		}
+
+		if (overlay->sliderInt("Extra Fog Lights", &ExtraFogLightCount, 0, static_cast<int32_t>(s_MaxFogLights - s_MaxTransmittanceLights)))
+		{
+			HistoryInvalid = true;
+		}
+		{
+			ClusterLightsInfo Counters{};
+			ClusterCountersBuff.map();
+			memcpy(&Counters, ClusterCountersBuff.mapped, sizeof(ClusterLightsInfo));
+			ClusterCountersBuff.unmap();
+			overlay->text("Fog lights: %u, cluster light indices: %u, dropped %u", static_cast<uint32_t>(FogLightsData.size()), Counters.Counters.x, Counters.Counters.y);
+		}
+
+		SettingsChanged |= overlay->sliderFloat("Albedo R", &VolumetricsData.Albedo.r, 0.f, 1.f);
+		SettingsChanged |= overlay->sliderFloat("Albedo G", &VolumetricsData.Albedo.g, 0.f, 1.f);
+		SettingsChanged |= overlay->sliderFloat("Albedo B", &VolumetricsData.Albedo.b, 0.f, 1.f);
+
+		int32_t Distribution = static_cast<int32_t>(VolumetricsData.SliceDistribution);
+		if (overlay->comboBox("Slice Distribution", &Distribution, { "Quadratic", "Exponential" }))
+		{
+			VolumetricsData.SliceDistribution = static_cast<glm::u32>(Distribution);
+			SettingsChanged = true;
+		}
+		if (VolumetricsData.SliceDistribution == SliceDistributionExponential)
+		{
+			SettingsChanged |= overlay->sliderFloat("Slice Far", &VolumetricsData.SliceFar, 1.f, 100.f);
+			SettingsChanged |= overlay->sliderFloat("Slice Curvature", &VolumetricsData.SliceCurvature, 0.1f, 10.f);
+		}
+		else
+		{
+			SettingsChanged |= overlay->sliderFloat("InitialStepSize", &VolumetricsData.InitialStepSize, 0.01f, 1.0f);
+			SettingsChanged |= overlay->sliderFloat("StepFallOff 10^-2", &StepFallOffMult, 0.0f, 1.0f);
+		}
+
+		if (overlay->sliderFloat("LightStepSize", &VolumetricsData.LightMarchSize, 0.01f, 0.2f))
+		{
+			SettingsChanged = true;
+			if (Governor.Enabled)
+			{
+				GovernorBaseLightMarchSize = VolumetricsData.LightMarchSize / Governor.CurrentLevel().LightMarchScale;
+			}
+		}
+		SettingsChanged |= overlay->sliderFloat("AbsorptionCoefficient", &VolumetricsData.Absorption, 0.01f, 1.f);
+		SettingsChanged |= overlay->sliderFloat("Max Density", &VolumetricsData.Density, 0.01f, 1.f);
+		SettingsChanged |= overlay->sliderFloat("AbsorptionCutoff", &VolumetricsData.AbsorptionCutoff, 0.f, 1.f);
+		SettingsChanged |= overlay->sliderFloat("LightAbsorptionCutoff", &VolumetricsData.LightAbsorptionCutoff, 0.f, 1.f);
+
+		SettingsChanged |= overlay->sliderFloat("NoiseXTile", &VolumetricsData.NoiseXTile, 0.05f, 40.f);
+		SettingsChanged |= overlay->sliderFloat("NoiseYTile", &VolumetricsData.NoiseYTile, 0.05f, 40.f);
+		SettingsChanged |= overlay->sliderFloat("NoiseZTile", &VolumetricsData.NoiseZTile, 0.05f, 40.f);
+		SettingsChanged |= overlay->sliderFloat("NoiseFactor", &VolumetricsData.NoiseFactor, 0.1f, 15.f);
 		overlay->sliderFloat("WindSpeed X", &XWindSpeed, -5.f, 5.f);
 		overlay->sliderFloat("WindSpeed Y", &YWindSpeed, -5.f, 5.f);
 		overlay->sliderFloat("WindSpeed Z", &ZWindSpeed, -5.f, 5.f);
 
 		overlay->text("\nSDF Data:");
-		overlay->sliderFloat("SmoothFactor", &VolumetricsData.SmoothFactor, 0.f, 1.f);
-		overlay->sliderInt("SphereIdx", &s_CurrentIMGUISphere, 0, 2);
+		if (overlay->sliderFloat("SmoothFactor", &VolumetricsData.SmoothFactor, 0.f, 1.f))
+		{
+			// The grid cells are grown by the smooth factor
+			FogShapesDirty = true;
+			SettingsChanged = true;
+		}
 
-		overlay->sliderFloat("Sphere X Pos", &FogShapesData.Spheres[s_CurrentIMGUISphere].Pos[0], -20.f, 20.f);
-		overlay->sliderFloat("Sphere Y Pos", &FogShapesData.Spheres[s_CurrentIMGUISphere].Pos[1], -20.f, 20.f);
-		overlay->sliderFloat("Sphere Z Pos", &FogShapesData.Spheres[s_CurrentIMGUISphere].Pos[2], -20.f, 20.f);
+		if (overlay->checkBox("Primitive Grid", &FogGridEnabled))
+		{
+			FogShapesDirty = true;
+		}
+		if (FogGridEnabled && overlay->sliderFloat("Grid Cells Per Primitive", &FogGridCellsPerPrimitive, 0.5f, 16.f))
+		{
+			FogShapesDirty = true;
+		}
+		overlay->text("Grid: %u x %u x %u, max %u primitives per cell", FogGridData.Info.Dims.x, FogGridData.Info.Dims.y, FogGridData.Info.Dims.z, FogGridData.MaxCellCount);
+
+		const int32_t PrimitiveCount = static_cast<int32_t>(FogShapesData.Primitives.size());
+		overlay->text("Primitives: %d", PrimitiveCount);
+		s_CurrentIMGUIPrimitive = std::min(s_CurrentIMGUIPrimitive, PrimitiveCount - 1);
+		overlay->sliderInt("PrimitiveIdx", &s_CurrentIMGUIPrimitive, 0, PrimitiveCount - 1);
+
+		bool ShapeChanged = false;
+		FogPrimitive& Primitive = FogShapesData.Primitives[s_CurrentIMGUIPrimitive];
+		int32_t PrimitiveType = static_cast<int32_t>(Primitive.Type);
+		if (overlay->comboBox("Primitive Type", &PrimitiveType, { "Sphere", "Box", "Capsule" }))
+		{
+			Primitive.Type = static_cast<glm::u32>(PrimitiveType);
+			ShapeChanged = true;
+		}
+
+		ShapeChanged |= overlay->sliderFloat("Primitive X Pos", &Primitive.Pos[0], -20.f, 20.f);
+		ShapeChanged |= overlay->sliderFloat("Primitive Y Pos", &Primitive.Pos[1], -20.f, 20.f);
+		ShapeChanged |= overlay->sliderFloat("Primitive Z Pos", &Primitive.Pos[2], -20.f, 20.f);
+		if (Primitive.Type != FogPrimitiveBox)
+		{
+			ShapeChanged |= overlay->sliderFloat("Primitive Radius", &Primitive.Radius, 0.f, 10.f);
+		}
+		if (Primitive.Type != FogPrimitiveSphere)
+		{
+			ShapeChanged |= overlay->sliderFloat("Primitive Extent X", &Primitive.Extent[0], -10.f, 10.f);
+			ShapeChanged |= overlay->sliderFloat("Primitive Extent Y", &Primitive.Extent[1], -10.f, 10.f);
+			ShapeChanged |= overlay->sliderFloat("Primitive Extent Z", &Primitive.Extent[2], -10.f, 10.f);
+		}
 
-		overlay->sliderFloat("Sphere Radius", &FogShapesData.Spheres[s_CurrentIMGUISphere].Radius, 0.f, 10.f);
-		
+		if (overlay->button("Add primitive"))
+		{
+			FogPrimitive NewPrimitive = Primitive;
+			NewPrimitive.Pos.x += 1.f;
+			FogShapesData.Primitives.push_back(NewPrimitive);
+			s_CurrentIMGUIPrimitive = PrimitiveCount;
+			ShapeChanged = true;
+		}
+		if (PrimitiveCount > 1 && overlay->button("Remove primitive"))
+		{
+			FogShapesData.Primitives.erase(FogShapesData.Primitives.begin() + s_CurrentIMGUIPrimitive);
+			s_CurrentIMGUIPrimitive = std::min(s_CurrentIMGUIPrimitive, PrimitiveCount - 2);
+			ShapeChanged = true;
+		}
+
+		if (ShapeChanged)
+		{
+			FogShapesDirty = true;
+			SettingsChanged = true;
+		}
+
+		if (overlay->button("Run scaling benchmark"))
+		{
+			ScalingBenchmarkRequested = true;
+		}
+		if (!ScalingBenchmarkReport.empty())
+		{
+			overlay->text("%s", ScalingBenchmarkReport.c_str());
+		}
+
+		if (overlay->button("Run CPU reference"))
+		{
+			CPUReferenceRequested = true;
+		}
+		if (!CPUReferenceReport.empty())
+		{
+			overlay->text("%s", CPUReferenceReport.c_str());
+		}
+
+		// Settings changes would otherwise ghost in the accumulated history for a few frames
+		if (SettingsChanged)
+		{
+			HistoryInvalid = true;
+		}
 
 		SettingsOOD = true;
 	}
-}
\ No newline at end of file
+}
+
+bool VulkanVolumetrics::ApplySetting(const std::string& name, float value)
+{
+	const bool Enable = value != 0.f;
+	if (name == "FroxelGrid")
+	{
+		FroxelPresetIndex = std::min(std::max(static_cast<int32_t>(value), 0), static_cast<int32_t>(s_FroxelGridPresets.size()) - 1);
+		const FroxelGridPreset& Preset = s_FroxelGridPresets[FroxelPresetIndex];
+		ResizeFroxelGrid(Preset.Width, Preset.Height, Preset.Depth);
+		if (Governor.Enabled)
+		{
+			Governor.Reset(GovernorLevelForPreset(FroxelPresetIndex));
+			ApplyQualityLevel(Governor.CurrentLevel());
+		}
+	}
+	else if (name == "StorageFormat")
+	{
+		const uint32_t Format = std::min(static_cast<uint32_t>(std::max(value, 0.f)), FroxelStorageCount - 1u);
+		// Keep the current format where the device can't store the requested one
+		if (FroxelStorageSupported[Format])
+		{
+			SetFroxelStorageFormat(static_cast<FroxelStorageFormat>(Format));
+		}
+	}
+	else if (name == "Governor")
+	{
+		SetGovernorEnabled(Enable);
+	}
+	else if (name == "GovernorBudget")
+	{
+		Governor.BudgetMs = value;
+	}
+	else if (name == "Temporal")
+	{
+		TemporalEnabled = Enable;
+	}
+	else if (name == "DepthScan")
+	{
+		SecondStageScanEnabled = Enable;
+		BuildCommandBuffers();
+	}
+	else if (name == "Fused")
+	{
+		FusedEnabled = Enable;
+		BuildCommandBuffers();
+	}
+	else if (name == "Transmittance")
+	{
+		TransmittanceData.Enabled = Enable ? 1 : 0;
+		TransmittanceDirty = true;
+	}
+	else if (name == "ExtraFogLights")
+	{
+		ExtraFogLightCount = std::min(std::max(static_cast<int32_t>(value), 0), static_cast<int32_t>(s_MaxFogLights - s_MaxTransmittanceLights));
+	}
+	else if (name == "SliceDistribution")
+	{
+		VolumetricsData.SliceDistribution = Enable ? SliceDistributionExponential : SliceDistributionQuadratic;
+	}
+	else if (name == "InitialStepSize")
+	{
+		VolumetricsData.InitialStepSize = value;
+	}
+	else if (name == "StepFallOff")
+	{
+		StepFallOffMult = value;
+	}
+	else if (name == "LightStepSize")
+	{
+		VolumetricsData.LightMarchSize = value;
+		if (Governor.Enabled)
+		{
+			GovernorBaseLightMarchSize = VolumetricsData.LightMarchSize / Governor.CurrentLevel().LightMarchScale;
+		}
+	}
+	else if (name == "Absorption")
+	{
+		VolumetricsData.Absorption = value;
+	}
+	else if (name == "Density")
+	{
+		VolumetricsData.Density = value;
+	}
+	else if (name == "NoiseFactor")
+	{
+		VolumetricsData.NoiseFactor = value;
+	}
+	else if (name == "SmoothFactor")
+	{
+		VolumetricsData.SmoothFactor = value;
+		FogShapesDirty = true;
+	}
+	else
+	{
+		return false;
+	}
+
+	// Don't blend the new settings with the history of the old ones
+	HistoryInvalid = true;
+	return true;
+}
+
+void VulkanVolumetrics::ResetAnimation()
+{
+	VolumetricsData.NoiseXOffset = 0.f;
+	VolumetricsData.NoiseYOffset = 0.f;
+	VolumetricsData.NoiseZOffset = 0.f;
+	HistoryInvalid = true;
+}
+
+std::vector<uint32_t> VulkanVolumetrics::ReadbackSecondStage(uint32_t& width, uint32_t& height)
+{
+	const vks::Texture& SecondStageTexture = SecondStageTextures[CurrentFroxelIndex];
+	width = SecondStageTexture.width;
+	height = SecondStageTexture.height;
+	std::vector<uint32_t> Texels(static_cast<size_t>(width) * height);
+	pDevice->copyImageToHost(SecondStageTexture.image, SecondStageTexture.imageLayout, { width, height, 1 }, sizeof(uint32_t), pExampleBase->queue, Texels.data());
+	return Texels;
+}
@@ -2,31 +2,24 @@
 
 // Timer Util Class
 #include "Timer.h"
+#include "FogShapes.h"
+#include "NoiseVolume.h"
+#include "VolumetricsGovernor.h"
 
 #include "VulkanDevice.h"
 #include "VulkanTexture.h"
 #include "VulkanBuffer.h"
 #include "VulkanUIOverlay.h"
 #include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include "glm/common.hpp"
+#include "glm/mat4x4.hpp"
 
 class VulkanExample;
 class Camera;
 
-struct SphereInfo
-{
-	// Centre position of the sphere
-	glm::vec3 Pos;
-	// Radius of the sphere
-	float Radius;
-};
-
-struct FogShapes
-{
-	SphereInfo Spheres[3];
-	int SphereCount = 3;
-};
-
 struct VolumetricsInfo
 {
 	// The Albedo of the volumetric fog
@@ -62,16 +55,154 @@ struct VolumetricsInfo
 	glm::u32 MapHeight;
 	glm::u32 MapWidth;
 	glm::u32 MapDepth;
+	// One of FroxelStorageFormat, how the froxel grid is laid out in memory
+	glm::u32 StorageFormat;
+	// One of SliceDistribution, how the froxel slices are spread along the view ray
+	glm::u32 SliceDistribution;
+	// Depth the exponential distribution ends at, its slices start at Near
+	glm::f32 SliceFar;
+	// How strongly the exponential distribution packs its slices towards the camera, must be above zero
+	glm::f32 SliceCurvature;
+};
+
+// Spacing of the froxel slices along the view ray, matches the SLICE_DISTRIBUTION_* defines in the volumetrics shaders
+enum SliceDistribution : glm::u32
+{
+	// Slices growing by StepFallOff each step from InitialStepSize, with a constant size when StepFallOff is zero
+	SliceDistributionQuadratic = 0,
+	// Slices growing exponentially from Near to SliceFar, so every slice covers the same fraction of the remaining depth
+	SliceDistributionExponential = 1,
+	SliceDistributionCount
+};
+
+// Storage layouts of the froxel grid, trading precision against memory and bandwidth.
+// Matches the FROXEL_STORAGE_* defines in the volumetrics shaders.
+enum FroxelStorageFormat : glm::u32
+{
+	// In-scattering and density in a single RGBA8 texture
+	FroxelStorageRGBA8 = 0,
+	// In-scattering and density in a single RGBA16F texture
+	FroxelStorageRGBA16F = 1,
+	// B10G11R11 float in-scattering with the density in its own R16 texture, or R8 where R16 can't be stored to
+	FroxelStorageB10G11R11 = 2,
+	// In-scattering packed into 32 bits with a shared exponent like E5B9G9R9 and a separate density texture. Stored as
+	// R32_UINT, so the shaders unpack and filter it themselves.
+	FroxelStorageRGB9E5 = 3,
+	FroxelStorageCount
+};
+
+// One froxel grid written by the first stage
+struct FroxelVolume
+{
+	vks::Texture Colour{};
+	// Only created for the formats without room for the density
+	vks::Texture Density{};
+};
+
+// Per frame camera info the first stage needs to build the ray through each froxel and reproject it into the history
+struct VolumetricsFrameInfo
+{
+	// Inverse of the camera's view projection matrix
+	glm::mat4 InvViewProj;
+	// View projection matrix and camera position of the frame the history volume was built with
+	glm::mat4 PrevViewProj;
+	glm::vec4 PrevViewPos;
+	// Offset of the sample within each froxel slice in [0, 1), changes every frame when temporal accumulation is enabled
+	glm::f32 DepthJitter;
+	// Weight of the current frame when blending with the reprojected history
+	glm::f32 HistoryBlend;
+	// Zero when the history volume can't be used, e.g. on the first frame or after a settings change
+	glm::u32 HistoryValid;
+	// Largest number of lights the fog is lit by, lowered by the quality governor
+	glm::u32 LightLimit;
+};
+
+// Bounds and settings of the per light transmittance volume
+struct TransmittanceInfo
+{
+	// World space bounds of the fog covered by the volume
+	glm::vec4 BoundsMin;
+	glm::vec4 BoundsMax;
+	// Width, height and depth of the volume of each light
+	glm::u32 Resolution;
+	// When zero the first stage marches towards each light instead
+	glm::u32 Enabled;
+	// Number of lights with a volume, the first fog lights. Any further lights are marched.
+	glm::u32 LightCount;
+};
+
+// A light the fog is lit by, laid out like the scene lights so they can be copied across
+struct FogLight
+{
+	glm::vec4 Position;
+	glm::vec3 Colour;
+	glm::f32 Radius;
 };
 
+// Header of the fog light buffer, followed by the lights themselves
+struct FogLightsInfo
+{
+	// x is the number of lights
+	glm::uvec4 Count;
+};
+
+// Header of the cluster light list buffer written by the light culling pass. It's followed by an offset and count into the
+// light indices for each cluster of 8 x 8 x 8 froxels, one first stage workgroup, and then the indices themselves.
+struct ClusterLightsInfo
+{
+	// x counts the indices written this frame, y the indices that didn't fit
+	glm::uvec4 Counters;
+};
+
+// Dimensions of the frustum aligned voxel (froxel) grid written by the first stage
+struct FroxelGridPreset
+{
+	const char* Name;
+	glm::u32 Width;
+	glm::u32 Height;
+	glm::u32 Depth;
+};
+
+// Settings the froxel passes are specialised for. Passed to the shaders as specialization constants, matching their
+// constant_id declarations, so the branches on them are resolved when the pipelines are created.
+struct VolumetricsPipelineKey
+{
+	// One of SliceDistribution
+	glm::u32 SliceDistribution;
+	// Set when the quadratic slices have no fall off
+	VkBool32 UniformSlices;
+	// One of FroxelStorageFormat
+	glm::u32 StorageFormat;
+	// Set when the light visibility is looked up in the transmittance volume
+	VkBool32 TransmittanceEnabled;
+
+	// Single value identifying the combination in the variant lookup
+	uint32_t Hash() const { return SliceDistribution | (UniformSlices << 4) | (StorageFormat << 8) | (TransmittanceEnabled << 12); }
+};
+
+// Pipelines of every pass reading the specialised settings, created together for one VolumetricsPipelineKey
+struct VolumetricsPipelineVariant
+{
+	VkPipeline FirstStage{ VK_NULL_HANDLE };
+	VkPipeline SecondStage{ VK_NULL_HANDLE };
+	VkPipeline SecondStageScan{ VK_NULL_HANDLE };
+	VkPipeline Fused{ VK_NULL_HANDLE };
+	VkPipeline LightCull{ VK_NULL_HANDLE };
+};
+
+// Frames which can be in flight at once. The froxel grids, fog output, G-Buffer and per frame buffers are kept once per
+// slot, so the compute queue can still be working on one frame's volumetrics while the graphics queue renders the next.
+static constexpr uint32_t s_FrameSlots = 2;
+
 struct ComputePipelineResources
 {
-	VkCommandBuffer CmdBuff{ VK_NULL_HANDLE };				// Command buffer storing the dispatch commands and barriers
-	VkSemaphore Semaphore{ VK_NULL_HANDLE };						// Execution dependency betweensubmission
+	std::array<VkCommandBuffer, s_FrameSlots> CmdBuffs{};	// Command buffers storing the dispatch commands and barriers, one per frame slot
+	std::array<VkSemaphore, s_FrameSlots> Semaphores{};		// Execution dependency between submissions, one per frame slot
 	VkDescriptorSetLayout DescSetLayout{ VK_NULL_HANDLE };	// shader binding layout
-	VkDescriptorSet DescSet{ VK_NULL_HANDLE };				// shader bindings
+	std::array<VkDescriptorSet, s_FrameSlots> DescSets{};	// shader bindings, one per frame slot
 	VkPipelineLayout PipelineLayout{ VK_NULL_HANDLE };				// Layout of the  pipeline
-	VkPipeline Pipeline{ VK_NULL_HANDLE };							// Pipeline object
+	VkPipeline Pipeline{ VK_NULL_HANDLE };							// Pipeline object, unused by the passes kept in the pipeline variants
+	VkPipelineShaderStageCreateInfo ShaderStage{};					// Shader the pipeline variants are specialised from
 };
 
 class VulkanVolumetrics
@@ -80,50 +211,337 @@ private:
 
 	void PrepareTextures();
 
+	// Create a 3D froxel grid texture, returns the device memory it takes
+	VkDeviceSize PrepareFroxelTexture(vks::Texture& Texture, VkFormat Format, VkExtent3D Extent);
+
+	// Create the textures of a froxel grid at the current map size and storage format
+	void PrepareFroxelVolume(FroxelVolume& Volume);
+
+	void DestroyFroxelVolume(FroxelVolume& Volume);
+
+	// Pool the current froxel grids, which were created with the old size and format, and take or create grids matching
+	// the current settings
+	void SwapFroxelVolumes(uint32_t oldWidth, uint32_t oldHeight, uint32_t oldDepth, uint32_t oldFormat);
+
+	// Read back a froxel grid converted to packed RGBA8, the layout the CPU reference works with
+	std::vector<uint32_t> ReadbackFroxels(const FroxelVolume& Volume);
+
 	void PrepareDescriptors();
 
+	// Point the descriptors which reference the froxel grids at the current textures
+	void UpdateFroxelDescriptors();
+
+	// Update the jitter, reprojection matrices and history state for the next frame
+	void UpdateFrameInfo();
+
+	// Check whether the lights, fog shapes or noise have changed enough since the transmittance volume was built
+	bool TransmittanceOutOfDate() const;
+
+	// Snapshot the inputs of the transmittance volume and fit its bounds around the fog shapes
+	void UpdateTransmittanceInfo();
+
+	// Record the transmittance build for the current number of lights
+	void BuildTransmittanceCommandBuffer();
+
+	// Gather the scene lights and the extra fog lights into the fog light buffer
+	void UpdateFogLights();
+
+	// Rebuild the fog grid and upload it with the primitives, growing the storage buffers when needed
+	void UploadFogShapes();
+
+	// Point the descriptors which reference the fog shape buffers at the current buffers
+	void UpdateFogShapeDescriptors();
+
 	void PreparePipelines();
 
+	// Load a compute shader module from the deferred shader folder, exits with an error naming the file if it's missing
+	VkPipelineShaderStageCreateInfo LoadComputeShader(const std::string& Name);
+
+	// Settings the pipeline variant has to be specialised for to match the current ones
+	VolumetricsPipelineKey CurrentPipelineKey() const;
+
+	// Pipelines specialised for the current settings, created the first time the combination is used. The pipelines of
+	// optional paths are only created once the path is selected.
+	const VolumetricsPipelineVariant& GetPipelineVariant();
+
+	// Read back the stage timestamps of the previous frame and let the governor react to them
+	void ReadStageTimes();
+
+	// Governor level matching a froxel grid preset at full light quality
+	int32_t GovernorLevelForPreset(int32_t presetIndex) const;
+
+	// Switch the grid size, light march and light limit to a governor level
+	void ApplyQualityLevel(const VolumetricsQualityLevel& level);
+
+	void SetGovernorEnabled(bool enabled);
+
+	// Whether the fused kernel is selected and can run at the current grid size
+	bool FusedKernelActive() const;
+
 	void BuildCommandBuffers();
 
+	// Barrier transferring an image of a frame slot between the graphics and compute queue families, the same barrier is
+	// recorded on both queues
+	VkImageMemoryBarrier OwnershipTransfer(VkImage Image, VkImageLayout Layout, bool ToCompute) const;
+
 
 public:
 	void Init(VulkanExample* example, vks::VulkanDevice* device, Camera* camera, VkQueue* pQueue);
 
-	void UpdateBuffers();
+	// Write the per frame buffers of a frame slot, the frame which last used the slot must have completed
+	void UpdateBuffers(uint32_t frameSlot);
 
-	// Call to submit the volumetrics commands to the GPU. 
-	// IN: A semaphore the the submission should wait on.
+	// Call to submit the volumetrics commands of the current frame slot to the compute queue.
+	// IN: A semaphore signalled once the slot's G-Buffer has been rendered, only the second stage waits on it.
 	// OUT: A semaphore which will be signalled when the Volumetrics have completed
 	VkSemaphore* SubmitCommands(VkSemaphore* pWaitSemaphore = VK_NULL_HANDLE);
 
+	// The G-Buffer positions and the fog output are exclusive to one queue family at a time, so they're transferred between the
+	// graphics and compute queues when those are of different families. Recorded on the graphics queue after the G-Buffer
+	// of a frame slot has been rendered, every submission of the slot's volumetrics has to follow one.
+	void ReleaseGBuffer(VkCommandBuffer CmdBuff, uint32_t frameSlot) const;
+	// Recorded on the graphics queue before the lighting pass of a frame slot samples the positions and the fog
+	void AcquireOutputs(VkCommandBuffer CmdBuff, uint32_t frameSlot) const;
+
 	void Release(VkDevice& device);
 
 	void UpdateOverlay(vks::UIOverlay* overlay);
 
+	// Change a setting by name the same way the overlay would, for the benchmark scenarios. Returns false for unknown names.
+	bool ApplySetting(const std::string& name, float value);
+
+	// Restart the wind animation and the temporal accumulation, e.g. before rendering a golden image
+	void ResetAnimation();
+
+	// Read back the second stage output of the last frame as packed RGBA8, the device has to be idle
+	std::vector<uint32_t> ReadbackSecondStage(uint32_t& width, uint32_t& height);
+
+	// Seconds the wind advances each frame, the measured frame time is used when negative. Golden image runs fix it so
+	// their output doesn't depend on the frame rate.
+	float FixedFrameTime = -1.f;
+
+	// Recreate the froxel grid at a new size. The slice size is scaled so the grid keeps covering the same depth range.
+	void ResizeFroxelGrid(uint32_t width, uint32_t height, uint32_t depth);
+
+	// Recreate the froxel grid in another storage format, does nothing when the device doesn't support it
+	void SetFroxelStorageFormat(FroxelStorageFormat format);
+
+	// Run the CPU reference implementation on the inputs of the last submitted frame and compare it against the GPU output.
+	// Waits for the device to be idle and reads back the G-Buffer positions and both volumetrics textures.
+	void RunCPUReference();
+
+	// Time the transmittance and first stage passes with GPU timestamps over a range of generated fog primitive counts,
+	// with and without the grid. Restores the current shapes once done.
+	void RunScalingBenchmark();
+
 	// Store the resources needed for the volumetrics compute commands
 	VkQueue ComputeQueue{ VK_NULL_HANDLE };
 	VkCommandPool ComputeCmdPool{ VK_NULL_HANDLE };
 
 	std::array<ComputePipelineResources, 2> ComputePipelines;
 
-	// Texture to store the output of the first stage volumetrics compute shader
-	vks::Texture FirstStageTexture;
+	// Builds the per light transmittance volume
+	ComputePipelineResources TransmittancePipeline;
+
+	// Bins the fog lights into the clusters of the froxel grid ahead of the first stage, recorded into the first stage's
+	// command buffers so it has no command buffers or semaphores of its own
+	ComputePipelineResources LightCullPipeline;
+
+	// Textures to store the output of the first stage volumetrics compute shader, sized by the froxel grid, one per frame
+	// slot. The first stage alternates between them each frame, reading the other one as the history volume.
+	std::array<FroxelVolume, s_FrameSlots> FirstStageTextures;
+
+	// Bound in place of the packed grid when another storage format is used, descriptors can't be left empty
+	vks::Texture DummyPackedTexture{};
+
+	// Density format of the split storage formats
+	VkFormat FroxelDensityFormat = VK_FORMAT_R16_UNORM;
+
+	// Storage formats the device can write and filter, all but RGBA8 need shaderStorageImageWriteWithoutFormat
+	std::array<bool, FroxelStorageCount> FroxelStorageSupported{};
+
+	// Memory and smoothed GPU time of each storage format at the current grid size, for choosing between them
+	struct FroxelStorageStats
+	{
+		VkDeviceSize MemorySize = 0;
+		float FirstStageMs = 0.0f;
+		float SecondStageMs = 0.0f;
+		bool Measured = false;
+	};
+	std::array<FroxelStorageStats, FroxelStorageCount> FroxelStorageResults;
+
+	// Index of the froxel grid written this frame, the current frame slot
+	uint32_t CurrentFroxelIndex = 0;
+
+	// Textures to store the output of the second stage volumetrics compute shader, sized to match the lighting pass. One
+	// per frame slot, so the lighting pass can read one while the next frame's second stage writes the other.
+	std::array<vks::Texture, s_FrameSlots> SecondStageTextures;
 
-	// Texture to store the output of the second stage volumetrics compute shader
-	vks::Texture SecondStageTexture;
+	// Second stage which composites the froxel columns with a parallel scan, shares the layout of the serial one. Loaded the
+	// first time the scan is selected.
+	VkPipelineShaderStageCreateInfo SecondStageScanShaderStage{};
+
+	// First stage writing the float storage formats other than RGBA8 through format-less images, loaded the first time one
+	// of them is selected
+	VkPipelineShaderStageCreateInfo FirstStageFormatlessShaderStage{};
+
+	// Specialised pipelines of the froxel passes keyed by VolumetricsPipelineKey::Hash, kept for switching back
+	std::unordered_map<uint32_t, VolumetricsPipelineVariant> PipelineVariants;
+
+	// Key of the variant the command buffers were last recorded with
+	uint32_t RecordedPipelineKey = ~0u;
+
+	// Use the scan variant of the second stage instead of one thread marching each pixel
+	bool SecondStageScanEnabled = true;
+
+	// Pixels per workgroup in volumetrics_secondstage_scan.comp
+	static constexpr uint32_t s_ScanPixelsPerGroup = 4;
+
+	// Evaluates and composites the froxels under each tile of the output in shared memory, without writing the froxel grid.
+	// Recorded into the second stage's command buffers in place of both stages, after the light culling in the first. The
+	// shader and pipeline are only created once it's selected.
+	ComputePipelineResources FusedPipeline;
+
+	// Use the fused kernel instead of the two stages. Needs a froxel grid no larger than the output, the two stages are used
+	// otherwise.
+	bool FusedEnabled = false;
+
+	// Output pixels along each side of a workgroup in volumetrics_fused.comp
+	static constexpr uint32_t s_FusedTileSize = 16;
+
+	// Device memory used by the textures of both froxel grids in bytes
+	VkDeviceSize FroxelMemorySize = 0;
+
+	// Index into the froxel grid presets selected in the overlay
+	int32_t FroxelPresetIndex = 1;
+
+	// Steps the froxel grid, light march and light count to keep both stages within a GPU time budget
+	VolumetricsGovernor Governor;
+
+	// GPU time of each stage in the last frame in milliseconds, zero without timestamp support
+	float FirstStageGPUTime = 0.0f;
+	float SecondStageGPUTime = 0.0f;
+
+	// Time spent creating compute pipelines in milliseconds, lower when they were found in the pipeline cache
+	double PipelineCreationTime = 0.0;
+
+	// Device memory held by the froxel grids kept for reuse in bytes
+	VkDeviceSize FroxelPoolMemorySize = 0;
 
 	FogShapes FogShapesData;
 
+	FogGrid FogGridData;
+
+	// Set when the primitives or the grid settings changed and have to be uploaded again
+	bool FogShapesDirty = true;
+
+	// Incremented every time the primitives are uploaded
+	uint32_t FogShapesVersion = 0;
+
+	// When disabled every density query evaluates all of the primitives
+	bool FogGridEnabled = true;
+
+	// Roughly how many grid cells there are for each primitive
+	float FogGridCellsPerPrimitive = 4.f;
+
 	VolumetricsInfo VolumetricsData;
 
 	glm::f32 StepFallOffMult = 0.025f;
 
+	// Only rewritten when the shapes change, after waiting for the frames using them
 	vks::Buffer FogShapesBuff;
 
-	vks::Buffer VolumetricsBuff;
+	vks::Buffer FogGridBuff;
+
+	// Lights the fog is lit by, the scene lights followed by the extra fog lights
+	std::vector<FogLight> FogLightsData;
+
+	std::array<vks::Buffer, s_FrameSlots> FogLightsBuffs;
+
+	// Offset and count into the light indices for every cluster, written by the light culling pass
+	vks::Buffer ClusterLightsBuff;
+
+	// Host visible copy of the counters of the cluster light list, shown in the overlay
+	vks::Buffer ClusterCountersBuff;
+
+	// Lights scattered through the fog on top of the scene lights, to see how the light culling scales
+	int32_t ExtraFogLightCount = 0;
+
+	// Froxels along each side of a light cluster, the size of a first stage workgroup
+	static constexpr uint32_t s_ClusterSize = 8;
+	// Largest number of fog lights, must match MAX_CLUSTER_LIGHTS in volumetrics_lightcull.comp
+	static constexpr uint32_t s_MaxFogLights = 256;
+	// Light indices reserved for each cluster of the largest froxel grid, on average
+	static constexpr uint32_t s_ClusterLightBudget = 32;
+
+	std::array<vks::Buffer, s_FrameSlots> VolumetricsBuffs;
+
+	VolumetricsFrameInfo FrameData;
+
+	// Blend the froxel grid with the reprojected result of the previous frames
+	bool TemporalEnabled = true;
+
+	// Set when the history volume no longer matches the current settings
+	bool HistoryInvalid = true;
+
+	// Frame of the profiler's results the stage times were last taken from
+	uint64_t ProfilerFrameRead = 0;
+
+	// Light march step size set by the user, scaled by the governor level
+	float GovernorBaseLightMarchSize = 0.0f;
+
+	// Froxel grids of other sizes kept around after a resize, so switching back doesn't have to allocate again
+	struct FroxelGridTextures
+	{
+		uint32_t Width;
+		uint32_t Height;
+		uint32_t Depth;
+		uint32_t StorageFormat;
+		std::array<FroxelVolume, 2> Volumes;
+		VkDeviceSize MemorySize;
+	};
+	std::vector<FroxelGridTextures> FroxelTexturePool;
 
-	vks::Texture2D PerlinNoise;
+	// Memory the pooled grids may hold before the oldest are released
+	static constexpr VkDeviceSize s_FroxelPoolBudget = 256ull * 1024ull * 1024ull;
+
+	// Number of frames accumulated since the history was last reset, drives the depth jitter sequence
+	uint32_t TemporalFrameIndex = 0;
+
+	// View projection and camera position used for the current frame, become the previous ones next frame
+	glm::mat4 ViewProj = glm::mat4(1.0f);
+	glm::vec4 ViewPos = glm::vec4(0.0f);
+
+	std::array<vks::Buffer, s_FrameSlots> FrameBuffs;
+
+	// Tileable noise volume added to the fog shapes, generated on the CPU or loaded from its disk cache
+	NoiseVolume NoiseData;
+	vks::Texture3D NoiseTexture;
+
+	// Optical depth of the fog towards each light, the volumes of all lights are stacked along z
+	vks::Texture TransmittanceTexture;
+
+	TransmittanceInfo TransmittanceData;
+
+	std::array<vks::Buffer, s_FrameSlots> TransmittanceBuffs;
+
+	// Set when the transmittance volume has to be rebuilt before the next first stage
+	bool TransmittanceDirty = true;
+
+	// How far the noise can scroll in the wind before the transmittance volume is rebuilt
+	float TransmittanceNoiseTolerance = 0.05f;
+
+	// Number of times the transmittance volume has been rebuilt
+	uint32_t TransmittanceBuildCount = 0;
+
+	// Inputs the transmittance volume was last built with
+	VolumetricsInfo TransmittanceBuiltInfo{};
+	uint32_t TransmittanceBuiltShapesVersion = 0;
+	std::array<glm::vec4, 6> TransmittanceBuiltLights{};
+	int32_t TransmittanceBuiltLightCount = 0;
+
+	static constexpr uint32_t s_TransmittanceResolution = 64;
+	static constexpr uint32_t s_MaxTransmittanceLights = 6;
 
 	static constexpr int s_NumResources = 1;
 	static constexpr int s_VolumeDescSetID = 2;
@@ -132,13 +550,28 @@ public:
 	// Flag to check if the volumetrics settings have become out of date
 	bool SettingsOOD = false;
 
+	// Set to run the CPU reference once the current frame has been submitted
+	bool CPUReferenceRequested = false;
+	// Summary of the last CPU reference run shown in the overlay
+	std::string CPUReferenceReport;
+
+	// Set to run the scaling benchmark once the current frame has been submitted
+	bool ScalingBenchmarkRequested = false;
+	// Summary of the last scaling benchmark shown in the overlay
+	std::string ScalingBenchmarkReport;
+
 	// Vulkan Specific Resources
 
 	VkDescriptorPool DescPool = VK_NULL_HANDLE;
 
-	// Resources for the final descriptor set for use in the main lighting pass
+	// Timestamps written by the scaling benchmark, the stages of every frame are timed by the example's GpuProfiler
+	VkQueryPool TimestampQueryPool = VK_NULL_HANDLE;
+	static constexpr uint32_t s_BenchmarkFirstQuery = 0;
+	static constexpr uint32_t s_BenchmarkQueryCount = 3;
+
+	// Resources for the final descriptor sets for use in the main lighting pass, one per frame slot
 	VkDescriptorSetLayout LightingPassDescSetLayout = VK_NULL_HANDLE;
-	VkDescriptorSet LightingPassDescSet = VK_NULL_HANDLE;
+	std::array<VkDescriptorSet, s_FrameSlots> LightingPassDescSets{};
 
 	VkPipelineStageFlags SubmitStageFlag = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
 	VkSubmitInfo SubmitInfo;
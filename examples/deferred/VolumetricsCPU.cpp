@@ -0,0 +1,728 @@
+#include "VolumetricsCPU.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+#include "VulkanTaskScheduler.h"
+
+using namespace simd;
+
+namespace
+{
+	// The transmittance volume has a slab for every light slot in the scene UBO, like lights.length() in the shaders
+	const uint32_t s_TransmittanceLightSlabs = static_cast<uint32_t>(sizeof(VulkanExample::UniformDataComposition::lights) / sizeof(VulkanExample::Light));
+
+	// Matches the float to UNORM conversion done by imageStore on an rgba8 image
+	inline uint32_t PackUnorm8(float value)
+	{
+		value = std::min(std::max(value, 0.f), 1.f);
+		return static_cast<uint32_t>(value * 255.f + 0.5f);
+	}
+
+	inline uint32_t PackUnorm4x8(float r, float g, float b, float a)
+	{
+		return PackUnorm8(r) | (PackUnorm8(g) << 8) | (PackUnorm8(b) << 16) | (PackUnorm8(a) << 24);
+	}
+
+	inline float UnpackUnorm8(uint32_t packed, uint32_t channel)
+	{
+		return static_cast<float>((packed >> (channel * 8)) & 0xFF) / 255.f;
+	}
+
+	// Distance along the view ray of a position within the froxel slices, the integer part selects the slice
+	inline float SliceDepth(const VolumetricsInfo& info, float slice)
+	{
+		if (info.SliceDistribution == SliceDistributionExponential)
+		{
+			const float t = slice / static_cast<float>(info.MapDepth);
+			return info.Near + (info.SliceFar - info.Near) * (std::exp(info.SliceCurvature * t) - 1.f) / (std::exp(info.SliceCurvature) - 1.f);
+		}
+		return (info.StepFallOff == 0.f) ?
+			(slice * info.InitialStepSize) + info.Near :
+			(info.InitialStepSize * slice) + ((info.StepFallOff * slice * slice) / 2);
+	}
+
+	// Inverse of SliceDepth
+	inline float DepthToSlice(const VolumetricsInfo& info, float depth)
+	{
+		if (info.SliceDistribution == SliceDistributionExponential)
+		{
+			const float scaled = (depth - info.Near) / (info.SliceFar - info.Near) * (std::exp(info.SliceCurvature) - 1.f);
+			return std::log(std::max(scaled + 1.f, 1e-6f)) / info.SliceCurvature * static_cast<float>(info.MapDepth);
+		}
+		return (info.StepFallOff == 0.f) ?
+			(depth - info.Near) / info.InitialStepSize :
+			(std::sqrt(info.InitialStepSize * info.InitialStepSize + 2.f * info.StepFallOff * depth) - info.InitialStepSize) / info.StepFallOff;
+	}
+
+	// Trilinear sample of a packed RGBA8 volume with clamp to edge addressing
+	glm::vec4 SampleVolume(const std::vector<uint32_t>& texels, uint32_t width, uint32_t height, uint32_t depth, const glm::vec3& uvw)
+	{
+		const glm::vec3 size(static_cast<float>(width), static_cast<float>(height), static_cast<float>(depth));
+		const glm::vec3 coord = uvw * size - 0.5f;
+		const glm::vec3 base = glm::floor(coord);
+		const glm::vec3 weight = coord - base;
+		const glm::vec3 maxTexel = size - 1.f;
+
+		glm::vec4 result(0.f);
+		for (uint32_t corner = 0; corner < 8; ++corner)
+		{
+			const glm::vec3 offset(static_cast<float>(corner & 1), static_cast<float>((corner >> 1) & 1), static_cast<float>((corner >> 2) & 1));
+			const glm::vec3 texel = glm::clamp(base + offset, glm::vec3(0.f), maxTexel);
+			const glm::vec3 w = glm::mix(1.f - weight, weight, offset);
+			const uint32_t packed = texels[(static_cast<size_t>(texel.z) * height + static_cast<size_t>(texel.y)) * width + static_cast<size_t>(texel.x)];
+			result += w.x * w.y * w.z * glm::vec4(UnpackUnorm8(packed, 0), UnpackUnorm8(packed, 1), UnpackUnorm8(packed, 2), UnpackUnorm8(packed, 3));
+		}
+		return result;
+	}
+
+	inline VFloat OpSmoothUnion(VFloat d1, VFloat d2, VFloat k)
+	{
+		const VFloat h = Clamp(VFloat(0.5f) + VFloat(0.5f) * (d2 - d1) / k, VFloat(0.f), VFloat(1.f));
+		return d2 + (d1 - d2) * h - k * h * (VFloat(1.f) - h);
+	}
+
+	// Vector version of FogGrid::PrimitiveDistance, evaluates one primitive for every lane
+	VFloat PrimitiveDistance(const FogPrimitive& primitive, const VVec3& pos)
+	{
+		const VVec3 p = pos - VVec3(primitive.Pos.x, primitive.Pos.y, primitive.Pos.z);
+		switch (primitive.Type)
+		{
+		case FogPrimitiveBox:
+		{
+			const VVec3 q = VVec3(Abs(p.x), Abs(p.y), Abs(p.z)) - VVec3(primitive.Extent.x, primitive.Extent.y, primitive.Extent.z);
+			const VVec3 outside(Max(q.x, VFloat(0.f)), Max(q.y, VFloat(0.f)), Max(q.z, VFloat(0.f)));
+			return Length(outside) + Min(Max(q.x, Max(q.y, q.z)), VFloat(0.f));
+		}
+		case FogPrimitiveCapsule:
+		{
+			const VVec3 extent(primitive.Extent.x, primitive.Extent.y, primitive.Extent.z);
+			const VVec3 pa = p + extent;
+			const VVec3 ba = extent * VFloat(2.f);
+			const float baLength2 = std::max(glm::dot(primitive.Extent, primitive.Extent) * 4.f, 1e-6f);
+			const VFloat h = Clamp(Dot(pa, ba) / VFloat(baLength2), VFloat(0.f), VFloat(1.f));
+			return Length(pa - ba * h) - VFloat(primitive.Radius);
+		}
+		default:
+			return Length(p) - VFloat(primitive.Radius);
+		}
+	}
+}
+
+VolumetricsCPU::VolumetricsCPU(uint32_t threadCount)
+{
+	if (threadCount > 0)
+	{
+		// The thread waiting for a parallel loop runs part of it, so it takes one worker less
+		OwnScheduler.reset(new vks::TaskScheduler(std::max(threadCount, 2u) - 1));
+		Scheduler = OwnScheduler.get();
+	}
+	else
+	{
+		Scheduler = &vks::TaskScheduler::shared();
+	}
+	ThreadCount = Scheduler->concurrency();
+}
+
+VolumetricsCPU::~VolumetricsCPU()
+{
+}
+
+template<typename Func>
+void VolumetricsCPU::ParallelFor(uint32_t count, const Func& func)
+{
+	// A grain size of one lets threads that land on cheap slices steal more of them
+	Scheduler->parallelFor(0, count, 1, func);
+}
+
+void VolumetricsCPU::SetNoise(const NoiseVolume& noise)
+{
+	Noise = &noise;
+}
+
+void VolumetricsCPU::SetPositions(std::vector<glm::vec4> positions, uint32_t width, uint32_t height)
+{
+	assert(positions.size() == static_cast<size_t>(width) * height);
+	Positions = std::move(positions);
+	PositionsWidth = width;
+	PositionsHeight = height;
+}
+
+void VolumetricsCPU::SetLights(std::vector<FogLight> lights)
+{
+	Lights = std::move(lights);
+}
+
+void VolumetricsCPU::SetHistory(std::vector<uint32_t> history)
+{
+	History = std::move(history);
+}
+
+void VolumetricsCPU::Run(const VolumetricsInfo& info, const VolumetricsFrameInfo& frame, const TransmittanceInfo& transmittance, const FogShapes& shapes, const FogGrid& grid,
+	const VulkanExample::UniformDataComposition& scene, uint32_t outputWidth, uint32_t outputHeight)
+{
+	RunFirstStage(info, frame, transmittance, shapes, grid, scene);
+	RunSecondStage(info, scene, outputWidth, outputHeight);
+}
+
+glm::vec4 VolumetricsCPU::SampleFroxels(float u, float v, uint32_t z) const
+{
+	const float x = u * static_cast<float>(MapWidth) - 0.5f;
+	const float y = v * static_cast<float>(MapHeight) - 0.5f;
+	const float fx = std::floor(x);
+	const float fy = std::floor(y);
+	const float ax = x - fx;
+	const float ay = y - fy;
+
+	const uint32_t x0 = static_cast<uint32_t>(std::min(std::max(fx, 0.f), static_cast<float>(MapWidth - 1)));
+	const uint32_t x1 = static_cast<uint32_t>(std::min(std::max(fx + 1.f, 0.f), static_cast<float>(MapWidth - 1)));
+	const uint32_t y0 = static_cast<uint32_t>(std::min(std::max(fy, 0.f), static_cast<float>(MapHeight - 1)));
+	const uint32_t y1 = static_cast<uint32_t>(std::min(std::max(fy + 1.f, 0.f), static_cast<float>(MapHeight - 1)));
+
+	const uint32_t* slice = &FirstStageMap[static_cast<size_t>(z) * MapHeight * MapWidth];
+	auto texel = [&](uint32_t tx, uint32_t ty)
+	{
+		const uint32_t packed = slice[ty * MapWidth + tx];
+		return glm::vec4(UnpackUnorm8(packed, 0), UnpackUnorm8(packed, 1), UnpackUnorm8(packed, 2), UnpackUnorm8(packed, 3));
+	};
+
+	const glm::vec4 top = texel(x0, y0) * (1.f - ax) + texel(x1, y0) * ax;
+	const glm::vec4 bottom = texel(x0, y1) * (1.f - ax) + texel(x1, y1) * ax;
+	return top * (1.f - ay) + bottom * ay;
+}
+
+VFloat VolumetricsCPU::QueryDensity(const FirstStageParams& params, const VVec3& samplePos, VMask active) const
+{
+	const VolumetricsInfo& info = *params.Info;
+	const FogGrid& grid = *params.Grid;
+	const std::vector<FogPrimitive>& primitives = params.Shapes->Primitives;
+
+	const VVec3 pos(VFloat(0.f) - samplePos.x, VFloat(0.f) - samplePos.y, VFloat(0.f) - samplePos.z);
+
+	// Only the cell lookup is done per lane, lanes outside the grid or in an empty cell stay out of the fog
+	alignas(32) float px[Width], py[Width], pz[Width];
+	pos.x.Store(px);
+	pos.y.Store(py);
+	pos.z.Store(pz);
+	int64_t cells[Width];
+	const int lanes = Bits(active);
+	for (int i = 0; i < Width; ++i)
+	{
+		cells[i] = (lanes & (1 << i)) ? grid.CellIndex(glm::vec3(px[i], py[i], pz[i])) : -1;
+	}
+
+	// Walk the primitive list of each distinct cell once for all lanes, lanes in other cells keep their distance
+	const VFloat smoothFactor(info.SmoothFactor);
+	VFloat sdf(1.f);
+	VMask inFog = FirstLanes(0);
+	for (int i = 0; i < Width; ++i)
+	{
+		if (cells[i] < 0)
+		{
+			continue;
+		}
+		const int64_t cell = cells[i];
+		alignas(32) float inCellLanes[Width];
+		for (int j = 0; j < Width; ++j)
+		{
+			inCellLanes[j] = (cells[j] == cell) ? 1.f : 0.f;
+			cells[j] = (cells[j] == cell) ? -1 : cells[j];
+		}
+		const uint32_t offset = grid.Data[cell * 2];
+		const uint32_t count = grid.Data[cell * 2 + 1];
+		if (count == 0)
+		{
+			continue;
+		}
+
+		const VMask inCell = VFloat::Load(inCellLanes) > VFloat(0.f);
+		VFloat cellSdf = PrimitiveDistance(primitives[grid.Data[offset]], pos);
+		for (uint32_t p = 1; p < count; ++p)
+		{
+			cellSdf = OpSmoothUnion(cellSdf, PrimitiveDistance(primitives[grid.Data[offset + p]], pos), smoothFactor);
+		}
+		sdf = Select(inCell, cellSdf, sdf);
+		inFog = inFog | inCell;
+	}
+
+	// The noise only ever pushes the distance up, so only lanes already inside a shape need it
+	inFog = inFog & (sdf <= VFloat(0.f));
+	if (!Any(inFog))
+	{
+		return VFloat(0.f);
+	}
+
+	const VFloat sx = (pos.x + VFloat(info.NoiseXOffset)) / VFloat(info.NoiseXTile);
+	const VFloat sy = (pos.y - VFloat(info.NoiseYOffset)) / VFloat(info.NoiseYTile);
+	const VFloat sz = (pos.z - VFloat(info.NoiseZOffset)) / VFloat(info.NoiseZTile);
+	alignas(32) float nx[Width], ny[Width], nz[Width], noiseLanes[Width];
+	sx.Store(nx);
+	sy.Store(ny);
+	sz.Store(nz);
+	const int fogLanes = Bits(inFog);
+	for (int i = 0; i < Width; ++i)
+	{
+		// The noise volume has no vector sampler, fetch it per lane
+		noiseLanes[i] = (fogLanes & (1 << i)) ? Noise->Sample(glm::vec3(nx[i], ny[i], nz[i])) : 0.f;
+	}
+	VFloat noise = VFloat::Load(noiseLanes) * VFloat(info.NoiseFactor);
+	noise = noise - noise / VFloat(2.f);
+
+	return Select(inFog & (sdf + noise <= VFloat(0.f)), VFloat(info.Density), VFloat(0.f));
+}
+
+VFloat VolumetricsCPU::CalculateLightVisibility(const FirstStageParams& params, const VVec3& origin, const VVec3& direction, VFloat length, VMask active) const
+{
+	const VolumetricsInfo& info = *params.Info;
+
+	VFloat depth(0.f);
+	VFloat visibility(1.f);
+
+	// Each lane keeps marching until it has covered its own ray or hit the cutoff, finished lanes are masked out
+	VMask marching = active & (depth < length) & (visibility > VFloat(info.LightAbsorptionCutoff));
+	while (Any(marching))
+	{
+		const VFloat density = QueryDensity(params, origin + direction * depth, marching);
+		visibility = Select(marching & (density > VFloat(0.f)), visibility * VFloat(params.LightStepTransmittance), visibility);
+		depth = Select(marching, depth + VFloat(info.LightMarchSize), depth);
+		marching = marching & (depth < length) & (visibility > VFloat(info.LightAbsorptionCutoff));
+	}
+	return visibility;
+}
+
+void VolumetricsCPU::FirstStageRow(const FirstStageParams& params, uint32_t y, uint32_t z)
+{
+	const VolumetricsInfo& info = *params.Info;
+	const VulkanExample::UniformDataComposition& scene = *params.Scene;
+
+	uint32_t* output = &FirstStageMap[(static_cast<size_t>(z) * MapHeight + y) * MapWidth];
+
+	// The sample depth only depends on the slice and the jitter of this frame
+	const float sampleDepth = SliceDepth(info, static_cast<float>(z) + params.Frame->DepthJitter);
+
+	if (sampleDepth > info.Far)
+	{
+		std::fill(output, output + MapWidth, 0u);
+		return;
+	}
+
+	const VVec3 viewPos(scene.viewPos.x, scene.viewPos.y, scene.viewPos.z);
+	const float ndcY = ((static_cast<float>(y) + 0.5f) / static_cast<float>(MapHeight)) * 2.f - 1.f;
+
+	for (uint32_t x0 = 0; x0 < MapWidth; x0 += Width)
+	{
+		const int laneCount = static_cast<int>(std::min<uint32_t>(Width, MapWidth - x0));
+
+		// Unproject the centre of each froxel column onto the far plane to get the direction of its view ray
+		alignas(32) float tx[Width], ty[Width], tz[Width];
+		for (int i = 0; i < Width; ++i)
+		{
+			const uint32_t x = std::min(x0 + i, MapWidth - 1);
+			const float ndcX = ((static_cast<float>(x) + 0.5f) / static_cast<float>(MapWidth)) * 2.f - 1.f;
+			const glm::vec4 farPos = params.Frame->InvViewProj * glm::vec4(ndcX, ndcY, 1.f, 1.f);
+			tx[i] = farPos.x / farPos.w;
+			ty[i] = farPos.y / farPos.w;
+			tz[i] = farPos.z / farPos.w;
+		}
+
+		const VVec3 ray = VVec3(VFloat::Load(tx), VFloat::Load(ty), VFloat::Load(tz)) - viewPos;
+
+		const VMask active = FirstLanes(laneCount);
+
+		const VVec3 direction = ray * (VFloat(1.f) / Length(ray));
+		const VVec3 samplePos = viewPos + direction * VFloat(sampleDepth);
+
+		const VFloat density = Select(active, QueryDensity(params, samplePos, active), VFloat(0.f));
+		const VMask inFog = active & (density > VFloat(0.f));
+
+		VVec3 colour(0.f, 0.f, 0.f);
+
+		// Every light is tested here, the GPU only skips the ones its culling pass proved to be out of range
+		const int lightCount = static_cast<int>(std::min<size_t>(Lights.size(), params.Frame->LightLimit));
+		for (int l = 0; Any(inFog) && l < lightCount; ++l)
+		{
+			const FogLight& light = Lights[l];
+			const VVec3 toLight = VVec3(light.Position.x, light.Position.y, light.Position.z) - samplePos;
+			const VFloat lightDist = Length(toLight);
+			const VMask inRange = inFog & (lightDist < VFloat(light.Radius));
+			if (!Any(inRange))
+			{
+				continue;
+			}
+
+			const VFloat attenuation = VFloat(light.Radius) / (lightDist * lightDist + VFloat(1.f));
+			VFloat visibility(1.f);
+			if (params.Transmittance->Enabled != 0 && l < static_cast<int>(params.Transmittance->LightCount))
+			{
+				alignas(32) float px[Width], py[Width], pz[Width], lightVisibility[Width];
+				samplePos.x.Store(px);
+				samplePos.y.Store(py);
+				samplePos.z.Store(pz);
+				for (int i = 0; i < Width; ++i)
+				{
+					lightVisibility[i] = SampleLightVisibility(params, glm::vec3(px[i], py[i], pz[i]), l);
+				}
+				visibility = VFloat::Load(lightVisibility);
+			}
+			else
+			{
+				const VVec3 lightDir = toLight * (VFloat(1.f) / lightDist);
+				visibility = CalculateLightVisibility(params, samplePos, lightDir, lightDist, inRange);
+			}
+
+			colour.x = colour.x + Select(inRange, visibility * VFloat(info.Albedo.x) * (VFloat(light.Colour.x) * attenuation), VFloat(0.f));
+			colour.y = colour.y + Select(inRange, visibility * VFloat(info.Albedo.y) * (VFloat(light.Colour.y) * attenuation), VFloat(0.f));
+			colour.z = colour.z + Select(inRange, visibility * VFloat(info.Albedo.z) * (VFloat(light.Colour.z) * attenuation), VFloat(0.f));
+		}
+
+		alignas(32) float r[Width], g[Width], b[Width], a[Width];
+		colour.x.Store(r);
+		colour.y.Store(g);
+		colour.z.Store(b);
+		density.Store(a);
+		for (int i = 0; i < laneCount; ++i)
+		{
+			glm::vec4 current(r[i], g[i], b[i], a[i]);
+			if (params.BlendHistory)
+			{
+				const glm::vec3 direction = glm::normalize(glm::vec3(tx[i], ty[i], tz[i]) - glm::vec3(scene.viewPos));
+				current = BlendHistory(params, current, direction, z);
+			}
+			output[x0 + i] = PackUnorm4x8(current.r, current.g, current.b, current.a);
+		}
+	}
+}
+
+float VolumetricsCPU::SampleLightVisibility(const FirstStageParams& params, const glm::vec3& pos, int light) const
+{
+	const TransmittanceInfo& transmittance = *params.Transmittance;
+	const uint32_t resolution = TransmittanceResolution;
+	const uint32_t depth = resolution * s_TransmittanceLightSlabs;
+
+	// Trilinear sample with clamp to edge addressing, kept half a texel inside this light's slab
+	const float halfTexel = 0.5f / static_cast<float>(resolution);
+	glm::vec3 uvw = (pos - glm::vec3(transmittance.BoundsMin)) / glm::vec3(transmittance.BoundsMax - transmittance.BoundsMin);
+	uvw = glm::clamp(uvw, glm::vec3(halfTexel), glm::vec3(1.f - halfTexel));
+	uvw.z = (uvw.z + static_cast<float>(light)) / static_cast<float>(s_TransmittanceLightSlabs);
+
+	const glm::vec3 size(static_cast<float>(resolution), static_cast<float>(resolution), static_cast<float>(depth));
+	const glm::vec3 coord = uvw * size - 0.5f;
+	const glm::vec3 base = glm::floor(coord);
+	const glm::vec3 weight = coord - base;
+	const glm::vec3 maxTexel = size - 1.f;
+
+	float opticalDepth = 0.f;
+	for (uint32_t corner = 0; corner < 8; ++corner)
+	{
+		const glm::vec3 offset(static_cast<float>(corner & 1), static_cast<float>((corner >> 1) & 1), static_cast<float>((corner >> 2) & 1));
+		const glm::vec3 texel = glm::clamp(base + offset, glm::vec3(0.f), maxTexel);
+		const glm::vec3 w = glm::mix(1.f - weight, weight, offset);
+		opticalDepth += w.x * w.y * w.z * TransmittanceMap[(static_cast<size_t>(texel.z) * resolution + static_cast<size_t>(texel.y)) * resolution + static_cast<size_t>(texel.x)];
+	}
+	return std::exp(-(params.Info->Absorption * opticalDepth));
+}
+
+void VolumetricsCPU::TransmittanceRow(const FirstStageParams& params, int light, uint32_t y, uint32_t z)
+{
+	const VolumetricsInfo& info = *params.Info;
+	const TransmittanceInfo& transmittance = *params.Transmittance;
+	const glm::vec3 lightPos(params.Scene->lights[light].position);
+	const glm::vec3 boundsMin(transmittance.BoundsMin);
+	const glm::vec3 boundsMax(transmittance.BoundsMax);
+	const float resolution = static_cast<float>(TransmittanceResolution);
+
+	float* output = &TransmittanceMap[((static_cast<size_t>(light) * TransmittanceResolution + z) * TransmittanceResolution + y) * TransmittanceResolution];
+
+	const float maxOpticalDepth = -std::log(std::max(info.LightAbsorptionCutoff, 0.0001f)) / info.Absorption;
+
+	for (uint32_t x0 = 0; x0 < TransmittanceResolution; x0 += Width)
+	{
+		const int laneCount = static_cast<int>(std::min<uint32_t>(Width, TransmittanceResolution - x0));
+
+		// Ray from the voxel centre towards the light, clipped to where it leaves the bounds
+		alignas(32) float ox[Width], oy[Width], oz[Width], dx[Width], dy[Width], dz[Width], len[Width];
+		for (int i = 0; i < Width; ++i)
+		{
+			const uint32_t x = std::min(x0 + i, TransmittanceResolution - 1);
+			const glm::vec3 uvw((static_cast<float>(x) + 0.5f) / resolution, (static_cast<float>(y) + 0.5f) / resolution, (static_cast<float>(z) + 0.5f) / resolution);
+			const glm::vec3 origin = glm::mix(boundsMin, boundsMax, uvw);
+			const glm::vec3 toLight = lightPos - origin;
+			const float lightDist = glm::length(toLight);
+			const glm::vec3 direction = toLight / std::max(lightDist, 0.0001f);
+			const glm::vec3 invDirection = 1.f / direction;
+			const glm::vec3 tFar = glm::max((boundsMin - origin) * invDirection, (boundsMax - origin) * invDirection);
+			ox[i] = origin.x;
+			oy[i] = origin.y;
+			oz[i] = origin.z;
+			dx[i] = direction.x;
+			dy[i] = direction.y;
+			dz[i] = direction.z;
+			len[i] = std::min(lightDist, std::min(std::min(tFar.x, tFar.y), tFar.z));
+		}
+
+		const VVec3 origin(VFloat::Load(ox), VFloat::Load(oy), VFloat::Load(oz));
+		const VVec3 direction(VFloat::Load(dx), VFloat::Load(dy), VFloat::Load(dz));
+		const VFloat length = VFloat::Load(len);
+
+		VFloat depth(0.f);
+		VFloat opticalDepth(0.f);
+		VMask marching = FirstLanes(laneCount) & (depth < length) & (opticalDepth < VFloat(maxOpticalDepth));
+		while (Any(marching))
+		{
+			const VFloat density = QueryDensity(params, origin + direction * depth, marching);
+			opticalDepth = Select(marching, opticalDepth + density * VFloat(info.LightMarchSize), opticalDepth);
+			depth = Select(marching, depth + VFloat(info.LightMarchSize), depth);
+			marching = marching & (depth < length) & (opticalDepth < VFloat(maxOpticalDepth));
+		}
+
+		alignas(32) float result[Width];
+		opticalDepth.Store(result);
+		std::copy(result, result + laneCount, output + x0);
+	}
+}
+
+void VolumetricsCPU::RunTransmittance(const VolumetricsInfo& info, const TransmittanceInfo& transmittance, const FogShapes& shapes, const FogGrid& grid, const VulkanExample::UniformDataComposition& scene)
+{
+	assert(Noise != nullptr);
+
+	TransmittanceResolution = transmittance.Resolution;
+	TransmittanceMap.assign(static_cast<size_t>(TransmittanceResolution) * TransmittanceResolution * TransmittanceResolution * s_TransmittanceLightSlabs, 0.f);
+
+	FirstStageParams params{};
+	params.Info = &info;
+	params.Transmittance = &transmittance;
+	params.Shapes = &shapes;
+	params.Grid = &grid;
+	params.Scene = &scene;
+
+	const uint32_t lightCount = std::min(static_cast<uint32_t>(std::max(scene.lightCount, 0)), s_TransmittanceLightSlabs);
+
+	Timer<resolutions::microseconds> timer;
+	ParallelFor(lightCount * TransmittanceResolution, [&](uint32_t slice)
+	{
+		const int light = static_cast<int>(slice / TransmittanceResolution);
+		const uint32_t z = slice % TransmittanceResolution;
+		for (uint32_t y = 0; y < TransmittanceResolution; ++y)
+		{
+			TransmittanceRow(params, light, y, z);
+		}
+	});
+	TransmittanceTime = static_cast<double>(timer.total_elapsed()) / 1000.0;
+}
+
+glm::vec4 VolumetricsCPU::BlendHistory(const FirstStageParams& params, const glm::vec4& current, const glm::vec3& direction, uint32_t z) const
+{
+	const VolumetricsInfo& info = *params.Info;
+	const VolumetricsFrameInfo& frame = *params.Frame;
+
+	// Reproject the centre of this froxel rather than the jittered sample, the history holds the average over the froxel
+	const glm::vec3 centrePos = glm::vec3(params.Scene->viewPos) + direction * SliceDepth(info, static_cast<float>(z) + 0.5f);
+	const glm::vec4 prevClip = frame.PrevViewProj * glm::vec4(centrePos, 1.f);
+	if (prevClip.w <= 0.f)
+	{
+		return current;
+	}
+
+	const glm::vec2 uv = (glm::vec2(prevClip) / prevClip.w) * 0.5f + 0.5f;
+	const glm::vec3 uvw(uv, DepthToSlice(info, glm::length(centrePos - glm::vec3(frame.PrevViewPos))) / static_cast<float>(MapDepth));
+	if (glm::any(glm::lessThan(uvw, glm::vec3(0.f))) || glm::any(glm::greaterThan(uvw, glm::vec3(1.f))))
+	{
+		return current;
+	}
+
+	const glm::vec4 history = SampleVolume(History, MapWidth, MapHeight, MapDepth, uvw);
+	return glm::mix(history, current, frame.HistoryBlend);
+}
+
+void VolumetricsCPU::RunFirstStage(const VolumetricsInfo& info, const VolumetricsFrameInfo& frame, const TransmittanceInfo& transmittance, const FogShapes& shapes, const FogGrid& grid,
+	const VulkanExample::UniformDataComposition& scene)
+{
+	assert(Noise != nullptr);
+
+	MapWidth = info.MapWidth;
+	MapHeight = info.MapHeight;
+	MapDepth = info.MapDepth;
+	FirstStageMap.assign(static_cast<size_t>(MapWidth) * MapHeight * MapDepth, 0u);
+
+	FirstStageParams params;
+	params.Info = &info;
+	params.Frame = &frame;
+	params.Transmittance = &transmittance;
+	params.Shapes = &shapes;
+	params.Grid = &grid;
+	params.Scene = &scene;
+	params.LightStepTransmittance = std::exp(-(info.Absorption * info.Density * info.LightMarchSize));
+	params.BlendHistory = (frame.HistoryValid != 0) && (History.size() == FirstStageMap.size());
+
+	Timer<resolutions::microseconds> timer;
+	ParallelFor(MapDepth, [&](uint32_t z)
+	{
+		for (uint32_t y = 0; y < MapHeight; ++y)
+		{
+			FirstStageRow(params, y, z);
+		}
+	});
+	FirstStageTime = static_cast<double>(timer.total_elapsed()) / 1000.0;
+}
+
+void VolumetricsCPU::SecondStageRow(const VolumetricsInfo& info, const VulkanExample::UniformDataComposition& scene, uint32_t y)
+{
+	uint32_t* output = &SecondStageMap[static_cast<size_t>(y) * OutputWidth];
+
+	const VVec3 viewPos(scene.viewPos.x, scene.viewPos.y, scene.viewPos.z);
+	const float v = (static_cast<float>(y) + 0.5f) / static_cast<float>(OutputHeight);
+	const uint32_t py = std::min(static_cast<uint32_t>(v * PositionsHeight), PositionsHeight - 1);
+
+	for (uint32_t x0 = 0; x0 < OutputWidth; x0 += Width)
+	{
+		const int laneCount = static_cast<int>(std::min<uint32_t>(Width, OutputWidth - x0));
+
+		// Fetch the ray targets from the G-Buffer with nearest filtering
+		alignas(32) float u[Width], tx[Width], ty[Width], tz[Width], hasTarget[Width];
+		for (int i = 0; i < Width; ++i)
+		{
+			const uint32_t x = std::min(x0 + i, OutputWidth - 1);
+			u[i] = (static_cast<float>(x) + 0.5f) / static_cast<float>(OutputWidth);
+			const uint32_t px = std::min(static_cast<uint32_t>(u[i] * PositionsWidth), PositionsWidth - 1);
+			const glm::vec4& target = Positions[static_cast<size_t>(py) * PositionsWidth + px];
+			tx[i] = target.x;
+			ty[i] = target.y;
+			tz[i] = target.z;
+			hasTarget[i] = (target.x != 0.f || target.y != 0.f || target.z != 0.f) ? 1.f : 0.f;
+		}
+
+		const VFloat rayLength = Length(VVec3(VFloat::Load(tx), VFloat::Load(ty), VFloat::Load(tz)) - viewPos);
+
+		VFloat visibility(1.f);
+		VFloat r(0.f), g(0.f), b(0.f), a(0.f);
+		VMask marching = FirstLanes(laneCount) & (VFloat::Load(hasTarget) > VFloat(0.f)) & (visibility > VFloat(info.AbsorptionCutoff));
+
+		for (uint32_t z = 0; z < MapDepth && Any(marching); ++z)
+		{
+			const float sliceStart = SliceDepth(info, static_cast<float>(z));
+			if (sliceStart > info.Far)
+			{
+				break;
+			}
+			marching = marching & (VFloat(sliceStart) < rayLength);
+			if (!Any(marching))
+			{
+				break;
+			}
+
+			alignas(32) float sr[Width], sg[Width], sb[Width], sa[Width];
+			const int lanes = Bits(marching);
+			for (int i = 0; i < Width; ++i)
+			{
+				const glm::vec4 sampled = (lanes & (1 << i)) ? SampleFroxels(u[i], v, z) : glm::vec4(0.f);
+				sr[i] = sampled.r;
+				sg[i] = sampled.g;
+				sb[i] = sampled.b;
+				sa[i] = sampled.a;
+			}
+
+			const VFloat sampledDensity = VFloat::Load(sa);
+			const VMask inFog = marching & (sampledDensity > VFloat(0.f));
+			if (Any(inFog))
+			{
+				// The exact thickness of the slice, only the part of the last slice in front of the surface contributes
+				const float sliceEnd = SliceDepth(info, static_cast<float>(z + 1));
+				const VFloat stepLength = Min(VFloat(sliceEnd), rayLength) - VFloat(sliceStart);
+
+				const VFloat marched = visibility * Exp(VFloat(0.f) - VFloat(info.Absorption) * sampledDensity * stepLength);
+				const VFloat absorbed = Select(inFog, visibility - marched, VFloat(0.f));
+				visibility = Select(inFog, marched, visibility);
+
+				r = r + absorbed * VFloat::Load(sr);
+				g = g + absorbed * VFloat::Load(sg);
+				b = b + absorbed * VFloat::Load(sb);
+				a = a + absorbed * sampledDensity;
+			}
+
+			marching = marching & (visibility > VFloat(info.AbsorptionCutoff));
+		}
+
+		alignas(32) float or_[Width], og[Width], ob[Width], oa[Width];
+		r.Store(or_);
+		g.Store(og);
+		b.Store(ob);
+		a.Store(oa);
+		for (int i = 0; i < laneCount; ++i)
+		{
+			output[x0 + i] = PackUnorm4x8(or_[i], og[i], ob[i], oa[i]);
+		}
+	}
+}
+
+void VolumetricsCPU::RunSecondStage(const VolumetricsInfo& info, const VulkanExample::UniformDataComposition& scene, uint32_t outputWidth, uint32_t outputHeight)
+{
+	assert(FirstStageMap.size() == static_cast<size_t>(MapWidth) * MapHeight * MapDepth);
+	assert(!Positions.empty());
+
+	OutputWidth = outputWidth;
+	OutputHeight = outputHeight;
+	SecondStageMap.assign(static_cast<size_t>(OutputWidth) * OutputHeight, 0u);
+
+	Timer<resolutions::microseconds> timer;
+	ParallelFor(OutputHeight, [&](uint32_t y)
+	{
+		SecondStageRow(info, scene, y);
+	});
+	SecondStageTime = static_cast<double>(timer.total_elapsed()) / 1000.0;
+}
+
+VolumetricsCPU::Difference VolumetricsCPU::Compare(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b, uint32_t tolerance)
+{
+	Difference result;
+	if (a.size() != b.size() || a.empty())
+	{
+		result.MismatchedTexels = std::max(a.size(), b.size());
+		return result;
+	}
+
+	double squaredError = 0.0;
+	for (size_t i = 0; i < a.size(); ++i)
+	{
+		bool mismatch = false;
+		for (uint32_t channel = 0; channel < 4; ++channel)
+		{
+			const int32_t ca = static_cast<int32_t>((a[i] >> (channel * 8)) & 0xFF);
+			const int32_t cb = static_cast<int32_t>((b[i] >> (channel * 8)) & 0xFF);
+			const uint32_t error = static_cast<uint32_t>(std::abs(ca - cb));
+			result.MaxError = std::max(result.MaxError, error);
+			squaredError += static_cast<double>(error) * error;
+			mismatch |= error > tolerance;
+		}
+		result.MismatchedTexels += mismatch ? 1 : 0;
+	}
+	result.RMSE = std::sqrt(squaredError / (static_cast<double>(a.size()) * 4.0));
+	return result;
+}
+
+bool VolumetricsCPU::SaveRaw(const std::string& filename, const std::vector<uint32_t>& texels)
+{
+	std::ofstream file(filename, std::ios::out | std::ios::binary);
+	if (!file.is_open())
+	{
+		std::cerr << "Could not write " << filename << "\n";
+		return false;
+	}
+	file.write(reinterpret_cast<const char*>(texels.data()), texels.size() * sizeof(uint32_t));
+	return true;
+}
+
+bool VolumetricsCPU::SavePAM(const std::string& filename, const std::vector<uint32_t>& texels, uint32_t width, uint32_t height)
+{
+	std::ofstream file(filename, std::ios::out | std::ios::binary);
+	if (!file.is_open())
+	{
+		std::cerr << "Could not write " << filename << "\n";
+		return false;
+	}
+	file << "P7\nWIDTH " << width << "\nHEIGHT " << height << "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+	file.write(reinterpret_cast<const char*>(texels.data()), static_cast<std::streamsize>(width) * height * sizeof(uint32_t));
+	return true;
+}
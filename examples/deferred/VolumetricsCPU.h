@@ -0,0 +1,148 @@
+#pragma once
+
+#include "Volumetrics.h"
+#include "deferred.h"
+#include "VolumetricsSIMD.h"
+#include "NoiseVolume.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace vks
+{
+	class TaskScheduler;
+}
+
+// CPU reference implementation of the two volumetrics compute stages.
+// Mirrors volumetrics_firststage.comp and volumetrics_secondstage.comp using the same input structs,
+// vectorised across neighbouring froxels / pixels along x and spread across worker threads by depth slice / row.
+// The outputs are quantized to RGBA8 exactly like the storage images so they can be diffed against a
+// readback of the GPU textures, or used to experiment with the algorithm on machines without a GPU.
+class VolumetricsCPU
+{
+public:
+	// A thread count of 0 runs on the shared task scheduler, which uses all hardware threads
+	explicit VolumetricsCPU(uint32_t threadCount = 0);
+	~VolumetricsCPU();
+
+	// Set the noise volume sampled when querying the fog density, it has to outlive the runs
+	void SetNoise(const NoiseVolume& noise);
+
+	// Set the lights the fog is lit by, the scene lights followed by the extra fog lights like the GPU's fog light buffer
+	void SetLights(std::vector<FogLight> lights);
+
+	// Set the world space positions of the G-Buffer, the second stage ends its rays at these
+	void SetPositions(std::vector<glm::vec4> positions, uint32_t width, uint32_t height);
+
+	// Set the froxel grid written by the previous frame, blended into the first stage output when the frame info marks it valid
+	void SetHistory(std::vector<uint32_t> history);
+
+	// Run both stages with the same inputs the GPU receives. When the transmittance volume is enabled RunTransmittance has to
+	// be called first, with the inputs it was last built with on the GPU.
+	void Run(const VolumetricsInfo& info, const VolumetricsFrameInfo& frame, const TransmittanceInfo& transmittance, const FogShapes& shapes, const FogGrid& grid,
+		const VulkanExample::UniformDataComposition& scene, uint32_t outputWidth, uint32_t outputHeight);
+
+	// Build the optical depth volume towards each light, mirrors volumetrics_transmittance.comp
+	void RunTransmittance(const VolumetricsInfo& info, const TransmittanceInfo& transmittance, const FogShapes& shapes, const FogGrid& grid, const VulkanExample::UniformDataComposition& scene);
+
+	void RunFirstStage(const VolumetricsInfo& info, const VolumetricsFrameInfo& frame, const TransmittanceInfo& transmittance, const FogShapes& shapes, const FogGrid& grid,
+		const VulkanExample::UniformDataComposition& scene);
+
+	void RunSecondStage(const VolumetricsInfo& info, const VulkanExample::UniformDataComposition& scene, uint32_t outputWidth, uint32_t outputHeight);
+
+	struct Difference
+	{
+		// Largest per channel difference in 8 bit units
+		uint32_t MaxError = 0;
+		// Root mean square error over all channels in 8 bit units
+		double RMSE = 0.0;
+		// Number of texels with any channel differing by more than the tolerance
+		size_t MismatchedTexels = 0;
+	};
+
+	// Compare two packed RGBA8 images of the same size
+	static Difference Compare(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b, uint32_t tolerance = 1);
+
+	// Write packed RGBA8 texels as raw bytes, x fastest then y then z (same layout as an image readback)
+	static bool SaveRaw(const std::string& filename, const std::vector<uint32_t>& texels);
+
+	// Write a packed RGBA8 2D image as a PAM file which most image viewers and diff tools can open
+	static bool SavePAM(const std::string& filename, const std::vector<uint32_t>& texels, uint32_t width, uint32_t height);
+
+	// Packed RGBA8 output of the first stage, MapWidth * MapHeight * MapDepth texels
+	std::vector<uint32_t> FirstStageMap;
+	// Packed RGBA8 output of the second stage, OutputWidth * OutputHeight texels
+	std::vector<uint32_t> SecondStageMap;
+	// Optical depth towards each light, TransmittanceResolution^3 texels per light stacked along z
+	std::vector<float> TransmittanceMap;
+
+	uint32_t MapWidth = 0;
+	uint32_t MapHeight = 0;
+	uint32_t MapDepth = 0;
+
+	uint32_t OutputWidth = 0;
+	uint32_t OutputHeight = 0;
+
+	uint32_t TransmittanceResolution = 0;
+
+	// Timings of the last run in milliseconds
+	double FirstStageTime = 0.0;
+	double SecondStageTime = 0.0;
+	double TransmittanceTime = 0.0;
+
+	uint32_t ThreadCount = 0;
+
+private:
+	// Per run constants shared by all first stage workers
+	struct FirstStageParams
+	{
+		const VolumetricsInfo* Info;
+		const VolumetricsFrameInfo* Frame;
+		const TransmittanceInfo* Transmittance;
+		const FogShapes* Shapes;
+		const FogGrid* Grid;
+		const VulkanExample::UniformDataComposition* Scene;
+		// Transmittance of a single light march step through fog, constant as the density is either 0 or Info->Density
+		float LightStepTransmittance;
+		// Set when a history grid of the right size was provided and the frame info marks it valid
+		bool BlendHistory;
+	};
+
+	void FirstStageRow(const FirstStageParams& params, uint32_t y, uint32_t z);
+
+	void TransmittanceRow(const FirstStageParams& params, int light, uint32_t y, uint32_t z);
+
+	// Light visibility from the transmittance volume, following SampleLightVisibility in volumetrics_firststage.comp
+	float SampleLightVisibility(const FirstStageParams& params, const glm::vec3& pos, int light) const;
+
+	// Blend a froxel with the reprojected history, following BlendHistory in volumetrics_firststage.comp
+	glm::vec4 BlendHistory(const FirstStageParams& params, const glm::vec4& current, const glm::vec3& direction, uint32_t z) const;
+
+	void SecondStageRow(const VolumetricsInfo& info, const VulkanExample::UniformDataComposition& scene, uint32_t y);
+
+	simd::VFloat QueryDensity(const FirstStageParams& params, const simd::VVec3& pos, simd::VMask active) const;
+
+	simd::VFloat CalculateLightVisibility(const FirstStageParams& params, const simd::VVec3& origin, const simd::VVec3& direction, simd::VFloat length, simd::VMask active) const;
+
+	// Bilinear sample of a single slice of the first stage output with clamp to edge addressing
+	glm::vec4 SampleFroxels(float u, float v, uint32_t z) const;
+
+	// Run func(i) for every i in [0, count) across the worker threads
+	template<typename Func>
+	void ParallelFor(uint32_t count, const Func& func);
+
+	// Only set for an explicit thread count, Scheduler points to the shared one otherwise
+	std::unique_ptr<vks::TaskScheduler> OwnScheduler;
+	vks::TaskScheduler* Scheduler = nullptr;
+
+	const NoiseVolume* Noise = nullptr;
+
+	std::vector<uint32_t> History;
+
+	std::vector<FogLight> Lights;
+
+	std::vector<glm::vec4> Positions;
+	uint32_t PositionsWidth = 0;
+	uint32_t PositionsHeight = 0;
+};
@@ -0,0 +1,102 @@
+#include "VolumetricsGovernor.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+const std::array<VolumetricsQualityLevel, 6> VolumetricsGovernor::s_Levels =
+{{
+	{ "640 x 360 x 512", 3, 1.f, VolumetricsQualityLevel::s_AllLights },
+	{ "640 x 360 x 256", 2, 1.f, VolumetricsQualityLevel::s_AllLights },
+	{ "320 x 180 x 128", 1, 1.f, VolumetricsQualityLevel::s_AllLights },
+	{ "320 x 180 x 128, coarse light march", 1, 2.f, VolumetricsQualityLevel::s_AllLights },
+	{ "160 x 90 x 64, coarse light march, 3 lights", 0, 2.f, 3 },
+	{ "160 x 90 x 64, coarsest light march, 1 light", 0, 4.f, 1 },
+}};
+
+void VolumetricsGovernor::Reset(int32_t level)
+{
+	Level = std::min(std::max(level, 0), static_cast<int32_t>(s_Levels.size()) - 1);
+	SampleCount = 0;
+	OverBudgetFrames = 0;
+	UnderBudgetFrames = 0;
+	CooldownFrames = 0;
+}
+
+bool VolumetricsGovernor::Update(float gpuTime)
+{
+	++FrameIndex;
+
+	SmoothedMs = (SampleCount == 0) ? gpuTime : SmoothedMs + (gpuTime - SmoothedMs) * s_Smoothing;
+	++SampleCount;
+
+	if (CooldownFrames > 0)
+	{
+		--CooldownFrames;
+		return false;
+	}
+
+	const int32_t PreviousLevel = Level;
+	const char* Reason = nullptr;
+
+	if (SmoothedMs > BudgetMs && Level < static_cast<int32_t>(s_Levels.size()) - 1)
+	{
+		UnderBudgetFrames = 0;
+		if (++OverBudgetFrames >= s_FramesToLower)
+		{
+			++Level;
+			Reason = "over budget";
+		}
+	}
+	else if (SmoothedMs < BudgetMs * s_Headroom && Level > 0)
+	{
+		OverBudgetFrames = 0;
+		if (++UnderBudgetFrames >= s_FramesToRaise)
+		{
+			--Level;
+			Reason = "under budget";
+		}
+	}
+	else
+	{
+		OverBudgetFrames = 0;
+		UnderBudgetFrames = 0;
+	}
+
+	if (Reason == nullptr)
+	{
+		return false;
+	}
+
+	LogDecision(PreviousLevel, Reason);
+
+	// The new settings cost a different amount, start measuring again once they've settled
+	OverBudgetFrames = 0;
+	UnderBudgetFrames = 0;
+	CooldownFrames = s_Cooldown;
+	SampleCount = 0;
+	return true;
+}
+
+void VolumetricsGovernor::LogDecision(int32_t previousLevel, const char* reason)
+{
+	if (!Log.is_open())
+	{
+		Log.open("volumetrics_governor.csv");
+		Log << "frame,smoothed_ms,budget_ms,from_level,to_level,reason,settings\n";
+	}
+	Log << FrameIndex << "," << SmoothedMs << "," << BudgetMs << "," << previousLevel << "," << Level << "," << reason << ",\"" << s_Levels[Level].Name << "\"\n";
+	Log.flush();
+
+	std::stringstream Decision;
+	Decision << std::fixed << std::setprecision(2);
+	Decision << "Frame " << FrameIndex << ": " << SmoothedMs << " ms " << reason << ", level " << previousLevel << " -> " << Level << " (" << s_Levels[Level].Name << ")";
+	std::cout << "Volumetrics governor: " << Decision.str() << "\n";
+
+	RecentDecisions.push_front(Decision.str());
+	if (RecentDecisions.size() > s_MaxRecentDecisions)
+	{
+		RecentDecisions.pop_back();
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <string>
+
+// Quality settings the governor steps between, from the most to the least expensive
+struct VolumetricsQualityLevel
+{
+	const char* Name;
+	// Index into the froxel grid presets, resizing the grid also rescales InitialStepSize to cover the same depth
+	uint32_t PresetIndex;
+	// Multiplier on the user's light march step size
+	float LightMarchScale;
+	// Largest number of lights the fog is lit by
+	uint32_t LightLimit;
+
+	// Light limit which lights the fog with every light
+	static constexpr uint32_t s_AllLights = ~0u;
+};
+
+// Feedback controller keeping the GPU time of the volumetrics under a budget.
+// The time is smoothed over a few frames and the quality is only stepped down after it has stayed over budget for a
+// while, and only stepped back up after a longer stretch with plenty of headroom, so it doesn't oscillate between levels.
+// Every decision is written to volumetrics_governor.csv.
+class VolumetricsGovernor
+{
+public:
+	// Feed the GPU time of the last frame in milliseconds, returns true when the level has changed
+	bool Update(float gpuTime);
+
+	// Start controlling from the given level, e.g. the one matching the current settings
+	void Reset(int32_t level);
+
+	const VolumetricsQualityLevel& CurrentLevel() const { return s_Levels[Level]; }
+
+	static const std::array<VolumetricsQualityLevel, 6> s_Levels;
+
+	bool Enabled = false;
+
+	// Target GPU time of the volumetrics passes in milliseconds
+	float BudgetMs = 2.0f;
+
+	int32_t Level = 0;
+
+	// Exponential moving average of the GPU time
+	float SmoothedMs = 0.0f;
+
+	// Most recent decisions shown in the overlay
+	std::deque<std::string> RecentDecisions;
+
+private:
+	void LogDecision(int32_t previousLevel, const char* reason);
+
+	// Weight of the newest frame in the moving average
+	static constexpr float s_Smoothing = 0.1f;
+	// Fraction of the budget the time has to stay under before the quality is raised, leaves room for the next level's cost
+	static constexpr float s_Headroom = 0.6f;
+	// Frames over / under budget before the level changes
+	static constexpr uint32_t s_FramesToLower = 8;
+	static constexpr uint32_t s_FramesToRaise = 90;
+	// Frames ignored after a change while the new settings settle
+	static constexpr uint32_t s_Cooldown = 30;
+	static constexpr size_t s_MaxRecentDecisions = 5;
+
+	uint64_t FrameIndex = 0;
+	uint32_t SampleCount = 0;
+	uint32_t OverBudgetFrames = 0;
+	uint32_t UnderBudgetFrames = 0;
+	uint32_t CooldownFrames = 0;
+
+	std::ofstream Log;
+};
@@ -0,0 +1,190 @@
+#pragma once
+
+// Small SIMD wrapper used by the CPU side of the volumetrics.
+// Picks AVX2 or SSE2 depending on what the compiler targets and falls back to plain
+// arrays otherwise, so the calling code can be written once in terms of VFloat/VMask lanes.
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VOLUMETRICS_SIMD_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VOLUMETRICS_SIMD_SSE2 1
+#endif
+
+namespace simd
+{
+#if defined(VOLUMETRICS_SIMD_AVX2)
+
+	constexpr int Width = 8;
+	constexpr const char* Name = "AVX2";
+
+	struct VMask { __m256 v; };
+
+	struct VFloat
+	{
+		__m256 v;
+		VFloat() = default;
+		explicit VFloat(__m256 x) : v(x) {}
+		VFloat(float s) : v(_mm256_set1_ps(s)) {}
+		static VFloat Load(const float* p) { return VFloat(_mm256_loadu_ps(p)); }
+		void Store(float* p) const { _mm256_storeu_ps(p, v); }
+		// Lane indices 0..Width-1
+		static VFloat Iota() { return VFloat(_mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f)); }
+	};
+
+	inline VFloat operator+(VFloat a, VFloat b) { return VFloat(_mm256_add_ps(a.v, b.v)); }
+	inline VFloat operator-(VFloat a, VFloat b) { return VFloat(_mm256_sub_ps(a.v, b.v)); }
+	inline VFloat operator*(VFloat a, VFloat b) { return VFloat(_mm256_mul_ps(a.v, b.v)); }
+	inline VFloat operator/(VFloat a, VFloat b) { return VFloat(_mm256_div_ps(a.v, b.v)); }
+	inline VFloat Min(VFloat a, VFloat b) { return VFloat(_mm256_min_ps(a.v, b.v)); }
+	inline VFloat Max(VFloat a, VFloat b) { return VFloat(_mm256_max_ps(a.v, b.v)); }
+	inline VFloat Sqrt(VFloat a) { return VFloat(_mm256_sqrt_ps(a.v)); }
+	inline VFloat Floor(VFloat a) { return VFloat(_mm256_floor_ps(a.v)); }
+
+	inline VMask operator<(VFloat a, VFloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+	inline VMask operator<=(VFloat a, VFloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+	inline VMask operator>(VFloat a, VFloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+	inline VMask operator>=(VFloat a, VFloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+	inline VMask operator&(VMask a, VMask b) { return { _mm256_and_ps(a.v, b.v) }; }
+	inline VMask operator|(VMask a, VMask b) { return { _mm256_or_ps(a.v, b.v) }; }
+	inline VMask AndNot(VMask a, VMask b) { return { _mm256_andnot_ps(b.v, a.v) }; }
+	inline VMask AllLanes() { return { _mm256_castsi256_ps(_mm256_set1_epi32(-1)) }; }
+
+	// Returns a where the mask is set, b otherwise
+	inline VFloat Select(VMask m, VFloat a, VFloat b) { return VFloat(_mm256_blendv_ps(b.v, a.v, m.v)); }
+	inline int Bits(VMask m) { return _mm256_movemask_ps(m.v); }
+
+#elif defined(VOLUMETRICS_SIMD_SSE2)
+
+	constexpr int Width = 4;
+	constexpr const char* Name = "SSE2";
+
+	struct VMask { __m128 v; };
+
+	struct VFloat
+	{
+		__m128 v;
+		VFloat() = default;
+		explicit VFloat(__m128 x) : v(x) {}
+		VFloat(float s) : v(_mm_set1_ps(s)) {}
+		static VFloat Load(const float* p) { return VFloat(_mm_loadu_ps(p)); }
+		void Store(float* p) const { _mm_storeu_ps(p, v); }
+		static VFloat Iota() { return VFloat(_mm_setr_ps(0.f, 1.f, 2.f, 3.f)); }
+	};
+
+	inline VFloat operator+(VFloat a, VFloat b) { return VFloat(_mm_add_ps(a.v, b.v)); }
+	inline VFloat operator-(VFloat a, VFloat b) { return VFloat(_mm_sub_ps(a.v, b.v)); }
+	inline VFloat operator*(VFloat a, VFloat b) { return VFloat(_mm_mul_ps(a.v, b.v)); }
+	inline VFloat operator/(VFloat a, VFloat b) { return VFloat(_mm_div_ps(a.v, b.v)); }
+	inline VFloat Min(VFloat a, VFloat b) { return VFloat(_mm_min_ps(a.v, b.v)); }
+	inline VFloat Max(VFloat a, VFloat b) { return VFloat(_mm_max_ps(a.v, b.v)); }
+	inline VFloat Sqrt(VFloat a) { return VFloat(_mm_sqrt_ps(a.v)); }
+
+	inline VMask operator<(VFloat a, VFloat b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+	inline VMask operator<=(VFloat a, VFloat b) { return { _mm_cmple_ps(a.v, b.v) }; }
+	inline VMask operator>(VFloat a, VFloat b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+	inline VMask operator>=(VFloat a, VFloat b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+	inline VMask operator&(VMask a, VMask b) { return { _mm_and_ps(a.v, b.v) }; }
+	inline VMask operator|(VMask a, VMask b) { return { _mm_or_ps(a.v, b.v) }; }
+	inline VMask AndNot(VMask a, VMask b) { return { _mm_andnot_ps(b.v, a.v) }; }
+	inline VMask AllLanes() { return { _mm_castsi128_ps(_mm_set1_epi32(-1)) }; }
+
+	// SSE2 has no blendv, so build the select out of bitwise ops
+	inline VFloat Select(VMask m, VFloat a, VFloat b) { return VFloat(_mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v))); }
+	inline int Bits(VMask m) { return _mm_movemask_ps(m.v); }
+
+	// SSE2 has no round instruction, truncate and correct for negative values instead
+	inline VFloat Floor(VFloat a)
+	{
+		const __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+		return VFloat(_mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.f))));
+	}
+
+#else
+
+	constexpr int Width = 4;
+	constexpr const char* Name = "Scalar";
+
+	struct VMask { bool v[Width]; };
+
+	struct VFloat
+	{
+		float v[Width];
+		VFloat() = default;
+		VFloat(float s) { for (int i = 0; i < Width; ++i) v[i] = s; }
+		static VFloat Load(const float* p) { VFloat r; for (int i = 0; i < Width; ++i) r.v[i] = p[i]; return r; }
+		void Store(float* p) const { for (int i = 0; i < Width; ++i) p[i] = v[i]; }
+		static VFloat Iota() { VFloat r; for (int i = 0; i < Width; ++i) r.v[i] = static_cast<float>(i); return r; }
+	};
+
+#define VOLUMETRICS_SIMD_LANEWISE(expr) for (int i = 0; i < Width; ++i) { expr; } return r;
+
+	inline VFloat operator+(VFloat a, VFloat b) { VFloat r; VOLUMETRICS_SIMD_LANEWISE(r.v[i] = a.v[i] + b.v[i]) }
+	inline VFloat operator-(VFloat a, VFloat b) { VFloat r; VOLUMETRICS_SIMD_LANEWISE(r.v[i] = a.v[i] - b.v[i]) }
+	inline VFloat operator*(VFloat a, VFloat b) { VFloat r; VOLUMETRICS_SIMD_LANEWISE(r.v[i] = a.v[i] * b.v[i]) }
+	inline VFloat operator/(VFloat a, VFloat b) { VFloat r; VOLUMETRICS_SIMD_LANEWISE(r.v[i] = a.v[i] / b.v[i]) }
+	inline VFloat Min(VFloat a, VFloat b) { VFloat r; VOLUMETRICS_SIMD_LANEWISE(r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]) }
+	inline VFloat Max(VFloat a, VFloat b) { VFloat r; VOLUMETRICS_SIMD_LANEWISE(r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]) }
+	inline VFloat Sqrt(VFloat a) { VFloat r; VOLUMETRICS_SIMD_LANEWISE(r.v[i] = std::sqrt(a.v[i])) }
+	inline VFloat Floor(VFloat a) { VFloat r; VOLUMETRICS_SIMD_LANEWISE(r.v[i] = std::floor(a.v[i])) }
+
+	inline VMask operator<(VFloat a, VFloat b) { VMask r; VOLUMETRICS_SIMD_LANEWISE(r.v[i] = a.v[i] < b.v[i]) }
+	inline VMask operator<=(VFloat a, VFloat b) { VMask r; VOLUMETRICS_SIMD_LANEWISE(r.v[i] = a.v[i] <= b.v[i]) }
+	inline VMask operator>(VFloat a, VFloat b) { VMask r; VOLUMETRICS_SIMD_LANEWISE(r.v[i] = a.v[i] > b.v[i]) }
+	inline VMask operator>=(VFloat a, VFloat b) { VMask r; VOLUMETRICS_SIMD_LANEWISE(r.v[i] = a.v[i] >= b.v[i]) }
+	inline VMask operator&(VMask a, VMask b) { VMask r; VOLUMETRICS_SIMD_LANEWISE(r.v[i] = a.v[i] && b.v[i]) }
+	inline VMask operator|(VMask a, VMask b) { VMask r; VOLUMETRICS_SIMD_LANEWISE(r.v[i] = a.v[i] || b.v[i]) }
+	inline VMask AndNot(VMask a, VMask b) { VMask r; VOLUMETRICS_SIMD_LANEWISE(r.v[i] = a.v[i] && !b.v[i]) }
+	inline VMask AllLanes() { VMask r; VOLUMETRICS_SIMD_LANEWISE(r.v[i] = true) }
+
+	inline VFloat Select(VMask m, VFloat a, VFloat b) { VFloat r; VOLUMETRICS_SIMD_LANEWISE(r.v[i] = m.v[i] ? a.v[i] : b.v[i]) }
+	inline int Bits(VMask m) { int r = 0; for (int i = 0; i < Width; ++i) { r |= m.v[i] ? (1 << i) : 0; } return r; }
+
+#undef VOLUMETRICS_SIMD_LANEWISE
+
+#endif
+
+	inline bool Any(VMask m) { return Bits(m) != 0; }
+	inline bool All(VMask m) { return Bits(m) == (1 << Width) - 1; }
+
+	inline VFloat Abs(VFloat a) { return Max(a, VFloat(0.f) - a); }
+	inline VFloat Clamp(VFloat x, VFloat lo, VFloat hi) { return Min(Max(x, lo), hi); }
+	inline VFloat Mix(VFloat a, VFloat b, VFloat t) { return a + (b - a) * t; }
+
+	// Mask with the first 'count' lanes set, used for the tail of rows that aren't a multiple of Width
+	inline VMask FirstLanes(int count) { return VFloat::Iota() < VFloat(static_cast<float>(count)); }
+
+	// Per lane fallback for functions without a vector implementation
+	template<typename Func>
+	inline VFloat Lanewise(VFloat a, Func f)
+	{
+		alignas(32) float tmp[Width];
+		a.Store(tmp);
+		for (int i = 0; i < Width; ++i)
+		{
+			tmp[i] = f(tmp[i]);
+		}
+		return VFloat::Load(tmp);
+	}
+
+	inline VFloat Exp(VFloat a) { return Lanewise(a, [](float x) { return std::exp(x); }); }
+
+	// Three lanes of floats treated as a vec3 per lane
+	struct VVec3
+	{
+		VFloat x, y, z;
+		VVec3() = default;
+		VVec3(VFloat ix, VFloat iy, VFloat iz) : x(ix), y(iy), z(iz) {}
+		VVec3(float ix, float iy, float iz) : x(ix), y(iy), z(iz) {}
+	};
+
+	inline VVec3 operator+(const VVec3& a, const VVec3& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+	inline VVec3 operator-(const VVec3& a, const VVec3& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+	inline VVec3 operator*(const VVec3& a, VFloat s) { return { a.x * s, a.y * s, a.z * s }; }
+	inline VFloat Dot(const VVec3& a, const VVec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+	inline VFloat Length(const VVec3& a) { return Sqrt(Dot(a, a)); }
+}
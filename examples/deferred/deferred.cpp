@@ -13,9 +13,12 @@
 */
 
 #include "Volumetrics.h"
+#include "VolumetricsCPU.h"
 #include "deferred.h"
 #include "VulkanglTFModel.h"
 
+#include <iomanip>
+
 VulkanExample::VulkanExample() : VulkanExampleBase()
 {
 	title = "Deferred shading";
@@ -27,6 +30,7 @@ VulkanExample::VulkanExample() : VulkanExampleBase()
 	camera.position = { 0.f, 5.0f, -16.f };
 	camera.setRotation(glm::vec3(-18.f, 0.f, 0.0f));
 	camera.setPerspective(60.0f, (float)width / (float)height, 0.1f, 256.0f);
+	startAssetDecoding();
 }
 
 VulkanExample::~VulkanExample()
@@ -34,29 +38,32 @@ VulkanExample::~VulkanExample()
 	if (device) {
 		vkDestroySampler(device, colorSampler, nullptr);
 
-		// Frame buffer
-
-		// Color attachments
-		vkDestroyImageView(device, offScreenFrameBuf.position.view, nullptr);
-		vkDestroyImage(device, offScreenFrameBuf.position.image, nullptr);
-		vkFreeMemory(device, offScreenFrameBuf.position.mem, nullptr);
+		// Frame buffers
+		for (GBuffer& slot : offScreenFrameBuf.slots) {
+			// Color attachments
+			vkDestroyImageView(device, slot.position.view, nullptr);
+			vkDestroyImage(device, slot.position.image, nullptr);
+			vulkanDevice->allocator.free(slot.position.memory);
 
-		vkDestroyImageView(device, offScreenFrameBuf.normal.view, nullptr);
-		vkDestroyImage(device, offScreenFrameBuf.normal.image, nullptr);
-		vkFreeMemory(device, offScreenFrameBuf.normal.mem, nullptr);
+			vkDestroyImageView(device, slot.normal.view, nullptr);
+			vkDestroyImage(device, slot.normal.image, nullptr);
+			vulkanDevice->allocator.free(slot.normal.memory);
 
-		vkDestroyImageView(device, offScreenFrameBuf.albedo.view, nullptr);
-		vkDestroyImage(device, offScreenFrameBuf.albedo.image, nullptr);
-		vkFreeMemory(device, offScreenFrameBuf.albedo.mem, nullptr);
+			vkDestroyImageView(device, slot.albedo.view, nullptr);
+			vkDestroyImage(device, slot.albedo.image, nullptr);
+			vulkanDevice->allocator.free(slot.albedo.memory);
 
-		// Depth attachment
-		vkDestroyImageView(device, offScreenFrameBuf.depth.view, nullptr);
-		vkDestroyImage(device, offScreenFrameBuf.depth.image, nullptr);
-		vkFreeMemory(device, offScreenFrameBuf.depth.mem, nullptr);
+			// Depth attachment
+			vkDestroyImageView(device, slot.depth.view, nullptr);
+			vkDestroyImage(device, slot.depth.image, nullptr);
+			vulkanDevice->allocator.free(slot.depth.memory);
 
-		vkDestroyFramebuffer(device, offScreenFrameBuf.frameBuffer, nullptr);
+			vkDestroyFramebuffer(device, slot.frameBuffer, nullptr);
+		}
 
-		vkDestroyPipeline(device, pipelines.composition, nullptr);
+		for (auto& compositionPipeline : compositionPipelines) {
+			vkDestroyPipeline(device, compositionPipeline.second, nullptr);
+		}
 		vkDestroyPipeline(device, pipelines.offscreen, nullptr);
 
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
@@ -64,8 +71,10 @@ VulkanExample::~VulkanExample()
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 
 		// Uniform buffers
-		uniformBuffers.offscreen.destroy();
-		uniformBuffers.composition.destroy();
+		for (UniformBuffers& buffers : uniformBuffers) {
+			buffers.offscreen.destroy();
+			buffers.composition.destroy();
+		}
 
 		vkDestroyRenderPass(device, offScreenFrameBuf.renderPass, nullptr);
 
@@ -74,9 +83,15 @@ VulkanExample::~VulkanExample()
 		textures.floor.colorMap.destroy();
 		textures.floor.normalMap.destroy();
 
-		vkDestroySemaphore(device, offscreenSemaphore, nullptr);
+		for (uint32_t i = 0; i < s_FrameSlots; ++i) {
+			vkDestroySemaphore(device, offscreenSemaphores[i], nullptr);
+			vkDestroySemaphore(device, presentCompleteSemaphores[i], nullptr);
+			vkDestroySemaphore(device, renderCompleteSemaphores[i], nullptr);
+			vkDestroyFence(device, frameFences[i], nullptr);
+		}
 
 		Volumetrics.Release(device);
+		profiler.Release();
 	}
 }
 
@@ -87,6 +102,14 @@ void VulkanExample::getEnabledFeatures()
 	if (deviceFeatures.samplerAnisotropy) {
 		enabledFeatures.samplerAnisotropy = VK_TRUE;
 	}
+	// The volumetrics froxel grid can only use the storage formats other than RGBA8 with this, as they are stored without declaring the format
+	if (deviceFeatures.shaderStorageImageWriteWithoutFormat) {
+		enabledFeatures.shaderStorageImageWriteWithoutFormat = VK_TRUE;
+	}
+	// Lets the profiler count the compute shader invocations of the volumetrics
+	if (deviceFeatures.pipelineStatisticsQuery) {
+		enabledFeatures.pipelineStatisticsQuery = VK_TRUE;
+	}
 };
 
 // Create a frame buffer attachment
@@ -125,17 +148,11 @@ void VulkanExample::createAttachment(
 	image.arrayLayers = 1;
 	image.samples = VK_SAMPLE_COUNT_1_BIT;
 	image.tiling = VK_IMAGE_TILING_OPTIMAL;
-	image.usage = usage | VK_IMAGE_USAGE_SAMPLED_BIT;
-
-	VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
-	VkMemoryRequirements memReqs;
+	// Transfer source so the attachments can be read back for validation
+	image.usage = usage | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
 
 	VK_CHECK_RESULT(vkCreateImage(device, &image, nullptr, &attachment->image));
-	vkGetImageMemoryRequirements(device, attachment->image, &memReqs);
-	memAlloc.allocationSize = memReqs.size;
-	memAlloc.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &attachment->mem));
-	VK_CHECK_RESULT(vkBindImageMemory(device, attachment->image, attachment->mem, 0));
+	VK_CHECK_RESULT(vulkanDevice->allocator.allocateImage(attachment->image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &attachment->memory));
 
 	VkImageViewCreateInfo imageView = vks::initializers::imageViewCreateInfo();
 	imageView.viewType = VK_IMAGE_VIEW_TYPE_2D;
@@ -157,37 +174,39 @@ void VulkanExample::prepareOffscreenFramebuffer()
 	offScreenFrameBuf.width = 2048;
 	offScreenFrameBuf.height = 2048;
 
-	// Color attachments
-
-	// (World space) Positions
-	createAttachment(
-		VK_FORMAT_R16G16B16A16_SFLOAT,
-		VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-		&offScreenFrameBuf.position);
-
-	// (World space) Normals
-	createAttachment(
-		VK_FORMAT_R16G16B16A16_SFLOAT,
-		VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-		&offScreenFrameBuf.normal);
-
-	// Albedo (color)
-	createAttachment(
-		VK_FORMAT_R8G8B8A8_UNORM,
-		VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-		&offScreenFrameBuf.albedo);
-
-	// Depth attachment
-
 	// Find a suitable depth format
 	VkFormat attDepthFormat;
 	VkBool32 validDepthFormat = vks::tools::getSupportedDepthFormat(physicalDevice, &attDepthFormat);
 	assert(validDepthFormat);
 
-	createAttachment(
-		attDepthFormat,
-		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-		&offScreenFrameBuf.depth);
+	for (GBuffer& slot : offScreenFrameBuf.slots)
+	{
+		// Color attachments
+
+		// (World space) Positions, the volumetrics second stage ends its rays at these on the compute queue
+		createAttachment(
+			VK_FORMAT_R16G16B16A16_SFLOAT,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+			&slot.position);
+
+		// (World space) Normals
+		createAttachment(
+			VK_FORMAT_R16G16B16A16_SFLOAT,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+			&slot.normal);
+
+		// Albedo (color)
+		createAttachment(
+			VK_FORMAT_R8G8B8A8_UNORM,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+			&slot.albedo);
+
+		// Depth attachment
+		createAttachment(
+			attDepthFormat,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+			&slot.depth);
+	}
 
 	// Set up separate renderpass with references to the color and depth attachments
 	std::array<VkAttachmentDescription, 4> attachmentDescs = {};
@@ -212,11 +231,11 @@ void VulkanExample::prepareOffscreenFramebuffer()
 		}
 	}
 
-	// Formats
-	attachmentDescs[0].format = offScreenFrameBuf.position.format;
-	attachmentDescs[1].format = offScreenFrameBuf.normal.format;
-	attachmentDescs[2].format = offScreenFrameBuf.albedo.format;
-	attachmentDescs[3].format = offScreenFrameBuf.depth.format;
+	// Formats, the same for every slot
+	attachmentDescs[0].format = offScreenFrameBuf.slots[0].position.format;
+	attachmentDescs[1].format = offScreenFrameBuf.slots[0].normal.format;
+	attachmentDescs[2].format = offScreenFrameBuf.slots[0].albedo.format;
+	attachmentDescs[3].format = offScreenFrameBuf.slots[0].depth.format;
 
 	std::vector<VkAttachmentReference> colorReferences;
 	colorReferences.push_back({ 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
@@ -263,22 +282,25 @@ void VulkanExample::prepareOffscreenFramebuffer()
 
 	VK_CHECK_RESULT(vkCreateRenderPass(device, &renderPassInfo, nullptr, &offScreenFrameBuf.renderPass));
 
-	std::array<VkImageView,4> attachments;
-	attachments[0] = offScreenFrameBuf.position.view;
-	attachments[1] = offScreenFrameBuf.normal.view;
-	attachments[2] = offScreenFrameBuf.albedo.view;
-	attachments[3] = offScreenFrameBuf.depth.view;
-
-	VkFramebufferCreateInfo fbufCreateInfo = {};
-	fbufCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-	fbufCreateInfo.pNext = NULL;
-	fbufCreateInfo.renderPass = offScreenFrameBuf.renderPass;
-	fbufCreateInfo.pAttachments = attachments.data();
-	fbufCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-	fbufCreateInfo.width = offScreenFrameBuf.width;
-	fbufCreateInfo.height = offScreenFrameBuf.height;
-	fbufCreateInfo.layers = 1;
-	VK_CHECK_RESULT(vkCreateFramebuffer(device, &fbufCreateInfo, nullptr, &offScreenFrameBuf.frameBuffer));
+	for (GBuffer& slot : offScreenFrameBuf.slots)
+	{
+		std::array<VkImageView,4> attachments;
+		attachments[0] = slot.position.view;
+		attachments[1] = slot.normal.view;
+		attachments[2] = slot.albedo.view;
+		attachments[3] = slot.depth.view;
+
+		VkFramebufferCreateInfo fbufCreateInfo = {};
+		fbufCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		fbufCreateInfo.pNext = NULL;
+		fbufCreateInfo.renderPass = offScreenFrameBuf.renderPass;
+		fbufCreateInfo.pAttachments = attachments.data();
+		fbufCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		fbufCreateInfo.width = offScreenFrameBuf.width;
+		fbufCreateInfo.height = offScreenFrameBuf.height;
+		fbufCreateInfo.layers = 1;
+		VK_CHECK_RESULT(vkCreateFramebuffer(device, &fbufCreateInfo, nullptr, &slot.frameBuffer));
+	}
 
 	// Create sampler to sample from the color attachments
 	VkSamplerCreateInfo sampler = vks::initializers::samplerCreateInfo();
@@ -299,14 +321,6 @@ void VulkanExample::prepareOffscreenFramebuffer()
 // Build command buffer for rendering the scene to the offscreen frame buffer attachments
 void VulkanExample::buildDeferredCommandBuffer()
 {
-	if (offScreenCmdBuffer == VK_NULL_HANDLE) {
-		offScreenCmdBuffer = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, false);
-	}
-
-	// Create a semaphore used to synchronize offscreen rendering and usage
-	VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
-	VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &offscreenSemaphore));
-
 	VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
 
 	// Clear values for all attachments written in the fragment shader
@@ -318,52 +332,158 @@ void VulkanExample::buildDeferredCommandBuffer()
 
 	VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
 	renderPassBeginInfo.renderPass =  offScreenFrameBuf.renderPass;
-	renderPassBeginInfo.framebuffer = offScreenFrameBuf.frameBuffer;
 	renderPassBeginInfo.renderArea.extent.width = offScreenFrameBuf.width;
 	renderPassBeginInfo.renderArea.extent.height = offScreenFrameBuf.height;
 	renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
 	renderPassBeginInfo.pClearValues = clearValues.data();
 
-	VK_CHECK_RESULT(vkBeginCommandBuffer(offScreenCmdBuffer, &cmdBufInfo));
+	// One command buffer per frame slot, each rendering into its own G-Buffer with its own uniform buffers
+	for (uint32_t i = 0; i < s_FrameSlots; ++i)
+	{
+		VkCommandBuffer& offScreenCmdBuffer = offScreenCmdBuffers[i];
+		if (offScreenCmdBuffer == VK_NULL_HANDLE) {
+			offScreenCmdBuffer = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, false);
+		}
+
+		renderPassBeginInfo.framebuffer = offScreenFrameBuf.slots[i].frameBuffer;
 
-	vkCmdBeginRenderPass(offScreenCmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		VK_CHECK_RESULT(vkBeginCommandBuffer(offScreenCmdBuffer, &cmdBufInfo));
 
-	VkViewport viewport = vks::initializers::viewport((float)offScreenFrameBuf.width, (float)offScreenFrameBuf.height, 0.0f, 1.0f);
-	vkCmdSetViewport(offScreenCmdBuffer, 0, 1, &viewport);
+		profiler.ResetPass(offScreenCmdBuffer, i, GpuPass::Offscreen);
+		profiler.BeginPass(offScreenCmdBuffer, i, GpuPass::Offscreen);
 
-	VkRect2D scissor = vks::initializers::rect2D(offScreenFrameBuf.width, offScreenFrameBuf.height, 0, 0);
-	vkCmdSetScissor(offScreenCmdBuffer, 0, 1, &scissor);
+		vkCmdBeginRenderPass(offScreenCmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-	vkCmdBindPipeline(offScreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.offscreen);
+		VkViewport viewport = vks::initializers::viewport((float)offScreenFrameBuf.width, (float)offScreenFrameBuf.height, 0.0f, 1.0f);
+		vkCmdSetViewport(offScreenCmdBuffer, 0, 1, &viewport);
 
-	// Floor
-	vkCmdBindDescriptorSets(offScreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.floor, 0, nullptr);
-	models.floor.draw(offScreenCmdBuffer);
+		VkRect2D scissor = vks::initializers::rect2D(offScreenFrameBuf.width, offScreenFrameBuf.height, 0, 0);
+		vkCmdSetScissor(offScreenCmdBuffer, 0, 1, &scissor);
 
-	// We render multiple instances of a model
-	vkCmdBindDescriptorSets(offScreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.model, 0, nullptr);
-	models.model.bindBuffers(offScreenCmdBuffer);
-	vkCmdDrawIndexed(offScreenCmdBuffer, models.model.indices.count, 3, 0, 0, 0);
+		vkCmdBindPipeline(offScreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.offscreen);
 
-	vkCmdEndRenderPass(offScreenCmdBuffer);
+		// Floor
+		vkCmdBindDescriptorSets(offScreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[i].floor, 0, nullptr);
+		models.floor.draw(offScreenCmdBuffer);
 
-	VK_CHECK_RESULT(vkEndCommandBuffer(offScreenCmdBuffer));
+		// We render multiple instances of a model
+		vkCmdBindDescriptorSets(offScreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[i].model, 0, nullptr);
+		models.model.bindBuffers(offScreenCmdBuffer);
+		vkCmdDrawIndexed(offScreenCmdBuffer, models.model.indices.count, 3, 0, 0, 0);
+
+		vkCmdEndRenderPass(offScreenCmdBuffer);
+
+		// Hand the positions over to the compute queue for the volumetrics
+		Volumetrics.ReleaseGBuffer(offScreenCmdBuffer, i);
+
+		profiler.EndPass(offScreenCmdBuffer, i, GpuPass::Offscreen);
+
+		VK_CHECK_RESULT(vkEndCommandBuffer(offScreenCmdBuffer));
+	}
 }
 
-void VulkanExample::loadAssets()
+// Create the per frame slot semaphores and fences
+void VulkanExample::prepareSynchronizationPrimitives()
 {
+	VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
+	// Created signaled as the first wait for each slot has no frame to wait for
+	VkFenceCreateInfo fenceCreateInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
+	for (uint32_t i = 0; i < s_FrameSlots; ++i)
+	{
+		// Used to synchronize offscreen rendering and usage
+		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &offscreenSemaphores[i]));
+		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &presentCompleteSemaphores[i]));
+		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &renderCompleteSemaphores[i]));
+		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &frameFences[i]));
+	}
+	VK_CHECK_RESULT(vkResetFences(device, 1, &frameFences[frameSlot]));
+}
+
+void VulkanExample::startAssetDecoding()
+{
+	// The jobs only read files and fill the CPU side of the assets, the device doesn't exist yet
+	assetLoader.reset(new AssetLoader());
 	const uint32_t glTFLoadingFlags = vkglTF::FileLoadingFlags::PreTransformVertices | vkglTF::FileLoadingFlags::PreMultiplyVertexColors | vkglTF::FileLoadingFlags::FlipY;
-	models.model.loadFromFile(getAssetPath() + "models/armor/armor.gltf", vulkanDevice, queue, glTFLoadingFlags);
-	models.floor.loadFromFile(getAssetPath() + "models/deferred_box.gltf", vulkanDevice, queue, glTFLoadingFlags);
-	textures.model.colorMap.loadFromFile(getAssetPath() + "models/armor/colormap_rgba.ktx", VK_FORMAT_R8G8B8A8_UNORM, vulkanDevice, queue);
-	textures.model.normalMap.loadFromFile(getAssetPath() + "models/armor/normalmap_rgba.ktx", VK_FORMAT_R8G8B8A8_UNORM, vulkanDevice, queue);
-	textures.floor.colorMap.loadFromFile(getAssetPath() + "textures/stonefloor01_color_rgba.ktx", VK_FORMAT_R8G8B8A8_UNORM, vulkanDevice, queue);
-	textures.floor.normalMap.loadFromFile(getAssetPath() + "textures/stonefloor01_normal_rgba.ktx", VK_FORMAT_R8G8B8A8_UNORM, vulkanDevice, queue);
+	auto decodeModel = [this, glTFLoadingFlags](vkglTF::Model& model, const std::string& filename)
+	{
+		return assetLoader->Submit([&model, filename, glTFLoadingFlags]
+		{
+			std::string error;
+			model.parseFile(filename, glTFLoadingFlags, 1.0f, &error);
+			return error;
+		});
+	};
+	assetDecodes.model = decodeModel(models.model, getAssetPath() + "models/armor/armor.gltf");
+	assetDecodes.floor = decodeModel(models.floor, getAssetPath() + "models/deferred_box.gltf");
+	auto decodeTexture = [this](vks::Texture2D& texture, const std::string& filename)
+	{
+		return assetLoader->Submit([&texture, filename]
+		{
+			VKS_CPU_ZONE("Decode texture");
+			DecodedTexture decoded;
+			ktxResult result = texture.loadKTXFile(filename, &decoded.texture);
+			if (result != KTX_SUCCESS) {
+				decoded.texture = nullptr;
+				decoded.error = vks::Texture::loadKTXFileError(filename, result);
+			}
+			return decoded;
+		});
+	};
+	assetDecodes.modelColorMap = decodeTexture(textures.model.colorMap, getAssetPath() + "models/armor/colormap_rgba.ktx");
+	assetDecodes.modelNormalMap = decodeTexture(textures.model.normalMap, getAssetPath() + "models/armor/normalmap_rgba.ktx");
+	assetDecodes.floorColorMap = decodeTexture(textures.floor.colorMap, getAssetPath() + "textures/stonefloor01_color_rgba.ktx");
+	assetDecodes.floorNormalMap = decodeTexture(textures.floor.normalMap, getAssetPath() + "textures/stonefloor01_normal_rgba.ktx");
+}
+
+void VulkanExample::loadAssets()
+{
+	VKS_CPU_ZONE("VulkanExample::loadAssets");
+	Timer<resolutions::microseconds> timer;
+	// Each asset is created as soon as it's decoded, waiting only for those that aren't yet
+	auto createModel = [&](std::future<std::string>& decode, vkglTF::Model& model)
+	{
+		const std::string error = assetLoader->Get(decode);
+		if (!error.empty()) {
+			vks::tools::exitFatal(error, -1);
+			return;
+		}
+		timer.restart();
+		model.createResources(vulkanDevice, queue);
+		assetCreationTime += static_cast<double>(timer.total_elapsed()) / 1000.0;
+	};
+	auto createTexture = [&](std::future<DecodedTexture>& decode, vks::Texture2D& texture)
+	{
+		const DecodedTexture decoded = assetLoader->Get(decode);
+		if (!decoded.texture) {
+			vks::tools::exitFatal(decoded.error, -1);
+			return;
+		}
+		timer.restart();
+		texture.fromKtxTexture(decoded.texture, VK_FORMAT_R8G8B8A8_UNORM, vulkanDevice, queue);
+		assetCreationTime += static_cast<double>(timer.total_elapsed()) / 1000.0;
+	};
+	createModel(assetDecodes.model, models.model);
+	createModel(assetDecodes.floor, models.floor);
+	createTexture(assetDecodes.modelColorMap, textures.model.colorMap);
+	createTexture(assetDecodes.modelNormalMap, textures.model.normalMap);
+	createTexture(assetDecodes.floorColorMap, textures.floor.colorMap);
+	createTexture(assetDecodes.floorNormalMap, textures.floor.normalMap);
 }
 
 void VulkanExample::buildCommandBuffers()
 {
+	// The composition binds the current frame slot's resources, so it's recorded every frame in draw() instead
+}
+
+void VulkanExample::buildCompositionCommandBuffer()
+{
+	VkCommandBuffer& cmdBuffer = compositionCmdBuffers[frameSlot];
+	if (cmdBuffer == VK_NULL_HANDLE) {
+		cmdBuffer = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, false);
+	}
+
 	VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+	cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
 	VkClearValue clearValues[2];
 	clearValues[0].color = { { 0.0f, 0.0f, 0.2f, 0.0f } };
@@ -377,49 +497,58 @@ void VulkanExample::buildCommandBuffers()
 	renderPassBeginInfo.renderArea.extent.height = height;
 	renderPassBeginInfo.clearValueCount = 2;
 	renderPassBeginInfo.pClearValues = clearValues;
+	renderPassBeginInfo.framebuffer = frameBuffers[currentBuffer];
 
-	for (int32_t i = 0; i < drawCmdBuffers.size(); ++i)
-	{
-		renderPassBeginInfo.framebuffer = frameBuffers[i];
+	VK_CHECK_RESULT(vkBeginCommandBuffer(cmdBuffer, &cmdBufInfo));
 
-		VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
+	// Queries can't be reset within the render pass
+	profiler.ResetPass(cmdBuffer, frameSlot, GpuPass::Composition);
+	profiler.ResetPass(cmdBuffer, frameSlot, GpuPass::UI);
+	profiler.BeginPass(cmdBuffer, frameSlot, GpuPass::Composition);
 
-		vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+	// Take the positions and the fog back from the compute queue
+	Volumetrics.AcquireOutputs(cmdBuffer, frameSlot);
 
-		VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
-		vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
+	vkCmdBeginRenderPass(cmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-		VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
-		vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
+	VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
+	vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
 
-		vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.composition, 0, nullptr);
+	VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
+	vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
 
-   		vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.composition);
-			
-		vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &Volumetrics.LightingPassDescSet, 0, nullptr);
+	vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[frameSlot].composition, 0, nullptr);
 
-		// Final composition
-		// This is done by simply drawing a full screen quad
-		// The fragment shader then combines the deferred attachments into the final image
-		// Note: Also used for debug display if debugDisplayTarget > 0
-		vkCmdDraw(drawCmdBuffers[i], 3, 1, 0, 0);
+	vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, getCompositionPipeline());
 
-		drawUI(drawCmdBuffers[i]);
+	vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &Volumetrics.LightingPassDescSets[frameSlot], 0, nullptr);
 
-		vkCmdEndRenderPass(drawCmdBuffers[i]);
+	// Final composition
+	// This is done by simply drawing a full screen quad
+	// The fragment shader then combines the deferred attachments into the final image
+	// Note: Also used for debug display if debugDisplayTarget > 0
+	vkCmdDraw(cmdBuffer, 3, 1, 0, 0);
 
-		VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
-	}
+	profiler.EndPass(cmdBuffer, frameSlot, GpuPass::Composition);
+	profiler.BeginPass(cmdBuffer, frameSlot, GpuPass::UI);
+
+	drawUI(cmdBuffer);
+
+	profiler.EndPass(cmdBuffer, frameSlot, GpuPass::UI);
+
+	vkCmdEndRenderPass(cmdBuffer);
+
+	VK_CHECK_RESULT(vkEndCommandBuffer(cmdBuffer));
 }
 
 void VulkanExample::setupDescriptors()
 {
-	// Pool
+	// Pool, the sets are duplicated for every frame slot
 	std::vector<VkDescriptorPoolSize> poolSizes = {
-		vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 8),
-		vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 9)
+		vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 8 * s_FrameSlots),
+		vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 9 * s_FrameSlots)
 	};
-	VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, 3);
+	VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, 3 * s_FrameSlots);
 	VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
 
 	// Layouts
@@ -442,64 +571,69 @@ void VulkanExample::setupDescriptors()
 	std::vector<VkWriteDescriptorSet> writeDescriptorSets;
 	VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayout, 1);
 
-	// Image descriptors for the offscreen color attachments
-	VkDescriptorImageInfo texDescriptorPosition =
-		vks::initializers::descriptorImageInfo(
-			colorSampler,
-			offScreenFrameBuf.position.view,
-			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-	VkDescriptorImageInfo texDescriptorNormal =
-		vks::initializers::descriptorImageInfo(
-			colorSampler,
-			offScreenFrameBuf.normal.view,
-			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-	VkDescriptorImageInfo texDescriptorAlbedo =
-		vks::initializers::descriptorImageInfo(
-			colorSampler,
-			offScreenFrameBuf.albedo.view,
-			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-	// Deferred composition
-	VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSets.composition));
-	writeDescriptorSets = {
-		// Binding 1 : Position texture target
-		vks::initializers::writeDescriptorSet(descriptorSets.composition, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &texDescriptorPosition),
-		// Binding 2 : Normals texture target
-		vks::initializers::writeDescriptorSet(descriptorSets.composition, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &texDescriptorNormal),
-		// Binding 3 : Albedo texture target
-		vks::initializers::writeDescriptorSet(descriptorSets.composition, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3, &texDescriptorAlbedo),
-		// Binding 4 : Fragment shader uniform buffer
-		vks::initializers::writeDescriptorSet(descriptorSets.composition, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &uniformBuffers.composition.descriptor),
-	};
-	vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
-
-	// Offscreen (scene)
-
-	// Model
-	VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSets.model));
-	writeDescriptorSets = {
-		// Binding 0: Vertex shader uniform buffer
-		vks::initializers::writeDescriptorSet(descriptorSets.model, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &uniformBuffers.offscreen.descriptor),
-		// Binding 1: Color map
-		vks::initializers::writeDescriptorSet(descriptorSets.model, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &textures.model.colorMap.descriptor),
-		// Binding 2: Normal map
-		vks::initializers::writeDescriptorSet(descriptorSets.model, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &textures.model.normalMap.descriptor)
-	};
-	vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
-
-	// Background
-	VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSets.floor));
-	writeDescriptorSets = {
-		// Binding 0: Vertex shader uniform buffer
-		vks::initializers::writeDescriptorSet(descriptorSets.floor, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &uniformBuffers.offscreen.descriptor),
-		// Binding 1: Color map
-		vks::initializers::writeDescriptorSet(descriptorSets.floor, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &textures.floor.colorMap.descriptor),
-		// Binding 2: Normal map
-		vks::initializers::writeDescriptorSet(descriptorSets.floor, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &textures.floor.normalMap.descriptor)
-	};
-	vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+	for (uint32_t i = 0; i < s_FrameSlots; ++i)
+	{
+		const GBuffer& slot = offScreenFrameBuf.slots[i];
+
+		// Image descriptors for the offscreen color attachments
+		VkDescriptorImageInfo texDescriptorPosition =
+			vks::initializers::descriptorImageInfo(
+				colorSampler,
+				slot.position.view,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+		VkDescriptorImageInfo texDescriptorNormal =
+			vks::initializers::descriptorImageInfo(
+				colorSampler,
+				slot.normal.view,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+		VkDescriptorImageInfo texDescriptorAlbedo =
+			vks::initializers::descriptorImageInfo(
+				colorSampler,
+				slot.albedo.view,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+		// Deferred composition
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSets[i].composition));
+		writeDescriptorSets = {
+			// Binding 1 : Position texture target
+			vks::initializers::writeDescriptorSet(descriptorSets[i].composition, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &texDescriptorPosition),
+			// Binding 2 : Normals texture target
+			vks::initializers::writeDescriptorSet(descriptorSets[i].composition, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &texDescriptorNormal),
+			// Binding 3 : Albedo texture target
+			vks::initializers::writeDescriptorSet(descriptorSets[i].composition, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3, &texDescriptorAlbedo),
+			// Binding 4 : Fragment shader uniform buffer
+			vks::initializers::writeDescriptorSet(descriptorSets[i].composition, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &uniformBuffers[i].composition.descriptor),
+		};
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+
+		// Offscreen (scene)
+
+		// Model
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSets[i].model));
+		writeDescriptorSets = {
+			// Binding 0: Vertex shader uniform buffer
+			vks::initializers::writeDescriptorSet(descriptorSets[i].model, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &uniformBuffers[i].offscreen.descriptor),
+			// Binding 1: Color map
+			vks::initializers::writeDescriptorSet(descriptorSets[i].model, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &textures.model.colorMap.descriptor),
+			// Binding 2: Normal map
+			vks::initializers::writeDescriptorSet(descriptorSets[i].model, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &textures.model.normalMap.descriptor)
+		};
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+
+		// Background
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSets[i].floor));
+		writeDescriptorSets = {
+			// Binding 0: Vertex shader uniform buffer
+			vks::initializers::writeDescriptorSet(descriptorSets[i].floor, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &uniformBuffers[i].offscreen.descriptor),
+			// Binding 1: Color map
+			vks::initializers::writeDescriptorSet(descriptorSets[i].floor, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &textures.floor.colorMap.descriptor),
+			// Binding 2: Normal map
+			vks::initializers::writeDescriptorSet(descriptorSets[i].floor, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &textures.floor.normalMap.descriptor)
+		};
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+	}
 }
 
 void VulkanExample::preparePipelines()
@@ -533,14 +667,10 @@ void VulkanExample::preparePipelines()
 	pipelineCI.stageCount = static_cast<uint32_t>(shaderStages.size());
 	pipelineCI.pStages = shaderStages.data();
 
-	// Final fullscreen composition pass pipeline
-	rasterizationState.cullMode = VK_CULL_MODE_FRONT_BIT;
-	shaderStages[0] = loadShader(getShadersPath() + "deferred/deferred.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
-	shaderStages[1] = loadShader(getShadersPath() + "deferred/deferred.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
-	// Empty vertex input state, vertices are generated by the vertex shader
-	VkPipelineVertexInputStateCreateInfo emptyInputState = vks::initializers::pipelineVertexInputStateCreateInfo();
-	pipelineCI.pVertexInputState = &emptyInputState;
-	VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.composition));
+	// Final fullscreen composition pass pipeline, the variants are created on demand so only the default one is created here
+	compositionShaderStages[0] = loadShader(getShadersPath() + "deferred/deferred.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+	compositionShaderStages[1] = loadShader(getShadersPath() + "deferred/deferred.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+	getCompositionPipeline();
 
 	// Vertex input state from glTF model for pipeline rendering models
 	pipelineCI.pVertexInputState = vkglTF::Vertex::getPipelineVertexInputState({vkglTF::VertexComponent::Position, vkglTF::VertexComponent::UV, vkglTF::VertexComponent::Color, vkglTF::VertexComponent::Normal, vkglTF::VertexComponent::Tangent});
@@ -568,25 +698,80 @@ void VulkanExample::preparePipelines()
 	VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.offscreen));
 }
 
+VkPipeline VulkanExample::getCompositionPipeline()
+{
+	const uint32_t key = (static_cast<uint32_t>(debugDisplayTarget) << 16) | static_cast<uint32_t>(uniformDataComposition.lightCount);
+	auto cached = compositionPipelines.find(key);
+	if (cached != compositionPipelines.end()) {
+		return cached->second;
+	}
+
+	// Specialization constants for the debug display target and the light count
+	struct SpecializationData {
+		int32_t debugDisplayTarget;
+		int32_t lightCount;
+	} specializationData = { debugDisplayTarget, uniformDataComposition.lightCount };
+	std::array<VkSpecializationMapEntry, 2> specializationMapEntries = {
+		vks::initializers::specializationMapEntry(0, offsetof(SpecializationData, debugDisplayTarget), sizeof(int32_t)),
+		vks::initializers::specializationMapEntry(1, offsetof(SpecializationData, lightCount), sizeof(int32_t))
+	};
+	VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(static_cast<uint32_t>(specializationMapEntries.size()), specializationMapEntries.data(), sizeof(specializationData), &specializationData);
+
+	std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages = compositionShaderStages;
+	shaderStages[1].pSpecializationInfo = &specializationInfo;
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
+	VkPipelineRasterizationStateCreateInfo rasterizationState = vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_FRONT_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE, 0);
+	VkPipelineColorBlendAttachmentState blendAttachmentState = vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_FALSE);
+	VkPipelineColorBlendStateCreateInfo colorBlendState = vks::initializers::pipelineColorBlendStateCreateInfo(1, &blendAttachmentState);
+	VkPipelineDepthStencilStateCreateInfo depthStencilState = vks::initializers::pipelineDepthStencilStateCreateInfo(VK_TRUE, VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL);
+	VkPipelineViewportStateCreateInfo viewportState = vks::initializers::pipelineViewportStateCreateInfo(1, 1, 0);
+	VkPipelineMultisampleStateCreateInfo multisampleState = vks::initializers::pipelineMultisampleStateCreateInfo(VK_SAMPLE_COUNT_1_BIT, 0);
+	std::vector<VkDynamicState> dynamicStateEnables = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+	VkPipelineDynamicStateCreateInfo dynamicState = vks::initializers::pipelineDynamicStateCreateInfo(dynamicStateEnables);
+	// Empty vertex input state, vertices are generated by the vertex shader
+	VkPipelineVertexInputStateCreateInfo emptyInputState = vks::initializers::pipelineVertexInputStateCreateInfo();
+
+	VkGraphicsPipelineCreateInfo pipelineCI = vks::initializers::pipelineCreateInfo(pipelineLayout, renderPass);
+	pipelineCI.pInputAssemblyState = &inputAssemblyState;
+	pipelineCI.pRasterizationState = &rasterizationState;
+	pipelineCI.pColorBlendState = &colorBlendState;
+	pipelineCI.pMultisampleState = &multisampleState;
+	pipelineCI.pViewportState = &viewportState;
+	pipelineCI.pDepthStencilState = &depthStencilState;
+	pipelineCI.pDynamicState = &dynamicState;
+	pipelineCI.pVertexInputState = &emptyInputState;
+	pipelineCI.stageCount = static_cast<uint32_t>(shaderStages.size());
+	pipelineCI.pStages = shaderStages.data();
+
+	VkPipeline pipeline;
+	VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipeline));
+	compositionPipelines[key] = pipeline;
+	return pipeline;
+}
+
 // Prepare and initialize uniform buffer containing shader uniforms
 void VulkanExample::prepareUniformBuffers()
 {
-	// Offscreen vertex shader
-	VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &uniformBuffers.offscreen, sizeof(UniformDataOffscreen)));
+	for (UniformBuffers& buffers : uniformBuffers)
+	{
+		// Offscreen vertex shader
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &buffers.offscreen, sizeof(UniformDataOffscreen)));
 
-	// Deferred fragment shader
-	VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &uniformBuffers.composition, sizeof(UniformDataComposition)));
+		// Deferred fragment shader
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &buffers.composition, sizeof(UniformDataComposition)));
 
-	// Map persistent
-	VK_CHECK_RESULT(uniformBuffers.offscreen.map());
-	VK_CHECK_RESULT(uniformBuffers.composition.map());
+		// Map persistent
+		VK_CHECK_RESULT(buffers.offscreen.map());
+		VK_CHECK_RESULT(buffers.composition.map());
+	}
 
 	// Setup instanced model positions
 	uniformDataOffscreen.instancePos[0] = glm::vec4(0.0f);
 	uniformDataOffscreen.instancePos[1] = glm::vec4(-4.0f, 0.0, -4.0f, 0.0f);
 	uniformDataOffscreen.instancePos[2] = glm::vec4(4.0f, 0.0, -4.0f, 0.0f);
 
-	// Update
+	// Update, the other slots are written before their first use
 	updateUniformBufferOffscreen();
 	updateUniformBufferComposition();
 }
@@ -597,7 +782,7 @@ void VulkanExample::updateUniformBufferOffscreen()
 	uniformDataOffscreen.projection = camera.matrices.perspective;
 	uniformDataOffscreen.view = camera.matrices.view;
 	uniformDataOffscreen.model = glm::mat4(1.0f);
-	memcpy(uniformBuffers.offscreen.mapped, &uniformDataOffscreen, sizeof(UniformDataOffscreen));
+	memcpy(uniformBuffers[frameSlot].offscreen.mapped, &uniformDataOffscreen, sizeof(UniformDataOffscreen));
 }
 
 // Update lights and parameters passed to the composition shaders
@@ -633,26 +818,67 @@ void VulkanExample::updateUniformBufferComposition()
 
 	uniformDataComposition.debugDisplayTarget = debugDisplayTarget;
 
-	memcpy(uniformBuffers.composition.mapped, &uniformDataComposition, sizeof(UniformDataComposition));
+	memcpy(uniformBuffers[frameSlot].composition.mapped, &uniformDataComposition, sizeof(UniformDataComposition));
 }
 
 void VulkanExample::prepare()
 {
+	VKS_CPU_ZONE("VulkanExample::prepare");
+	// Everything since the construction of the example has been instance, device and window creation
+	const double vulkanInitTime = static_cast<double>(startupTimer.total_elapsed()) / 1000.0;
+	Timer<resolutions::microseconds> startupPhaseTimer;
 	VulkanExampleBase::prepare();
+	const double basePrepareTime = static_cast<double>(startupPhaseTimer.total_elapsed()) / 1000.0;
 	loadAssets();
 	prepareOffscreenFramebuffer();
 	prepareUniformBuffers();
 	setupDescriptors();
+	// Before any command buffers are recorded, as they write its queries
+	profiler.Init(vulkanDevice, s_FrameSlots);
+	profiler.CsvEnabled = commandLineParser.isSet("gpuprofile");
 	Volumetrics.Init(this, vulkanDevice, &camera, &queue);
+	Timer<resolutions::microseconds> pipelineTimer;
 	preparePipelines();
-	buildCommandBuffers();
+	const double graphicsPipelineTime = static_cast<double>(pipelineTimer.total_elapsed()) / 1000.0;
+	pipelineCreationTime = graphicsPipelineTime + Volumetrics.PipelineCreationTime;
+	std::cout << "Pipeline creation: " << std::fixed << std::setprecision(1) << pipelineCreationTime << " ms ("
+		<< graphicsPipelineTime << " ms graphics, " << Volumetrics.PipelineCreationTime << " ms volumetrics) with a "
+		<< (pipelineCacheWarm ? "warm" : "cold") << " pipeline cache, " << pipelineCacheLoadedSize << " bytes loaded from " << pipelineCacheFile << "\n";
 	buildDeferredCommandBuffer();
+	prepareSynchronizationPrimitives();
+	UIOverlay.setFrameCount(s_FrameSlots);
+	Volumetrics.CPUReferenceRequested = commandLineParser.isSet("cpureference");
+	Volumetrics.ScalingBenchmarkRequested = commandLineParser.isSet("fogscaling");
+
+	const double startupTime = static_cast<double>(startupTimer.total_elapsed()) / 1000.0;
+	const double sceneSetupTime = startupTime - vulkanInitTime - basePrepareTime - assetLoader->StallTime() - assetCreationTime;
+	std::cout << "Startup: " << std::fixed << std::setprecision(1) << startupTime << " ms (" << vulkanInitTime << " ms instance, device and window, "
+		<< basePrepareTime << " ms swap chain and base resources, " << assetLoader->StallTime() << " ms waiting for asset decoding, "
+		<< assetCreationTime << " ms asset creation, " << sceneSetupTime << " ms scene setup)\n";
+	std::cout << "Asset decoding: " << assetLoader->JobTime() << " ms on " << assetLoader->ThreadCount() << " worker threads, finished "
+		<< assetLoader->CompletionTime() << " ms after startup\n";
+	// All assets have been decoded, so the workers aren't needed anymore
+	assetLoader.reset();
 	prepared = true;
 }
 
 void VulkanExample::draw()
 {
-	VulkanExampleBase::prepareFrame();
+	VKS_CPU_ZONE("VulkanExample::draw");
+	// Acquire the next image from the swap chain. Each frame slot has its own semaphores, as the previous frame may still
+	// be waiting on the other slot's.
+	VkResult result = swapChain.acquireNextImage(presentCompleteSemaphores[frameSlot], &currentBuffer);
+	// Recreate the swapchain if it's no longer compatible with the surface (OUT_OF_DATE)
+	// If no longer optimal (VK_SUBOPTIMAL_KHR), carry on and let the present recreate it
+	if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+		windowResize();
+		return;
+	}
+	else if (result != VK_SUBOPTIMAL_KHR) {
+		VK_CHECK_RESULT(result);
+	}
+
+	buildCompositionCommandBuffer();
 
 	// The scene render command buffer has to wait for the offscreen
 	// rendering to be finished before we can use the framebuffer
@@ -667,40 +893,266 @@ void VulkanExample::draw()
 
 	// Offscreen rendering
 
-	// Wait for swap chain presentation to finish
-	submitInfo.pWaitSemaphores = &semaphores.presentComplete;
+	// Doesn't touch the swap chain image, so it doesn't wait for the presentation
+	VkSubmitInfo offscreenSubmitInfo = vks::initializers::submitInfo();
 	// Signal ready with offscreen semaphore
-	submitInfo.pSignalSemaphores = &offscreenSemaphore;
+	offscreenSubmitInfo.signalSemaphoreCount = 1;
+	offscreenSubmitInfo.pSignalSemaphores = &offscreenSemaphores[frameSlot];
 
 	// Submit work
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &offScreenCmdBuffer;
-	VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+	offscreenSubmitInfo.commandBufferCount = 1;
+	offscreenSubmitInfo.pCommandBuffers = &offScreenCmdBuffers[frameSlot];
+	VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &offscreenSubmitInfo, VK_NULL_HANDLE));
 
 
 	// Scene rendering
 
-	// Call to submit volumetrics and retrieve semaphore to wait on
-	submitInfo.pWaitSemaphores = Volumetrics.SubmitCommands(&offscreenSemaphore);
-	
-	// Signal ready with render complete semaphore
-	submitInfo.pSignalSemaphores = &semaphores.renderComplete;
+	// Call to submit volumetrics and retrieve semaphore to wait on, the first stage runs on the compute queue alongside the
+	// G-Buffer and the second waits for it
+	VkSemaphore* pVolumetricsSemaphore = Volumetrics.SubmitCommands(&offscreenSemaphores[frameSlot]);
 
-	// Submit work
-	submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
-	VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+	// Wait for the volumetrics before the fog is sampled, and for the swap chain image before it's written
+	const std::array<VkSemaphore, 2> waitSemaphores = { *pVolumetricsSemaphore, presentCompleteSemaphores[frameSlot] };
+	const std::array<VkPipelineStageFlags, 2> waitStages = { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	VkSubmitInfo compositionSubmitInfo = vks::initializers::submitInfo();
+	compositionSubmitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+	compositionSubmitInfo.pWaitSemaphores = waitSemaphores.data();
+	compositionSubmitInfo.pWaitDstStageMask = waitStages.data();
+
+	// Signal ready with render complete semaphore
+	compositionSubmitInfo.signalSemaphoreCount = 1;
+	compositionSubmitInfo.pSignalSemaphores = &renderCompleteSemaphores[frameSlot];
+
+	// Submit work, the fence tells when the slot can be reused
+	compositionSubmitInfo.commandBufferCount = 1;
+	compositionSubmitInfo.pCommandBuffers = &compositionCmdBuffers[frameSlot];
+	VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &compositionSubmitInfo, frameFences[frameSlot]));
+	profiler.FrameSubmitted(frameSlot);
+
+	// Present without waiting for the queue to go idle, the fences keep the CPU at most one frame ahead
+	result = swapChain.queuePresent(queue, currentBuffer, renderCompleteSemaphores[frameSlot]);
+	// Recreate the swapchain if it's no longer compatible with the surface (OUT_OF_DATE) or no longer optimal for presentation (SUBOPTIMAL)
+	if ((result == VK_ERROR_OUT_OF_DATE_KHR) || (result == VK_SUBOPTIMAL_KHR)) {
+		windowResize();
+	}
+	else {
+		VK_CHECK_RESULT(result);
+	}
 
-	VulkanExampleBase::submitFrame();
+	// Move on to the next frame slot once the frame which last used it has completed, before the UI overlay and the
+	// uniform buffers of the next frame are written
+	frameSlot = (frameSlot + 1) % s_FrameSlots;
+	VK_CHECK_RESULT(vkWaitForFences(device, 1, &frameFences[frameSlot], VK_TRUE, UINT64_MAX));
+	VK_CHECK_RESULT(vkResetFences(device, 1, &frameFences[frameSlot]));
+	UIOverlay.frameIndex = frameSlot;
 }
 
 void VulkanExample::render()
 {
 	if (!prepared)
 		return;
+	VKS_CPU_ZONE("VulkanExample::render");
 	updateUniformBufferComposition();
 	updateUniformBufferOffscreen();
-	Volumetrics.UpdateBuffers();
+	// The frame which last used this slot has completed, the volumetrics read their stage times from it
+	profiler.ReadResults(frameSlot);
+	Volumetrics.UpdateBuffers(frameSlot);
 	draw();
+	if (Volumetrics.CPUReferenceRequested)
+	{
+		Volumetrics.RunCPUReference();
+	}
+	if (Volumetrics.ScalingBenchmarkRequested)
+	{
+		Volumetrics.RunScalingBenchmark();
+	}
+}
+
+void VulkanExample::runBenchmark()
+{
+	if (!commandLineParser.isSet("benchmarkscenarios")) {
+		VulkanExampleBase::runBenchmark();
+		return;
+	}
+
+	const std::vector<BenchmarkScenario> scenarios = LoadBenchmarkScenarios(commandLineParser.getValueAsString("benchmarkscenarios", ""));
+	std::vector<BenchmarkScenarioResult> results;
+	for (const BenchmarkScenario& scenario : scenarios) {
+		std::cout << "Scenario " << scenario.Name << "\n";
+		if (scenario.LightCount >= 0) {
+			uniformDataComposition.lightCount = std::min(std::max(scenario.LightCount, 1), 6);
+		}
+		for (const std::pair<std::string, float>& setting : scenario.FogSettings) {
+			if (!Volumetrics.ApplySetting(setting.first, setting.second)) {
+				std::cerr << "Unknown fog setting " << setting.first << " in scenario " << scenario.Name << "\n";
+			}
+		}
+
+		BenchmarkScenarioResult result;
+		result.Name = scenario.Name;
+		uint64_t profilerFrame = profiler.FramesRead();
+		uint32_t profiledFrames = 0;
+
+		benchmark.reset();
+		benchmark.duration = static_cast<uint32_t>(std::ceil(scenario.Duration));
+		benchmark.run([&] {
+			// The camera path is timed by the measured frames, the warm up holds the first key
+			if (!scenario.CameraPath.empty()) {
+				const BenchmarkScenario::CameraKey key = scenario.Evaluate(static_cast<float>(benchmark.runtime / (benchmark.duration * 1000.0)));
+				camera.setPosition(key.Position);
+				camera.setRotation(key.Rotation);
+			}
+			render();
+			if (benchmark.measuring && profiler.FramesRead() != profilerFrame) {
+				profilerFrame = profiler.FramesRead();
+				for (uint32_t pass = 0; pass < GpuProfiler::s_PassCount; ++pass) {
+					result.PassTimes[pass] += profiler.PassTime(static_cast<GpuPass>(pass));
+				}
+				profiledFrames++;
+			}
+		}, vulkanDevice->properties);
+
+		result.FrameCount = benchmark.frameCount;
+		result.Runtime = benchmark.runtime;
+		result.FrameTimes = benchmark.statistics();
+		result.FrameTimeSamples = benchmark.frameTimes;
+		for (double& passTime : result.PassTimes) {
+			passTime = profiledFrames > 0 ? passTime / profiledFrames : 0.0;
+		}
+		results.push_back(result);
+	}
+	vkDeviceWaitIdle(device);
+
+	const std::string filename = benchmark.filename != "" ? benchmark.filename : "benchmark_scenarios.json";
+	if (WriteBenchmarkResults(filename, vulkanDevice->properties, results)) {
+		std::cout << "Scenario results written to " << filename << "\n";
+	}
+	else {
+		std::cerr << "Could not write scenario results to " << filename << "\n";
+	}
+}
+
+std::vector<uint32_t> VulkanExample::readbackComposition()
+{
+	std::vector<uint32_t> texels(static_cast<size_t>(width) * height);
+	vulkanDevice->copyImageToHost(swapChain.images[currentBuffer], VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, { width, height, 1 }, sizeof(uint32_t), queue, texels.data());
+	// Golden images are stored as RGBA regardless of the swap chain format
+	if (swapChain.colorFormat == VK_FORMAT_B8G8R8A8_UNORM || swapChain.colorFormat == VK_FORMAT_B8G8R8A8_SRGB) {
+		for (uint32_t& texel : texels) {
+			texel = (texel & 0xFF00FF00) | ((texel & 0x00FF0000) >> 16) | ((texel & 0x000000FF) << 16);
+		}
+	}
+	return texels;
+}
+
+bool VulkanExample::runGoldenImages(const std::string& filename)
+{
+	const std::vector<BenchmarkScenario> scenarios = LoadBenchmarkScenarios(filename);
+	if (scenarios.empty()) {
+		std::cerr << "No golden image scenarios in " << filename << "\n";
+		return false;
+	}
+	const bool update = commandLineParser.isSet("goldenupdate");
+	// The golden images live next to the scenario file
+	const size_t separator = filename.find_last_of("/\\");
+	const std::string directory = separator != std::string::npos ? filename.substr(0, separator + 1) : "";
+
+	// Freeze the wind so the images don't depend on the frame rate
+	Volumetrics.FixedFrameTime = 1.f / 60.f;
+
+	std::vector<GoldenImageResult> results;
+	bool passed = true;
+	for (const BenchmarkScenario& scenario : scenarios) {
+		if (scenario.LightCount >= 0) {
+			uniformDataComposition.lightCount = std::min(std::max(scenario.LightCount, 1), 6);
+		}
+		for (const std::pair<std::string, float>& setting : scenario.FogSettings) {
+			if (!Volumetrics.ApplySetting(setting.first, setting.second)) {
+				std::cerr << "Unknown fog setting " << setting.first << " in scenario " << scenario.Name << "\n";
+			}
+		}
+		if (!scenario.CameraPath.empty()) {
+			const BenchmarkScenario::CameraKey key = scenario.Evaluate(0.f);
+			camera.setPosition(key.Position);
+			camera.setRotation(key.Rotation);
+		}
+		Volumetrics.ResetAnimation();
+
+		GoldenImageResult result;
+		result.Name = scenario.Name;
+		uint64_t profilerFrame = profiler.FramesRead();
+		uint32_t profiledFrames = 0;
+		double frameTimeSum = 0.0;
+		for (uint32_t frame = 0; frame < scenario.CaptureFrames; frame++) {
+			const auto tStart = std::chrono::high_resolution_clock::now();
+			render();
+			frameTimeSum += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+			if (profiler.FramesRead() != profilerFrame) {
+				profilerFrame = profiler.FramesRead();
+				for (uint32_t pass = 0; pass < GpuProfiler::s_PassCount; ++pass) {
+					result.PassTimes[pass] += profiler.PassTime(static_cast<GpuPass>(pass));
+				}
+				profiledFrames++;
+			}
+		}
+		result.FrameTime = frameTimeSum / scenario.CaptureFrames;
+		for (double& passTime : result.PassTimes) {
+			passTime = profiledFrames > 0 ? passTime / profiledFrames : 0.0;
+		}
+		vkDeviceWaitIdle(device);
+
+		const std::vector<uint32_t> composition = readbackComposition();
+		uint32_t secondStageWidth = 0;
+		uint32_t secondStageHeight = 0;
+		const std::vector<uint32_t> secondStage = Volumetrics.ReadbackSecondStage(secondStageWidth, secondStageHeight);
+
+		const std::string prefix = directory + "golden_" + scenario.Name;
+		if (update) {
+			result.Updated = VolumetricsCPU::SavePAM(prefix + "_composition.pam", composition, width, height)
+				&& VolumetricsCPU::SavePAM(prefix + "_secondstage.pam", secondStage, secondStageWidth, secondStageHeight);
+			result.Passed = result.Updated;
+			std::cout << "Scenario " << scenario.Name << (result.Updated ? ": golden images written" : ": could not write the golden images") << "\n";
+		}
+		else {
+			std::vector<uint32_t> reference;
+			uint32_t referenceWidth = 0;
+			uint32_t referenceHeight = 0;
+			if (LoadPAM(prefix + "_composition.pam", reference, referenceWidth, referenceHeight) && referenceWidth == width && referenceHeight == height) {
+				result.Composition = CompareGoldenImages(reference, composition, width, height);
+			}
+			if (LoadPAM(prefix + "_secondstage.pam", reference, referenceWidth, referenceHeight) && referenceWidth == secondStageWidth && referenceHeight == secondStageHeight) {
+				result.SecondStage = CompareGoldenImages(reference, secondStage, secondStageWidth, secondStageHeight);
+			}
+			result.Passed = result.Composition.Within(scenario.Tolerance) && result.SecondStage.Within(scenario.Tolerance);
+			if (!result.Passed) {
+				// Keep what was rendered so it can be inspected next to the reference
+				VolumetricsCPU::SavePAM(prefix + "_composition_actual.pam", composition, width, height);
+				VolumetricsCPU::SavePAM(prefix + "_secondstage_actual.pam", secondStage, secondStageWidth, secondStageHeight);
+			}
+			std::cout << std::fixed << std::setprecision(4) << "Scenario " << scenario.Name << ": " << (result.Passed ? "passed" : "FAILED")
+				<< " (composition rmse " << result.Composition.RMSE << " max " << result.Composition.MaxError << " perceptual " << result.Composition.Perceptual
+				<< ", second stage rmse " << result.SecondStage.RMSE << " max " << result.SecondStage.MaxError << " perceptual " << result.SecondStage.Perceptual << ")"
+				<< (result.Composition.Compared && result.SecondStage.Compared ? "" : ", golden image missing or of a different size") << "\n";
+		}
+		passed = passed && result.Passed;
+		results.push_back(result);
+	}
+	Volumetrics.FixedFrameTime = -1.f;
+
+	const std::string resultsFile = directory + "golden_results.json";
+	if (!WriteGoldenImageResults(resultsFile, results)) {
+		std::cerr << "Could not write golden image results to " << resultsFile << "\n";
+	}
+	return passed;
+}
+
+void VulkanExample::renderHeadless()
+{
+	if (!commandLineParser.isSet("golden")) {
+		VulkanExampleBase::renderHeadless();
+		return;
+	}
+	exitCode = runGoldenImages(commandLineParser.getValueAsString("golden", "")) ? 0 : 1;
 }
 
 void VulkanExample::OnUpdateUIOverlay(vks::UIOverlay *overlay)
@@ -710,8 +1162,25 @@ void VulkanExample::OnUpdateUIOverlay(vks::UIOverlay *overlay)
 	}
 
 	overlay->sliderInt("LightCount", &uniformDataComposition.lightCount, 1, 6);
+	overlay->text("Startup pipelines: %.1f ms, %s cache", pipelineCreationTime, pipelineCacheWarm ? "warm" : "cold");
 
 	Volumetrics.UpdateOverlay(overlay);
+	profiler.UpdateOverlay(overlay);
+
+	if (overlay->header("Device memory")) {
+		const std::vector<vks::MemoryTypeStats> memoryStats = vulkanDevice->allocator.getStats();
+		for (uint32_t type = 0; type < static_cast<uint32_t>(memoryStats.size()); type++) {
+			const vks::MemoryTypeStats& stats = memoryStats[type];
+			if (stats.blockCount == 0 && stats.dedicatedCount == 0) {
+				continue;
+			}
+			overlay->text("Type %u: %u allocations in %u blocks, %.1f of %.1f MB used, %.0f%% fragmented", type, stats.allocationCount, stats.blockCount,
+				stats.usedBytes / (1024.0 * 1024.0), stats.blockBytes / (1024.0 * 1024.0), stats.fragmentation() * 100.0f);
+			if (stats.dedicatedCount > 0) {
+				overlay->text("Type %u: %u dedicated, %.1f MB", type, stats.dedicatedCount, stats.dedicatedBytes / (1024.0 * 1024.0));
+			}
+		}
+	}
 }
 
 VULKAN_EXAMPLE_MAIN()
@@ -1,6 +1,11 @@
 #pragma once
 #include "vulkanexamplebase.h"
 #include "VulkanglTFModel.h"
+#include "GpuProfiler.h"
+#include "BenchmarkScenarios.h"
+#include "GoldenImages.h"
+#include "AssetLoader.h"
+#include <unordered_map>
 
 class VulkanVolumetrics;
 
@@ -26,6 +31,29 @@ public:
 		vkglTF::Model floor;
 	} models;
 
+	// Decodes the models and textures from construction on while Vulkan is initialized, loadAssets only creates their
+	// resources. Declared after the assets, so it is destroyed, finishing its jobs, before them.
+	std::unique_ptr<AssetLoader> assetLoader;
+	// The jobs can't exit on a worker thread, so a failed decode is returned and reported by loadAssets
+	struct DecodedTexture {
+		// Null if the file couldn't be loaded
+		ktxTexture* texture = nullptr;
+		std::string error;
+	};
+	struct {
+		// Empty on success, the reason the file couldn't be loaded otherwise
+		std::future<std::string> model;
+		std::future<std::string> floor;
+		std::future<DecodedTexture> modelColorMap;
+		std::future<DecodedTexture> modelNormalMap;
+		std::future<DecodedTexture> floorColorMap;
+		std::future<DecodedTexture> floorNormalMap;
+	} assetDecodes;
+	// Started with the construction of the example, for the startup breakdown
+	Timer<resolutions::microseconds> startupTimer;
+	// Milliseconds of asset resource creation on the main thread, excluding the time spent waiting for decoded assets
+	double assetCreationTime = 0.0;
+
 	struct UniformDataOffscreen {
 		glm::mat4 projection;
 		glm::mat4 model;
@@ -46,52 +74,81 @@ public:
 		int lightCount = 3;
 	} uniformDataComposition;
 
-	struct {
+	// Uniform buffers for each frame slot, rewritten once the frame which last used them has completed
+	struct UniformBuffers {
 		vks::Buffer offscreen{ VK_NULL_HANDLE };
 		vks::Buffer composition{ VK_NULL_HANDLE };
-	} uniformBuffers;
+	};
+	std::array<UniformBuffers, s_FrameSlots> uniformBuffers;
 
 	struct {
 		VkPipeline offscreen{ VK_NULL_HANDLE };
-		VkPipeline composition{ VK_NULL_HANDLE };
 	} pipelines;
+
+	// Composition pipelines specialised for a debug display target and light count, created the first time a combination
+	// is displayed and kept for switching back
+	std::unordered_map<uint32_t, VkPipeline> compositionPipelines;
+	std::array<VkPipelineShaderStageCreateInfo, 2> compositionShaderStages{};
+	// Time spent creating all pipelines at startup in milliseconds, to compare cold and warm pipeline caches
+	double pipelineCreationTime = 0.0;
 	VkPipelineLayout pipelineLayout{ VK_NULL_HANDLE };
 
-	struct {
+	struct DescriptorSets {
 		VkDescriptorSet model{ VK_NULL_HANDLE };
 		VkDescriptorSet floor{ VK_NULL_HANDLE };
 		VkDescriptorSet composition{ VK_NULL_HANDLE };
-	} descriptorSets;
+	};
+	std::array<DescriptorSets, s_FrameSlots> descriptorSets;
 
 	VkDescriptorSetLayout descriptorSetLayout{ VK_NULL_HANDLE };
 
 	// Framebuffers holding the deferred attachments
 	struct FrameBufferAttachment {
 		VkImage image;
-		VkDeviceMemory mem;
+		vks::Allocation memory;
 		VkImageView view;
 		VkFormat format;
 	};
-	struct FrameBuffer {
-		int32_t width, height;
+	struct GBuffer {
 		VkFramebuffer frameBuffer;
 		// One attachment for every component required for a deferred rendering setup
 		FrameBufferAttachment position, normal, albedo;
 		FrameBufferAttachment depth;
+	};
+	struct FrameBuffer {
+		int32_t width, height;
+		// One G-Buffer per frame slot, the next frame's is rendered while the volumetrics and composition still read this one's
+		std::array<GBuffer, s_FrameSlots> slots;
 		VkRenderPass renderPass;
 	} offScreenFrameBuf{};
 
 	// One sampler for the frame buffer color attachments
 	VkSampler colorSampler{ VK_NULL_HANDLE };
 
-	VkCommandBuffer offScreenCmdBuffer{ VK_NULL_HANDLE };
+	// Frame slot the next frame is recorded into
+	uint32_t frameSlot = 0;
 
-	// Semaphore used to synchronize between offscreen and final scene rendering
-	VkSemaphore offscreenSemaphore{ VK_NULL_HANDLE };
+	std::array<VkCommandBuffer, s_FrameSlots> offScreenCmdBuffers{};
+
+	// The composition is recorded every frame for the acquired swap chain image, one per slot as the other may be in flight
+	std::array<VkCommandBuffer, s_FrameSlots> compositionCmdBuffers{};
+
+	// Semaphores used to synchronize between offscreen and final scene rendering
+	std::array<VkSemaphore, s_FrameSlots> offscreenSemaphores{};
+
+	// Swap chain semaphores per frame slot, the base class only has one of each
+	std::array<VkSemaphore, s_FrameSlots> presentCompleteSemaphores{};
+	std::array<VkSemaphore, s_FrameSlots> renderCompleteSemaphores{};
+
+	// Signalled once a frame slot's composition has completed, waited on before the slot is reused
+	std::array<VkFence, s_FrameSlots> frameFences{};
 
 	// Volumetrics to manage the volumetric fog added to the scene
 	VulkanVolumetrics Volumetrics;
 
+	// GPU time of every pass, the volumetrics stages are timed through it too
+	GpuProfiler profiler;
+
 
 	VulkanExample();
 
@@ -112,14 +169,27 @@ public:
 	// Build command buffer for rendering the scene to the offscreen frame buffer attachments
 	void buildDeferredCommandBuffer();
 
+	// Create the per frame slot semaphores and fences
+	void prepareSynchronizationPrimitives();
+
+	// Queue the decoding of all models and textures on the asset loader, called from the constructor
+	void startAssetDecoding();
+
+	// Create the Vulkan resources of the decoded models and textures
 	void loadAssets();
 
 	void buildCommandBuffers();
 
+	// Record the composition of the current frame slot into the acquired swap chain image
+	void buildCompositionCommandBuffer();
+
 	void setupDescriptors();
 
 	void preparePipelines();
 
+	// Composition pipeline for the current debug display target and light count
+	VkPipeline getCompositionPipeline();
+
 	// Prepare and initialize uniform buffer containing shader uniforms
 	void prepareUniformBuffers();
 
@@ -135,5 +205,18 @@ public:
 
 	virtual void render();
 
+	// Runs the scenarios given with --benchscenarios one after another, or the default benchmark without them
+	virtual void runBenchmark() override;
+
+	// Read back the final composition of the last presented frame as packed RGBA8, the device has to be idle
+	std::vector<uint32_t> readbackComposition();
+
+	// Renders the scenarios given with --golden and compares the composition and the volumetrics' second stage against
+	// the golden images next to the scenario file, or writes them with --goldenupdate. Returns false if any scenario failed.
+	bool runGoldenImages(const std::string& filename);
+
+	// Runs the golden image comparison instead of the default headless frames if --golden is given
+	virtual void renderHeadless() override;
+
 	virtual void OnUpdateUIOverlay(vks::UIOverlay* overlay);
 };
\ No newline at end of file
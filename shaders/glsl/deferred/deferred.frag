@@ -23,7 +23,12 @@ layout (binding = 4) uniform UBO
 } ubo;
 
 
-layout (set = 1, binding = 0, rgba8) uniform readonly image2D FogImage;
+layout (set = 1, binding = 0) uniform sampler2D FogImage;
+
+// The debug display target and light count the pipeline was created for, so the composition has no branch on the target
+// and a fixed light loop
+layout (constant_id = 0) const int DEBUG_DISPLAY_TARGET = 0;
+layout (constant_id = 1) const int LIGHT_COUNT = 3;
 
 void main() 
 {
@@ -33,8 +38,8 @@ void main()
 	vec4 albedo = texture(samplerAlbedo, inUV);
 	
 	// Debug display
-	if (ubo.displayDebugTarget > 0) {
-		switch (ubo.displayDebugTarget) {
+	if (DEBUG_DISPLAY_TARGET > 0) {
+		switch (DEBUG_DISPLAY_TARGET) {
 			case 1: 
 				outFragcolor.rgb = fragPos;
 				break;
@@ -58,7 +63,7 @@ void main()
 	// Ambient part
 	vec3 fragcolor  = albedo.rgb * ambient;
 	
-	for(int i = 0; i < ubo.lightCount; ++i)
+	for(int i = 0; i < LIGHT_COUNT; ++i)
 	{
 		// Vector to light
 		vec3 L = ubo.lights[i].position.xyz - fragPos;
@@ -93,8 +98,7 @@ void main()
 	}    	
    
   // Apply the volumetric fog to the final image by blending with the fog texture
-  ivec2 FogImageSize = imageSize(FogImage);
-  vec4 FogColour = imageLoad(FogImage, ivec2(inUV.x * FogImageSize.x, inUV.y * FogImageSize.y));
+  vec4 FogColour = texture(FogImage, inUV);
   fragcolor = mix(fragcolor, FogColour.xyz, FogColour.w);
 
   outFragcolor = vec4(fragcolor, 1.0);	
@@ -0,0 +1,129 @@
+// Declarations shared by the volumetrics compute shaders, the settings block, the froxel slice spacing and reading the
+// froxel grid back in each of its storage formats.
+// Define VOLUMETRICS_INFO_BINDING to the binding of the VolumetricsInfo block before including this.
+
+// Storage formats of the froxel grid, must match FroxelStorageFormat in Volumetrics.h
+#define FROXEL_STORAGE_RGBA8 0
+#define FROXEL_STORAGE_RGBA16F 1
+#define FROXEL_STORAGE_B10G11R11 2
+#define FROXEL_STORAGE_RGB9E5 3
+
+// Spacing of the froxel slices, must match SliceDistribution in Volumetrics.h
+#define SLICE_DISTRIBUTION_QUADRATIC 0
+#define SLICE_DISTRIBUTION_EXPONENTIAL 1
+
+// Settings the pipeline was specialised for, must match VolumetricsPipelineKey in Volumetrics.h. The branches on them are
+// resolved when the pipeline is created instead of for every invocation.
+// One of the SLICE_DISTRIBUTION_* spacings
+layout (constant_id = 0) const uint SLICE_DISTRIBUTION_MODE = SLICE_DISTRIBUTION_QUADRATIC;
+// Set when the quadratic slices have no fall off, so every slice is InitialStepSize long
+layout (constant_id = 1) const bool UNIFORM_SLICES = false;
+// One of the FROXEL_STORAGE_* formats
+layout (constant_id = 2) const uint STORAGE_FORMAT = FROXEL_STORAGE_RGBA8;
+
+// General Info on the volumetrics
+layout (set = 0, binding = VOLUMETRICS_INFO_BINDING) uniform readonly VolumetricsInfo
+{
+	vec3 Albedo;
+	float InitialStepSize;
+	float StepFallOff;
+	float LightStepSize;
+	float Near;
+	float Far;
+	float Absorption;
+	float Density;
+	float AbsorptionCutoff;
+	float LightAbsorptionCutoff;
+	float NoiseXTile;
+	float NoiseYTile;
+	float NoiseZTile;
+	float NoiseXOffset;
+	float NoiseYOffset;
+	float NoiseZOffset;
+	float NoiseFactor;
+	float SmoothFactor;
+	uint MapHeight;
+	uint MapWidth;
+	uint MapDepth;
+	// One of the FROXEL_STORAGE_* formats
+	uint StorageFormat;
+	// One of the SLICE_DISTRIBUTION_* spacings
+	uint SliceDistribution;
+	// Depth the exponential distribution ends at
+	float SliceFar;
+	// How strongly the exponential distribution packs its slices towards the camera
+	float SliceCurvature;
+}Volumetrics;
+
+// Distance along the view ray of a position within the froxel slices, the integer part selects the slice
+float SliceDepth(float Slice)
+{
+	if(SLICE_DISTRIBUTION_MODE == SLICE_DISTRIBUTION_EXPONENTIAL)
+	{
+		const float T = Slice / float(Volumetrics.MapDepth);
+		return Volumetrics.Near + (Volumetrics.SliceFar - Volumetrics.Near) * (exp(Volumetrics.SliceCurvature * T) - 1.0) / (exp(Volumetrics.SliceCurvature) - 1.0);
+	}
+	if(UNIFORM_SLICES)
+	{
+		return (Slice * Volumetrics.InitialStepSize) + Volumetrics.Near;
+	}
+	return (Volumetrics.InitialStepSize * Slice) + ((Volumetrics.StepFallOff * pow(Slice, 2))/2);
+}
+
+// Inverse of SliceDepth
+float DepthToSlice(float Depth)
+{
+	if(SLICE_DISTRIBUTION_MODE == SLICE_DISTRIBUTION_EXPONENTIAL)
+	{
+		const float Scaled = (Depth - Volumetrics.Near) / (Volumetrics.SliceFar - Volumetrics.Near) * (exp(Volumetrics.SliceCurvature) - 1.0);
+		// Depths in front of Near land below the first slice rather than on NaN
+		return log(max(Scaled + 1.0, 1e-6)) / Volumetrics.SliceCurvature * float(Volumetrics.MapDepth);
+	}
+	if(UNIFORM_SLICES)
+	{
+		return (Depth - Volumetrics.Near) / Volumetrics.InitialStepSize;
+	}
+	return (sqrt(pow(Volumetrics.InitialStepSize, 2) + 2 * Volumetrics.StepFallOff * Depth) - Volumetrics.InitialStepSize) / Volumetrics.StepFallOff;
+}
+
+// Unpack in-scattering stored with 9 bit mantissas for red in the low bits, green and blue, and a shared 5 bit exponent
+// with a bias of 15, the layout of E5B9G9R9
+vec3 UnpackRGB9E5(uint Packed)
+{
+	const uvec3 Mantissa = uvec3(Packed, Packed >> 9, Packed >> 18) & 511u;
+	return vec3(Mantissa) * exp2(float(Packed >> 27) - 24.0);
+}
+
+// Integer textures can't be filtered by the sampler, blend the eight neighbouring froxels like a linear clamped sampler would
+vec3 SamplePacked(usampler3D Packed, vec3 UVW)
+{
+	const ivec3 Size = textureSize(Packed, 0);
+	const vec3 Texel = UVW * vec3(Size) - 0.5;
+	const ivec3 Base = ivec3(floor(Texel));
+	const vec3 Weight = Texel - floor(Texel);
+
+	vec3 Result = vec3(0.0);
+	for(int i = 0; i < 8; ++i)
+	{
+		const ivec3 Offset = ivec3(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+		const vec3 CornerWeight = mix(1.0 - Weight, Weight, vec3(Offset));
+		const ivec3 Coord = clamp(Base + Offset, ivec3(0), Size - 1);
+		Result += CornerWeight.x * CornerWeight.y * CornerWeight.z * UnpackRGB9E5(texelFetch(Packed, Coord, 0).r);
+	}
+	return Result;
+}
+
+// In-scattering and density of a froxel grid in whichever format it is stored in. Colour holds the whole froxel for the
+// RGBA formats, the split formats keep their density in Density and the shared exponent one its in-scattering in Packed.
+vec4 SampleFroxels(sampler3D Colour, sampler3D Density, usampler3D Packed, vec3 UVW)
+{
+	switch(STORAGE_FORMAT)
+	{
+	case FROXEL_STORAGE_B10G11R11:
+		return vec4(textureLod(Colour, UVW, 0.0).rgb, textureLod(Density, UVW, 0.0).r);
+	case FROXEL_STORAGE_RGB9E5:
+		return vec4(SamplePacked(Packed, UVW), textureLod(Density, UVW, 0.0).r);
+	default:
+		return textureLod(Colour, UVW, 0.0);
+	}
+}
@@ -0,0 +1,411 @@
+// Body of the first stage, included by volumetrics_firststage.comp and volumetrics_firststage_formatless.comp, which only
+// differ in how the float outputs are declared
+
+layout (local_size_x = 8, local_size_y  = 8, local_size_z  = 8) in;
+
+#define VOLUMETRICS_INFO_BINDING 2
+#include "volumetrics_common.glsl"
+
+// Pass in lighting info so we can calculate in-scattering
+struct Light {
+	vec4 position;
+	vec3 color; 
+	float radius;
+};
+
+layout (set = 0, binding = 0) uniform readonly SceneInfo 
+{
+	Light lights[6];
+	vec4 viewPos;
+	int displayDebugTarget;
+	int lightCount;
+}Scene;
+
+#define FOG_PRIMITIVE_SPHERE 0
+#define FOG_PRIMITIVE_BOX 1
+#define FOG_PRIMITIVE_CAPSULE 2
+
+// Structure defining a single fog shape
+struct FogPrimitive
+{
+	vec3 Pos;
+	// Radius of a sphere or capsule
+	float Radius;
+	// Half extents of a box, or the offset from the centre to either end of a capsule's segment
+	vec3 Extent;
+	uint Type;
+};
+
+// Buffer to define the shapes and locations of the fog in world-space
+layout (set = 0, binding = 1, std430) readonly buffer FogShapes
+{
+	FogPrimitive Primitives[];
+}SceneFog;
+
+// Look the light visibility up in the transmittance volume rather than marching towards the lights
+layout (constant_id = 3) const bool TRANSMITTANCE_ENABLED = false;
+
+// Tileable noise volume baked on the CPU at startup
+layout (set = 0, binding = 3) uniform sampler3D NoiseSampler;
+
+// Per frame camera info used to build the ray through each froxel and reproject it into the history
+layout (set = 0, binding = 4) uniform readonly FrameInfo
+{
+	mat4 InvViewProj;
+	mat4 PrevViewProj;
+	vec4 PrevViewPos;
+	float DepthJitter;
+	float HistoryBlend;
+	uint HistoryValid;
+	// Largest number of lights the fog is lit by, lowered by the quality governor
+	uint LightLimit;
+}Frame;
+
+// 3D texture map output, a frustum aligned voxel (froxel) grid with x and y in screen space and z along the view ray.
+// Declared without a format so the same shader can write any of the float storage formats, which needs the
+// shaderStorageImageWriteWithoutFormat feature. RGBA8 grids are written through a format qualified binding instead.
+#ifdef FROXEL_OUTPUT_FORMATLESS
+layout (set = 0, binding = 5) uniform writeonly image3D OutputTexture;
+#else
+layout (set = 0, binding = 5, rgba8) uniform writeonly image3D OutputTexture;
+#endif
+
+// The froxel grid written by the previous frame
+layout (set = 0, binding = 6) uniform sampler3D HistorySampler;
+
+// World space bounds of the fog covered by the transmittance volume
+layout (set = 0, binding = 7) uniform readonly TransmittanceInfo
+{
+	vec4 BoundsMin;
+	vec4 BoundsMax;
+	uint Resolution;
+	uint Enabled;
+	// Number of lights with a volume, any further lights are marched
+	uint LightCount;
+}Transmittance;
+
+// Optical depth towards each light, the volumes of all lights are stacked along z
+layout (set = 0, binding = 8) uniform sampler3D TransmittanceSampler;
+
+// Uniform grid over the fog shapes, each cell has an offset and count into the primitive indices that follow the cells
+layout (set = 0, binding = 9, std430) readonly buffer FogGrid
+{
+	vec4 BoundsMin;
+	vec4 BoundsMax;
+	vec4 CellSize;
+	uvec4 Dims;
+	uint Data[];
+}Grid;
+
+// Density output of the split storage formats, bound to the colour output for the others
+#ifdef FROXEL_OUTPUT_FORMATLESS
+layout (set = 0, binding = 10) uniform writeonly image3D DensityOutputTexture;
+#else
+layout (set = 0, binding = 10, rgba8) uniform writeonly image3D DensityOutputTexture;
+#endif
+
+// In-scattering output of the shared exponent storage format, bound to a dummy texture for the others
+layout (set = 0, binding = 11, r32ui) uniform writeonly uimage3D PackedOutputTexture;
+
+// Density and packed in-scattering of the previous frame's grid, like the outputs above
+layout (set = 0, binding = 12) uniform sampler3D HistoryDensitySampler;
+layout (set = 0, binding = 13) uniform usampler3D HistoryPackedSampler;
+
+// Scene lights followed by the extra fog lights
+layout (set = 0, binding = 14, std430) readonly buffer FogLights
+{
+	uvec4 Count;
+	Light Lights[];
+}Fog;
+
+// Lights reaching each workgroup's cluster of froxels from volumetrics_lightcull.comp. An offset and count for every
+// cluster, followed by the light indices they point at.
+layout (set = 0, binding = 15, std430) readonly buffer ClusterLights
+{
+	uvec4 Counters;
+	uint Data[];
+}Clusters;
+
+// Pack in-scattering into 9 bit mantissas and a shared 5 bit exponent, following the E5B9G9R9 conversion in the Vulkan spec
+uint PackRGB9E5(vec3 Colour)
+{
+	// Largest representable value, (511 / 512) * 2^16
+	const vec3 Clamped = clamp(Colour, vec3(0.0), vec3(65408.0));
+	const float MaxChannel = max(Clamped.r, max(Clamped.g, Clamped.b));
+
+	int Exponent = max(-16, int(floor(log2(max(MaxChannel, 1e-30))))) + 16;
+	// Rounding the largest channel up can overflow its mantissa
+	if(floor(MaxChannel / exp2(float(Exponent - 24)) + 0.5) >= 512.0)
+	{
+		++Exponent;
+	}
+
+	const uvec3 Mantissa = uvec3(floor(Clamped / exp2(float(Exponent - 24)) + 0.5));
+	return Mantissa.r | (Mantissa.g << 9) | (Mantissa.b << 18) | (uint(Exponent) << 27);
+}
+
+// The previous frame's grid in whichever format it is stored in
+vec4 SampleHistory(vec3 UVW)
+{
+	return SampleFroxels(HistorySampler, HistoryDensitySampler, HistoryPackedSampler, UVW);
+}
+
+// Write a froxel in the current storage format
+void StoreFroxel(ivec3 Coord, vec4 Colour)
+{
+	switch(STORAGE_FORMAT)
+	{
+	case FROXEL_STORAGE_B10G11R11:
+		imageStore(OutputTexture, Coord, Colour);
+		imageStore(DensityOutputTexture, Coord, vec4(Colour.w));
+		break;
+	case FROXEL_STORAGE_RGB9E5:
+		imageStore(PackedOutputTexture, Coord, uvec4(PackRGB9E5(Colour.rgb)));
+		imageStore(DensityOutputTexture, Coord, vec4(Colour.w));
+		break;
+	default:
+		imageStore(OutputTexture, Coord, Colour);
+		break;
+	}
+}
+
+// Beer Lambert Equation used to exponentially reduce visibility based on the Absorption coefficient,
+// Density and distance covered.
+float BeerLambert(float AbsorptionCoefficient, float Density, float dist)
+{
+	return exp(-(AbsorptionCoefficient * Density * dist));
+}
+
+// Modified From https://iquilezles.org/articles/distfunctions
+// Returns the distance to the primitive
+// Negative = Within The Primitive, Positive = Outside of the primitive
+float PrimitiveDistance(vec3 Pos, FogPrimitive Primitive)
+{
+	Pos = Pos - Primitive.Pos;
+	if(Primitive.Type == FOG_PRIMITIVE_BOX)
+	{
+		const vec3 Q = abs(Pos) - Primitive.Extent;
+		return length(max(Q, 0.0)) + min(max(Q.x, max(Q.y, Q.z)), 0.0);
+	}
+	else if(Primitive.Type == FOG_PRIMITIVE_CAPSULE)
+	{
+		const vec3 PA = Pos + Primitive.Extent;
+		const vec3 BA = 2.0 * Primitive.Extent;
+		const float H = clamp(dot(PA, BA) / max(dot(BA, BA), 1e-6), 0.0, 1.0);
+		return length(PA - BA * H) - Primitive.Radius;
+	}
+	return length(Pos) - Primitive.Radius;
+}
+
+// Taken from https://iquilezles.org/articles/distfunctions
+float opSmoothUnion( float d1, float d2, float k ) 
+{
+    float h = clamp( 0.5 + 0.5*(d2-d1)/k, 0.0, 1.0 );
+    return mix( d2, d1, h ) - k*h*(1.0-h); 
+}
+
+// Query the density by checking if the sample position is within the volume and return
+// the density at that point
+float QueryDensity(vec3 Pos)
+{
+	Pos = -Pos;
+
+	// Find the grid cell of the sample, there is no fog outside of the grid or in empty cells
+	const vec3 Cell = floor((Pos - Grid.BoundsMin.xyz) / Grid.CellSize.xyz);
+	if(any(lessThan(Cell, vec3(0.0))) || any(greaterThanEqual(Cell, vec3(Grid.Dims.xyz))))
+	{
+		return 0.f;
+	}
+	const uvec3 CellCoord = uvec3(Cell);
+	const uint CellIndex = (CellCoord.z * Grid.Dims.y + CellCoord.y) * Grid.Dims.x + CellCoord.x;
+	const uint Offset = Grid.Data[CellIndex * 2];
+	const uint Count = Grid.Data[CellIndex * 2 + 1];
+	if(Count == 0)
+	{
+		return 0.f;
+	}
+
+	// Sample the distance from the primitives overlapping this cell
+	float SDFValue = PrimitiveDistance(Pos, SceneFog.Primitives[Grid.Data[Offset]]);
+	for(uint i = 1; i < Count; ++i)
+	{
+		SDFValue = opSmoothUnion(SDFValue, PrimitiveDistance(Pos, SceneFog.Primitives[Grid.Data[Offset + i]]), Volumetrics.SmoothFactor);
+	}
+
+	// The noise only ever pushes the distance up, so skip fetching it outside of the shapes
+	if(SDFValue > 0.f)
+	{
+		return 0.f;
+	}
+
+	// Generate a Noise Sampling UV vector
+	vec3 samplingPos = Pos;
+	samplingPos[0] += Volumetrics.NoiseXOffset;
+	samplingPos[1] -= Volumetrics.NoiseYOffset;
+	samplingPos[2] -= Volumetrics.NoiseZOffset;
+
+	samplingPos.x /= Volumetrics.NoiseXTile;
+	samplingPos.y /=  Volumetrics.NoiseYTile;
+	samplingPos.z /=  Volumetrics.NoiseZTile;
+
+	// Calculate the noise from a single fetch of the tileable noise volume and the noise factor multiplier
+	float NoiseValue = texture(NoiseSampler, samplingPos).r * Volumetrics.NoiseFactor;
+	NoiseValue -= NoiseValue/2;
+
+	// Adjust with the noise value
+	SDFValue += NoiseValue;
+
+	if(SDFValue <= 0.f)
+	{
+		return Volumetrics.Density;
+	}
+	else
+	{
+		return 0.f;
+	}
+}
+
+// March from the sample point to a light source and calculate how visible the light should be to this point in the 
+// volume
+float CalculateLightVisibility(const vec3 RayOrigin,const vec3 RayDirection, float RayLength)
+{
+    float RayDepth = 0.0f;
+    float Visibility = 1.0f;
+
+	// March along the ray until the full length of the ray has been sampled or
+	// the absorption cutoff has been reached
+    while(RayDepth < RayLength && Visibility > Volumetrics.LightAbsorptionCutoff)
+	{                       
+		// Calculate the Sample Position
+        vec3 SamplePos = RayOrigin + RayDepth * RayDirection;
+
+		// Query the fog density at our sample position
+        float Density = QueryDensity(SamplePos);
+		// If their is fog density at this point, reduce the visibility of the light
+        if(Density > 0)
+        {
+            Visibility *= BeerLambert(Volumetrics.Absorption, Density, Volumetrics.LightStepSize);
+        }
+		// March further along the ray
+        RayDepth += Volumetrics.LightStepSize;
+    }
+    return Visibility;
+}
+
+// Look up the visibility of a light from the precomputed optical depth volume instead of marching towards it
+float SampleLightVisibility(vec3 Pos, int LightIndex)
+{
+	// Keep the lookup away from the edges of the slab so it doesn't filter with the neighbouring light's volume
+	const float HalfTexel = 0.5 / float(Transmittance.Resolution);
+	vec3 UVW = (Pos - Transmittance.BoundsMin.xyz) / (Transmittance.BoundsMax.xyz - Transmittance.BoundsMin.xyz);
+	UVW = clamp(UVW, vec3(HalfTexel), vec3(1.0 - HalfTexel));
+	UVW.z = (UVW.z + float(LightIndex)) / float(Scene.lights.length());
+
+	const float OpticalDepth = textureLod(TransmittanceSampler, UVW, 0.0).r;
+	return exp(-(Volumetrics.Absorption * OpticalDepth));
+}
+
+// Blend the froxel with the value the previous frame computed for the same world space position.
+// The history is rejected when the position was outside of the previous frame's grid (disoccluded by the camera moving)
+// or when it's been invalidated by a settings change.
+vec4 BlendHistory(vec4 Current, vec3 RayDirection)
+{
+	if(Frame.HistoryValid == 0)
+	{
+		return Current;
+	}
+
+	// Reproject the centre of this froxel rather than the jittered sample, the history holds the average over the froxel
+	const vec3 CentrePos = Scene.viewPos.xyz + RayDirection * SliceDepth(float(gl_GlobalInvocationID.z) + 0.5);
+	const vec4 PrevClip = Frame.PrevViewProj * vec4(CentrePos, 1.0);
+	if(PrevClip.w <= 0.0)
+	{
+		return Current;
+	}
+
+	const vec3 HistoryUVW = vec3((PrevClip.xy / PrevClip.w) * 0.5 + 0.5, DepthToSlice(length(CentrePos - Frame.PrevViewPos.xyz)) / float(Volumetrics.MapDepth));
+	if(any(lessThan(HistoryUVW, vec3(0.0))) || any(greaterThan(HistoryUVW, vec3(1.0))))
+	{
+		return Current;
+	}
+
+	const vec4 History = SampleHistory(HistoryUVW);
+	return mix(History, Current, Frame.HistoryBlend);
+}
+
+void main ()
+{
+	//  Make sure we don't try and sample fog from outside bounds of the 3D map
+	if(gl_GlobalInvocationID.x >= Volumetrics.MapWidth ||
+	gl_GlobalInvocationID.y >= Volumetrics.MapHeight ||
+	gl_GlobalInvocationID.z >= Volumetrics.MapDepth)
+		return;
+
+	vec4 OutputColour = vec4(0, 0, 0, 0);
+
+	// The ray starts at the camera position
+	const vec3 RayStartPos = Scene.viewPos.xyz; 
+
+	// Unproject the centre of this froxel column onto the far plane to get the direction of the view ray through it
+	const vec2 FroxelUV = (vec2(gl_GlobalInvocationID.xy) + 0.5) / vec2(Volumetrics.MapWidth, Volumetrics.MapHeight);
+	const vec4 FarPos = Frame.InvViewProj * vec4(FroxelUV * 2.0 - 1.0, 1.0, 1.0);
+	const vec3 RayDirection = normalize(FarPos.xyz / FarPos.w - RayStartPos);
+
+	// Jitter the sample within the slice, the history accumulates the samples over the whole froxel
+	const float SampleDepth = SliceDepth(float(gl_GlobalInvocationID.z) + Frame.DepthJitter);
+
+	// Return if this map voxel's depth is beyond the camera far clip. Occlusion by the scene is handled per pixel
+	// in the second stage so the grid doesn't depend on the G-Buffer
+	if(SampleDepth > Volumetrics.Far)
+	{
+		StoreFroxel(ivec3(gl_GlobalInvocationID.xyz), OutputColour);
+		return;
+	}
+	
+	vec3 SamplePos = RayStartPos + (RayDirection * SampleDepth);
+	//Sample the fog and calculate lighting at the sample position
+
+	float SampledDensity = QueryDensity(SamplePos);
+
+	// Initialise the output colour to have the sampled density as the alpha value
+	OutputColour.w = SampledDensity;
+
+	if(SampledDensity <= 0.f)
+	{
+		StoreFroxel(ivec3(gl_GlobalInvocationID.xyz), BlendHistory(OutputColour, RayDirection));
+		return;
+	}
+		
+	// Only the lights the culling pass found for this workgroup's cluster can be in range, already limited by the governor
+	const uint ClusterIndex = (gl_WorkGroupID.z * gl_NumWorkGroups.y + gl_WorkGroupID.y) * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+	const uint ClusterLightOffset = gl_NumWorkGroups.x * gl_NumWorkGroups.y * gl_NumWorkGroups.z * 2 + Clusters.Data[ClusterIndex * 2];
+	const uint ClusterLightCount = Clusters.Data[ClusterIndex * 2 + 1];
+
+	// Calculate the lit colour of the fog by marching to all lights in range
+	for(uint ClusterLight = 0; ClusterLight < ClusterLightCount; ++ClusterLight)
+	{
+		const int i = int(Clusters.Data[ClusterLightOffset + ClusterLight]);
+		// Vector to light
+		const vec3 PosToLight = Fog.Lights[i].position.xyz - SamplePos;
+		// Distance from light to fragment position
+		const float LightDist = length(PosToLight);
+		if(LightDist < Fog.Lights[i].radius)
+		{
+			// Attenuation
+			float Attenuation = Fog.Lights[i].radius / (pow(LightDist, 2.0) + 1.0);
+
+			// Get the colour of the light affected by the Attenuation
+			vec3 LightColor = Fog.Lights[i].color * Attenuation;
+
+			const vec3 LightDir = normalize(PosToLight);
+
+			// Calculate the Visibility of the light, either from the transmittance volume or by marching towards the light
+			// from the sample position
+            float LightVisibility = (TRANSMITTANCE_ENABLED && i < int(Transmittance.LightCount)) ? SampleLightVisibility(SamplePos, i) : CalculateLightVisibility(SamplePos, LightDir, LightDist); 
+            OutputColour.xyz += LightVisibility * Volumetrics.Albedo * LightColor;
+		}
+	}
+
+	StoreFroxel(ivec3(gl_GlobalInvocationID.xyz), BlendHistory(OutputColour, RayDirection));
+
+}
@@ -0,0 +1,371 @@
+/*
+* Benchmark comparison tool
+*
+* Compares the frame times of benchmark runs against a baseline run and flags regressions, for use in automated
+* benchmark runs. Takes the JSON written by --benchscenarios, or the CSV written by --benchfilename together with
+* --benchframetimes (read as a single scenario named "default").
+*
+* Each scenario's frame times are compared with a one sided Mann-Whitney U test, which doesn't assume the frame times
+* are normally distributed. A scenario regressed if its candidate frame times are significantly larger than the
+* baseline's and the median grew by more than the threshold.
+*
+* Usage: benchcompare [--threshold percent] [--alpha p] baseline candidate [candidate...]
+* Exits with 0 if no scenario regressed, 1 if one did and 2 if the input couldn't be read.
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+	/** @brief Frame times of every scenario of a run, by scenario name */
+	using BenchmarkRun = std::map<std::string, std::vector<double>>;
+
+	/** @brief Minimal JSON reader, enough for the benchmark results */
+	class JsonReader
+	{
+	public:
+		struct Value {
+			enum class Type { Null, Bool, Number, String, Array, Object } type = Type::Null;
+			double number = 0.0;
+			std::string string;
+			std::vector<Value> array;
+			std::vector<std::pair<std::string, Value>> object;
+
+			const Value* find(const std::string& key) const
+			{
+				for (const auto& member : object) {
+					if (member.first == key) {
+						return &member.second;
+					}
+				}
+				return nullptr;
+			}
+		};
+
+		explicit JsonReader(const std::string& text) : text(text) {}
+
+		bool parse(Value& value)
+		{
+			return parseValue(value) && (skipWhitespace(), pos == text.size());
+		}
+
+	private:
+		const std::string& text;
+		size_t pos = 0;
+
+		void skipWhitespace()
+		{
+			while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) {
+				pos++;
+			}
+		}
+
+		bool consume(char c)
+		{
+			skipWhitespace();
+			if (pos < text.size() && text[pos] == c) {
+				pos++;
+				return true;
+			}
+			return false;
+		}
+
+		bool parseString(std::string& string)
+		{
+			if (!consume('"')) {
+				return false;
+			}
+			while (pos < text.size() && text[pos] != '"') {
+				if (text[pos] == '\\' && pos + 1 < text.size()) {
+					pos++;
+				}
+				string += text[pos++];
+			}
+			return consume('"');
+		}
+
+		bool parseValue(Value& value)
+		{
+			skipWhitespace();
+			if (pos >= text.size()) {
+				return false;
+			}
+			const char c = text[pos];
+			if (c == '{') {
+				pos++;
+				value.type = Value::Type::Object;
+				if (consume('}')) {
+					return true;
+				}
+				do {
+					std::pair<std::string, Value> member;
+					if (!parseString(member.first) || !consume(':') || !parseValue(member.second)) {
+						return false;
+					}
+					value.object.push_back(std::move(member));
+				} while (consume(','));
+				return consume('}');
+			}
+			if (c == '[') {
+				pos++;
+				value.type = Value::Type::Array;
+				if (consume(']')) {
+					return true;
+				}
+				do {
+					value.array.emplace_back();
+					if (!parseValue(value.array.back())) {
+						return false;
+					}
+				} while (consume(','));
+				return consume(']');
+			}
+			if (c == '"') {
+				value.type = Value::Type::String;
+				return parseString(value.string);
+			}
+			if (text.compare(pos, 4, "true") == 0 || text.compare(pos, 5, "false") == 0) {
+				value.type = Value::Type::Bool;
+				value.number = c == 't' ? 1.0 : 0.0;
+				pos += c == 't' ? 4 : 5;
+				return true;
+			}
+			if (text.compare(pos, 4, "null") == 0) {
+				pos += 4;
+				return true;
+			}
+			char* end = nullptr;
+			value.type = Value::Type::Number;
+			value.number = std::strtod(text.c_str() + pos, &end);
+			if (end == text.c_str() + pos) {
+				return false;
+			}
+			pos = static_cast<size_t>(end - text.c_str());
+			return true;
+		}
+	};
+
+	bool loadJson(const std::string& text, BenchmarkRun& run)
+	{
+		JsonReader::Value root;
+		if (!JsonReader(text).parse(root)) {
+			return false;
+		}
+		const JsonReader::Value* scenarios = root.find("scenarios");
+		if (scenarios == nullptr || scenarios->type != JsonReader::Value::Type::Array) {
+			return false;
+		}
+		for (const JsonReader::Value& scenario : scenarios->array) {
+			const JsonReader::Value* name = scenario.find("name");
+			const JsonReader::Value* frameTimes = scenario.find("frameTimesMs");
+			if (name == nullptr || frameTimes == nullptr) {
+				return false;
+			}
+			std::vector<double>& times = run[name->string];
+			for (const JsonReader::Value& time : frameTimes->array) {
+				times.push_back(time.number);
+			}
+		}
+		return true;
+	}
+
+	// The frame times follow a "frame,ms" header, after the summary
+	bool loadCsv(const std::string& text, BenchmarkRun& run)
+	{
+		std::istringstream stream(text);
+		std::string line;
+		bool frameTimes = false;
+		std::vector<double>& times = run["default"];
+		while (std::getline(stream, line)) {
+			if (line.compare(0, 8, "frame,ms") == 0) {
+				frameTimes = true;
+				continue;
+			}
+			const size_t comma = line.find(',');
+			if (frameTimes && comma != std::string::npos) {
+				times.push_back(std::strtod(line.c_str() + comma + 1, nullptr));
+			}
+		}
+		return frameTimes;
+	}
+
+	bool loadRun(const std::string& filename, BenchmarkRun& run)
+	{
+		std::ifstream file(filename);
+		if (!file.is_open()) {
+			std::cerr << "Could not open " << filename << "\n";
+			return false;
+		}
+		std::stringstream buffer;
+		buffer << file.rdbuf();
+		const std::string text = buffer.str();
+
+		const size_t first = text.find_first_not_of(" \t\r\n");
+		const bool json = first != std::string::npos && text[first] == '{';
+		if (!(json ? loadJson(text, run) : loadCsv(text, run))) {
+			std::cerr << "Could not read frame times from " << filename << (json ? "" : ", it needs to be written with --benchframetimes") << "\n";
+			return false;
+		}
+		return true;
+	}
+
+	double median(std::vector<double> values)
+	{
+		std::sort(values.begin(), values.end());
+		const size_t mid = values.size() / 2;
+		return values.size() % 2 == 1 ? values[mid] : 0.5 * (values[mid - 1] + values[mid]);
+	}
+
+	double percentile(std::vector<double> values, double p)
+	{
+		std::sort(values.begin(), values.end());
+		const size_t rank = static_cast<size_t>(std::ceil(p * static_cast<double>(values.size())));
+		return values[std::min(std::max(rank, static_cast<size_t>(1)), values.size()) - 1];
+	}
+
+	/**
+	* One sided Mann-Whitney U test with the normal approximation, corrected for ties
+	*
+	* @return Probability of candidate frame times at least this much larger than the baseline's if both came from the same distribution
+	*/
+	double mannWhitneyGreater(const std::vector<double>& baseline, const std::vector<double>& candidate)
+	{
+		struct Sample {
+			double value;
+			bool candidate;
+		};
+		std::vector<Sample> samples;
+		samples.reserve(baseline.size() + candidate.size());
+		for (double value : baseline) {
+			samples.push_back({ value, false });
+		}
+		for (double value : candidate) {
+			samples.push_back({ value, true });
+		}
+		std::sort(samples.begin(), samples.end(), [](const Sample& a, const Sample& b) { return a.value < b.value; });
+
+		// Tied values share the average of their ranks
+		const double n = static_cast<double>(samples.size());
+		double candidateRankSum = 0.0;
+		double tieCorrection = 0.0;
+		for (size_t i = 0; i < samples.size();) {
+			size_t j = i;
+			while (j < samples.size() && samples[j].value == samples[i].value) {
+				j++;
+			}
+			const double rank = 0.5 * static_cast<double>(i + j + 1);
+			for (size_t k = i; k < j; k++) {
+				if (samples[k].candidate) {
+					candidateRankSum += rank;
+				}
+			}
+			const double ties = static_cast<double>(j - i);
+			tieCorrection += ties * ties * ties - ties;
+			i = j;
+		}
+
+		const double n1 = static_cast<double>(candidate.size());
+		const double n2 = static_cast<double>(baseline.size());
+		const double u = candidateRankSum - n1 * (n1 + 1.0) / 2.0;
+		const double mean = n1 * n2 / 2.0;
+		const double variance = n1 * n2 / 12.0 * ((n + 1.0) - tieCorrection / (n * (n - 1.0)));
+		if (variance <= 0.0) {
+			return 1.0;
+		}
+		// With continuity correction
+		const double z = (u - mean - 0.5) / std::sqrt(variance);
+		return 0.5 * std::erfc(z / std::sqrt(2.0));
+	}
+
+	void printUsage()
+	{
+		std::cout << "Usage: benchcompare [--threshold percent] [--alpha p] baseline candidate [candidate...]\n"
+			<< "  --threshold  Smallest growth of the median frame time counted as a regression, default 5 percent\n"
+			<< "  --alpha      Significance level of the Mann-Whitney U test, default 0.01\n";
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	double threshold = 5.0;
+	double alpha = 0.01;
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		if ((arg == "--threshold" || arg == "--alpha") && i + 1 < argc) {
+			(arg == "--threshold" ? threshold : alpha) = std::atof(argv[++i]);
+		}
+		else if (arg == "--help" || arg == "-h") {
+			printUsage();
+			return 0;
+		}
+		else {
+			files.push_back(arg);
+		}
+	}
+	if (files.size() < 2) {
+		printUsage();
+		return 2;
+	}
+
+	BenchmarkRun baseline;
+	if (!loadRun(files[0], baseline)) {
+		return 2;
+	}
+
+	std::cout << std::fixed << std::setprecision(3);
+	bool regressed = false;
+	for (size_t f = 1; f < files.size(); f++) {
+		BenchmarkRun candidate;
+		if (!loadRun(files[f], candidate)) {
+			return 2;
+		}
+
+		std::cout << files[f] << " against " << files[0] << "\n";
+		std::cout << std::left << std::setw(24) << "scenario" << std::right << std::setw(12) << "base p50" << std::setw(12) << "new p50" << std::setw(10) << "change"
+			<< std::setw(12) << "base p99" << std::setw(12) << "new p99" << std::setw(12) << "p-value" << "  result\n";
+		for (const auto& scenario : candidate) {
+			const auto base = baseline.find(scenario.first);
+			if (base == baseline.end() || base->second.empty() || scenario.second.empty()) {
+				std::cout << std::left << std::setw(24) << scenario.first << std::right << "  not in both runs\n";
+				continue;
+			}
+
+			const double baseMedian = median(base->second);
+			const double newMedian = median(scenario.second);
+			const double change = baseMedian > 0.0 ? (newMedian - baseMedian) / baseMedian * 100.0 : 0.0;
+			const double slower = mannWhitneyGreater(base->second, scenario.second);
+			const double faster = mannWhitneyGreater(scenario.second, base->second);
+
+			std::string result = "unchanged";
+			if (slower < alpha && change > threshold) {
+				result = "REGRESSION";
+				regressed = true;
+			}
+			else if (faster < alpha && -change > threshold) {
+				result = "improvement";
+			}
+
+			std::cout << std::left << std::setw(24) << scenario.first << std::right
+				<< std::setw(12) << baseMedian << std::setw(12) << newMedian << std::setw(9) << change << "%"
+				<< std::setw(12) << percentile(base->second, 0.99) << std::setw(12) << percentile(scenario.second, 0.99)
+				<< std::setw(12) << std::min(slower, faster) << "  " << result << "\n";
+		}
+		std::cout << "\n";
+	}
+
+	return regressed ? 1 : 0;
+}
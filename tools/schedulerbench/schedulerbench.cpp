@@ -0,0 +1,179 @@
+/*
+* Task scheduler microbenchmark
+*
+* Compares the work stealing vks::TaskScheduler against vks::ThreadPool, the per thread job queues it replaced, with the
+* same number of threads running jobs. The thread waiting for the scheduler runs tasks too, so the scheduler gets one
+* worker less than the pool.
+*
+* Scenarios:
+*   small jobs       Many tiny independent jobs queued from the main thread, measures the queueing overhead
+*   parallel for     A loop with very uneven iteration costs. The pool hands out one index at a time through an atomic
+*                    counter, like the CPU fog code did, the scheduler splits the range and lets idle threads steal
+*   static ranges    The same loop split into one contiguous range per pool thread, the way jobs were assigned manually
+*                    to the pool's threads, against the scheduler's parallel for
+*
+* Usage: schedulerbench [--threads n] [--jobs n] [--repeat n]
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "threadpool.hpp"
+#include "VulkanTaskScheduler.h"
+
+namespace
+{
+	/** @brief Busy work that can't be optimized away, costs roughly a nanosecond per iteration */
+	uint32_t work(uint32_t seed, uint32_t iterations)
+	{
+		uint32_t x = seed | 1u;
+		for (uint32_t i = 0; i < iterations; i++) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+		}
+		return x;
+	}
+
+	/** @brief Iterations of a loop index, the first eighth of the loop is twenty times as expensive as the rest */
+	uint32_t unevenCost(uint32_t index, uint32_t count)
+	{
+		return (static_cast<uint64_t>(index) * 8 < count) ? 4000 : 200;
+	}
+
+	uint64_t checksum(const std::vector<uint32_t>& results)
+	{
+		uint64_t sum = 0;
+		for (uint32_t value : results) {
+			sum += value;
+		}
+		return sum;
+	}
+
+	/** @brief Median duration of a number of runs in milliseconds */
+	double measure(uint32_t repeat, const std::function<void()>& run)
+	{
+		// One run to warm up the threads and caches
+		run();
+		std::vector<double> times;
+		for (uint32_t i = 0; i < repeat; i++) {
+			const auto begin = std::chrono::steady_clock::now();
+			run();
+			times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+		}
+		std::sort(times.begin(), times.end());
+		return times[times.size() / 2];
+	}
+
+	void printResult(const std::string& scenario, double poolTime, double schedulerTime, bool matches)
+	{
+		std::cout << std::left << std::setw(18) << scenario << std::right << std::setw(12) << poolTime << std::setw(12) << schedulerTime
+			<< std::setw(10) << poolTime / schedulerTime << "x" << (matches ? "" : "  RESULTS DIFFER") << "\n";
+	}
+
+	void printUsage()
+	{
+		std::cout << "Usage: schedulerbench [--threads n] [--jobs n] [--repeat n]\n"
+			<< "  --threads  Threads running jobs, default one per hardware thread\n"
+			<< "  --jobs     Number of jobs and loop iterations per run, default 20000\n"
+			<< "  --repeat   Runs per scenario, the median is reported, default 20\n";
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t threadCount = std::max(std::thread::hardware_concurrency(), 2u);
+	uint32_t jobCount = 20000;
+	uint32_t repeat = 20;
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		if ((arg == "--threads" || arg == "--jobs" || arg == "--repeat") && i + 1 < argc) {
+			const uint32_t value = static_cast<uint32_t>(std::max(std::atoi(argv[++i]), 1));
+			(arg == "--threads" ? threadCount : arg == "--jobs" ? jobCount : repeat) = value;
+		}
+		else if (arg == "--help" || arg == "-h") {
+			printUsage();
+			return 0;
+		}
+		else {
+			printUsage();
+			return 2;
+		}
+	}
+	threadCount = std::max(threadCount, 2u);
+
+	vks::ThreadPool pool;
+	pool.setThreadCount(threadCount);
+	vks::TaskScheduler scheduler(threadCount - 1);
+
+	std::vector<uint32_t> poolResults(jobCount);
+	std::vector<uint32_t> schedulerResults(jobCount);
+
+	std::cout << threadCount << " threads, " << jobCount << " jobs, median of " << repeat << " runs in ms\n";
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << std::left << std::setw(18) << "scenario" << std::right << std::setw(12) << "pool" << std::setw(12) << "scheduler" << std::setw(11) << "speedup" << "\n";
+
+	// Small jobs
+	{
+		const double poolTime = measure(repeat, [&] {
+			for (uint32_t i = 0; i < jobCount; i++) {
+				pool.threads[i % threadCount]->addJob([&poolResults, i] { poolResults[i] = work(i, 100); });
+			}
+			pool.wait();
+		});
+		const double schedulerTime = measure(repeat, [&] {
+			vks::TaskGroup group;
+			for (uint32_t i = 0; i < jobCount; i++) {
+				scheduler.run(group, [&schedulerResults, i] { schedulerResults[i] = work(i, 100); });
+			}
+			scheduler.wait(group);
+		});
+		printResult("small jobs", poolTime, schedulerTime, checksum(poolResults) == checksum(schedulerResults));
+	}
+
+	// Uneven parallel for
+	{
+		const double poolTime = measure(repeat, [&] {
+			std::atomic<uint32_t> next{ 0 };
+			for (auto& thread : pool.threads) {
+				thread->addJob([&] {
+					for (uint32_t i = next++; i < jobCount; i = next++) {
+						poolResults[i] = work(i, unevenCost(i, jobCount));
+					}
+				});
+			}
+			pool.wait();
+		});
+		const double schedulerTime = measure(repeat, [&] {
+			scheduler.parallelFor(0, jobCount, 0, [&](uint32_t i) { schedulerResults[i] = work(i, unevenCost(i, jobCount)); });
+		});
+		printResult("parallel for", poolTime, schedulerTime, checksum(poolResults) == checksum(schedulerResults));
+
+		const double staticTime = measure(repeat, [&] {
+			const uint32_t rangeSize = (jobCount + threadCount - 1) / threadCount;
+			for (uint32_t t = 0; t < threadCount; t++) {
+				pool.threads[t]->addJob([&, t] {
+					for (uint32_t i = t * rangeSize; i < std::min((t + 1) * rangeSize, jobCount); i++) {
+						poolResults[i] = work(i, unevenCost(i, jobCount));
+					}
+				});
+			}
+			pool.wait();
+		});
+		printResult("static ranges", staticTime, schedulerTime, checksum(poolResults) == checksum(schedulerResults));
+	}
+
+	return 0;
+}